@@ -1,19 +1,34 @@
 #include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 #include "collectors/common.h"
 
 // Pointer methods
 size_t
 p_size(ptr p) {
-    switch (P_GET_TYPE(p)) {
+    return p_size_of_type(p, P_GET_TYPE(p));
+}
+
+size_t
+p_size_of_type(ptr p, int type) {
+    switch (type) {
     case TYPE_INT:
     case TYPE_FLOAT:
-    case TYPE_WRAPPER:
         return NPTRS(2);
+    case TYPE_WRAPPER:
+        return P_SLOTS_SIZE(1);
     case TYPE_ARRAY: {
-        size_t n_els = *SLOT_P(*SLOT_P(p, 0), 0);
-        return NPTRS(2 + n_els);
+        size_t n_els = *VALUE_P(P_GET_SLOT(p, 0));
+        return P_ARRAY_SIZE(n_els);
     }
+    case TYPE_FLOAT_ARRAY:
+    case TYPE_INT_ARRAY:
+        return NPTRS(2 + RAW_COUNT(p));
+    case TYPE_BYTE_ARRAY:
+        return NPTRS(2) + ALIGN(RAW_COUNT(p), sizeof(ptr));
     default:
         error("Unknown type in p_size!\n");
         return 0;
@@ -27,21 +42,22 @@ p_slot_count(ptr p) {
     case TYPE_FLOAT: return 0;
     case TYPE_WRAPPER: return 1;
     case TYPE_ARRAY: {
-        size_t n_els = *SLOT_P(*SLOT_P(p, 0), 0);
+        size_t n_els = *VALUE_P(P_GET_SLOT(p, 0));
         return 1 + n_els;
     }
+    case TYPE_FLOAT_ARRAY:
+    case TYPE_INT_ARRAY:
+    case TYPE_BYTE_ARRAY:
+        return 0;
     default:
         error("Unknown type in p_slot_count!\n");
         return 0;
     }
 }
 
-static
-void p_print(int ind, size_t i, ptr p);
-
-void p_print_slots(int ind, ptr *base, size_t n) {
+void p_print_slots(int ind, ref *base, size_t n) {
     for (size_t i = 0; i < n; i++) {
-        p_print(ind + 2, i, base[i]);
+        p_print(ind + 2, i, REF_DECODE(base[i]));
     }
 }
 
@@ -52,26 +68,211 @@ type_name(unsigned int t) {
     case TYPE_FLOAT: return "float";
     case TYPE_WRAPPER: return "wrapper";
     case TYPE_ARRAY: return "array";
+    case TYPE_FLOAT_ARRAY: return "float array";
+    case TYPE_INT_ARRAY: return "int array";
+    case TYPE_BYTE_ARRAY: return "byte array";
     default: return "unknown";
     }
 }
 
-static
-void p_print(int ind, size_t n, ptr p) {
+void
+p_print(int ind, size_t n, ptr p) {
     for (int x = 0; x < ind; x++) { putchar(' '); }
     if (p == 0) {
         printf("%2llu: null\n", (unsigned long long)n);
         return;
     }
+    if (P_TAGGED_P(p)) {
+        printf("%2llu: %lld\n", (unsigned long long)n,
+               (long long)P_UNTAG_INT(p));
+        return;
+    }
     unsigned int t = P_GET_TYPE(p);
     printf("%2llu: %s @ 0x%" PRIxPTR ": ",
            (unsigned long long)n, type_name(t), p);
     if (t == TYPE_FLOAT) {
-        printf("%.3f", *(double*)SLOT_P(p, 0));
+        printf("%.3f", *(double*)VALUE_P(p));
     } else if (t == TYPE_INT) {
-        printf("%d", (int)*SLOT_P(p, 0));
+        printf("%d", (int)*VALUE_P(p));
+    } else if (TYPE_RAW_ARRAY_P(t)) {
+        printf("%lu elements", RAW_COUNT(p));
     }
     putchar('\n');
     size_t n_slots = p_slot_count(p);
     p_print_slots(ind + 2, SLOT_P(p, 0), n_slots);
 }
+
+// Heap memory
+#ifdef GC_COMPRESSED_REFS
+
+#ifdef _WIN32
+#error "Compressed refs are not supported on Windows"
+#endif
+
+// Heaps are first-fit allocated from the range that refs can address.
+// The free ranges are kept sorted as start, end pairs.
+ptr ref_base = 0;
+static vector *ref_free = NULL;
+static bool ref_lock = false;
+
+static void
+ref_range_init() {
+    if (ref_base) {
+        return;
+    }
+    void *p = mmap(NULL, REF_RANGE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        error("Can't reserve the ref range!\n");
+    }
+    ref_free = v_init(16);
+    // Nothing starts at the base so that no ref is 0.
+    v_add(ref_free, (ptr)p + HEAP_PAGE_SIZE);
+    v_add(ref_free, (ptr)p + REF_RANGE);
+    __atomic_store_n(&ref_base, (ptr)p, __ATOMIC_RELEASE);
+}
+
+// Inserts the free range [start, end) before the ith one.
+static void
+ref_insert(size_t i, ptr start, ptr end) {
+    vector *v = ref_free;
+    v_add(v, 0);
+    v_add(v, 0);
+    memmove(&v->array[i + 2], &v->array[i], NPTRS(v->used - 2 - i));
+    v->array[i] = start;
+    v->array[i + 1] = end;
+}
+
+// Removes [start, end) from the free range that starts at index i.
+static void
+ref_take(size_t i, ptr start, ptr end) {
+    ptr *a = ref_free->array;
+    if (a[i] == start && a[i + 1] == end) {
+        v_remove_at(ref_free, i);
+        v_remove_at(ref_free, i);
+    } else if (a[i] == start) {
+        a[i] = end;
+    } else if (a[i + 1] == end) {
+        a[i + 1] = start;
+    } else {
+        ptr free_end = a[i + 1];
+        a[i + 1] = start;
+        ref_insert(i + 2, end, free_end);
+    }
+}
+
+ptr
+heap_reserve_at(ptr start, size_t size) {
+    size = ALIGN(size, HEAP_PAGE_SIZE);
+    while (__atomic_test_and_set(&ref_lock, __ATOMIC_ACQUIRE));
+    ref_range_init();
+    ptr *a = ref_free->array;
+    ptr p = 0;
+    for (size_t i = 0; i < ref_free->used && start; i += 2) {
+        if (a[i] <= start && start + size <= a[i + 1]) {
+            p = start;
+            ref_take(i, p, p + size);
+            break;
+        }
+    }
+    for (size_t i = 0; i < ref_free->used && !p; i += 2) {
+        if (a[i + 1] - a[i] >= size) {
+            p = a[i];
+            ref_take(i, p, p + size);
+        }
+    }
+    __atomic_clear(&ref_lock, __ATOMIC_RELEASE);
+    if (!p) {
+        error("Can't reserve %lu bytes!\n", size);
+    }
+    return p;
+}
+
+// The range is mapped anew so that it reads as zeroes when it is
+// reused, even if a file was mapped into it.
+void
+heap_unreserve(ptr start, size_t size) {
+    ptr end = start + ALIGN(size, HEAP_PAGE_SIZE);
+    mmap((void *)start, end - start, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    while (__atomic_test_and_set(&ref_lock, __ATOMIC_ACQUIRE));
+    vector *v = ref_free;
+    size_t i = 0;
+    while (i < v->used && v->array[i] < start) {
+        i += 2;
+    }
+    if (i > 0 && v->array[i - 1] == start) {
+        v->array[i - 1] = end;
+        if (i < v->used && v->array[i] == end) {
+            v->array[i - 1] = v->array[i + 1];
+            v_remove_at(v, i);
+            v_remove_at(v, i);
+        }
+    } else if (i < v->used && v->array[i] == end) {
+        v->array[i] = start;
+    } else {
+        ref_insert(i, start, end);
+    }
+    __atomic_clear(&ref_lock, __ATOMIC_RELEASE);
+}
+
+ptr
+heap_origin() {
+    while (__atomic_test_and_set(&ref_lock, __ATOMIC_ACQUIRE));
+    ref_range_init();
+    __atomic_clear(&ref_lock, __ATOMIC_RELEASE);
+    return ref_base;
+}
+
+#else
+
+// The start is only a hint to mmap. On Windows the heap is malloced
+// so it is ignored.
+ptr
+heap_reserve_at(ptr start, size_t size) {
+#ifdef _WIN32
+    void *p = malloc(size);
+    if (!p) {
+        error("Can't reserve %lu bytes!\n", size);
+    }
+#else
+    void *p = mmap((void *)start, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        error("Can't reserve %lu bytes!\n", size);
+    }
+#endif
+    return (ptr)p;
+}
+
+void
+heap_unreserve(ptr start, size_t size) {
+#ifdef _WIN32
+    free((void *)start);
+#else
+    munmap((void *)start, size);
+#endif
+}
+
+ptr
+heap_origin() {
+    return 0;
+}
+
+#endif
+
+ptr
+heap_reserve(size_t size) {
+    return heap_reserve_at(0, size);
+}
+
+void
+heap_release(ptr start, ptr end) {
+#ifndef _WIN32
+    start = ALIGN(start, HEAP_PAGE_SIZE);
+    end = end & ~(ptr)(HEAP_PAGE_SIZE - 1);
+    if (start < end) {
+        madvise((void *)start, end - start, MADV_DONTNEED);
+    }
+#endif
+}
@@ -6,6 +6,7 @@
 #include "datatypes/bits.h"
 #include "datatypes/common.h"
 #include "datatypes/vector.h"
+#include "collectors/stats.h"
 
 // New object header:
 //
@@ -18,6 +19,8 @@
 #define P_MARK(p)           AT(p) |= 1
 
 #define P_GET_TYPE(p)       P_GET(p, 1, 4)
+// Type of an already loaded header.
+#define P_HEADER_TYPE(h)    BF_GET(h, 1, 4)
 #define P_SET_TYPE(p, t)    P_SET(p, t, 1, 4)
 
 #define P_GET_RC(p)         P_GET(p, 8, 24)
@@ -25,17 +28,71 @@
 
 #define P_DEC_RC(p)         AT(p) = AT(p) - (1L << 8)
 #define P_INC_RC(p)         AT(p) = AT(p) + (1L << 8)
+#define P_ADD_RC(p, n)      AT(p) = AT(p) + ((ptr)(n) << 8)
 
 #define P_GET_COL(p)        P_GET(p, 5, 3)
 #define P_SET_COL(p, c)     P_SET(p, c, 5, 3)
 
 #define TYPE_CONTAINER_P(t) (t == TYPE_ARRAY || t == TYPE_WRAPPER)
+#define TYPE_RAW_ARRAY_P(t) (t >= TYPE_FLOAT_ARRAY && t <= TYPE_BYTE_ARRAY)
+
+// Integers that fit in 63 bits are stored in the ptr itself, shifted
+// up one bit with the lowest bit set. Objects are word aligned so the
+// lowest bit of pointers to them is always clear. Slots and roots may
+// contain either and the collectors only follow P_OBJ_P values.
+#define P_TAGGED_P(p)       ((p) & 1)
+#define P_OBJ_P(p)          ((p) && !P_TAGGED_P(p))
+#define P_TAG_INT(n)        (((ptr)(n) << 1) | 1)
+#define P_UNTAG_INT(p)      ((int64_t)(p) >> 1)
+
+// Slots hold refs. Normally a ref is just a ptr, but when built with
+// GC_COMPRESSED_REFS it is 32 bits wide. All heaps are then carved
+// out of one reserved range starting at ref_base, and a ref to an
+// object is its offset from there divided by four. Objects are word
+// aligned, so the lowest bit stays free for tagged ints, which are
+// limited to 31 bits. The range is 16 GB. Roots are always full
+// ptrs.
+#ifdef GC_COMPRESSED_REFS
+typedef uint32_t ref;
+extern ptr ref_base;
+#define REF_RANGE           ((ptr)1 << 34)
+// Functions rather than macros since the argument is often an
+// allocation.
+static inline ref
+ref_encode(ptr p) {
+    return (ref)(P_OBJ_P(p) ? (p - ref_base) >> 2 : p);
+}
+
+static inline ptr
+ref_decode(ref r) {
+    if (r & 1) {
+        return (ptr)(int64_t)(int32_t)r;
+    }
+    return r ? ref_base + ((ptr)r << 2) : 0;
+}
+
+#define REF_ENCODE(p)       ref_encode(p)
+#define REF_DECODE(r)       ref_decode(r)
+#define P_TAG_INT_MIN       (-(1L << 30))
+#define P_TAG_INT_MAX       ((1L << 30) - 1)
+#else
+typedef ptr ref;
+#define REF_ENCODE(p)       (p)
+#define REF_DECODE(r)       (r)
+#define P_TAG_INT_MIN       (-(1L << 62))
+#define P_TAG_INT_MAX       ((1L << 62) - 1)
+#endif
 
 // Object types
 #define TYPE_INT        1
 #define TYPE_FLOAT      2
 #define TYPE_WRAPPER    3
 #define TYPE_ARRAY      4
+// Arrays of raw values. The element count is stored unboxed in the
+// first slot and they have no slots the collectors scan.
+#define TYPE_FLOAT_ARRAY    5
+#define TYPE_INT_ARRAY      6
+#define TYPE_BYTE_ARRAY     7
 
 // Object colors, used for ref counting cycles
 
@@ -47,24 +104,67 @@
 #define COL_GRAY 2
 // Looks like garbage...
 #define COL_WHITE 3
+// Not a color but a flag combined with the colors above. Set while
+// the object is in the candidate buffer.
+#define COL_BUFFERED 4
 
 
 // Utility macros
 #define P_FOR_EACH_CHILD(p, body)                               \
     for (size_t _n = p_slot_count(p), _i = 0; _i < _n; _i++) {  \
-        ptr p_child = *SLOT_P(p, _i);                           \
-        if (p_child) { body }                                   \
+        ptr p_child = P_GET_SLOT(p, _i);                        \
+        if (P_OBJ_P(p_child)) { body }                          \
     }
 
 #define NPTRS(n)  ((n) * sizeof(ptr))
 
 // Takes an address to an object and outputs a pointer to the given
 // slot in that object. It's used for reading and writing slots.
-#define SLOT_P(p, n) (ptr *)(p + NPTRS(n + 1))
+#define SLOT_P(p, n) ((ref *)((p) + sizeof(ptr) + (n) * sizeof(ref)))
+
+// Reads and writes slots without any barrier.
+#define P_GET_SLOT(p, n)    REF_DECODE(*SLOT_P(p, n))
+#define P_SET_SLOT(p, n, v) (*SLOT_P(p, n) = REF_ENCODE(v))
+
+// Size of objects with n slots, rounded up to whole words. Arrays
+// have their count in the first slot.
+#define P_SLOTS_SIZE(n) \
+    ALIGN(sizeof(ptr) + (n) * sizeof(ref), sizeof(ptr))
+#define P_ARRAY_SIZE(n)     P_SLOTS_SIZE((n) + 1)
+
+// The word after the header of boxed ints and floats and raw arrays
+// holds a value instead of slots.
+#define VALUE_P(p)          ((ptr *)((p) + sizeof(ptr)))
+
+// Element count and element addresses of raw arrays.
+#define RAW_COUNT(p)        (*VALUE_P(p))
+#define FLOAT_SLOT_P(p, n)  ((double *)VALUE_P(p) + 1 + (n))
+#define INT_SLOT_P(p, n)    ((int64_t *)VALUE_P(p) + 1 + (n))
+#define BYTE_SLOT_P(p, n)   ((uint8_t *)(VALUE_P(p) + 1) + (n))
 
 size_t p_size(ptr p);
+// Like p_size, but the type is given so that the header needn't be
+// read again, e.g. when other threads may overwrite it.
+size_t p_size_of_type(ptr p, int type);
 size_t p_slot_count(ptr p);
-void p_print_slots(int ind, ptr *base, size_t n);
+void p_print(int ind, size_t n, ptr p);
+void p_print_slots(int ind, ref *base, size_t n);
+
+// Heap memory. Address space is reserved up front and pages are only
+// backed by memory when they are touched. Released pages are given
+// back to the OS but stay reserved and read as zeroes when touched
+// again. Partial pages at the ends of a released range are kept.
+#define HEAP_PAGE_SIZE  4096
+ptr heap_reserve(size_t size);
+// Like heap_reserve, but the range is placed at start if that part of
+// the address space is free.
+ptr heap_reserve_at(ptr start, size_t size);
+void heap_unreserve(ptr start, size_t size);
+void heap_release(ptr start, ptr end);
+// Addresses that are stored in files, like in heap images, are
+// relative to this. It is ref_base with compressed refs and 0
+// otherwise.
+ptr heap_origin();
 
 
 // This is the protocol that any collector must implement.
@@ -75,10 +175,51 @@ typedef bool (*gc_func_can_allot_p)(void *me, size_t n_bytes);
 typedef void (*gc_func_collect)(void *me, vector *roots);
 typedef ptr (*gc_func_do_allot)(void *me, int type, size_t n_bytes);
 
-typedef void (*gc_func_set_ptr)(void *me, ptr *from, ptr to);
-typedef void (*gc_func_set_new_ptr)(void *me, ptr *from, ptr to);
+typedef void (*gc_func_set_ptr)(void *me, ref *from, ptr to);
+typedef void (*gc_func_set_new_ptr)(void *me, ref *from, ptr to);
+// Bulk versions of set_ptr for n consecutive slots of one object.
+// fill_ptrs stores the same pointer in all of them and copy_ptrs
+// copies them from src, which may overlap the slots. The barrier is
+// run once for the whole range. NULL for collectors whose set_ptr
+// only stores the pointer.
+typedef void (*gc_func_fill_ptrs)(void *me, ref *from, size_t n, ptr to);
+typedef void (*gc_func_copy_ptrs)(void *me, ref *from, ref *src, size_t n);
 
 typedef size_t (*gc_func_space_used)(void *me);
+// Fills in the fields of the stats that only the collector knows
+// about.
+typedef void (*gc_func_heap_stats)(void *me, gc_stats *stats);
+// Changes the size of the heap. The heap never grows beyond the size
+// it was initialized with. Returns false if live objects are in the
+// way. NULL for collectors that can't resize their heaps.
+typedef bool (*gc_func_resize)(void *me, size_t size);
+
+// Thread-local allocation buffers. A buffer is a region of the heap
+// that one mutator bump allocates objects into without
+// synchronization. The headers of the objects are header | type << 1
+// with the object size in the upper 32 bits if sized is set.
+// Buffers are invalidated by collections.
+#define GC_TLAB_SIZE    (32 * 1024)
+
+typedef struct {
+    ptr here;
+    ptr end;
+    ptr header;
+    bool sized;
+} gc_tlab;
+
+// Gives the buffer a new region of at least n_bytes, preferably
+// GC_TLAB_SIZE bytes. Returns false if a collection is needed. NULL
+// for collectors whose heaps can't be shared by several mutators.
+typedef bool (*gc_func_refill)(void *me, gc_tlab *tlab, size_t n_bytes);
+
+// Takes over n_bytes of objects that the vm has placed back to back at
+// the start of the empty heap given to init, like when a heap image
+// is loaded. Every object is a quick fit block: it is aligned to
+// QF_DATA_ALIGNMENT and its header holds its size in the upper 32
+// bits. Mark bits and ref counts are clear. Returns false if the
+// objects don't fit. NULL for collectors that can't load images.
+typedef bool (*gc_func_load_image)(void *me, size_t n_bytes);
 
 typedef struct {
     gc_func_init init;
@@ -90,8 +231,14 @@ typedef struct {
 
     gc_func_set_ptr set_ptr;
     gc_func_set_new_ptr set_new_ptr;
+    gc_func_fill_ptrs fill_ptrs;
+    gc_func_copy_ptrs copy_ptrs;
 
     gc_func_space_used space_used;
+    gc_func_heap_stats heap_stats;
+    gc_func_resize resize;
+    gc_func_refill refill;
+    gc_func_load_image load_image;
 } gc_dispatch;
 
 
@@ -0,0 +1,418 @@
+// pthread_getattr_np is a GNU extension.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+#include "threads/threads.h"
+#include "collectors/conservative.h"
+
+// The thread registered by the calling thread.
+static __thread cs_thread *cs_self = NULL;
+
+conservative_gc *
+cs_init(size_t size) {
+    size = ALIGN(size, CS_CHUNK);
+    conservative_gc *me = malloc(sizeof(conservative_gc));
+    me->start = heap_reserve(size);
+    me->size = size;
+    me->ms = ms_init(me->start, size);
+    me->starts = ba_init((int)(size / CS_GRANULE));
+    me->spans = calloc(size / CS_CHUNK, sizeof(ptr));
+    me->threads = v_init(4);
+    me->roots = v_init(64);
+    me->lock = false;
+    me->gc_requested = false;
+    me->n_parked = 0;
+    me->n_collections = 0;
+    return me;
+}
+
+void
+cs_free(conservative_gc *me) {
+    if (me->threads->used) {
+        error("Threads must be unregistered before the gc is freed!\n");
+    }
+    ms_free(me->ms);
+    ba_free(me->starts);
+    free(me->spans);
+    v_free(me->threads);
+    v_free(me->roots);
+    heap_unreserve(me->start, me->size);
+    free(me);
+}
+
+// Locking and safepoints work like in vm.c. The registers and the
+// top of the stack are saved before a thread parks, so its frames up
+// to that point are kept intact until it leaves.
+static void
+cs_save_context(cs_thread *t) {
+#ifdef _WIN32
+    setjmp(t->regs);
+#else
+    getcontext(&t->regs);
+#endif
+    t->top = (ptr)&t;
+}
+
+void
+cs_enter_blocking(conservative_gc *me) {
+    cs_save_context(cs_self);
+    __atomic_add_fetch(&me->n_parked, 1, __ATOMIC_SEQ_CST);
+}
+
+void
+cs_leave_blocking(conservative_gc *me) {
+    while (true) {
+        while (__atomic_load_n(&me->gc_requested, __ATOMIC_SEQ_CST)) {
+            thr_yield();
+        }
+        __atomic_sub_fetch(&me->n_parked, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&me->gc_requested, __ATOMIC_SEQ_CST)) {
+            return;
+        }
+        __atomic_add_fetch(&me->n_parked, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static inline void
+cs_safepoint(conservative_gc *me) {
+    if (__atomic_load_n(&me->gc_requested, __ATOMIC_SEQ_CST)) {
+        cs_enter_blocking(me);
+        cs_leave_blocking(me);
+    }
+}
+
+static void
+cs_lock(conservative_gc *me) {
+    while (__atomic_test_and_set(&me->lock, __ATOMIC_ACQUIRE)) {
+        cs_safepoint(me);
+        thr_yield();
+    }
+}
+
+static void
+cs_unlock(conservative_gc *me) {
+    __atomic_clear(&me->lock, __ATOMIC_RELEASE);
+}
+
+static ptr
+cs_stack_base() {
+#ifdef __linux__
+    pthread_attr_t attr;
+    void *addr;
+    size_t size;
+    if (pthread_getattr_np(pthread_self(), &attr) ||
+        pthread_attr_getstack(&attr, &addr, &size)) {
+        error("Can't find the stack of the thread!\n");
+    }
+    pthread_attr_destroy(&attr);
+    return (ptr)addr + size;
+#else
+    error("The stack base must be given on this platform!\n");
+    return 0;
+#endif
+}
+
+void
+cs_register_thread(conservative_gc *me, void *stack_base) {
+    if (cs_self) {
+        error("The thread is already registered!\n");
+    }
+    cs_thread *t = malloc(sizeof(cs_thread));
+    t->base = stack_base ? (ptr)stack_base : cs_stack_base();
+    t->top = t->base;
+    // Collections don't wait for unregistered threads so this one
+    // must not park while it waits for the lock.
+    while (__atomic_test_and_set(&me->lock, __ATOMIC_ACQUIRE)) {
+        thr_yield();
+    }
+    v_add(me->threads, (ptr)t);
+    cs_unlock(me);
+    cs_self = t;
+}
+
+void
+cs_unregister_thread(conservative_gc *me) {
+    cs_thread *t = cs_self;
+    cs_lock(me);
+    vector *v = me->threads;
+    for (size_t i = 0; i < v->used; i++) {
+        if (v->array[i] == (ptr)t) {
+            v->array[i] = v->array[--v->used];
+            break;
+        }
+    }
+    cs_unlock(me);
+    cs_self = NULL;
+    free(t);
+}
+
+ptr
+cs_find_object(conservative_gc *me, ptr p) {
+    if (p - me->start >= me->size) {
+        return 0;
+    }
+    int bit = (int)((p - me->start) / CS_GRANULE);
+    int start = ba_prev_set_bit_in_word(me->starts, bit);
+    ptr obj;
+    if (start >= 0) {
+        obj = me->start + (ptr)start * CS_GRANULE;
+    } else {
+        obj = me->spans[bit / BA_WORD_BITS];
+        if (!obj || !ba_get_bit(me->starts,
+                                (int)((obj - me->start) / CS_GRANULE))) {
+            return 0;
+        }
+    }
+    if (p >= obj + QF_GET_BLOCK_SIZE(obj)) {
+        return 0;
+    }
+    return obj;
+}
+
+// Space in the output is reserved for this many words at a time.
+#define CS_FILTER_CHUNK 1024
+
+// Candidates are stored unconditionally and the vector's length is
+// only advanced for words in range, so the loops have no data
+// dependent branches.
+static inline void
+cs_reserve(vector *v, size_t n) {
+    if (v->used + n > v->size) {
+        v_grow(v, v->used + n);
+    }
+}
+
+static void
+cs_filter_tail(ptr *iter, ptr *end, ptr start, size_t size, vector *out) {
+    cs_reserve(out, end - iter);
+    ptr *dst = out->array + out->used;
+    for (; iter < end; iter++) {
+        ptr p = *iter;
+        *dst = p;
+        dst += p - start < size;
+    }
+    out->used = dst - out->array;
+}
+
+void
+cs_filter_words_scalar(ptr lo, ptr hi, ptr start, size_t size,
+                       vector *out) {
+    ptr *iter = (ptr *)ALIGN(lo, sizeof(ptr));
+    ptr *end = (ptr *)(hi & ~(sizeof(ptr) - 1));
+    while (iter < end) {
+        ptr *chunk_end = iter + MIN(end - iter, CS_FILTER_CHUNK);
+        cs_filter_tail(iter, chunk_end, start, size, out);
+        iter = chunk_end;
+    }
+}
+
+#if defined(__AVX2__)
+// Permutations of 32 bit lanes that move the 64 bit lanes selected
+// by a 4 bit mask to the front.
+static const uint32_t
+cs_compress_lut[16][8] __attribute__((aligned(32))) = {
+    {0, 1, 0, 1, 0, 1, 0, 1},
+    {0, 1, 0, 1, 0, 1, 0, 1},
+    {2, 3, 0, 1, 0, 1, 0, 1},
+    {0, 1, 2, 3, 0, 1, 0, 1},
+    {4, 5, 0, 1, 0, 1, 0, 1},
+    {0, 1, 4, 5, 0, 1, 0, 1},
+    {2, 3, 4, 5, 0, 1, 0, 1},
+    {0, 1, 2, 3, 4, 5, 0, 1},
+    {6, 7, 0, 1, 0, 1, 0, 1},
+    {0, 1, 6, 7, 0, 1, 0, 1},
+    {2, 3, 6, 7, 0, 1, 0, 1},
+    {0, 1, 2, 3, 6, 7, 0, 1},
+    {4, 5, 6, 7, 0, 1, 0, 1},
+    {0, 1, 4, 5, 6, 7, 0, 1},
+    {2, 3, 4, 5, 6, 7, 0, 1},
+    {0, 1, 2, 3, 4, 5, 6, 7}
+};
+
+static inline ptr *
+cs_compress4(__m256i x, __m256i start, __m256i limit, ptr *dst) {
+    // Unsigned p - start < size as a signed compare.
+    __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    __m256i d = _mm256_xor_si256(_mm256_sub_epi64(x, start), sign);
+    __m256i in = _mm256_cmpgt_epi64(limit, d);
+    int m = _mm256_movemask_pd(_mm256_castsi256_pd(in));
+    __m256i idx = _mm256_load_si256((__m256i *)cs_compress_lut[m]);
+    _mm256_storeu_si256((__m256i *)dst, _mm256_permutevar8x32_epi32(x, idx));
+    return dst + __builtin_popcount(m);
+}
+#elif defined(__SSE4_2__)
+// Byte shuffles that move the 64 bit lanes selected by a 2 bit mask
+// to the front.
+static const int8_t
+cs_compress_lut[4][16] __attribute__((aligned(16))) = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7},
+    {0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7},
+    {8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15}
+};
+
+static inline ptr *
+cs_compress2(__m128i x, __m128i start, __m128i limit, ptr *dst) {
+    __m128i sign = _mm_set1_epi64x(INT64_MIN);
+    __m128i d = _mm_xor_si128(_mm_sub_epi64(x, start), sign);
+    __m128i in = _mm_cmpgt_epi64(limit, d);
+    int m = _mm_movemask_pd(_mm_castsi128_pd(in));
+    __m128i idx = _mm_load_si128((__m128i *)cs_compress_lut[m]);
+    _mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(x, idx));
+    return dst + __builtin_popcount(m);
+}
+#endif
+
+// Eight words per iteration with AVX2 and four with SSE 4.2. Both
+// vector loops store whole vectors, so space for a chunk of words
+// plus some slack is reserved in the output up front.
+void
+cs_filter_words(ptr lo, ptr hi, ptr start, size_t size, vector *out) {
+    ptr *iter = (ptr *)ALIGN(lo, sizeof(ptr));
+    ptr *end = (ptr *)(hi & ~(sizeof(ptr) - 1));
+#if defined(__AVX2__)
+    __m256i vstart = _mm256_set1_epi64x((int64_t)start);
+    __m256i vlimit = _mm256_set1_epi64x((int64_t)size ^ INT64_MIN);
+    while (end - iter >= 8) {
+        ptr *chunk_end = iter + MIN(end - iter, CS_FILTER_CHUNK);
+        cs_reserve(out, CS_FILTER_CHUNK + 8);
+        ptr *dst = out->array + out->used;
+        for (; chunk_end - iter >= 8; iter += 8) {
+            __m256i x0 = _mm256_loadu_si256((__m256i *)iter);
+            __m256i x1 = _mm256_loadu_si256((__m256i *)(iter + 4));
+            dst = cs_compress4(x0, vstart, vlimit, dst);
+            dst = cs_compress4(x1, vstart, vlimit, dst);
+        }
+        out->used = dst - out->array;
+    }
+#elif defined(__SSE4_2__)
+    __m128i vstart = _mm_set1_epi64x((int64_t)start);
+    __m128i vlimit = _mm_set1_epi64x((int64_t)size ^ INT64_MIN);
+    while (end - iter >= 4) {
+        ptr *chunk_end = iter + MIN(end - iter, CS_FILTER_CHUNK);
+        cs_reserve(out, CS_FILTER_CHUNK + 4);
+        ptr *dst = out->array + out->used;
+        for (; chunk_end - iter >= 4; iter += 4) {
+            __m128i x0 = _mm_loadu_si128((__m128i *)iter);
+            __m128i x1 = _mm_loadu_si128((__m128i *)(iter + 2));
+            dst = cs_compress2(x0, vstart, vlimit, dst);
+            dst = cs_compress2(x1, vstart, vlimit, dst);
+        }
+        out->used = dst - out->array;
+    }
+#endif
+    if (iter < end) {
+        cs_filter_tail(iter, end, start, size, out);
+    }
+}
+
+// Words pointing into the heap are collected first and then resolved
+// to object starts in place.
+static void
+cs_scan_range(conservative_gc *me, ptr lo, ptr hi) {
+    vector *v = me->roots;
+    size_t n = v->used;
+    cs_filter_words(lo, hi, me->start, me->size, v);
+    size_t j = n;
+    for (size_t i = n; i < v->used; i++) {
+        ptr p = cs_find_object(me, v->array[i]);
+        v->array[j] = p;
+        j += p != 0;
+    }
+    v->used = j;
+}
+
+static void
+cs_scan_thread(conservative_gc *me, cs_thread *t) {
+    ptr regs = (ptr)&t->regs;
+    cs_scan_range(me, regs, regs + sizeof(t->regs));
+    cs_scan_range(me, t->top, t->base);
+}
+
+// The frame of this function is below its callers' so saving the
+// context here captures all of them.
+static void __attribute__((noinline))
+cs_mark_and_sweep(conservative_gc *me) {
+    cs_save_context(cs_self);
+    vector *v = me->threads;
+    me->roots->used = 0;
+    for (size_t i = 0; i < v->used; i++) {
+        cs_scan_thread(me, (cs_thread *)v->array[i]);
+    }
+    ms_mark(me->ms->mark_stack, me->roots);
+
+    // Bits of unmarked objects are cleared before the sweep frees
+    // them.
+    bitarray *ba = me->starts;
+    for (int i = ba_next_set_bit(ba, 0); i < ba->n_bits;
+         i = ba_next_set_bit(ba, i + 1)) {
+        if (!P_GET_MARK(me->start + (ptr)i * CS_GRANULE)) {
+            ba_clear_bit(ba, i);
+        }
+    }
+    ms_sweep(me->ms);
+    me->n_collections++;
+}
+
+// Called with the lock held.
+static void
+cs_collect_locked(conservative_gc *me) {
+    __atomic_store_n(&me->gc_requested, true, __ATOMIC_SEQ_CST);
+    int n_others = (int)me->threads->used - 1;
+    while (__atomic_load_n(&me->n_parked, __ATOMIC_SEQ_CST) < n_others) {
+        thr_yield();
+    }
+    cs_mark_and_sweep(me);
+    __atomic_store_n(&me->gc_requested, false, __ATOMIC_SEQ_CST);
+}
+
+void
+cs_collect(conservative_gc *me) {
+    if (!cs_self) {
+        error("Only registered threads can collect!\n");
+    }
+    cs_lock(me);
+    cs_collect_locked(me);
+    cs_unlock(me);
+}
+
+ptr
+cs_allot(conservative_gc *me, int type, size_t size) {
+    if (!cs_self) {
+        error("Only registered threads can allocate!\n");
+    }
+    size = ALIGN(size, CS_GRANULE);
+    cs_safepoint(me);
+    cs_lock(me);
+    if (!ms_can_allot_p(me->ms, size)) {
+        cs_collect_locked(me);
+        if (!ms_can_allot_p(me->ms, size)) {
+            error("Can't allocate %lu bytes! Space used %lu\n",
+                  size, ms_space_used(me->ms));
+        }
+    }
+    ptr p = ms_do_allot(me->ms, type, size);
+    memset((void *)(p + sizeof(ptr)), 0, size - sizeof(ptr));
+    ba_set_bit(me->starts, (int)((p - me->start) / CS_GRANULE));
+    size_t first = (p - me->start) / CS_CHUNK + 1;
+    size_t last = (p - me->start + QF_GET_BLOCK_SIZE(p) - 1) / CS_CHUNK;
+    for (size_t i = first; i <= last; i++) {
+        me->spans[i] = p;
+    }
+    cs_unlock(me);
+    return p;
+}
+
+size_t
+cs_space_used(conservative_gc *me) {
+    return ms_space_used(me->ms);
+}
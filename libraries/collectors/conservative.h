@@ -0,0 +1,102 @@
+#ifndef COLLECTORS_CONSERVATIVE_H
+#define COLLECTORS_CONSERVATIVE_H
+
+#include <stdbool.h>
+#ifdef _WIN32
+#include <setjmp.h>
+#else
+#include <ucontext.h>
+#endif
+#include "datatypes/bitarray.h"
+#include "datatypes/vector.h"
+#include "collectors/common.h"
+#include "collectors/mark-sweep.h"
+
+// Mark & sweep for C code that keeps its pointers in local variables
+// instead of in a root vector. The stacks and registers of all
+// registered threads are scanned conservatively: every word that
+// points into or at an allocated object keeps it alive. Objects are
+// scanned precisely according to their types, so they must follow
+// the object model in collectors/common.h.
+//
+// Since objects never move, interior pointers are fine. The start of
+// every allocated object is recorded in a bitmap with one bit per
+// QF_DATA_ALIGNMENT bytes. The object an interior pointer points into
+// is the last start at or before it in the same bitmap word. If there
+// is none, it is the object spanning the start of the word, which is
+// recorded in a side table when objects are allocated. So the lookup
+// takes constant time.
+//
+// Threads register their stacks with cs_register_thread. A thread
+// that collects stops the others at their next allocation. Threads
+// that block outside of the collector must bracket the blocking call
+// with cs_enter_blocking and cs_leave_blocking.
+#define CS_GRANULE      QF_DATA_ALIGNMENT
+#define CS_CHUNK        (CS_GRANULE * BA_WORD_BITS)
+
+typedef struct {
+    // The stack is scanned from top to base while the thread is
+    // parked.
+    ptr base;
+    ptr top;
+    // Registers saved when the thread parked.
+#ifdef _WIN32
+    jmp_buf regs;
+#else
+    ucontext_t regs;
+#endif
+} cs_thread;
+
+typedef struct {
+    ptr start;
+    size_t size;
+    mark_sweep_gc *ms;
+    bitarray *starts;
+    // For each chunk of heap covered by a bitmap word, the object
+    // that spans its start if the object starts in an earlier chunk.
+    // Entries of freed objects are left behind so they are only
+    // trusted if the object's start bit is set.
+    ptr *spans;
+    vector *threads;
+    vector *roots;
+
+    // Safepoints, like for vms with several mutators.
+    bool lock;
+    bool gc_requested;
+    int n_parked;
+
+    size_t n_collections;
+} conservative_gc;
+
+// Init, free
+conservative_gc *cs_init(size_t size);
+void cs_free(conservative_gc *me);
+
+// Registers the calling thread. The base is the highest address of
+// its stack. If it is NULL, it is looked up, which is only supported
+// on Linux.
+void cs_register_thread(conservative_gc *me, void *stack_base);
+void cs_unregister_thread(conservative_gc *me);
+void cs_enter_blocking(conservative_gc *me);
+void cs_leave_blocking(conservative_gc *me);
+
+// Allocation. Collects if the heap is full. The slots of new objects
+// are cleared, but arrays must get their counts before the thread
+// allocates again.
+ptr cs_allot(conservative_gc *me, int type, size_t size);
+void cs_collect(conservative_gc *me);
+
+// Returns the start of the allocated object p points into or 0.
+ptr cs_find_object(conservative_gc *me, ptr p);
+
+// Appends the aligned words in [lo, hi) whose values are in [start,
+// start + size) to out. Uses AVX2 or SSE 4.2 if the compiler targets
+// them. The scalar version is always available for comparison.
+void cs_filter_words(ptr lo, ptr hi, ptr start, size_t size, vector *out);
+void cs_filter_words_scalar(ptr lo, ptr hi, ptr start, size_t size,
+                            vector *out);
+
+// Stats
+size_t cs_space_used(conservative_gc *me);
+
+#endif
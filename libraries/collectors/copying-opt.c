@@ -37,16 +37,23 @@ fast_memcpy(ptr *dst, ptr* src, size_t n) {
 }
 
 static inline
-ptr s_copy_pointer(space *target, ptr p) {
+ptr s_copy_pointer(copying_gc *me, space *target, ptr p) {
+    if (!CG_SPACE_P(me->active, p)) {
+        los_mark(me->los, p);
+        return p;
+    }
     ptr header = AT(p);
     if ((header & 1) == 1) {
         return header & ~1;
     }
 
     size_t n_bytes = NPTRS(2);
-    if ((header >> 1) == TYPE_ARRAY) {
-        size_t n_els = *SLOT_P(*SLOT_P(p, 0), 0);
-        n_bytes = NPTRS(2 + n_els);
+    size_t t = header >> 1;
+    if (t == TYPE_ARRAY) {
+        size_t n_els = *VALUE_P(P_GET_SLOT(p, 0));
+        n_bytes = P_ARRAY_SIZE(n_els);
+    } else if (TYPE_RAW_ARRAY_P(t)) {
+        n_bytes = p_size(p);
     }
 
     ptr dst = s_allot(target, n_bytes);
@@ -56,22 +63,101 @@ ptr s_copy_pointer(space *target, ptr p) {
 }
 
 static
-void s_copy_slots(space *target, ptr *base, ptr *end) {
+void s_copy_slots(copying_gc *me, space *target, ref *base, ref *end) {
     while (base < end) {
-        ptr p = *base;
-        if (p != 0) {
-            *base = s_copy_pointer(target, p);
+        ptr p = REF_DECODE(*base);
+        if (P_OBJ_P(p)) {
+            *base = REF_ENCODE(s_copy_pointer(me, target, p));
         }
         base++;
     }
 }
 
-void
-cg_collect_optimized(copying_gc *me, vector *roots) {
-    space *target = me->inactive;
-    s_copy_slots(target, roots->array, roots->array + roots->used);
+static void
+s_copy_roots(copying_gc *me, space *target, vector *roots) {
+    for (size_t i = 0; i < roots->used; i++) {
+        ptr p = roots->array[i];
+        if (P_OBJ_P(p)) {
+            roots->array[i] = s_copy_pointer(me, target, p);
+        }
+    }
+}
+
+copying_gc *
+cg_init_depth_first(ptr start, size_t size) {
+    copying_gc *me = cg_init(start, size);
+    me->scan_stack = v_init(64);
+    return me;
+}
+
+// Pushes the addresses of the slots in [base, end) that point to
+// objects in reverse, so that the first one is popped first.
+static void
+s_push_slots(vector *stack, ref *base, ref *end) {
+    while (end > base) {
+        end--;
+        if (P_OBJ_P(REF_DECODE(*end))) {
+            v_add(stack, (ptr)end);
+        }
+    }
+}
+
+// Copies the object and pushes its slots if it wasn't copied before.
+static ptr
+s_copy_and_push(copying_gc *me, space *target, ptr p) {
+    bool new_p = CG_SPACE_P(me->active, p) && !(AT(p) & 1);
+    ptr dst = s_copy_pointer(me, target, p);
+    if (new_p && TYPE_CONTAINER_P(P_GET_TYPE(dst))) {
+        ref *base = SLOT_P(dst, 0);
+        s_push_slots(me->scan_stack, base, base + p_slot_count(dst));
+    }
+    return dst;
+}
+
+static void
+s_drain_depth_first(copying_gc *me, space *target) {
+    vector *stack = me->scan_stack;
+    vector *large = me->los->mark_stack;
+    while (stack->used || large->used) {
+        if (!stack->used) {
+            ptr l = v_remove(large);
+            ref *base = SLOT_P(l, 0);
+            s_push_slots(stack, base, base + p_slot_count(l));
+            continue;
+        }
+        ref *slot = (ref *)v_remove(stack);
+        ptr dst = s_copy_and_push(me, target, REF_DECODE(*slot));
+        *slot = REF_ENCODE(dst);
+    }
+}
+
+// Objects are copied when their slots are popped rather than when
+// their parents are scanned, so they end up in to-space in the order
+// a depth-first traversal would visit them. Each root is followed to
+// the end before the next one is copied.
+static void
+s_collect_depth_first(copying_gc *me, space *target, vector *roots) {
+    for (size_t i = 0; i < roots->used; i++) {
+        ptr p = roots->array[i];
+        if (P_OBJ_P(p)) {
+            roots->array[i] = s_copy_and_push(me, target, p);
+            s_drain_depth_first(me, target);
+        }
+    }
+}
+
+static void
+s_collect_cheney(copying_gc *me, space *target, vector *roots) {
+    vector *large = me->los->mark_stack;
+    s_copy_roots(me, target, roots);
     ptr p = target->start;
-    while (p < target->here) {
+    while (p < target->here || large->used) {
+        if (p == target->here) {
+            ptr l = v_remove(large);
+            ref *base = SLOT_P(l, 0);
+            s_copy_slots(me, target, base, base + p_slot_count(l));
+            continue;
+        }
         size_t t = P_GET_TYPE(p);
         switch (t) {
         case TYPE_INT:
@@ -80,22 +166,39 @@ cg_collect_optimized(copying_gc *me, vector *roots) {
             break;
         }
         case TYPE_WRAPPER: {
-            ptr *slot0 = SLOT_P(p, 0);
-            if (*slot0 != 0) {
-                *slot0 = s_copy_pointer(target, *slot0);
+            ref *slot0 = SLOT_P(p, 0);
+            ptr v = REF_DECODE(*slot0);
+            if (P_OBJ_P(v)) {
+                *slot0 = REF_ENCODE(s_copy_pointer(me, target, v));
             }
-            p += NPTRS(2);
+            p += P_SLOTS_SIZE(1);
             break;
         }
         case TYPE_ARRAY: {
-            ptr *slot0 = SLOT_P(p, 0);
-            size_t n_els = *SLOT_P(*slot0, 0);
-            p += NPTRS(2 + n_els);
-            s_copy_slots(target, slot0, (ptr *)p);
+            ref *slot0 = SLOT_P(p, 0);
+            size_t n_els = *VALUE_P(REF_DECODE(*slot0));
+            p += P_ARRAY_SIZE(n_els);
+            s_copy_slots(me, target, slot0, slot0 + 1 + n_els);
             break;
         }
+        case TYPE_FLOAT_ARRAY:
+        case TYPE_INT_ARRAY:
+        case TYPE_BYTE_ARRAY:
+            p += p_size(p);
+            break;
         }
     }
+}
+
+void
+cg_collect_optimized(copying_gc *me, vector *roots) {
+    space *target = me->inactive;
+    if (me->scan_stack) {
+        s_collect_depth_first(me, target, roots);
+    } else {
+        s_collect_cheney(me, target, roots);
+    }
+    los_sweep(me->los);
     me->active->here = me->active->start;
 
     space *tmp = me->active;
@@ -112,10 +215,39 @@ table = {
     (gc_func_do_allot)cg_do_allot,
     (gc_func_set_ptr)cg_set_ptr,
     (gc_func_set_ptr)cg_set_new_ptr,
-    (gc_func_space_used)cg_space_used
+    NULL,
+    NULL,
+    (gc_func_space_used)cg_space_used,
+    (gc_func_heap_stats)cg_heap_stats,
+    (gc_func_resize)cg_resize,
+    (gc_func_refill)cg_refill,
+    (gc_func_load_image)cg_load_image
 };
 
 gc_dispatch *
 cg_get_dispatch_table_optimized() {
     return &table;
 }
+
+static gc_dispatch
+table_depth_first = {
+    (gc_func_init)cg_init_depth_first,
+    (gc_func_free)cg_free,
+    (gc_func_can_allot_p)cg_can_allot_p,
+    (gc_func_collect)cg_collect_optimized,
+    (gc_func_do_allot)cg_do_allot,
+    (gc_func_set_ptr)cg_set_ptr,
+    (gc_func_set_ptr)cg_set_new_ptr,
+    NULL,
+    NULL,
+    (gc_func_space_used)cg_space_used,
+    (gc_func_heap_stats)cg_heap_stats,
+    (gc_func_resize)cg_resize,
+    (gc_func_refill)cg_refill,
+    (gc_func_load_image)cg_load_image
+};
+
+gc_dispatch *
+cg_get_dispatch_table_depth_first() {
+    return &table_depth_first;
+}
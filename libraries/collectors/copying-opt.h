@@ -1,9 +1,19 @@
 #ifndef COLLECTORS_COPYING2_H
 #define COLLECTORS_COPYING2_H
 
+// Objects are copied in breadth-first Cheney order unless the gc was
+// created with cg_init_depth_first. Then they are copied in the order
+// of a depth-first traversal: each object is followed by its first
+// child's subtree, then its second child's and so on. Mutators that
+// traverse the heap depth-first get better locality after collections
+// at the cost of a stack of pending slots that grows with the depth
+// of the object graph.
+copying_gc *cg_init_depth_first(ptr start, size_t size);
+
 void cg_collect_optimized(copying_gc *me, vector* roots);
 
 // Interface support
 gc_dispatch *cg_get_dispatch_table_optimized();
+gc_dispatch *cg_get_dispatch_table_depth_first();
 
 #endif
@@ -10,12 +10,17 @@
 // This means that half the memory is always unused, which is very
 // wasteful. The upside is that bump pointer allocation is extremely
 // fast.
+
+// Large objects are allocated outside the semispaces and are marked
+// instead of copied.
 #include <assert.h>
 #include <stdbool.h>
 #include <string.h>
 #include "collectors/common.h"
 #include "collectors/copying.h"
 #include "datatypes/vector.h"
+#include "quickfit/quickfit.h"
+#include "threads/threads.h"
 
 static
 space *s_init(ptr start, size_t size) {
@@ -44,8 +49,6 @@ ptr s_allot(space *s, size_t n_bytes) {
 // set up from the old location.
 static
 ptr s_copy_pointer(space *s, ptr p) {
-    if (p == 0)
-        return p;
     // Check if it has already been forwarded. If so, return its
     // existing forwarding address instead of copying anew.
     ptr header = AT(p);
@@ -60,10 +63,33 @@ ptr s_copy_pointer(space *s, ptr p) {
     return dst;
 }
 
+// Returns the new address of p, which must be an object.
+static inline ptr
+cg_copy_object(copying_gc *me, ptr p) {
+    if (CG_SPACE_P(me->active, p)) {
+        return s_copy_pointer(me->inactive, p);
+    }
+    los_mark(me->los, p);
+    return p;
+}
+
 static
-void s_copy_slots(space *s, ptr *base, size_t n_slots) {
+void cg_copy_slots(copying_gc *me, ref *base, size_t n_slots) {
     for (size_t n = 0; n < n_slots; n++) {
-        base[n] = s_copy_pointer(s, base[n]);
+        ptr p = REF_DECODE(base[n]);
+        if (P_OBJ_P(p)) {
+            base[n] = REF_ENCODE(cg_copy_object(me, p));
+        }
+    }
+}
+
+static void
+cg_copy_roots(copying_gc *me, vector *roots) {
+    for (size_t i = 0; i < roots->used; i++) {
+        ptr p = roots->array[i];
+        if (P_OBJ_P(p)) {
+            roots->array[i] = cg_copy_object(me, p);
+        }
     }
 }
 
@@ -73,20 +99,48 @@ cg_init(ptr start, size_t size) {
     copying_gc *cg = malloc(sizeof(copying_gc));
     cg->active = s_init(start, size / 2);
     cg->inactive = s_init(start + size / 2, size / 2);
+    cg->los = los_init();
+    cg->pc = NULL;
+    cg->waste = 0;
+    cg->scan_stack = NULL;
     return cg;
 }
 
+copying_gc *
+cg_init_parallel(ptr start, size_t size, size_t n_threads) {
+    copying_gc *me = cg_init(start, size);
+    me->pc = pc_init(n_threads);
+    return me;
+}
+
+static copying_gc *
+cg_init_all_cores(ptr start, size_t size) {
+    return cg_init_parallel(start, size, thr_n_cores());
+}
+
 void
 cg_collect(copying_gc *cg, vector *roots) {
     space *target = cg->inactive;
-    s_copy_slots(target, roots->array, roots->used);
-    ptr p = target->start;
-    while (p < target->here) {
-        size_t n_slots = p_slot_count(p);
-        s_copy_slots(target, SLOT_P(p, 0), n_slots);
-        p += p_size(p);
-    }
-    assert(p == target->here);
+    if (cg->pc) {
+        target->here = pc_copy(cg->pc, roots, target->start, target->end);
+        cg->waste = cg->pc->waste;
+    } else {
+        vector *large = cg->los->mark_stack;
+        cg_copy_roots(cg, roots);
+        ptr p = target->start;
+        while (p < target->here || large->used) {
+            if (p < target->here) {
+                size_t n_slots = p_slot_count(p);
+                cg_copy_slots(cg, SLOT_P(p, 0), n_slots);
+                p += p_size(p);
+            } else {
+                ptr l = v_remove(large);
+                cg_copy_slots(cg, SLOT_P(l, 0), p_slot_count(l));
+            }
+        }
+        assert(p == target->here);
+        los_sweep(cg->los);
+    }
     cg->active->here = cg->active->start;
 
     space *tmp = cg->active;
@@ -94,13 +148,42 @@ cg_collect(copying_gc *cg, vector *roots) {
     cg->inactive = tmp;
 }
 
+// Parallel copying leaves buffer tails and copies that lost races as
+// gaps in the to-space. So room is kept for a buffer per thread and
+// as much waste as the last collection left. Buffers shrink as the
+// to-space fills up, so in small heaps half of it is enough.
+static ptr
+cg_allot_end(copying_gc *me) {
+    space *s = me->active;
+    if (!me->pc) {
+        return s->end;
+    }
+    size_t headroom = me->pc->n_threads * PC_BUFFER_SIZE + me->waste;
+    return s->end - MIN(headroom, (size_t)(s->end - s->start) / 2);
+}
+
+static bool
+cg_large_p(copying_gc *me, size_t n_bytes) {
+    return !me->pc && n_bytes >= CG_LARGE_OBJECT_SIZE;
+}
+
+// A collection is triggered when the bytes allocated in the large
+// object space since the last one exceed the size of a semispace.
 bool
 cg_can_allot_p(copying_gc *cg, size_t n_bytes) {
-    return (cg->active->here + n_bytes) <= cg->active->end;
+    if (cg_large_p(cg, n_bytes)) {
+        size_t allocated = cg->los->allocated;
+        size_t limit = cg->active->end - cg->active->start;
+        return allocated == 0 || allocated + n_bytes <= limit;
+    }
+    return (cg->active->here + n_bytes) <= cg_allot_end(cg);
 }
 
 ptr
 cg_do_allot(copying_gc *cg, int type, size_t n_bytes) {
+    if (cg_large_p(cg, n_bytes)) {
+        return los_allot(cg->los, type, n_bytes);
+    }
     ptr p = s_allot(cg->active, n_bytes);
     AT(p) = type << 1;
     return p;
@@ -108,24 +191,93 @@ cg_do_allot(copying_gc *cg, int type, size_t n_bytes) {
 
 void
 cg_free(copying_gc *me) {
+    if (me->pc) {
+        pc_free(me->pc);
+    }
+    if (me->scan_stack) {
+        v_free(me->scan_stack);
+    }
     s_free(me->active);
     s_free(me->inactive);
+    los_free(me->los);
     free(me);
 }
 
 size_t
 cg_space_used(copying_gc *me) {
-    return me->active->here - me->active->start;
+    return me->active->here - me->active->start - me->waste +
+        me->los->size;
 }
 
 void
-cg_set_ptr(copying_gc *me, ptr *from, ptr to) {
-    *from = to;
+cg_heap_stats(copying_gc *me, gc_stats *stats) {
+    gs_set_free_space(stats, me->active->end - me->active->here);
+    stats->bytes_large = me->los->size;
+}
+
+// Both semispaces keep their start addresses so the heap can't grow
+// beyond the size it was initialized with.
+bool
+cg_resize(copying_gc *me, size_t size) {
+    size_t half = size / 2;
+    if (me->active->here > me->active->start + half) {
+        return false;
+    }
+    space *spaces[] = {me->active, me->inactive};
+    for (int i = 0; i < 2; i++) {
+        space *s = spaces[i];
+        ptr end = s->start + half;
+        heap_release(end, s->end);
+        s->end = end;
+    }
+    return true;
+}
+
+// Buffers are cut from the active semispace.
+bool
+cg_refill(copying_gc *me, gc_tlab *tlab, size_t n_bytes) {
+    space *s = me->active;
+    ptr end = cg_allot_end(me);
+    if (s->here > end) {
+        return false;
+    }
+    size_t n = MIN(MAX(n_bytes, GC_TLAB_SIZE), end - s->here);
+    if (n < n_bytes) {
+        return false;
+    }
+    tlab->here = s->here;
+    tlab->end = s->here + n;
+    tlab->header = 0;
+    tlab->sized = false;
+    s->here += n;
+    return true;
+}
+
+// The image is already at the start of the active semispace. Only
+// the type is kept in the headers, as the optimized copier expects.
+bool
+cg_load_image(copying_gc *me, size_t n_bytes) {
+    space *s = me->active;
+    if (s->here + n_bytes > s->end) {
+        return false;
+    }
+    ptr end = s->here + n_bytes;
+    while (s->here < end) {
+        ptr p = s->here;
+        s->here += QF_GET_BLOCK_SIZE(p);
+        AT(p) = P_GET_TYPE(p) << 1;
+    }
+    return true;
+}
+
+void
+cg_set_ptr(copying_gc *me, ref *from, ptr to) {
+    *from = REF_ENCODE(to);
 }
 
 void
-cg_set_new_ptr(copying_gc *me, ptr *from, ptr to) {
-    *from = to;
+cg_set_new_ptr(copying_gc *me, ref *from, ptr to) {
+    *from = REF_ENCODE(to);
 }
 
 static gc_dispatch
@@ -137,10 +289,39 @@ table = {
     (gc_func_do_allot)cg_do_allot,
     (gc_func_set_ptr)cg_set_ptr,
     (gc_func_set_ptr)cg_set_new_ptr,
-    (gc_func_space_used)cg_space_used
+    NULL,
+    NULL,
+    (gc_func_space_used)cg_space_used,
+    (gc_func_heap_stats)cg_heap_stats,
+    (gc_func_resize)cg_resize,
+    (gc_func_refill)cg_refill,
+    (gc_func_load_image)cg_load_image
 };
 
 gc_dispatch *
 cg_get_dispatch_table() {
     return &table;
 }
+
+static gc_dispatch
+table_parallel = {
+    (gc_func_init)cg_init_all_cores,
+    (gc_func_free)cg_free,
+    (gc_func_can_allot_p)cg_can_allot_p,
+    (gc_func_collect)cg_collect,
+    (gc_func_do_allot)cg_do_allot,
+    (gc_func_set_ptr)cg_set_ptr,
+    (gc_func_set_ptr)cg_set_new_ptr,
+    NULL,
+    NULL,
+    (gc_func_space_used)cg_space_used,
+    (gc_func_heap_stats)cg_heap_stats,
+    (gc_func_resize)cg_resize,
+    (gc_func_refill)cg_refill,
+    (gc_func_load_image)cg_load_image
+};
+
+gc_dispatch *
+cg_get_dispatch_table_parallel() {
+    return &table_parallel;
+}
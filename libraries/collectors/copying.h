@@ -3,6 +3,13 @@
 
 #include <stdbool.h>
 #include "datatypes/vector.h"
+#include "collectors/large-objects.h"
+#include "collectors/parallel-copy.h"
+
+// Objects this large are allocated in the large object space instead
+// of being copied between the semispaces. Parallel copying doesn't
+// support large objects.
+#define CG_LARGE_OBJECT_SIZE (16 * 1024)
 
 typedef struct {
     ptr start;
@@ -10,13 +17,24 @@ typedef struct {
     ptr here;
 } space;
 
+#define CG_SPACE_P(s, p) ((p) >= (s)->start && (p) < (s)->end)
+
 typedef struct {
     space *active;
     space *inactive;
+    large_object_space *los;
+    // Only set if parallel copying is enabled.
+    parallel_copier *pc;
+    // Bytes in the active space left unused by parallel copying.
+    size_t waste;
+    // Only set if depth-first copying is enabled. Copied objects
+    // whose slots haven't been scanned yet.
+    vector *scan_stack;
 } copying_gc;
 
 // Init, free
 copying_gc *cg_init(ptr start, size_t size);
+copying_gc *cg_init_parallel(ptr start, size_t size, size_t n_threads);
 void cg_free(copying_gc *me);
 
 // Allocation
@@ -24,14 +42,41 @@ bool cg_can_allot_p(copying_gc *me, size_t n_bytes);
 void cg_collect(copying_gc *me, vector *roots);
 ptr cg_do_allot(copying_gc *me, int type, size_t n_bytes);
 
+// Bump allocation fast path for specialized vms, see
+// collectors/vm-spec.h. Returns 0 if the object doesn't fit in the
+// active space or belongs in the large object space.
+static inline ptr
+cg_allot_fast(copying_gc *me, int type, size_t n_bytes) {
+    space *s = me->active;
+    if (n_bytes >= CG_LARGE_OBJECT_SIZE || s->here + n_bytes > s->end) {
+        return 0;
+    }
+    ptr p = s->here;
+    s->here += n_bytes;
+    AT(p) = type << 1;
+    return p;
+}
+
 // To facilitate barriers and refcounting.
-void cg_set_ptr(copying_gc *me, ptr *from, ptr to);
-void cg_set_new_ptr(copying_gc *me, ptr *from, ptr to);
+void cg_set_ptr(copying_gc *me, ref *from, ptr to);
+void cg_set_new_ptr(copying_gc *me, ref *from, ptr to);
 
 // Stats
 size_t cg_space_used(copying_gc *me);
+void cg_heap_stats(copying_gc *me, gc_stats *stats);
+
+// Heap resizing
+bool cg_resize(copying_gc *me, size_t size);
+
+// Thread-local allocation buffers
+bool cg_refill(copying_gc *me, gc_tlab *tlab, size_t n_bytes);
+
+// Heap images
+bool cg_load_image(copying_gc *me, size_t n_bytes);
 
 // Interface support
 gc_dispatch *cg_get_dispatch_table();
+// Copies in parallel using all cores.
+gc_dispatch *cg_get_dispatch_table_parallel();
 
 #endif
@@ -0,0 +1,330 @@
+// A generational garbage collector with two generations.
+//
+// New objects are bump allocated in a small nursery. When it fills
+// up, a minor collection promotes all live nursery objects to the
+// old space, which is managed by the quick fit allocator, and the
+// nursery is reset. Only the roots, the remembered set and the
+// promoted objects are scanned, so the pause is proportional to the
+// number of survivors rather than to the size of the heap.
+//
+// Old-to-young pointers are tracked by the write barrier. Whenever a
+// pointer to a nursery object is stored in an old space slot, the
+// address of the slot is added to the remembered set.
+//
+// When the old space can't fit the nursery survivors, or when a
+// collection is forced by the vm, a major collection marks the whole
+// heap and sweeps the old space like ms_collect does.
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "datatypes/bitarray.h"
+#include "collectors/common.h"
+#include "collectors/generational.h"
+
+static ptr
+s_allot(space *s, size_t n_bytes) {
+    assert(s->start <= s->here);
+    assert(s->here <= s->end);
+    ptr p = s->here;
+    s->here += n_bytes;
+    return p;
+}
+
+generational_gc *
+gen_init(ptr start, size_t size) {
+    generational_gc *me = malloc(sizeof(generational_gc));
+    size_t nursery_size = MIN(size / GEN_NURSERY_RATIO,
+                              GEN_NURSERY_MAX_SIZE);
+    nursery_size &= ~(QF_DATA_ALIGNMENT - 1);
+    size_t old_size = size - nursery_size;
+
+    me->qf = qf_init(start, old_size);
+    me->nursery.start = start + old_size;
+    me->nursery.here = me->nursery.start;
+    me->nursery.end = me->nursery.start + nursery_size;
+    me->large_size = nursery_size / GEN_LARGE_OBJECT_RATIO;
+
+    size_t n_slots = old_size / sizeof(ref);
+    me->remset = v_init(16);
+    me->remset_bits = ba_init((int)ALIGN(n_slots, BA_WORD_BITS));
+    me->mark_stack = v_init(16);
+    me->minor_requested = false;
+    me->bytes_promoted = 0;
+    return me;
+}
+
+void
+gen_free(generational_gc *me) {
+    qf_free(me->qf);
+    v_free(me->remset);
+    ba_free(me->remset_bits);
+    v_free(me->mark_stack);
+    free(me);
+}
+
+void
+gen_remember_slot(generational_gc *me, ptr slot) {
+    int bit = (int)((slot - me->qf->start) / sizeof(ref));
+    if (!ba_get_bit(me->remset_bits, bit)) {
+        ba_set_bit(me->remset_bits, bit);
+        v_add(me->remset, slot);
+    }
+}
+
+static inline void
+gen_remember(generational_gc *me, ref *from, ptr to) {
+    ptr slot = (ptr)from;
+    if (GEN_OLD_P(me, slot) && GEN_NURSERY_P(me, to)) {
+        gen_remember_slot(me, slot);
+    }
+}
+
+static void
+gen_clear_remset(generational_gc *me) {
+    vector *v = me->remset;
+    for (size_t i = 0; i < v->used; i++) {
+        int bit = (int)((v->array[i] - me->qf->start) / sizeof(ref));
+        ba_clear_bit(me->remset_bits, bit);
+    }
+    v->used = 0;
+}
+
+// Copies the object to the old space and leaves a forwarding pointer
+// in the nursery.
+static ptr
+gen_promote(generational_gc *me, ptr p) {
+    ptr header = AT(p);
+    if ((header & 1) == 1) {
+        return header & ~1;
+    }
+    size_t n_bytes = p_size(p);
+    ptr dst = qf_allot_block(me->qf, n_bytes);
+    if (!dst) {
+        error("Can't promote %lu bytes! Space used %lu\n",
+              n_bytes, gen_space_used(me));
+    }
+    size_t block_size = QF_GET_BLOCK_SIZE(dst);
+    memcpy((void *)dst, (void *)p, n_bytes);
+    AT(dst) = (block_size << 32) | (header & BF_LIT_BITS(32));
+    me->bytes_promoted += n_bytes;
+    AT(p) = dst | 1;
+    v_add(me->mark_stack, dst);
+    return dst;
+}
+
+static inline void
+gen_forward_slot(generational_gc *me, ref *slot) {
+    ptr p = REF_DECODE(*slot);
+    if (GEN_NURSERY_P(me, p)) {
+        *slot = REF_ENCODE(gen_promote(me, p));
+    }
+}
+
+static void
+gen_minor_collect(generational_gc *me, vector *roots) {
+    for (size_t i = 0; i < roots->used; i++) {
+        ptr p = roots->array[i];
+        if (GEN_NURSERY_P(me, p)) {
+            roots->array[i] = gen_promote(me, p);
+        }
+    }
+    vector *rs = me->remset;
+    for (size_t i = 0; i < rs->used; i++) {
+        gen_forward_slot(me, (ref *)rs->array[i]);
+    }
+    gen_clear_remset(me);
+
+    // Promoted objects are gray until their slots have been
+    // forwarded.
+    vector *v = me->mark_stack;
+    while (v->used) {
+        ptr p = v_remove(v);
+        for (size_t n = p_slot_count(p), i = 0; i < n; i++) {
+            gen_forward_slot(me, SLOT_P(p, i));
+        }
+    }
+    me->nursery.here = me->nursery.start;
+}
+
+static inline void
+gen_mark_step(vector *v, ptr p) {
+    if (!P_GET_MARK(p)) {
+        P_MARK(p);
+        v_add(v, p);
+    }
+}
+
+// Marks the whole heap, rebuilds the remembered set from the live
+// old objects and sweeps the old space. Nursery objects are
+// unmarked but not moved, the minor collection that follows takes
+// care of them.
+static void
+gen_major_collect(generational_gc *me, vector *roots) {
+    gen_clear_remset(me);
+    vector *v = me->mark_stack;
+    for (size_t i = 0; i < roots->used; i++) {
+        ptr p = roots->array[i];
+        if (P_OBJ_P(p)) {
+            gen_mark_step(v, p);
+        }
+    }
+    while (v->used) {
+        ptr p = v_remove(v);
+        bool old_p = GEN_OLD_P(me, p);
+        for (size_t n = p_slot_count(p), i = 0; i < n; i++) {
+            ref *slot = SLOT_P(p, i);
+            ptr p_child = REF_DECODE(*slot);
+            if (P_OBJ_P(p_child)) {
+                if (old_p) {
+                    gen_remember(me, slot, p_child);
+                }
+                gen_mark_step(v, p_child);
+            }
+        }
+    }
+
+    // The nursery must be unmarked before the old space is swept
+    // because the size of a dead array is stored in its count
+    // object, which may live in the old space.
+    ptr iter = me->nursery.start;
+    while (iter < me->nursery.here) {
+        P_UNMARK(iter);
+        iter += p_size(iter);
+    }
+
+    qf_clear(me->qf);
+    iter = me->qf->start;
+    ptr end = iter + me->qf->size;
+    while (iter != end) {
+        while (P_GET_MARK(iter)) {
+            P_UNMARK(iter);
+            iter += QF_GET_BLOCK_SIZE(iter);
+            if (iter == end) {
+                return;
+            }
+        }
+        ptr free_start = iter;
+        while (iter != end && !P_GET_MARK(iter)) {
+            iter += QF_GET_BLOCK_SIZE(iter);
+        }
+        qf_free_block(me->qf, free_start, iter - free_start);
+    }
+}
+
+// Promoted objects may need to be rounded up to the quick fit
+// alignment, hence the factor two.
+static bool
+gen_can_promote_p(generational_gc *me) {
+    size_t used = me->nursery.here - me->nursery.start;
+    return me->qf->free_space >= 2 * used + QF_PAGE_SIZE;
+}
+
+// A collection that isn't preceded by a failed allocation in the
+// nursery has been forced by the vm and is always a major one.
+void
+gen_collect(generational_gc *me, vector *roots) {
+    if (!me->minor_requested || !gen_can_promote_p(me)) {
+        gen_major_collect(me, roots);
+    }
+    gen_minor_collect(me, roots);
+    me->minor_requested = false;
+}
+
+bool
+gen_can_allot_p(generational_gc *me, size_t size) {
+    if (size > me->large_size) {
+        return qf_can_allot_p(me->qf, size);
+    }
+    if (me->nursery.here + size <= me->nursery.end) {
+        return true;
+    }
+    me->minor_requested = true;
+    return false;
+}
+
+ptr
+gen_do_allot(generational_gc *me, int type, size_t size) {
+    if (size > me->large_size) {
+        ptr p = qf_allot_block(me->qf, size);
+        P_SET_TYPE(p, type);
+        return p;
+    }
+    ptr p = s_allot(&me->nursery, size);
+    AT(p) = type << 1;
+    return p;
+}
+
+size_t
+gen_space_used(generational_gc *me) {
+    size_t nursery_used = me->nursery.here - me->nursery.start;
+    return nursery_used + qf_space_used(me->qf);
+}
+
+void
+gen_heap_stats(generational_gc *me, gc_stats *stats) {
+    gs_set_quick_fit(stats, me->qf);
+    stats->bytes_promoted = me->bytes_promoted;
+}
+
+void
+gen_set_ptr(generational_gc *me, ref *from, ptr to) {
+    gen_remember(me, from, to);
+    *from = REF_ENCODE(to);
+}
+
+void
+gen_set_new_ptr(generational_gc *me, ref *from, ptr to) {
+    gen_remember(me, from, to);
+    *from = REF_ENCODE(to);
+}
+
+// The slots belong to one object so whether it is old is only checked
+// once. Slots of nursery objects, like new arrays, need no barrier.
+void
+gen_fill_ptrs(generational_gc *me, ref *from, size_t n, ptr to) {
+    if (GEN_OLD_P(me, (ptr)from) && GEN_NURSERY_P(me, to)) {
+        for (size_t i = 0; i < n; i++) {
+            gen_remember_slot(me, (ptr)(from + i));
+        }
+    }
+    ref r = REF_ENCODE(to);
+    for (size_t i = 0; i < n; i++) {
+        from[i] = r;
+    }
+}
+
+void
+gen_copy_ptrs(generational_gc *me, ref *from, ref *src, size_t n) {
+    if (GEN_OLD_P(me, (ptr)from)) {
+        for (size_t i = 0; i < n; i++) {
+            if (GEN_NURSERY_P(me, REF_DECODE(src[i]))) {
+                gen_remember_slot(me, (ptr)(from + i));
+            }
+        }
+    }
+    memmove(from, src, n * sizeof(ref));
+}
+
+static gc_dispatch
+table = {
+    (gc_func_init)gen_init,
+    (gc_func_free)gen_free,
+    (gc_func_can_allot_p)gen_can_allot_p,
+    (gc_func_collect)gen_collect,
+    (gc_func_do_allot)gen_do_allot,
+    (gc_func_set_ptr)gen_set_ptr,
+    (gc_func_set_ptr)gen_set_new_ptr,
+    (gc_func_fill_ptrs)gen_fill_ptrs,
+    (gc_func_copy_ptrs)gen_copy_ptrs,
+    (gc_func_space_used)gen_space_used,
+    (gc_func_heap_stats)gen_heap_stats,
+    NULL,
+    NULL,
+    NULL
+};
+
+gc_dispatch *
+gen_get_dispatch_table() {
+    return &table;
+}
@@ -0,0 +1,93 @@
+#ifndef GENERATIONAL_H
+#define GENERATIONAL_H
+
+#include <stdbool.h>
+#include "datatypes/bitarray.h"
+#include "datatypes/vector.h"
+#include "quickfit/quickfit.h"
+#include "collectors/common.h"
+#include "collectors/copying.h"
+
+// The nursery takes 1/GEN_NURSERY_RATIO of the heap, but never more
+// than GEN_NURSERY_MAX_SIZE bytes.
+#define GEN_NURSERY_RATIO       8
+#define GEN_NURSERY_MAX_SIZE    (4 * 1024 * 1024)
+
+// Objects larger than nursery size / GEN_LARGE_OBJECT_RATIO are
+// allocated directly in the old space.
+#define GEN_LARGE_OBJECT_RATIO  4
+
+// All heap pointers are below the end of the nursery. Tagged ints
+// can have any value.
+#define GEN_NURSERY_P(me, p) \
+    (!P_TAGGED_P(p) && (p) >= (me)->nursery.start)
+#define GEN_OLD_P(me, p) \
+    ((p) >= (me)->qf->start && (p) < (me)->nursery.start)
+
+typedef struct {
+    // Young objects are bump allocated in the nursery. It is placed
+    // right after the old space.
+    space nursery;
+    // Survivors are promoted to the quick fit managed old space.
+    quick_fit *qf;
+    // Addresses of old space slots that may point into the nursery
+    // and one bit per old space word so that no slot is recorded
+    // twice.
+    vector *remset;
+    bitarray *remset_bits;
+    // Gray objects during major and minor collections.
+    vector *mark_stack;
+    size_t large_size;
+    // Set when the last allocation failed because the nursery was
+    // full.
+    bool minor_requested;
+    size_t bytes_promoted;
+} generational_gc;
+
+// Init, free
+generational_gc *gen_init(ptr start, size_t size);
+void gen_free(generational_gc *me);
+
+// Allocation
+bool gen_can_allot_p(generational_gc *me, size_t size);
+void gen_collect(generational_gc *me, vector *roots);
+ptr gen_do_allot(generational_gc *me, int type, size_t size);
+
+// Write barrier
+void gen_set_ptr(generational_gc *me, ref *from, ptr to);
+void gen_set_new_ptr(generational_gc *me, ref *from, ptr to);
+void gen_fill_ptrs(generational_gc *me, ref *from, size_t n, ptr to);
+void gen_copy_ptrs(generational_gc *me, ref *from, ref *src, size_t n);
+// Adds an old space slot to the remembered set.
+void gen_remember_slot(generational_gc *me, ptr slot);
+
+// Fast paths for specialized vms, see collectors/vm-spec.h. Only
+// adding to the remembered set happens out of line.
+static inline ptr
+gen_allot_fast(generational_gc *me, int type, size_t size) {
+    space *s = &me->nursery;
+    if (size > me->large_size || s->here + size > s->end) {
+        return 0;
+    }
+    ptr p = s->here;
+    s->here += size;
+    AT(p) = type << 1;
+    return p;
+}
+
+static inline void
+gen_set_ptr_fast(generational_gc *me, ref *from, ptr to) {
+    if (GEN_OLD_P(me, (ptr)from) && GEN_NURSERY_P(me, to)) {
+        gen_remember_slot(me, (ptr)from);
+    }
+    *from = REF_ENCODE(to);
+}
+
+// Stats
+size_t gen_space_used(generational_gc *me);
+void gen_heap_stats(generational_gc *me, gc_stats *stats);
+
+// Interface support
+gc_dispatch *gen_get_dispatch_table();
+
+#endif
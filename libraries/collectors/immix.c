@@ -0,0 +1,486 @@
+// A mark-region collector in the style of Immix.
+//
+// The heap is divided into 32 KB blocks of 128 byte lines. Objects
+// are bump allocated into holes, runs of lines that held no live
+// objects after the last collection. Collections mark live objects
+// and the lines and blocks they occupy. There is no sweep, lines
+// without marks are simply reused by the allocator.
+//
+// Marking fragments the heap over time so blocks with few live lines
+// are evacuated during marking. Their objects are copied to a small
+// reserve of free blocks that the allocator doesn't use and forwarded
+// like in the copying collectors. If the reserve runs out, the
+// remaining objects are marked in place. The blocks to evacuate are
+// picked at the end of the previous collection.
+//
+// The header stores the object size in its upper 32 bits, like quick
+// fit does, so that objects can be scanned and copied without
+// reading their array counts. The mark bit is bit 5, otherwise used
+// for the color by reference counting collectors.
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "collectors/common.h"
+#include "collectors/immix.h"
+
+#define IX_GET_MARK(h)      (((h) >> IX_MARK_SHIFT) & 1)
+#define IX_HEAP_P(me, p)    ((ptr)(p) - (me)->start < (me)->size)
+
+static inline int
+ix_address_to_line(immix_gc *me, ptr p) {
+    return (int)((p - me->start) / IX_LINE_SIZE);
+}
+
+static inline ptr
+ix_line_to_address(immix_gc *me, int line) {
+    return me->start + (ptr)line * IX_LINE_SIZE;
+}
+
+// The bitarray is padded to a multiple of the word size. The padding
+// is marked so that it never looks free.
+static void
+ix_clear_lines(immix_gc *me) {
+    bitarray *ba = me->line_marks;
+    ba_clear(ba);
+    if (ba->n_bits > me->n_lines) {
+        ba_set_bit_range(ba, me->n_lines, ba->n_bits - me->n_lines);
+    }
+}
+
+// Holds back free blocks for evacuation by marking their lines.
+static void
+ix_reserve_blocks(immix_gc *me) {
+    vector *v = me->free_blocks;
+    v->used = 0;
+    size_t n_reserve = me->n_blocks / IX_RESERVE_FRACTION;
+    for (int i = 0; i < me->n_blocks && v->used < n_reserve; i++) {
+        if (!ba_get_bit(me->block_marks, i)) {
+            v_add(v, i);
+            ba_set_bit_range(me->line_marks, i * IX_LINES_PER_BLOCK,
+                             IX_LINES_PER_BLOCK);
+        }
+    }
+}
+
+// Gives the reserved blocks and the ones to evacuate to the
+// allocator.
+static void
+ix_release_reserve(immix_gc *me) {
+    vector *v = me->free_blocks;
+    for (size_t i = 0; i < v->used; i++) {
+        int first = (int)v->array[i] * IX_LINES_PER_BLOCK;
+        int last = MIN(first + IX_LINES_PER_BLOCK, me->n_lines);
+        for (int j = first; j < last; j++) {
+            ba_clear_bit(me->line_marks, j);
+        }
+    }
+    v->used = 0;
+    ba_clear(me->candidates);
+    me->next_line = 0;
+    me->overflow_next_line = 0;
+}
+
+immix_gc *
+ix_init(ptr start, size_t size) {
+    immix_gc *me = malloc(sizeof(immix_gc));
+    me->start = start;
+    me->size = size;
+    me->n_lines = (int)(size / IX_LINE_SIZE);
+    me->n_blocks = (me->n_lines + IX_LINES_PER_BLOCK - 1) /
+        IX_LINES_PER_BLOCK;
+    me->line_marks = ba_init(me->n_blocks * IX_LINES_PER_BLOCK);
+    me->block_marks = ba_init(ALIGN(me->n_blocks, BA_WORD_BITS));
+    me->candidates = ba_init(ALIGN(me->n_blocks, BA_WORD_BITS));
+    me->block_lines = calloc(me->n_blocks, sizeof(int));
+    ix_clear_lines(me);
+    me->here = me->end = 0;
+    me->next_line = 0;
+    me->overflow_here = me->overflow_end = 0;
+    me->overflow_next_line = 0;
+    me->free_blocks = v_init(16);
+    me->next_free_block = 0;
+    me->evac_here = me->evac_end = 0;
+    me->mark_stack = v_init(16);
+    me->los = los_init();
+    me->mark_sense = 0;
+    me->live = 0;
+    me->allocated = 0;
+    me->evacuated = 0;
+    ix_reserve_blocks(me);
+    return me;
+}
+
+void
+ix_free(immix_gc *me) {
+    ba_free(me->line_marks);
+    ba_free(me->block_marks);
+    ba_free(me->candidates);
+    free(me->block_lines);
+    v_free(me->free_blocks);
+    v_free(me->mark_stack);
+    los_free(me->los);
+    free(me);
+}
+
+// Finds the next hole at or after *line that can fit size bytes and
+// marks its lines so that it isn't handed out twice. Holes in blocks
+// that are to be evacuated are skipped and at most max_lines lines
+// are taken.
+static bool
+ix_next_hole(immix_gc *me, int *line, size_t size, int max_lines,
+             ptr *here, ptr *end) {
+    bitarray *ba = me->line_marks;
+    int i = *line;
+    while (i < me->n_lines) {
+        int first = ba_next_unset_bit(ba, i);
+        if (first >= me->n_lines) {
+            break;
+        }
+        int block = first / IX_LINES_PER_BLOCK;
+        if (ba_get_bit(me->candidates, block)) {
+            i = (block + 1) * IX_LINES_PER_BLOCK;
+            continue;
+        }
+        int last = ba_next_set_bit(ba, first);
+        for (int b = block + 1; b * IX_LINES_PER_BLOCK < last; b++) {
+            if (ba_get_bit(me->candidates, b)) {
+                last = b * IX_LINES_PER_BLOCK;
+                break;
+            }
+        }
+        if ((size_t)(last - first) * IX_LINE_SIZE >= size) {
+            last = MIN(last, first + max_lines);
+            ba_set_bit_range(ba, first, last - first);
+            *here = ix_line_to_address(me, first);
+            *end = ix_line_to_address(me, last);
+            *line = last;
+            return true;
+        }
+        i = last;
+    }
+    *line = me->n_lines;
+    return false;
+}
+
+static bool
+ix_large_p(size_t size) {
+    return size >= IX_LARGE_OBJECT_SIZE;
+}
+
+// Makes sure that size bytes can be bump allocated from either the
+// current or the overflow hole.
+static bool
+ix_fit(immix_gc *me, size_t size) {
+    if (me->here + size <= me->end) {
+        return true;
+    }
+    if (size <= IX_LINE_SIZE) {
+        return ix_next_hole(me, &me->next_line, size, me->n_lines,
+                            &me->here, &me->end);
+    }
+    if (me->overflow_here + size <= me->overflow_end) {
+        return true;
+    }
+    return ix_next_hole(me, &me->overflow_next_line, size, me->n_lines,
+                        &me->overflow_here, &me->overflow_end);
+}
+
+// Like the copying collectors, a collection is triggered when the
+// bytes allocated in the large object space since the last one
+// exceed the heap size. The evacuation reserve is only given up if
+// the heap is full right after a collection.
+bool
+ix_can_allot_p(immix_gc *me, size_t size) {
+    if (ix_large_p(size)) {
+        size_t allocated = me->los->allocated;
+        return allocated == 0 || allocated + size <= me->size;
+    }
+    if (ix_fit(me, size)) {
+        return true;
+    }
+    if (me->allocated == 0 && me->free_blocks->used) {
+        ix_release_reserve(me);
+        return ix_fit(me, size);
+    }
+    return false;
+}
+
+ptr
+ix_do_allot(immix_gc *me, int type, size_t size) {
+    if (ix_large_p(size)) {
+        return los_allot(me->los, type, size);
+    }
+    if (!ix_fit(me, size)) {
+        error("Can't allocate %lu bytes!\n", size);
+    }
+    ptr p;
+    if (me->here + size <= me->end) {
+        p = me->here;
+        me->here += size;
+    } else {
+        p = me->overflow_here;
+        me->overflow_here += size;
+    }
+    AT(p) = ((ptr)size << 32) | (me->mark_sense << IX_MARK_SHIFT) |
+        (type << 1);
+    me->allocated += size;
+    return p;
+}
+
+// Buffers are holes of at most GC_TLAB_SIZE bytes. Objects in them
+// carry their size in the header, like the ones from ix_do_allot.
+bool
+ix_refill(immix_gc *me, gc_tlab *tlab, size_t n_bytes) {
+    int max_lines = GC_TLAB_SIZE / IX_LINE_SIZE;
+    ptr here, end;
+    if (!ix_next_hole(me, &me->next_line, n_bytes, max_lines,
+                      &here, &end)) {
+        if (me->allocated || !me->free_blocks->used) {
+            return false;
+        }
+        ix_release_reserve(me);
+        if (!ix_next_hole(me, &me->next_line, n_bytes, max_lines,
+                          &here, &end)) {
+            return false;
+        }
+    }
+    tlab->here = here;
+    tlab->end = end;
+    tlab->header = (ptr)me->mark_sense << IX_MARK_SHIFT;
+    tlab->sized = true;
+    me->allocated += end - here;
+    return true;
+}
+
+static int
+ix_block_occupancy(immix_gc *me, int block) {
+    ptr *words = (ptr *)me->line_marks->bits;
+    int n_words = IX_LINES_PER_BLOCK / BA_WORD_BITS;
+    int n = 0;
+    for (int i = 0; i < n_words; i++) {
+        n += BIT_COUNT(words[block * n_words + i]);
+    }
+    return n;
+}
+
+// Picks the blocks to evacuate during the next collection, sparsest
+// first. The allocator doesn't use them until then so they can't
+// hold more live data than now. As many are picked as fit in the
+// reserve as long as they don't withhold more than an eighth of the
+// free lines from the allocator.
+static void
+ix_select_candidates(immix_gc *me) {
+    ba_clear(me->candidates);
+    size_t budget = me->free_blocks->used * IX_LINES_PER_BLOCK;
+    size_t withhold = (me->n_lines - ba_bitsum(me->line_marks)) / 8;
+    for (int n = 1; n <= IX_SPARSE_LINES; n++) {
+        for (int i = 0; i < me->n_blocks; i++) {
+            if (me->block_lines[i] != n) {
+                continue;
+            }
+            size_t n_free = IX_LINES_PER_BLOCK - n;
+            if ((size_t)n > budget || n_free > withhold) {
+                return;
+            }
+            ba_set_bit(me->candidates, i);
+            budget -= n;
+            withhold -= n_free;
+        }
+    }
+}
+
+static ptr
+ix_evac_allot(immix_gc *me, size_t size) {
+    while (me->evac_here + size > me->evac_end) {
+        if (me->next_free_block == me->free_blocks->used) {
+            return 0;
+        }
+        int block = me->free_blocks->array[me->next_free_block++];
+        int first = block * IX_LINES_PER_BLOCK;
+        int last = MIN(first + IX_LINES_PER_BLOCK, me->n_lines);
+        me->evac_here = ix_line_to_address(me, first);
+        me->evac_end = ix_line_to_address(me, last);
+    }
+    ptr p = me->evac_here;
+    me->evac_here += size;
+    return p;
+}
+
+static inline void
+ix_mark_lines(immix_gc *me, ptr p, size_t size) {
+    int first = ix_address_to_line(me, p);
+    int last = ix_address_to_line(me, p + size - 1);
+    ba_set_bit_range(me->line_marks, first, last - first + 1);
+    // Medium objects may straddle two blocks.
+    ba_set_bit(me->block_marks, first / IX_LINES_PER_BLOCK);
+    ba_set_bit(me->block_marks, last / IX_LINES_PER_BLOCK);
+}
+
+// Marks the object and returns its new address if it is evacuated.
+static inline ptr
+ix_trace_object(immix_gc *me, ptr p) {
+    if (!IX_HEAP_P(me, p)) {
+        los_mark(me->los, p);
+        return p;
+    }
+    ptr header = AT(p);
+    if (header & 1) {
+        return header & ~1;
+    }
+    if (IX_GET_MARK(header) == me->mark_sense) {
+        return p;
+    }
+    size_t size = IX_GET_SIZE(header);
+    int block = ix_address_to_line(me, p) / IX_LINES_PER_BLOCK;
+    if (ba_get_bit(me->candidates, block)) {
+        ptr q = ix_evac_allot(me, size);
+        if (q) {
+            memcpy((void *)q, (void *)p, size);
+            AT(p) = q | 1;
+            p = q;
+            me->evacuated += size;
+        }
+    }
+    AT(p) = header ^ ((ptr)1 << IX_MARK_SHIFT);
+    ix_mark_lines(me, p, size);
+    me->live += size;
+    v_add(me->mark_stack, p);
+    return p;
+}
+
+static void
+ix_trace_slots(immix_gc *me, ref *base, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        ptr p = REF_DECODE(base[i]);
+        if (P_OBJ_P(p)) {
+            ptr q = ix_trace_object(me, p);
+            if (q != p) {
+                base[i] = REF_ENCODE(q);
+            }
+        }
+    }
+}
+
+static void
+ix_trace_roots(immix_gc *me, vector *roots) {
+    for (size_t i = 0; i < roots->used; i++) {
+        ptr p = roots->array[i];
+        if (P_OBJ_P(p)) {
+            roots->array[i] = ix_trace_object(me, p);
+        }
+    }
+}
+
+void
+ix_collect(immix_gc *me, vector *roots) {
+    me->next_free_block = 0;
+    me->evac_here = me->evac_end = 0;
+    ix_clear_lines(me);
+    ba_clear(me->block_marks);
+    me->mark_sense ^= 1;
+    me->live = 0;
+
+    ix_trace_roots(me, roots);
+    vector *v = me->mark_stack;
+    vector *large = me->los->mark_stack;
+    while (v->used || large->used) {
+        // Large objects keep their sizes in the same header bits.
+        ptr p = v->used ? v_remove(v) : v_remove(large);
+        if (TYPE_CONTAINER_P(P_GET_TYPE(p))) {
+#ifdef GC_COMPRESSED_REFS
+            // The size may include a padding slot.
+            size_t n_slots = p_slot_count(p);
+#else
+            size_t n_slots = IX_GET_SIZE(AT(p)) / sizeof(ptr) - 1;
+#endif
+            ix_trace_slots(me, SLOT_P(p, 0), n_slots);
+        }
+    }
+    los_sweep(me->los);
+
+    for (int i = 0; i < me->n_blocks; i++) {
+        me->block_lines[i] = ba_get_bit(me->block_marks, i)
+            ? ix_block_occupancy(me, i) : 0;
+    }
+    ix_reserve_blocks(me);
+    ix_select_candidates(me);
+
+    me->here = me->end = 0;
+    me->next_line = 0;
+    me->overflow_here = me->overflow_end = 0;
+    me->overflow_next_line = 0;
+    me->allocated = 0;
+}
+
+void
+ix_set_ptr(immix_gc *me, ref *from, ptr to) {
+    *from = REF_ENCODE(to);
+}
+
+void
+ix_set_new_ptr(immix_gc *me, ref *from, ptr to) {
+    *from = REF_ENCODE(to);
+}
+
+size_t
+ix_space_used(immix_gc *me) {
+    return me->live + me->allocated + me->los->size;
+}
+
+// Holes are reported as free blocks, plus what is left of the
+// allocation regions.
+void
+ix_heap_stats(immix_gc *me, gc_stats *stats) {
+    size_t n_holes = 0;
+    size_t free_space = 0;
+    size_t largest = 0;
+    bitarray *ba = me->line_marks;
+    int i = ba_next_unset_bit(ba, 0);
+    while (i < ba->n_bits) {
+        int next = ba_next_set_bit(ba, i);
+        size_t n = (size_t)(next - i) * IX_LINE_SIZE;
+        n_holes++;
+        free_space += n;
+        largest = MAX(largest, n);
+        i = ba_next_unset_bit(ba, next);
+    }
+    size_t regions[] = {
+        me->end - me->here,
+        me->overflow_end - me->overflow_here
+    };
+    for (int i = 0; i < 2; i++) {
+        if (regions[i]) {
+            n_holes++;
+            free_space += regions[i];
+            largest = MAX(largest, regions[i]);
+        }
+    }
+    stats->free_space = free_space;
+    stats->n_free_blocks = n_holes;
+    stats->largest_free_block = largest;
+    stats->bytes_large = me->los->size;
+}
+
+static gc_dispatch
+table = {
+    (gc_func_init)ix_init,
+    (gc_func_free)ix_free,
+    (gc_func_can_allot_p)ix_can_allot_p,
+    (gc_func_collect)ix_collect,
+    (gc_func_do_allot)ix_do_allot,
+    (gc_func_set_ptr)ix_set_ptr,
+    (gc_func_set_ptr)ix_set_new_ptr,
+    NULL,
+    NULL,
+    (gc_func_space_used)ix_space_used,
+    (gc_func_heap_stats)ix_heap_stats,
+    NULL,
+    (gc_func_refill)ix_refill,
+    NULL
+};
+
+gc_dispatch *
+ix_get_dispatch_table() {
+    return &table;
+}
@@ -0,0 +1,96 @@
+#ifndef COLLECTORS_IMMIX_H
+#define COLLECTORS_IMMIX_H
+
+#include <stdbool.h>
+#include "datatypes/bitarray.h"
+#include "datatypes/vector.h"
+#include "collectors/common.h"
+#include "collectors/large-objects.h"
+
+#define IX_LINE_SIZE            128
+#define IX_BLOCK_SIZE           (32 * 1024)
+#define IX_LINES_PER_BLOCK      (IX_BLOCK_SIZE / IX_LINE_SIZE)
+// Objects this large go to the large object space.
+#define IX_LARGE_OBJECT_SIZE    (8 * 1024)
+// The object size is kept in the upper half of the header and the
+// mark bit in one of the color bits.
+#define IX_GET_SIZE(h)          ((h) >> 32)
+#define IX_MARK_SHIFT           5
+
+// Blocks with at most this many marked lines are evacuated if there
+// are enough free blocks to evacuate them to.
+#define IX_SPARSE_LINES         (IX_LINES_PER_BLOCK / 4)
+// This fraction of the blocks is held back from the allocator to
+// evacuate objects to.
+#define IX_RESERVE_FRACTION     32
+
+typedef struct {
+    ptr start;
+    size_t size;
+    int n_lines;
+    int n_blocks;
+    // Lines that hold live objects or that have been handed out to
+    // the allocator since the last collection.
+    bitarray *line_marks;
+    // Blocks with live objects and their number of marked lines
+    // after the last collection.
+    bitarray *block_marks;
+    int *block_lines;
+    // Blocks that are evacuated during the current collection.
+    bitarray *candidates;
+
+    // Small objects are bump allocated into holes of free lines.
+    // Medium objects that don't fit in the current hole are
+    // allocated from a second, overflow, hole instead so that small
+    // holes aren't skipped. The next_line fields are where the
+    // search for the next hole starts.
+    ptr here;
+    ptr end;
+    int next_line;
+    ptr overflow_here;
+    ptr overflow_end;
+    int overflow_next_line;
+
+    // Free blocks reserved for evacuation and the current
+    // evacuation region.
+    vector *free_blocks;
+    size_t next_free_block;
+    ptr evac_here;
+    ptr evac_end;
+
+    vector *mark_stack;
+    large_object_space *los;
+    // Objects are marked if the mark bit in their header equals this.
+    // It flips every collection so marks never have to be cleared.
+    int mark_sense;
+    // Bytes marked by the last collection and allocated since.
+    size_t live;
+    size_t allocated;
+    // Bytes evacuated during all collections.
+    size_t evacuated;
+} immix_gc;
+
+// Init, free
+immix_gc *ix_init(ptr start, size_t size);
+void ix_free(immix_gc *me);
+
+// Allocation
+bool ix_can_allot_p(immix_gc *me, size_t size);
+void ix_collect(immix_gc *me, vector *roots);
+ptr ix_do_allot(immix_gc *me, int type, size_t size);
+
+// Thread-local allocation buffers
+bool ix_refill(immix_gc *me, gc_tlab *tlab, size_t n_bytes);
+
+// To facilitate barriers and refcounting.
+void ix_set_ptr(immix_gc *me, ref *from, ptr to);
+void ix_set_new_ptr(immix_gc *me, ref *from, ptr to);
+
+// Stats
+size_t ix_space_used(immix_gc *me);
+void ix_heap_stats(immix_gc *me, gc_stats *stats);
+
+// Interface support
+gc_dispatch *ix_get_dispatch_table();
+
+#endif
@@ -0,0 +1,59 @@
+#include <assert.h>
+#include "collectors/large-objects.h"
+
+large_object_space *
+los_init() {
+    large_object_space *me = malloc(sizeof(large_object_space));
+    me->objects = v_init(16);
+    me->mark_stack = v_init(16);
+    me->size = 0;
+    me->allocated = 0;
+    return me;
+}
+
+static void
+los_unmap(ptr p) {
+    heap_unreserve(p, ALIGN(LOS_GET_SIZE(p), HEAP_PAGE_SIZE));
+}
+
+void
+los_free(large_object_space *me) {
+    for (size_t i = 0; i < me->objects->used; i++) {
+        los_unmap(me->objects->array[i]);
+    }
+    v_free(me->objects);
+    v_free(me->mark_stack);
+    free(me);
+}
+
+ptr
+los_allot(large_object_space *me, int type, size_t n_bytes) {
+    if (n_bytes > 0xffffffff) {
+        error("Can't allocate %lu bytes!\n", n_bytes);
+    }
+    ptr p = heap_reserve(ALIGN(n_bytes, HEAP_PAGE_SIZE));
+    AT(p) = ((ptr)n_bytes << 32) | (type << 1);
+    v_add(me->objects, p);
+    me->size += n_bytes;
+    me->allocated += n_bytes;
+    return p;
+}
+
+void
+los_sweep(large_object_space *me) {
+    assert(me->mark_stack->used == 0);
+    ptr *objects = me->objects->array;
+    size_t n = 0;
+    for (size_t i = 0; i < me->objects->used; i++) {
+        ptr p = objects[i];
+        if (P_GET_MARK(p)) {
+            P_UNMARK(p);
+            objects[n++] = p;
+        } else {
+            me->size -= LOS_GET_SIZE(p);
+            los_unmap(p);
+        }
+    }
+    me->objects->used = n;
+    me->allocated = 0;
+}
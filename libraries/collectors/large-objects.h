@@ -0,0 +1,44 @@
+#ifndef COLLECTORS_LARGE_OBJECTS_H
+#define COLLECTORS_LARGE_OBJECTS_H
+
+#include <stdbool.h>
+#include "datatypes/vector.h"
+#include "collectors/common.h"
+
+// A space for objects that are too large to move cheaply. Each object
+// gets its own page-aligned memory region and never moves. Collectors
+// mark reachable large objects in place with the mark bit in their
+// headers and call los_sweep afterwards to free the unmarked ones.
+//
+// The object size is kept in the block size field of the header
+// since the array length can't be read once the length int is dead.
+#define LOS_GET_SIZE(p)     (AT(p) >> 32)
+
+typedef struct {
+    vector *objects;
+    // Marked objects whose slots haven't been traced yet.
+    vector *mark_stack;
+    // Bytes in all objects and bytes allocated since the last sweep.
+    size_t size;
+    size_t allocated;
+} large_object_space;
+
+large_object_space *los_init();
+void los_free(large_object_space *me);
+
+ptr los_allot(large_object_space *me, int type, size_t n_bytes);
+
+// Marks the object and pushes it on the mark stack unless it already
+// was marked.
+static inline void
+los_mark(large_object_space *me, ptr p) {
+    if (!P_GET_MARK(p)) {
+        P_MARK(p);
+        v_add(me->mark_stack, p);
+    }
+}
+
+// Frees all unmarked objects and unmarks the marked ones.
+void los_sweep(large_object_space *me);
+
+#endif
@@ -0,0 +1,184 @@
+// Sliding mark & compact, using the LISP2 algorithm.
+//
+// Objects are bump allocated. When the heap is full, the live objects
+// are marked like in mark & sweep and then slid towards the start of
+// the heap, preserving their order. Unlike mark & sweep the heap
+// never fragments and unlike copying the whole heap is usable.
+//
+// Compaction takes three passes over the heap:
+//
+//   1. Each live object gets a forwarding address which is the sum
+//      of the sizes of all live objects before it.
+//   2. All roots and slots are updated with the forwarding addresses
+//      of the objects they point to.
+//   3. The objects are moved to their forwarding addresses.
+//
+// The forwarding address is stored as a word offset in the upper 32
+// bits of the header, where quick fit stores the block size. The
+// object size is stored in words in the bits normally used for the
+// ref count and color. That way, the heap can be traversed without
+// looking at array counts, which might already have been moved in
+// pass 3.
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "collectors/common.h"
+#include "collectors/mark-compact.h"
+#include "collectors/mark-sweep.h"
+
+#define MC_SIZE_BITS            27
+#define MC_GET_SIZE(p)          NPTRS(P_GET(p, 5, MC_SIZE_BITS))
+#define MC_GET_FORWARD(me, p)   ((me)->start + NPTRS(AT(p) >> 32))
+#define MC_SET_FORWARD(me, p, to)                                   \
+    AT(p) = (AT(p) & 0xffffffff) |                                  \
+        (((to) - (me)->start) / sizeof(ptr)) << 32
+
+mark_compact_gc *
+mc_init(ptr start, size_t size) {
+    // Forwarding addresses must fit in 32 bits.
+    assert(size / sizeof(ptr) <= 0xffffffff);
+    mark_compact_gc *me = malloc(sizeof(mark_compact_gc));
+    me->start = start;
+    me->end = start + size;
+    me->here = start;
+    me->mark_stack = v_init(16);
+    return me;
+}
+
+void
+mc_free(mark_compact_gc *me) {
+    v_free(me->mark_stack);
+    free(me);
+}
+
+static void
+mc_compute_forwards(mark_compact_gc *me) {
+    ptr top = me->start;
+    for (ptr p = me->start; p < me->here; p += MC_GET_SIZE(p)) {
+        if (P_GET_MARK(p)) {
+            MC_SET_FORWARD(me, p, top);
+            top += MC_GET_SIZE(p);
+        }
+    }
+}
+
+static inline void
+mc_forward_slots(mark_compact_gc *me, ref *base, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        ptr p = REF_DECODE(base[i]);
+        if (P_OBJ_P(p)) {
+            base[i] = REF_ENCODE(MC_GET_FORWARD(me, p));
+        }
+    }
+}
+
+static void
+mc_update_refs(mark_compact_gc *me, vector *roots) {
+    for (size_t i = 0; i < roots->used; i++) {
+        ptr p = roots->array[i];
+        if (P_OBJ_P(p)) {
+            roots->array[i] = MC_GET_FORWARD(me, p);
+        }
+    }
+    for (ptr p = me->start; p < me->here; p += MC_GET_SIZE(p)) {
+        if (P_GET_MARK(p)) {
+            mc_forward_slots(me, SLOT_P(p, 0), p_slot_count(p));
+        }
+    }
+}
+
+static void
+mc_slide(mark_compact_gc *me) {
+    ptr p = me->start;
+    ptr top = me->start;
+    while (p < me->here) {
+        size_t size = MC_GET_SIZE(p);
+        if (P_GET_MARK(p)) {
+            top = MC_GET_FORWARD(me, p);
+            // Clears the mark bit and the forwarding address.
+            AT(p) &= 0xfffffffe;
+            memmove((void *)top, (void *)p, size);
+            top += size;
+        }
+        p += size;
+    }
+    me->here = top;
+}
+
+void
+mc_collect(mark_compact_gc *me, vector *roots) {
+    ms_mark(me->mark_stack, roots);
+    mc_compute_forwards(me);
+    mc_update_refs(me, roots);
+    mc_slide(me);
+}
+
+bool
+mc_can_allot_p(mark_compact_gc *me, size_t size) {
+    return me->here + size <= me->end;
+}
+
+ptr
+mc_do_allot(mark_compact_gc *me, int type, size_t size) {
+    size_t n_words = size / sizeof(ptr);
+    assert(n_words < (1L << MC_SIZE_BITS));
+    ptr p = me->here;
+    me->here += size;
+    AT(p) = n_words << 5 | type << 1;
+    return p;
+}
+
+size_t
+mc_space_used(mark_compact_gc *me) {
+    return me->here - me->start;
+}
+
+void
+mc_heap_stats(mark_compact_gc *me, gc_stats *stats) {
+    gs_set_free_space(stats, me->end - me->here);
+}
+
+bool
+mc_resize(mark_compact_gc *me, size_t size) {
+    ptr end = me->start + size;
+    if (me->here > end) {
+        return false;
+    }
+    heap_release(end, me->end);
+    me->end = end;
+    return true;
+}
+
+void
+mc_set_ptr(mark_compact_gc *me, ref *from, ptr to) {
+    *from = REF_ENCODE(to);
+}
+
+void
+mc_set_new_ptr(mark_compact_gc *me, ref *from, ptr to) {
+    *from = REF_ENCODE(to);
+}
+
+static gc_dispatch
+table = {
+    (gc_func_init)mc_init,
+    (gc_func_free)mc_free,
+    (gc_func_can_allot_p)mc_can_allot_p,
+    (gc_func_collect)mc_collect,
+    (gc_func_do_allot)mc_do_allot,
+    (gc_func_set_ptr)mc_set_ptr,
+    (gc_func_set_ptr)mc_set_new_ptr,
+    NULL,
+    NULL,
+    (gc_func_space_used)mc_space_used,
+    (gc_func_heap_stats)mc_heap_stats,
+    (gc_func_resize)mc_resize,
+    NULL,
+    NULL
+};
+
+gc_dispatch *
+mc_get_dispatch_table() {
+    return &table;
+}
@@ -0,0 +1,38 @@
+#ifndef MARK_COMPACT_H
+#define MARK_COMPACT_H
+
+#include <stdbool.h>
+#include "datatypes/vector.h"
+#include "collectors/common.h"
+
+typedef struct {
+    ptr start;
+    ptr end;
+    ptr here;
+    vector *mark_stack;
+} mark_compact_gc;
+
+// Init, free
+mark_compact_gc *mc_init(ptr start, size_t size);
+void mc_free(mark_compact_gc *me);
+
+// Allocation
+bool mc_can_allot_p(mark_compact_gc *me, size_t size);
+void mc_collect(mark_compact_gc *me, vector *roots);
+ptr mc_do_allot(mark_compact_gc *me, int type, size_t size);
+
+// To facilitate barriers and refcounting.
+void mc_set_ptr(mark_compact_gc *me, ref *from, ptr to);
+void mc_set_new_ptr(mark_compact_gc *me, ref *from, ptr to);
+
+// Stats
+size_t mc_space_used(mark_compact_gc *me);
+void mc_heap_stats(mark_compact_gc *me, gc_stats *stats);
+
+// Heap resizing
+bool mc_resize(mark_compact_gc *me, size_t size);
+
+// Interface support
+gc_dispatch *mc_get_dispatch_table();
+
+#endif
@@ -6,6 +6,7 @@
 #include "datatypes/bitarray.h"
 #include "collectors/common.h"
 #include "collectors/mark-sweep-bits.h"
+#include "threads/threads.h"
 
 mark_sweep_bits_gc *
 msb_init(ptr start, size_t size) {
@@ -13,11 +14,46 @@ msb_init(ptr start, size_t size) {
     me->mark_stack = v_init(16);
     me->qf = qf_init(start, size);
     me->ba = ba_init((int)(size / QF_DATA_ALIGNMENT));
+    me->max_size = size;
+    me->pm = NULL;
+    me->lazy = false;
+    me->sweep_bit = me->ba->n_bits;
+    me->unswept_free = 0;
+    me->prefetch = false;
     return me;
 }
 
+mark_sweep_bits_gc *
+msb_init_lazy(ptr start, size_t size) {
+    mark_sweep_bits_gc *me = msb_init(start, size);
+    me->lazy = true;
+    return me;
+}
+
+mark_sweep_bits_gc *
+msb_init_prefetch(ptr start, size_t size) {
+    mark_sweep_bits_gc *me = msb_init(start, size);
+    me->prefetch = true;
+    return me;
+}
+
+mark_sweep_bits_gc *
+msb_init_parallel(ptr start, size_t size, size_t n_threads) {
+    mark_sweep_bits_gc *me = msb_init(start, size);
+    me->pm = pm_init(n_threads, me->ba, start);
+    return me;
+}
+
+static mark_sweep_bits_gc *
+msb_init_all_cores(ptr start, size_t size) {
+    return msb_init_parallel(start, size, thr_n_cores());
+}
+
 void
 msb_free(mark_sweep_bits_gc* me) {
+    if (me->pm) {
+        pm_free(me->pm);
+    }
     v_free(me->mark_stack);
     qf_free(me->qf);
     ba_free(me->ba);
@@ -47,13 +83,12 @@ msb_mark_step(mark_sweep_bits_gc *me, vector *v, ptr p) {
     }
 }
 
-void
-msb_collect(mark_sweep_bits_gc *me, vector *roots) {
-    ba_clear(me->ba);
+static void
+msb_mark(mark_sweep_bits_gc *me, vector *roots) {
     vector *v = me->mark_stack;
     for (size_t i = 0; i < roots->used; i++) {
         ptr p = roots->array[i];
-        if (p) {
+        if (P_OBJ_P(p)) {
             msb_mark_step(me, v, p);
         }
     }
@@ -61,7 +96,68 @@ msb_collect(mark_sweep_bits_gc *me, vector *roots) {
         ptr p = v_remove(v);
         P_FOR_EACH_CHILD(p, { msb_mark_step(me, v, p_child); });
     }
+}
+
+// Only the first mark bit of an object is set when it is pushed so
+// that the object itself isn't touched until it has been prefetched.
+// The rest are set when it is scanned.
+static inline void
+msb_mark_step_prefetch(mark_sweep_bits_gc *me, vector *v, ptr p) {
+    int bit_addr = msb_address_to_bit(me, p);
+    if (!ba_get_bit(me->ba, bit_addr)) {
+        ba_set_bit(me->ba, bit_addr);
+        v_add(v, p);
+    }
+}
+
+static void
+msb_mark_prefetch(mark_sweep_bits_gc *me, vector *roots) {
+    vector *v = me->mark_stack;
+    for (size_t i = 0; i < roots->used; i++) {
+        ptr p = roots->array[i];
+        if (P_OBJ_P(p)) {
+            msb_mark_step_prefetch(me, v, p);
+        }
+    }
+    ptr fifo[MSB_PREFETCH_DISTANCE];
+    size_t head = 0;
+    size_t n = 0;
+    while (v->used || n) {
+        while (n < MSB_PREFETCH_DISTANCE && v->used) {
+            ptr p = v_remove(v);
+            __builtin_prefetch((void *)p, 0);
+            fifo[(head + n) % MSB_PREFETCH_DISTANCE] = p;
+            n++;
+        }
+        ptr p = fifo[head];
+        head = (head + 1) % MSB_PREFETCH_DISTANCE;
+        n--;
+        int n_bits = (int)(QF_GET_BLOCK_SIZE(p) / QF_DATA_ALIGNMENT);
+        ba_set_bit_range(me->ba, msb_address_to_bit(me, p), n_bits);
+        P_FOR_EACH_CHILD(p, { msb_mark_step_prefetch(me, v, p_child); });
+    }
+}
+
+void
+msb_collect(mark_sweep_bits_gc *me, vector *roots) {
+    ba_clear(me->ba);
+    if (me->pm) {
+        pm_mark(me->pm, roots);
+    } else if (me->prefetch) {
+        msb_mark_prefetch(me, roots);
+    } else {
+        msb_mark(me, roots);
+    }
     qf_clear(me->qf);
+    if (me->lazy) {
+        // Nothing is swept yet. Objects allocated from now on are
+        // only placed in swept ranges so their missing mark bits
+        // don't matter.
+        size_t live = ba_bitsum(me->ba) * QF_DATA_ALIGNMENT;
+        me->sweep_bit = 0;
+        me->unswept_free = me->qf->size - live;
+        return;
+    }
     BA_EACH_UNSET_RANGE(me->ba, {
         ptr free_start = msb_bit_to_address(me, addr);
         size_t free_size = size * QF_DATA_ALIGNMENT;
@@ -69,32 +165,100 @@ msb_collect(mark_sweep_bits_gc *me, vector *roots) {
     });
 }
 
+// Frees the next unmarked range after where the last sweep stopped.
+static void
+msb_lazy_sweep_step(mark_sweep_bits_gc *me) {
+    bitarray *ba = me->ba;
+    int addr = ba_next_unset_bit(ba, me->sweep_bit);
+    int next = ba_next_set_bit(ba, addr);
+    size_t free_size = (next - addr) * QF_DATA_ALIGNMENT;
+    qf_free_block(me->qf, msb_bit_to_address(me, addr), free_size);
+    me->unswept_free -= free_size;
+    me->sweep_bit = next;
+}
+
+// Frees unmarked ranges of the heap, starting from where the last
+// sweep stopped, until a block of the given size can be allocated.
+// Returns false if the whole heap is swept and that still isn't
+// possible.
+static bool
+msb_lazy_sweep(mark_sweep_bits_gc *me, size_t size) {
+    while (!qf_can_allot_p(me->qf, size)) {
+        if (!me->unswept_free) {
+            me->sweep_bit = me->ba->n_bits;
+            return false;
+        }
+        msb_lazy_sweep_step(me);
+    }
+    return true;
+}
+
 bool
 msb_can_allot_p(mark_sweep_bits_gc *me, size_t size) {
-    return qf_can_allot_p(me->qf, size);
+    if (qf_can_allot_p(me->qf, size)) {
+        return true;
+    }
+    return me->lazy && msb_lazy_sweep(me, size);
 }
 
 ptr
 msb_do_allot(mark_sweep_bits_gc *me, int type, size_t size) {
     // Allot and record address.
     ptr p = qf_allot_block(me->qf, size);
+    if (!p && me->lazy && msb_lazy_sweep(me, size)) {
+        p = qf_allot_block(me->qf, size);
+    }
     P_SET_TYPE(p, type);
     return p;
 }
 
 size_t
 msb_space_used(mark_sweep_bits_gc *me) {
-    return qf_space_used(me->qf);
+    return qf_space_used(me->qf) - me->unswept_free;
 }
 
 void
-msb_set_ptr(mark_sweep_bits_gc *ms, ptr *from, ptr to) {
-    *from = to;
+msb_heap_stats(mark_sweep_bits_gc *me, gc_stats *stats) {
+    gs_set_quick_fit(stats, me->qf);
+    stats->free_space += me->unswept_free;
+}
+
+// The mark bits cover max_size bytes, but only the bits of the part
+// in use are cleared and swept. Unswept ranges have no free block
+// headers so lazy sweeping is finished first.
+bool
+msb_resize(mark_sweep_bits_gc *me, size_t size) {
+    if (size > me->max_size ||
+        size % (QF_DATA_ALIGNMENT * BA_WORD_BITS)) {
+        return false;
+    }
+    while (me->unswept_free) {
+        msb_lazy_sweep_step(me);
+    }
+    ptr end = me->qf->start + me->qf->size;
+    if (!qf_resize(me->qf, size)) {
+        return false;
+    }
+    heap_release(me->qf->start + me->qf->size, end);
+    me->ba->n_bits = (int)(size / QF_DATA_ALIGNMENT);
+    me->ba->n_words = me->ba->n_bits / BA_WORD_BITS;
+    me->sweep_bit = me->ba->n_bits;
+    return true;
+}
+
+bool
+msb_load_image(mark_sweep_bits_gc *me, size_t n_bytes) {
+    return qf_adopt_blocks(me->qf, n_bytes);
+}
+
+void
+msb_set_ptr(mark_sweep_bits_gc *ms, ref *from, ptr to) {
+    *from = REF_ENCODE(to);
 }
 
 void
-msb_set_new_ptr(mark_sweep_bits_gc *ms, ptr *from, ptr to) {
-    *from = to;
+msb_set_new_ptr(mark_sweep_bits_gc *ms, ref *from, ptr to) {
+    *from = REF_ENCODE(to);
 }
 
 static gc_dispatch
@@ -106,10 +270,85 @@ table = {
     (gc_func_do_allot)msb_do_allot,
     (gc_func_set_ptr)msb_set_ptr,
     (gc_func_set_ptr)msb_set_new_ptr,
-    (gc_func_space_used)msb_space_used
+    NULL,
+    NULL,
+    (gc_func_space_used)msb_space_used,
+    (gc_func_heap_stats)msb_heap_stats,
+    (gc_func_resize)msb_resize,
+    NULL,
+    (gc_func_load_image)msb_load_image
 };
 
 gc_dispatch *
 msb_get_dispatch_table() {
     return &table;
 }
+
+static gc_dispatch
+table_parallel = {
+    (gc_func_init)msb_init_all_cores,
+    (gc_func_free)msb_free,
+    (gc_func_can_allot_p)msb_can_allot_p,
+    (gc_func_collect)msb_collect,
+    (gc_func_do_allot)msb_do_allot,
+    (gc_func_set_ptr)msb_set_ptr,
+    (gc_func_set_ptr)msb_set_new_ptr,
+    NULL,
+    NULL,
+    (gc_func_space_used)msb_space_used,
+    (gc_func_heap_stats)msb_heap_stats,
+    (gc_func_resize)msb_resize,
+    NULL,
+    (gc_func_load_image)msb_load_image
+};
+
+gc_dispatch *
+msb_get_dispatch_table_parallel() {
+    return &table_parallel;
+}
+
+static gc_dispatch
+table_lazy = {
+    (gc_func_init)msb_init_lazy,
+    (gc_func_free)msb_free,
+    (gc_func_can_allot_p)msb_can_allot_p,
+    (gc_func_collect)msb_collect,
+    (gc_func_do_allot)msb_do_allot,
+    (gc_func_set_ptr)msb_set_ptr,
+    (gc_func_set_ptr)msb_set_new_ptr,
+    NULL,
+    NULL,
+    (gc_func_space_used)msb_space_used,
+    (gc_func_heap_stats)msb_heap_stats,
+    (gc_func_resize)msb_resize,
+    NULL,
+    (gc_func_load_image)msb_load_image
+};
+
+gc_dispatch *
+msb_get_dispatch_table_lazy() {
+    return &table_lazy;
+}
+
+static gc_dispatch
+table_prefetch = {
+    (gc_func_init)msb_init_prefetch,
+    (gc_func_free)msb_free,
+    (gc_func_can_allot_p)msb_can_allot_p,
+    (gc_func_collect)msb_collect,
+    (gc_func_do_allot)msb_do_allot,
+    (gc_func_set_ptr)msb_set_ptr,
+    (gc_func_set_ptr)msb_set_new_ptr,
+    NULL,
+    NULL,
+    (gc_func_space_used)msb_space_used,
+    (gc_func_heap_stats)msb_heap_stats,
+    (gc_func_resize)msb_resize,
+    NULL,
+    (gc_func_load_image)msb_load_image
+};
+
+gc_dispatch *
+msb_get_dispatch_table_prefetch() {
+    return &table_prefetch;
+}
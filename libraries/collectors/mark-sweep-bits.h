@@ -6,18 +6,40 @@
 #include "datatypes/vector.h"
 #include "quickfit/quickfit.h"
 #include "collectors/common.h"
+#include "collectors/parallel-mark.h"
 
 // The reason this is a separate collector is because it appears that
 // using in-object mark bits can be faster.
 
+// Number of objects between the mark stack and the scanner in
+// prefetching mode.
+#define MSB_PREFETCH_DISTANCE 8
+
 typedef struct {
     vector *mark_stack;
     quick_fit *qf;
     bitarray *ba;
+    // Size of the heap the mark bits were allocated for.
+    size_t max_size;
+    // Only set if parallel marking is enabled.
+    parallel_marker *pm;
+    // In lazy mode, the heap is swept on demand during allocation.
+    // sweep_bit is where the next sweep starts and unswept_free the
+    // number of free bytes after it.
+    bool lazy;
+    int sweep_bit;
+    size_t unswept_free;
+    // In prefetch mode, objects popped from the mark stack are
+    // prefetched and scanned MSB_PREFETCH_DISTANCE objects later.
+    bool prefetch;
 } mark_sweep_bits_gc;
 
 // Init, free
 mark_sweep_bits_gc *msb_init(ptr start, size_t size);
+mark_sweep_bits_gc *msb_init_parallel(ptr start, size_t size,
+                                      size_t n_threads);
+mark_sweep_bits_gc *msb_init_lazy(ptr start, size_t size);
+mark_sweep_bits_gc *msb_init_prefetch(ptr start, size_t size);
 void msb_free(mark_sweep_bits_gc *ms);
 
 // Allocation
@@ -25,9 +47,24 @@ bool msb_can_allot_p(mark_sweep_bits_gc *me, size_t size);
 void msb_collect(mark_sweep_bits_gc *me, vector *roots);
 ptr msb_do_allot(mark_sweep_bits_gc *me, int type, size_t size);
 
+// Stats
+size_t msb_space_used(mark_sweep_bits_gc *me);
+void msb_heap_stats(mark_sweep_bits_gc *me, gc_stats *stats);
+
+// Heap resizing
+bool msb_resize(mark_sweep_bits_gc *me, size_t size);
+
+// Heap images
+bool msb_load_image(mark_sweep_bits_gc *me, size_t n_bytes);
 
 // Interface support
 gc_dispatch *msb_get_dispatch_table();
+// Marks in parallel using all cores.
+gc_dispatch *msb_get_dispatch_table_parallel();
+// Sweeps lazily during allocation.
+gc_dispatch *msb_get_dispatch_table_lazy();
+// Marks with prefetching.
+gc_dispatch *msb_get_dispatch_table_prefetch();
 
 
 #endif
@@ -0,0 +1,247 @@
+// Incremental mark & sweep.
+//
+// Instead of marking the whole heap in one go, marking is spread out
+// over the allocations. When the heap starts to fill up, a marking
+// cycle is started by graying the roots. Then every allocation scans
+// work_ratio bytes of gray objects per allocated byte. When no gray
+// objects remain, the heap is swept.
+//
+// Since the mutator runs while the heap is being marked, it could
+// hide a white object by storing it in an already scanned object and
+// deleting the last reference to it from an unscanned one. To
+// prevent that, msi_set_ptr implements Yuasa's deletion barrier: the
+// overwritten pointer is grayed. Therefore all objects reachable
+// when the cycle started are marked. Objects allocated during
+// marking are allocated black.
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "collectors/common.h"
+#include "collectors/mark-sweep-inc.h"
+
+mark_sweep_inc_gc *
+msi_init_with_ratio(ptr start, size_t size, double work_ratio) {
+    mark_sweep_inc_gc *me = malloc(sizeof(mark_sweep_inc_gc));
+    me->ms = ms_init(start, size);
+    me->marking = false;
+    me->cycle_requested = false;
+    me->work_ratio = work_ratio;
+    me->budget = 0;
+    me->scan_p = 0;
+    msi_reset_stats(me);
+    return me;
+}
+
+mark_sweep_inc_gc *
+msi_init(ptr start, size_t size) {
+    return msi_init_with_ratio(start, size, MSI_DEFAULT_WORK_RATIO);
+}
+
+void
+msi_free(mark_sweep_inc_gc *me) {
+    ms_free(me->ms);
+    free(me);
+}
+
+void
+msi_reset_stats(mark_sweep_inc_gc *me) {
+    me->n_cycles = 0;
+    me->n_slices = 0;
+    me->max_slice_pause = 0;
+    me->max_sweep_pause = 0;
+}
+
+static inline void
+msi_shade(mark_sweep_inc_gc *me, ptr p) {
+    if (P_OBJ_P(p) && !P_GET_MARK(p)) {
+        P_MARK(p);
+        v_add(me->ms->mark_stack, p);
+    }
+}
+
+static void
+msi_start_cycle(mark_sweep_inc_gc *me, vector *roots) {
+    assert(!me->marking);
+    for (size_t i = 0; i < roots->used; i++) {
+        msi_shade(me, roots->array[i]);
+    }
+    me->marking = true;
+    me->budget = 0;
+    me->scan_p = 0;
+    me->n_cycles++;
+}
+
+// Scans gray objects until the budget is spent. Returns true if
+// there are no gray objects left. Large arrays are scanned over
+// several slices so that the pause is bounded by the budget rather
+// than by the size of the largest object.
+static bool
+msi_mark_slice(mark_sweep_inc_gc *me) {
+    vector *v = me->ms->mark_stack;
+    while (me->budget > 0) {
+        if (!me->scan_p) {
+            if (!v->used) {
+                break;
+            }
+            me->scan_p = v_remove(v);
+            me->scan_i = 0;
+            me->budget -= NPTRS(1);
+        }
+        ptr p = me->scan_p;
+        size_t n = p_slot_count(p);
+        size_t end = n;
+        if (me->budget < NPTRS(n - me->scan_i)) {
+            end = me->scan_i + (size_t)(me->budget / NPTRS(1)) + 1;
+        }
+        for (size_t i = me->scan_i; i < end; i++) {
+            msi_shade(me, P_GET_SLOT(p, i));
+        }
+        me->budget -= NPTRS(end - me->scan_i);
+        me->scan_i = end;
+        if (end == n) {
+            me->scan_p = 0;
+        }
+    }
+    return !me->scan_p && !v->used;
+}
+
+static void
+msi_finish_cycle(mark_sweep_inc_gc *me) {
+    uint64_t start = nano_count();
+    ms_sweep(me->ms);
+    uint64_t pause = nano_count() - start;
+    me->max_sweep_pause = MAX(me->max_sweep_pause, pause);
+    me->marking = false;
+    me->budget = 0;
+}
+
+static void
+msi_full_cycle(mark_sweep_inc_gc *me, vector *roots) {
+    if (!me->marking) {
+        msi_start_cycle(me, roots);
+    }
+    me->budget = INFINITY;
+    msi_mark_slice(me);
+    msi_finish_cycle(me);
+}
+
+// If the collection was requested by msi_can_allot_p a new marking
+// cycle is started. Otherwise the heap is full or the collection is
+// forced so the current cycle, if any, is finished and a full one is
+// run to get rid of the floating garbage.
+void
+msi_collect(mark_sweep_inc_gc *me, vector *roots) {
+    if (me->cycle_requested) {
+        me->cycle_requested = false;
+        msi_start_cycle(me, roots);
+        return;
+    }
+    if (me->marking) {
+        msi_full_cycle(me, roots);
+    }
+    msi_full_cycle(me, roots);
+}
+
+bool
+msi_can_allot_p(mark_sweep_inc_gc *me, size_t size) {
+    quick_fit *qf = me->ms->qf;
+    bool ok = qf_can_allot_p(qf, size);
+    if (ok && !me->marking &&
+        qf->free_space < qf->size / MSI_TRIGGER_RATIO) {
+        me->cycle_requested = true;
+        return false;
+    }
+    return ok;
+}
+
+ptr
+msi_do_allot(mark_sweep_inc_gc *me, int type, size_t size) {
+    if (me->marking) {
+        uint64_t start = nano_count();
+        me->budget += size * me->work_ratio;
+        bool done = msi_mark_slice(me);
+        uint64_t pause = nano_count() - start;
+        me->max_slice_pause = MAX(me->max_slice_pause, pause);
+        me->n_slices++;
+        if (done) {
+            msi_finish_cycle(me);
+        }
+    }
+    ptr p = ms_do_allot(me->ms, type, size);
+    if (me->marking) {
+        P_MARK(p);
+    }
+    return p;
+}
+
+size_t
+msi_space_used(mark_sweep_inc_gc *me) {
+    return ms_space_used(me->ms);
+}
+
+void
+msi_heap_stats(mark_sweep_inc_gc *me, gc_stats *stats) {
+    ms_heap_stats(me->ms, stats);
+}
+
+void
+msi_set_ptr(mark_sweep_inc_gc *me, ref *from, ptr to) {
+    if (me->marking) {
+        msi_shade(me, REF_DECODE(*from));
+    }
+    *from = REF_ENCODE(to);
+}
+
+// The slots of new objects are either uninitialized or null, so
+// there is nothing to shade.
+void
+msi_set_new_ptr(mark_sweep_inc_gc *me, ref *from, ptr to) {
+    *from = REF_ENCODE(to);
+}
+
+void
+msi_fill_ptrs(mark_sweep_inc_gc *me, ref *from, size_t n, ptr to) {
+    if (me->marking) {
+        for (size_t i = 0; i < n; i++) {
+            msi_shade(me, REF_DECODE(from[i]));
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        from[i] = REF_ENCODE(to);
+    }
+}
+
+void
+msi_copy_ptrs(mark_sweep_inc_gc *me, ref *from, ref *src, size_t n) {
+    if (me->marking) {
+        for (size_t i = 0; i < n; i++) {
+            msi_shade(me, REF_DECODE(from[i]));
+        }
+    }
+    memmove(from, src, n * sizeof(ref));
+}
+
+static gc_dispatch
+table = {
+    (gc_func_init)msi_init,
+    (gc_func_free)msi_free,
+    (gc_func_can_allot_p)msi_can_allot_p,
+    (gc_func_collect)msi_collect,
+    (gc_func_do_allot)msi_do_allot,
+    (gc_func_set_ptr)msi_set_ptr,
+    (gc_func_set_ptr)msi_set_new_ptr,
+    (gc_func_fill_ptrs)msi_fill_ptrs,
+    (gc_func_copy_ptrs)msi_copy_ptrs,
+    (gc_func_space_used)msi_space_used,
+    (gc_func_heap_stats)msi_heap_stats,
+    NULL,
+    NULL,
+    NULL
+};
+
+gc_dispatch *
+msi_get_dispatch_table() {
+    return &table;
+}
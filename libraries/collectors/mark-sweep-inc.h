@@ -0,0 +1,61 @@
+#ifndef MARK_SWEEP_INC_H
+#define MARK_SWEEP_INC_H
+
+#include <stdbool.h>
+#include "datatypes/vector.h"
+#include "collectors/common.h"
+#include "collectors/mark-sweep.h"
+
+// Bytes of objects scanned per allocated byte during marking.
+#define MSI_DEFAULT_WORK_RATIO 2.0
+
+// A marking cycle is started when less than 1/MSI_TRIGGER_RATIO of
+// the heap is free.
+#define MSI_TRIGGER_RATIO 2
+
+typedef struct {
+    mark_sweep_gc *ms;
+    bool marking;
+    // Set when the last allocation failed because a marking cycle
+    // should be started.
+    bool cycle_requested;
+    double work_ratio;
+    // Bytes of scanning work the next slice should perform.
+    double budget;
+    // Object being scanned and the index of its next slot to scan.
+    ptr scan_p;
+    size_t scan_i;
+
+    // Stats. Pauses are in nanoseconds.
+    size_t n_cycles;
+    size_t n_slices;
+    uint64_t max_slice_pause;
+    uint64_t max_sweep_pause;
+} mark_sweep_inc_gc;
+
+// Init, free
+mark_sweep_inc_gc *msi_init(ptr start, size_t size);
+mark_sweep_inc_gc *msi_init_with_ratio(ptr start, size_t size,
+                                       double work_ratio);
+void msi_free(mark_sweep_inc_gc *me);
+
+// Allocation
+bool msi_can_allot_p(mark_sweep_inc_gc *me, size_t size);
+void msi_collect(mark_sweep_inc_gc *me, vector *roots);
+ptr msi_do_allot(mark_sweep_inc_gc *me, int type, size_t size);
+
+// Snapshot-at-the-beginning barrier
+void msi_set_ptr(mark_sweep_inc_gc *me, ref *from, ptr to);
+void msi_set_new_ptr(mark_sweep_inc_gc *me, ref *from, ptr to);
+void msi_fill_ptrs(mark_sweep_inc_gc *me, ref *from, size_t n, ptr to);
+void msi_copy_ptrs(mark_sweep_inc_gc *me, ref *from, ref *src, size_t n);
+
+// Stats
+size_t msi_space_used(mark_sweep_inc_gc *me);
+void msi_heap_stats(mark_sweep_inc_gc *me, gc_stats *stats);
+void msi_reset_stats(mark_sweep_inc_gc *me);
+
+// Interface support
+gc_dispatch *msi_get_dispatch_table();
+
+#endif
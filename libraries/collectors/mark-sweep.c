@@ -5,17 +5,42 @@
 #include <string.h>
 #include "collectors/common.h"
 #include "collectors/mark-sweep.h"
+#include "threads/threads.h"
 
 mark_sweep_gc *
 ms_init(ptr start, size_t size) {
     mark_sweep_gc *me = malloc(sizeof(mark_sweep_gc));
     me->mark_stack = v_init(16);
     me->qf = qf_init(start, size);
+    me->pm = NULL;
+    me->prefetch = false;
     return me;
 }
 
+mark_sweep_gc *
+ms_init_prefetch(ptr start, size_t size) {
+    mark_sweep_gc *me = ms_init(start, size);
+    me->prefetch = true;
+    return me;
+}
+
+mark_sweep_gc *
+ms_init_parallel(ptr start, size_t size, size_t n_threads) {
+    mark_sweep_gc *me = ms_init(start, size);
+    me->pm = pm_init(n_threads, NULL, 0);
+    return me;
+}
+
+static mark_sweep_gc *
+ms_init_all_cores(ptr start, size_t size) {
+    return ms_init_parallel(start, size, thr_n_cores());
+}
+
 void
 ms_free(mark_sweep_gc* me) {
+    if (me->pm) {
+        pm_free(me->pm);
+    }
     v_free(me->mark_stack);
     qf_free(me->qf);
     free(me);
@@ -31,14 +56,14 @@ mark_step(vector *v, ptr p) {
 }
 
 void
-ms_collect(mark_sweep_gc *me, vector *roots) {
+ms_mark(vector *mark_stack, vector *roots) {
     // Initally, the white set contains all objects, the black and
     // grey sets are empty.
-    vector *v = me->mark_stack;
+    vector *v = mark_stack;
     // First all root object are added to the gray set.
     for (size_t i = 0; i < roots->used; i++) {
         ptr p = roots->array[i];
-        if (p) {
+        if (P_OBJ_P(p)) {
             mark_step(v, p);
         }
     }
@@ -48,10 +73,42 @@ ms_collect(mark_sweep_gc *me, vector *roots) {
         ptr p = v_remove(v);
         P_FOR_EACH_CHILD(p, { mark_step(v, p_child); });
     }
+}
+
+void
+ms_mark_prefetch(vector *mark_stack, vector *roots) {
+    vector *v = mark_stack;
+    for (size_t i = 0; i < roots->used; i++) {
+        ptr p = roots->array[i];
+        if (P_OBJ_P(p)) {
+            v_add(v, p);
+        }
+    }
+    ptr fifo[MS_PREFETCH_DISTANCE];
+    size_t head = 0;
+    size_t n = 0;
+    while (v->used || n) {
+        while (n < MS_PREFETCH_DISTANCE && v->used) {
+            ptr p = v_remove(v);
+            __builtin_prefetch((void *)p, 1);
+            fifo[(head + n) % MS_PREFETCH_DISTANCE] = p;
+            n++;
+        }
+        ptr p = fifo[head];
+        head = (head + 1) % MS_PREFETCH_DISTANCE;
+        n--;
+        if (!P_GET_MARK(p)) {
+            P_MARK(p);
+            P_FOR_EACH_CHILD(p, { v_add(v, p_child); });
+        }
+    }
+}
 
-    // When control has reached this point, the gray set is empty and
-    // the whole heap has been divided into black (marked) and white
-    // (condemned) objects.
+// When control has reached this point, the gray set is empty and the
+// whole heap has been divided into black (marked) and white
+// (condemned) objects.
+void
+ms_sweep(mark_sweep_gc *me) {
     qf_clear(me->qf);
 
     ptr iter = me->qf->start;
@@ -76,6 +133,18 @@ ms_collect(mark_sweep_gc *me, vector *roots) {
     }
 }
 
+void
+ms_collect(mark_sweep_gc *me, vector *roots) {
+    if (me->pm) {
+        pm_mark(me->pm, roots);
+    } else if (me->prefetch) {
+        ms_mark_prefetch(me->mark_stack, roots);
+    } else {
+        ms_mark(me->mark_stack, roots);
+    }
+    ms_sweep(me);
+}
+
 bool
 ms_can_allot_p(mark_sweep_gc *me, size_t size) {
     return qf_can_allot_p(me->qf, size);
@@ -95,13 +164,33 @@ ms_space_used(mark_sweep_gc *me) {
 }
 
 void
-ms_set_ptr(mark_sweep_gc *ms, ptr *from, ptr to) {
-    *from = to;
+ms_heap_stats(mark_sweep_gc *me, gc_stats *stats) {
+    gs_set_quick_fit(stats, me->qf);
+}
+
+bool
+ms_resize(mark_sweep_gc *me, size_t size) {
+    ptr end = me->qf->start + me->qf->size;
+    bool ok = qf_resize(me->qf, size);
+    if (ok) {
+        heap_release(me->qf->start + me->qf->size, end);
+    }
+    return ok;
+}
+
+bool
+ms_load_image(mark_sweep_gc *me, size_t n_bytes) {
+    return qf_adopt_blocks(me->qf, n_bytes);
 }
 
 void
-ms_set_new_ptr(mark_sweep_gc *ms, ptr *from, ptr to) {
-    *from = to;
+ms_set_ptr(mark_sweep_gc *ms, ref *from, ptr to) {
+    *from = REF_ENCODE(to);
+}
+
+void
+ms_set_new_ptr(mark_sweep_gc *ms, ref *from, ptr to) {
+    *from = REF_ENCODE(to);
 }
 
 static gc_dispatch
@@ -113,10 +202,62 @@ table = {
     (gc_func_do_allot)ms_do_allot,
     (gc_func_set_ptr)ms_set_ptr,
     (gc_func_set_ptr)ms_set_new_ptr,
-    (gc_func_space_used)ms_space_used
+    NULL,
+    NULL,
+    (gc_func_space_used)ms_space_used,
+    (gc_func_heap_stats)ms_heap_stats,
+    (gc_func_resize)ms_resize,
+    NULL,
+    (gc_func_load_image)ms_load_image
 };
 
 gc_dispatch *
 ms_get_dispatch_table() {
     return &table;
 }
+
+static gc_dispatch
+table_parallel = {
+    (gc_func_init)ms_init_all_cores,
+    (gc_func_free)ms_free,
+    (gc_func_can_allot_p)ms_can_allot_p,
+    (gc_func_collect)ms_collect,
+    (gc_func_do_allot)ms_do_allot,
+    (gc_func_set_ptr)ms_set_ptr,
+    (gc_func_set_ptr)ms_set_new_ptr,
+    NULL,
+    NULL,
+    (gc_func_space_used)ms_space_used,
+    (gc_func_heap_stats)ms_heap_stats,
+    (gc_func_resize)ms_resize,
+    NULL,
+    (gc_func_load_image)ms_load_image
+};
+
+gc_dispatch *
+ms_get_dispatch_table_parallel() {
+    return &table_parallel;
+}
+
+static gc_dispatch
+table_prefetch = {
+    (gc_func_init)ms_init_prefetch,
+    (gc_func_free)ms_free,
+    (gc_func_can_allot_p)ms_can_allot_p,
+    (gc_func_collect)ms_collect,
+    (gc_func_do_allot)ms_do_allot,
+    (gc_func_set_ptr)ms_set_ptr,
+    (gc_func_set_ptr)ms_set_new_ptr,
+    NULL,
+    NULL,
+    (gc_func_space_used)ms_space_used,
+    (gc_func_heap_stats)ms_heap_stats,
+    (gc_func_resize)ms_resize,
+    NULL,
+    (gc_func_load_image)ms_load_image
+};
+
+gc_dispatch *
+ms_get_dispatch_table_prefetch() {
+    return &table_prefetch;
+}
@@ -5,30 +5,73 @@
 #include "datatypes/vector.h"
 #include "quickfit/quickfit.h"
 #include "collectors/common.h"
+#include "collectors/parallel-mark.h"
+
+// Number of objects between the mark stack and the scanner in
+// prefetching mode.
+#define MS_PREFETCH_DISTANCE 8
 
 typedef struct {
     vector *mark_stack;
     quick_fit *qf;
+    // Only set if parallel marking is enabled.
+    parallel_marker *pm;
+    bool prefetch;
 } mark_sweep_gc;
 
 // Init, free
 mark_sweep_gc *ms_init(ptr start, size_t size);
+mark_sweep_gc *ms_init_parallel(ptr start, size_t size, size_t n_threads);
+mark_sweep_gc *ms_init_prefetch(ptr start, size_t size);
 void ms_free(mark_sweep_gc *ms);
 
 // Allocation
 bool ms_can_allot_p(mark_sweep_gc *me, size_t size);
 void ms_collect(mark_sweep_gc *me, vector *roots);
+// Sets the mark bit of all objects reachable from the roots. The
+// mark stack is used as the gray set and is empty afterwards.
+void ms_mark(vector *mark_stack, vector *roots);
+// Same as above, but objects popped from the mark stack are
+// prefetched and pass through a FIFO of MS_PREFETCH_DISTANCE entries
+// before they are marked and scanned. Since checking the mark bit
+// would touch the object, children are pushed unconditionally.
+void ms_mark_prefetch(vector *mark_stack, vector *roots);
+// Frees all unmarked blocks and unmarks the marked ones.
+void ms_sweep(mark_sweep_gc *me);
 ptr ms_do_allot(mark_sweep_gc *me, int type, size_t size);
 
+// Allocation for specialized vms, see collectors/vm-spec.h. Calls
+// quick fit directly and returns 0 if no free block is large enough.
+static inline ptr
+ms_allot_fast(mark_sweep_gc *me, int type, size_t size) {
+    if (!qf_can_allot_p(me->qf, size)) {
+        return 0;
+    }
+    ptr p = qf_allot_block(me->qf, size);
+    P_SET_TYPE(p, type);
+    return p;
+}
+
 // To facilitate barriers and refcounting.
-void ms_set_ptr(mark_sweep_gc *me, ptr *from, ptr to);
-void ms_set_new_ptr(mark_sweep_gc *me, ptr *from, ptr to);
+void ms_set_ptr(mark_sweep_gc *me, ref *from, ptr to);
+void ms_set_new_ptr(mark_sweep_gc *me, ref *from, ptr to);
 
 // Stats
 size_t ms_space_used(mark_sweep_gc *me);
+void ms_heap_stats(mark_sweep_gc *me, gc_stats *stats);
+
+// Heap resizing
+bool ms_resize(mark_sweep_gc *me, size_t size);
+
+// Heap images
+bool ms_load_image(mark_sweep_gc *me, size_t n_bytes);
 
 // Interface support
 gc_dispatch *ms_get_dispatch_table();
+// Marks in parallel using all cores.
+gc_dispatch *ms_get_dispatch_table_parallel();
+// Marks with prefetching.
+gc_dispatch *ms_get_dispatch_table_prefetch();
 
 
 #endif
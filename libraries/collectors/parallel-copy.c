@@ -0,0 +1,278 @@
+// Parallel Cheney copying.
+//
+// Each worker thread copies objects into a private buffer carved
+// from the to-space and scans it Cheney-style: the objects between
+// its scan pointer and its allocation pointer are gray. When the
+// buffer is full, the unscanned part of it is put on a shared list of
+// to-space ranges and a new buffer is carved. A worker also publishes
+// its gray range if other workers are idle. Workers that run out of
+// gray objects scan ranges from the shared list. Copying ends when
+// all workers are idle.
+//
+// Several workers may reach the same object at the same time. Each of
+// them copies it to its own buffer but only the one whose
+// compare-and-swap sets the forwarding pointer in the header wins.
+// The others give back the space they allocated.
+#include <assert.h>
+#include <string.h>
+#include "threads/threads.h"
+#include "collectors/parallel-copy.h"
+
+parallel_copier *
+pc_init(size_t n_threads) {
+    assert(n_threads > 0);
+    parallel_copier *me = malloc(sizeof(parallel_copier));
+    me->n_threads = n_threads;
+    me->workers = malloc(sizeof(pc_worker) * n_threads);
+    for (size_t i = 0; i < n_threads; i++) {
+        me->workers[i].pc = me;
+    }
+    me->ranges = v_init(256);
+    me->n_ranges = 0;
+    me->lock = false;
+    me->waste = 0;
+    return me;
+}
+
+void
+pc_free(parallel_copier *me) {
+    v_free(me->ranges);
+    free(me->workers);
+    free(me);
+}
+
+static inline void
+pc_lock(parallel_copier *me) {
+    while (__atomic_test_and_set(&me->lock, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+static inline void
+pc_unlock(parallel_copier *me) {
+    __atomic_clear(&me->lock, __ATOMIC_RELEASE);
+}
+
+static void
+pc_push_range(parallel_copier *me, ptr start, ptr end) {
+    pc_lock(me);
+    v_add(me->ranges, start);
+    v_add(me->ranges, end);
+    __atomic_store_n(&me->n_ranges, me->ranges->used / 2, __ATOMIC_RELAXED);
+    pc_unlock(me);
+}
+
+static bool
+pc_pop_range(parallel_copier *me, ptr *start, ptr *end) {
+    if (!__atomic_load_n(&me->n_ranges, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    pc_lock(me);
+    bool found = me->ranges->used > 0;
+    if (found) {
+        *end = v_remove(me->ranges);
+        *start = v_remove(me->ranges);
+        __atomic_store_n(&me->n_ranges, me->ranges->used / 2,
+                         __ATOMIC_RELAXED);
+    }
+    pc_unlock(me);
+    return found;
+}
+
+// Carves at least min and at most *size bytes from the to-space. The
+// carved size is stored in *size.
+static ptr
+pc_carve(parallel_copier *me, size_t min, size_t *size) {
+    ptr top = __atomic_load_n(&me->top, __ATOMIC_RELAXED);
+    size_t n;
+    do {
+        n = MIN(*size, (size_t)(me->end - top));
+        if (n < min) {
+            error("Out of to-space!\n");
+        }
+    } while (!__atomic_compare_exchange_n(&me->top, &top, top + n, true,
+                                          __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    *size = n;
+    return top;
+}
+
+static void
+pc_new_buffer(pc_worker *w, size_t min) {
+    parallel_copier *pc = w->pc;
+    if (w->scan < w->here) {
+        pc_push_range(pc, w->scan, w->here);
+    }
+    w->waste += w->end - w->here;
+    // Buffers shrink when the to-space is almost full so that every
+    // worker gets one.
+    ptr top = __atomic_load_n(&pc->top, __ATOMIC_RELAXED);
+    size_t left = (pc->end - top) / (2 * pc->n_threads);
+    size_t size = MAX(MIN(PC_BUFFER_SIZE, ALIGN(left, sizeof(ptr))), min);
+    w->here = pc_carve(pc, min, &size);
+    w->scan = w->here;
+    w->end = w->here + size;
+}
+
+static ptr
+pc_copy_pointer(pc_worker *w, ptr p) {
+    ptr header = __atomic_load_n((ptr *)p, __ATOMIC_ACQUIRE);
+    if (header & 1) {
+        return header & ~1;
+    }
+    // The header may be replaced by a forwarding pointer at any time
+    // so the size is computed from the loaded one.
+    size_t size = p_size_of_type(p, P_HEADER_TYPE(header));
+    bool large = size > PC_BUFFER_SIZE / 4;
+    ptr dst;
+    if (large) {
+        dst = pc_carve(w->pc, size, &size);
+    } else {
+        if (w->here + size > w->end) {
+            pc_new_buffer(w, size);
+        }
+        dst = w->here;
+        w->here += size;
+    }
+    memcpy((void *)dst, (void *)p, size);
+    AT(dst) = header;
+    if (!__atomic_compare_exchange_n((ptr *)p, &header, dst | 1, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // Another worker copied the object first.
+        if (large) {
+            w->waste += size;
+        } else {
+            w->here -= size;
+        }
+        return header & ~1;
+    }
+    if (large) {
+        pc_push_range(w->pc, dst, dst + size);
+    }
+    return dst;
+}
+
+static inline void
+pc_scan_slots(pc_worker *w, ptr p) {
+    size_t n = p_slot_count(p);
+    ref *base = SLOT_P(p, 0);
+    for (size_t i = 0; i < n; i++) {
+        ptr v = REF_DECODE(base[i]);
+        if (P_OBJ_P(v)) {
+            base[i] = REF_ENCODE(pc_copy_pointer(w, v));
+        }
+    }
+}
+
+// The size of an object must be read before its slots are updated
+// since it depends on the array count.
+static void
+pc_scan_range(pc_worker *w, ptr start, ptr end) {
+    while (start < end) {
+        ptr p = start;
+        start += p_size(p);
+        pc_scan_slots(w, p);
+    }
+}
+
+static inline void
+pc_share(pc_worker *w) {
+    parallel_copier *pc = w->pc;
+    if (w->here - w->scan > PC_SHARE_THRESHOLD &&
+        __atomic_load_n(&pc->n_idle, __ATOMIC_RELAXED)) {
+        pc_push_range(pc, w->scan, w->here);
+        w->scan = w->here;
+    }
+}
+
+static void *
+pc_worker_main(void *arg) {
+    pc_worker *w = (pc_worker *)arg;
+    parallel_copier *pc = w->pc;
+    vector *roots = pc->roots;
+    for (size_t i = w - pc->workers; i < roots->used; i += pc->n_threads) {
+        if (P_OBJ_P(roots->array[i])) {
+            roots->array[i] = pc_copy_pointer(w, roots->array[i]);
+        }
+    }
+    while (true) {
+        while (w->scan < w->here) {
+            // Scan is advanced first so that the object isn't
+            // published again if the buffer is retired.
+            ptr p = w->scan;
+            w->scan += p_size(p);
+            pc_scan_slots(w, p);
+            pc_share(w);
+        }
+        ptr start, end;
+        if (pc_pop_range(pc, &start, &end)) {
+            pc_scan_range(w, start, end);
+            continue;
+        }
+        // Same termination protocol as in parallel-mark.c. Ranges are
+        // only published by busy workers so when all workers are idle
+        // there is no more work.
+        __atomic_add_fetch(&pc->n_idle, 1, __ATOMIC_SEQ_CST);
+        while (true) {
+            if (__atomic_load_n(&pc->n_idle, __ATOMIC_SEQ_CST)
+                == pc->n_threads) {
+                return NULL;
+            }
+            if (__atomic_load_n(&pc->n_ranges, __ATOMIC_RELAXED)) {
+                __atomic_sub_fetch(&pc->n_idle, 1, __ATOMIC_SEQ_CST);
+                if (pc_pop_range(pc, &start, &end)) {
+                    pc_scan_range(w, start, end);
+                    break;
+                }
+                __atomic_add_fetch(&pc->n_idle, 1, __ATOMIC_SEQ_CST);
+            }
+            thr_yield();
+        }
+    }
+}
+
+ptr
+pc_copy(parallel_copier *me, vector *roots, ptr start, ptr end) {
+    size_t n_threads = me->n_threads;
+    me->roots = roots;
+    me->top = start;
+    me->end = end;
+    me->n_idle = 0;
+    for (size_t i = 0; i < n_threads; i++) {
+        pc_worker *w = &me->workers[i];
+        w->scan = w->here = w->end = start;
+        w->waste = 0;
+    }
+    if (n_threads == 1) {
+        pc_worker_main(&me->workers[0]);
+    } else {
+        thr_handle handles[n_threads];
+        if (!thr_create_threads(n_threads, handles, sizeof(pc_worker),
+                                me->workers, pc_worker_main)) {
+            error("Failed to create %lu copying threads!\n", n_threads);
+        }
+        if (!thr_wait_for_threads(n_threads, handles)) {
+            error("Failed to join copying threads!\n");
+        }
+    }
+    assert(!me->ranges->used);
+
+    // The unused parts of the buffers at the top of the to-space are
+    // given back. The others are wasted until the next collection.
+    bool retracted = true;
+    while (retracted) {
+        retracted = false;
+        for (size_t i = 0; i < n_threads; i++) {
+            pc_worker *w = &me->workers[i];
+            if (w->end == me->top && w->here != w->end) {
+                me->top = w->end = w->here;
+                retracted = true;
+            }
+        }
+    }
+    me->waste = 0;
+    for (size_t i = 0; i < n_threads; i++) {
+        pc_worker *w = &me->workers[i];
+        me->waste += w->waste + w->end - w->here;
+    }
+    return me->top;
+}
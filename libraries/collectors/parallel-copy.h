@@ -0,0 +1,52 @@
+#ifndef PARALLEL_COPY_H
+#define PARALLEL_COPY_H
+
+#include <stdbool.h>
+#include "datatypes/vector.h"
+#include "collectors/common.h"
+
+// Size of the to-space buffers the workers copy objects into. Larger
+// objects are given buffers of their own.
+#define PC_BUFFER_SIZE (32 * 1024)
+
+// A worker shares its unscanned objects with idle workers if they
+// take up more than this many bytes.
+#define PC_SHARE_THRESHOLD 1024
+
+typedef struct {
+    struct _parallel_copier *pc;
+    // The worker's private allocation buffer. Objects between scan
+    // and here are gray.
+    ptr scan;
+    ptr here;
+    ptr end;
+    size_t waste;
+} pc_worker;
+
+typedef struct _parallel_copier {
+    size_t n_threads;
+    pc_worker *workers;
+    vector *roots;
+    // Unscanned to-space ranges as pairs of start and end
+    // addresses. Guarded by lock.
+    vector *ranges;
+    size_t n_ranges;
+    bool lock;
+    size_t n_idle;
+    // Buffers are carved from [top, end).
+    ptr top;
+    ptr end;
+    // Bytes in the to-space not occupied by any object after the
+    // last copy.
+    size_t waste;
+} parallel_copier;
+
+parallel_copier *pc_init(size_t n_threads);
+void pc_free(parallel_copier *me);
+
+// Copies all objects reachable from the roots to the to-space
+// starting at start using n_threads threads, updating the roots. The
+// address after the last copied object is returned.
+ptr pc_copy(parallel_copier *me, vector *roots, ptr start, ptr end);
+
+#endif
@@ -0,0 +1,224 @@
+// Parallel marking with work stealing.
+//
+// Each worker thread traces from its own private mark stack. When it
+// has plenty of gray objects and its shared stack is empty, it moves
+// the oldest half of them to the shared stack. Workers that run out
+// of work steal half of another worker's shared stack. Marking ends
+// when all workers are idle.
+//
+// Since several workers may reach the same object at the same time,
+// mark bits are set with atomic test-and-set operations. Only the
+// worker that flips the bit scans the object.
+#include <assert.h>
+#include <string.h>
+#include "quickfit/quickfit.h"
+#include "threads/threads.h"
+#include "collectors/parallel-mark.h"
+
+parallel_marker *
+pm_init(size_t n_threads, bitarray *ba, ptr start) {
+    assert(n_threads > 0);
+    parallel_marker *me = malloc(sizeof(parallel_marker));
+    me->n_threads = n_threads;
+    me->workers = malloc(sizeof(pm_worker) * n_threads);
+    for (size_t i = 0; i < n_threads; i++) {
+        pm_worker *w = &me->workers[i];
+        w->pm = me;
+        w->local = v_init(256);
+        w->shared = v_init(256);
+        w->n_shared = 0;
+        w->lock = false;
+    }
+    me->ba = ba;
+    me->start = start;
+    me->n_idle = 0;
+    return me;
+}
+
+void
+pm_free(parallel_marker *me) {
+    for (size_t i = 0; i < me->n_threads; i++) {
+        v_free(me->workers[i].local);
+        v_free(me->workers[i].shared);
+    }
+    free(me->workers);
+    free(me);
+}
+
+static inline void
+pm_lock(pm_worker *w) {
+    while (__atomic_test_and_set(&w->lock, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+static inline void
+pm_unlock(pm_worker *w) {
+    __atomic_clear(&w->lock, __ATOMIC_RELEASE);
+}
+
+// Sets the bits [addr, addr + n) and returns true if the first one
+// wasn't already set.
+static bool
+pm_ba_try_mark(bitarray *ba, int addr, int n) {
+    ptr *words = (ptr *)ba->bits;
+    int w_idx = addr / BA_WORD_BITS;
+    int b_idx = addr % BA_WORD_BITS;
+    ptr first = (ptr)1 << b_idx;
+    if (words[w_idx] & first) {
+        return false;
+    }
+    // The range of bits in the first word.
+    int n_first = MIN(n, (int)BA_WORD_BITS - b_idx);
+    ptr mask = n_first == BA_WORD_BITS ? ~(ptr)0
+        : (((ptr)1 << n_first) - 1) << b_idx;
+    ptr old = __atomic_fetch_or(&words[w_idx], mask, __ATOMIC_RELAXED);
+    if (old & first) {
+        return false;
+    }
+    n -= n_first;
+    while (n > 0) {
+        w_idx++;
+        int n_bits = MIN(n, (int)BA_WORD_BITS);
+        mask = n_bits == BA_WORD_BITS ? ~(ptr)0 : ((ptr)1 << n_bits) - 1;
+        __atomic_fetch_or(&words[w_idx], mask, __ATOMIC_RELAXED);
+        n -= n_bits;
+    }
+    return true;
+}
+
+static inline bool
+pm_try_mark(parallel_marker *me, ptr p) {
+    if (me->ba) {
+        int addr = (int)((p - me->start) / QF_DATA_ALIGNMENT);
+        int n = (int)(QF_GET_BLOCK_SIZE(p) / QF_DATA_ALIGNMENT);
+        return pm_ba_try_mark(me->ba, addr, n);
+    }
+    if (P_GET_MARK(p)) {
+        return false;
+    }
+    ptr old = __atomic_fetch_or((ptr *)p, 1, __ATOMIC_RELAXED);
+    return (old & 1) == 0;
+}
+
+static void
+pm_share(pm_worker *w) {
+    vector *v = w->local;
+    if (v->used <= PM_SHARE_THRESHOLD ||
+        __atomic_load_n(&w->n_shared, __ATOMIC_RELAXED)) {
+        return;
+    }
+    // The oldest objects on the stack are likely to have the largest
+    // unexplored subgraphs.
+    size_t n = v->used / 2;
+    pm_lock(w);
+    v_add_all(w->shared, v->array, n);
+    __atomic_store_n(&w->n_shared, w->shared->used, __ATOMIC_RELAXED);
+    pm_unlock(w);
+    memmove(v->array, v->array + n, NPTRS(v->used - n));
+    v->used -= n;
+}
+
+// Moves half of the victim's shared objects to the thief's private
+// stack.
+static bool
+pm_steal_from(pm_worker *thief, pm_worker *victim) {
+    if (!__atomic_load_n(&victim->n_shared, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    pm_lock(victim);
+    vector *s = victim->shared;
+    size_t n = (s->used + 1) / 2;
+    if (n) {
+        s->used -= n;
+        v_add_all(thief->local, s->array + s->used, n);
+        __atomic_store_n(&victim->n_shared, s->used, __ATOMIC_RELAXED);
+    }
+    pm_unlock(victim);
+    return n > 0;
+}
+
+static bool
+pm_steal(pm_worker *w) {
+    parallel_marker *pm = w->pm;
+    size_t i0 = w - pm->workers;
+    for (size_t i = 0; i < pm->n_threads; i++) {
+        pm_worker *victim = &pm->workers[(i0 + i) % pm->n_threads];
+        if (pm_steal_from(w, victim)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+pm_work_available_p(parallel_marker *me) {
+    for (size_t i = 0; i < me->n_threads; i++) {
+        if (__atomic_load_n(&me->workers[i].n_shared, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *
+pm_worker_main(void *arg) {
+    pm_worker *w = (pm_worker *)arg;
+    parallel_marker *pm = w->pm;
+    vector *v = w->local;
+    while (true) {
+        while (v->used) {
+            ptr p = v_remove(v);
+            P_FOR_EACH_CHILD(p, {
+                if (pm_try_mark(pm, p_child)) {
+                    v_add(v, p_child);
+                }
+            });
+            pm_share(w);
+        }
+        if (pm_steal(w)) {
+            continue;
+        }
+        // Idle until some worker shares objects or all workers are
+        // idle. Workers only share objects when they are busy so in
+        // the latter case there is no more work.
+        __atomic_add_fetch(&pm->n_idle, 1, __ATOMIC_SEQ_CST);
+        while (true) {
+            if (__atomic_load_n(&pm->n_idle, __ATOMIC_SEQ_CST)
+                == pm->n_threads) {
+                return NULL;
+            }
+            if (pm_work_available_p(pm)) {
+                __atomic_sub_fetch(&pm->n_idle, 1, __ATOMIC_SEQ_CST);
+                if (pm_steal(w)) {
+                    break;
+                }
+                __atomic_add_fetch(&pm->n_idle, 1, __ATOMIC_SEQ_CST);
+            }
+            thr_yield();
+        }
+    }
+}
+
+void
+pm_mark(parallel_marker *me, vector *roots) {
+    size_t n_threads = me->n_threads;
+    for (size_t i = 0; i < roots->used; i++) {
+        ptr p = roots->array[i];
+        if (P_OBJ_P(p) && pm_try_mark(me, p)) {
+            v_add(me->workers[i % n_threads].local, p);
+        }
+    }
+    me->n_idle = 0;
+    if (n_threads == 1) {
+        pm_worker_main(&me->workers[0]);
+        return;
+    }
+    thr_handle handles[n_threads];
+    if (!thr_create_threads(n_threads, handles, sizeof(pm_worker),
+                            me->workers, pm_worker_main)) {
+        error("Failed to create %lu marking threads!\n", n_threads);
+    }
+    if (!thr_wait_for_threads(n_threads, handles)) {
+        error("Failed to join marking threads!\n");
+    }
+}
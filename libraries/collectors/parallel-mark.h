@@ -0,0 +1,42 @@
+#ifndef PARALLEL_MARK_H
+#define PARALLEL_MARK_H
+
+#include <stdbool.h>
+#include "datatypes/bitarray.h"
+#include "datatypes/vector.h"
+#include "collectors/common.h"
+
+// A worker only shares gray objects with the other workers if it has
+// more than this many of them.
+#define PM_SHARE_THRESHOLD 64
+
+typedef struct {
+    struct _parallel_marker *pm;
+    // Private mark stack, only touched by the owning worker.
+    vector *local;
+    // Gray objects other workers can steal. Guarded by lock.
+    vector *shared;
+    size_t n_shared;
+    bool lock;
+} pm_worker;
+
+typedef struct _parallel_marker {
+    size_t n_threads;
+    pm_worker *workers;
+    // If ba is set, mark bits are stored in it, one for each
+    // QF_DATA_ALIGNMENT bytes of the heap starting at start, like
+    // mark-sweep-bits does it. Otherwise the mark bit in the object
+    // header is used.
+    bitarray *ba;
+    ptr start;
+    size_t n_idle;
+} parallel_marker;
+
+parallel_marker *pm_init(size_t n_threads, bitarray *ba, ptr start);
+void pm_free(parallel_marker *me);
+
+// Marks all objects reachable from the roots using n_threads
+// threads.
+void pm_mark(parallel_marker *me, vector *roots);
+
+#endif
@@ -1,44 +1,104 @@
 // Copyright (C) 2016 Björn Lindqvist
+//
+// Reference counting with Bacon and Rajan's trial deletion cycle
+// collector.
+//
+// When a container's count is decremented but not to zero, it may
+// be the root of a garbage cycle so it is colored purple and
+// appended to the candidate buffer. The COL_BUFFERED bit in the
+// color field is set while the object is in the buffer. Objects in
+// the buffer whose counts drop to zero are not freed until they are
+// taken out of it, otherwise the buffer would contain dangling
+// pointers.
+//
+// In concurrent mode the mutator only buffers candidates and a
+// background thread runs the cycle collector. It takes the buffer
+// when it is full and collects it in small batches. Since trial
+// deletion temporarily changes ref counts, each batch is collected
+// while holding a lock that the barrier and the allocator also take.
+// That bounds the mutator's pauses by the batch size rather than by
+// the number of candidates.
 #include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include "datatypes/hashset.h"
+#include <string.h>
 #include "collectors/common.h"
-#include "collectors/ref-counting.h"
 #include "collectors/ref-counting-cycles.h"
 
+// How long the background thread sleeps when it has nothing to do.
+#define RCC_IDLE_USECS 100
+
+#define RCC_GET_COL(p)      (P_GET_COL(p) & ~COL_BUFFERED)
+#define RCC_SET_COL(p, c)   P_SET_COL(p, (P_GET_COL(p) & COL_BUFFERED) | (c))
+#define RCC_BUFFERED_P(p)   (P_GET_COL(p) & COL_BUFFERED)
+#define RCC_SET_BUFFERED(p) P_SET_COL(p, P_GET_COL(p) | COL_BUFFERED)
+#define RCC_CLEAR_BUFFERED(p) P_SET_COL(p, RCC_GET_COL(p))
+
+static void *rcc_collector_main(void *arg);
+
 static ref_counting_cycles_gc *
-rcc_init(ptr start, size_t size) {
+rcc_init_with_mode(ptr start, size_t size, bool concurrent) {
     ref_counting_cycles_gc *me = malloc(sizeof(ref_counting_cycles_gc));
     me->qf = qf_init(start, size);
     me->blacks = v_init(16);
     me->grays = v_init(16);
     me->whites = v_init(16);
     me->decrefs = v_init(16);
-    me->candidates = hs_init();
+    me->candidates = v_init(16);
+    me->work = v_init(16);
+    me->batch = v_init(16);
+    me->concurrent = concurrent;
+    me->lock = false;
+    me->stop = false;
+    me->n_candidates = 0;
+    me->n_batches = 0;
+    me->max_batch_pause = 0;
+    if (concurrent &&
+        !thr_create_threads(1, &me->thread, sizeof(ref_counting_cycles_gc),
+                            me, rcc_collector_main)) {
+        error("Failed to create the cycle collector thread!\n");
+    }
     return me;
 }
 
+ref_counting_cycles_gc *
+rcc_init(ptr start, size_t size) {
+    return rcc_init_with_mode(start, size, false);
+}
+
+ref_counting_cycles_gc *
+rcc_init_concurrent(ptr start, size_t size) {
+    return rcc_init_with_mode(start, size, true);
+}
+
+static inline void
+rcc_lock(ref_counting_cycles_gc *me) {
+    if (me->concurrent) {
+        while (__atomic_test_and_set(&me->lock, __ATOMIC_ACQUIRE)) {
+            thr_yield();
+        }
+    }
+}
+
+static inline void
+rcc_unlock(ref_counting_cycles_gc *me) {
+    if (me->concurrent) {
+        __atomic_clear(&me->lock, __ATOMIC_RELEASE);
+    }
+}
+
 static void
 rcc_mark_gray(ref_counting_cycles_gc *me, ptr p) {
     vector *st = me->grays;
-    P_SET_COL(p, COL_GRAY);
-    P_FOR_EACH_CHILD(p, {
-        P_DEC_RC(p_child);
-        size_t col = P_GET_COL(p_child);
-        if (col != COL_BLACK && col != COL_GRAY) {
-            P_SET_COL(p_child, COL_GRAY);
-            v_add(st, p_child);
-        }
-    });
+    RCC_SET_COL(p, COL_GRAY);
+    v_add(st, p);
     while (st->used) {
         p = v_remove(st);
         P_FOR_EACH_CHILD(p, {
             P_DEC_RC(p_child);
-            size_t col = P_GET_COL(p_child);
-            if (col != COL_BLACK && col != COL_GRAY) {
-                P_SET_COL(p_child, COL_GRAY);
+            if (RCC_GET_COL(p_child) != COL_GRAY) {
+                RCC_SET_COL(p_child, COL_GRAY);
                 v_add(st, p_child);
             }
         });
@@ -46,31 +106,34 @@ rcc_mark_gray(ref_counting_cycles_gc *me, ptr p) {
 }
 
 static void
-rcc_mark_candidates(ref_counting_cycles_gc *me) {
-    hashset *c = me->candidates;
-    HS_FOR_EACH_ITEM(c, {
-        if (P_GET_COL(p) == COL_PURPLE) {
+rcc_mark_candidates(ref_counting_cycles_gc *me, vector *v) {
+    size_t n = 0;
+    for (size_t i = 0; i < v->used; i++) {
+        ptr p = v->array[i];
+        if (RCC_GET_COL(p) == COL_PURPLE) {
             rcc_mark_gray(me, p);
+            v->array[n++] = p;
         } else {
-            hs_remove_at(c, _i);
-            if (P_GET_COL(p) == COL_BLACK && P_GET_RC(p) == 0) {
+            RCC_CLEAR_BUFFERED(p);
+            if (RCC_GET_COL(p) == COL_BLACK && P_GET_RC(p) == 0) {
                 qf_free_block(me->qf, p, QF_GET_BLOCK_SIZE(p));
             }
         }
-    });
+    }
+    v->used = n;
 }
 
 static void
 rcc_scan_blacks(ref_counting_cycles_gc *me, ptr p) {
-    assert(P_GET_COL(p) == COL_BLACK);
+    assert(RCC_GET_COL(p) == COL_BLACK);
     vector *st = me->blacks;
     v_add(st, p);
     while (st->used) {
         p = v_remove(st);
         P_FOR_EACH_CHILD(p, {
             P_INC_RC(p_child);
-            if (P_GET_COL(p_child) != COL_BLACK) {
-                P_SET_COL(p_child, COL_BLACK);
+            if (RCC_GET_COL(p_child) != COL_BLACK) {
+                RCC_SET_COL(p_child, COL_BLACK);
                 v_add(st, p_child);
             }
         });
@@ -80,16 +143,16 @@ rcc_scan_blacks(ref_counting_cycles_gc *me, ptr p) {
 static inline void
 rcc_scan_candidate_step(ref_counting_cycles_gc *me, ptr p) {
     // Already processed?
-    if (P_GET_COL(p) != COL_GRAY) {
+    if (RCC_GET_COL(p) != COL_GRAY) {
         return;
     }
     if (P_GET_RC(p) > 0) {
         // External ref found, undo trial deletion.
-        P_SET_COL(p, COL_BLACK);
+        RCC_SET_COL(p, COL_BLACK);
         rcc_scan_blacks(me, p);
     } else {
         // Could be garbage.. investigate children.
-        P_SET_COL(p, COL_WHITE);
+        RCC_SET_COL(p, COL_WHITE);
         v_add(me->whites, p);
     }
 }
@@ -104,42 +167,102 @@ rcc_scan_candidate(ref_counting_cycles_gc *me, ptr p) {
     }
 }
 
+// White objects that are still buffered are blackened but not freed.
+// Their counts are zero so they are freed when they are taken out of
+// the buffer.
 static void
 rcc_collect_white(ref_counting_cycles_gc *me, ptr p) {
-    hashset *c = me->candidates;
-    if (P_GET_COL(p) == COL_WHITE && !hs_in_p(c, p)) {
-        P_SET_COL(p, COL_BLACK);
-        P_FOR_EACH_CHILD(p, { rcc_collect_white(me, p_child); });
-        qf_free_block(me->qf, p, QF_GET_BLOCK_SIZE(p));
+    if (RCC_GET_COL(p) != COL_WHITE) {
+        return;
+    }
+    vector *v = me->whites;
+    RCC_SET_COL(p, COL_BLACK);
+    v_add(v, p);
+    while (v->used) {
+        p = v_remove(v);
+        P_FOR_EACH_CHILD(p, {
+            if (RCC_GET_COL(p_child) == COL_WHITE) {
+                RCC_SET_COL(p_child, COL_BLACK);
+                v_add(v, p_child);
+            }
+        });
+        if (!RCC_BUFFERED_P(p)) {
+            qf_free_block(me->qf, p, QF_GET_BLOCK_SIZE(p));
+        }
     }
 }
 
 static void
-rcc_collect_candidates(ref_counting_cycles_gc *me) {
-    hashset *c = me->candidates;
-    HS_FOR_EACH_ITEM(c, {
-        hs_remove_at(c, _i);
-        rcc_collect_white(me, p);
-    });
+rcc_collect_candidates(ref_counting_cycles_gc *me, vector *v) {
+    for (size_t i = 0; i < v->used; i++) {
+        ptr p = v->array[i];
+        RCC_CLEAR_BUFFERED(p);
+        if (RCC_GET_COL(p) == COL_WHITE) {
+            rcc_collect_white(me, p);
+        } else if (P_GET_RC(p) == 0) {
+            qf_free_block(me->qf, p, QF_GET_BLOCK_SIZE(p));
+        }
+    }
+    v->used = 0;
+}
+
+static void
+rcc_collect_cycles(ref_counting_cycles_gc *me, vector *v) {
+    rcc_mark_candidates(me, v);
+    for (size_t i = 0; i < v->used; i++) {
+        rcc_scan_candidate(me, v->array[i]);
+    }
+    rcc_collect_candidates(me, v);
 }
 
 void
 rcc_collect(ref_counting_cycles_gc *me) {
-    rcc_mark_candidates(me);
-    hashset *c = me->candidates;
-    HS_FOR_EACH_ITEM(c, { rcc_scan_candidate(me, p); });
-    rcc_collect_candidates(me);
-    assert(c->n_items == 0);
-    hs_clear(c);
+    rcc_lock(me);
+    rcc_collect_cycles(me, me->work);
+    rcc_collect_cycles(me, me->candidates);
+    rcc_unlock(me);
+}
+
+static void *
+rcc_collector_main(void *arg) {
+    ref_counting_cycles_gc *me = (ref_counting_cycles_gc *)arg;
+    while (!__atomic_load_n(&me->stop, __ATOMIC_RELAXED)) {
+        rcc_lock(me);
+        uint64_t start = nano_count();
+        if (!me->work->used && me->candidates->used >= RCC_TRIGGER_SIZE) {
+            vector *tmp = me->work;
+            me->work = me->candidates;
+            me->candidates = tmp;
+        }
+        vector *w = me->work;
+        size_t n = MIN(w->used, RCC_BATCH_SIZE);
+        if (n) {
+            w->used -= n;
+            v_add_all(me->batch, w->array + w->used, n);
+            rcc_collect_cycles(me, me->batch);
+            uint64_t pause = nano_count() - start;
+            me->max_batch_pause = MAX(me->max_batch_pause, pause);
+            me->n_batches++;
+        }
+        rcc_unlock(me);
+        if (!n) {
+            thr_sleep(RCC_IDLE_USECS);
+        }
+    }
+    return NULL;
 }
 
 static void
 rcc_candidate(ref_counting_cycles_gc *me, ptr p) {
-    if (P_GET_COL(p) != COL_PURPLE) {
+    if (RCC_GET_COL(p) != COL_PURPLE) {
         size_t t = P_GET_TYPE(p);
         if (TYPE_CONTAINER_P(t)) {
-            P_SET_COL(p, COL_PURPLE);
-            hs_add(me->candidates, p);
+            RCC_SET_COL(p, COL_PURPLE);
+            if (!RCC_BUFFERED_P(p)) {
+                RCC_SET_BUFFERED(p);
+                v_add(me->candidates, p);
+                me->n_candidates++;
+            }
         }
     }
 }
@@ -147,19 +270,18 @@ rcc_candidate(ref_counting_cycles_gc *me, ptr p) {
 static void
 rcc_release(ref_counting_cycles_gc *me, ptr p) {
     P_FOR_EACH_CHILD(p, { v_add(me->decrefs, p_child); });
-    // The handbook recommends keeping the pointer and waiting for a
-    // collection cycle. I don't understand why you shouldn't just
-    // free the pointer immediately.
-    hs_remove(me->candidates, p);
-    qf_free_block(me->qf, p, QF_GET_BLOCK_SIZE(p));
+    RCC_SET_COL(p, COL_BLACK);
+    if (!RCC_BUFFERED_P(p)) {
+        qf_free_block(me->qf, p, QF_GET_BLOCK_SIZE(p));
+    }
 }
 
+// Processes the decrements on the stack and the ones they cause.
 static void
-rcc_decref(ref_counting_cycles_gc *me, ptr p) {
+rcc_process_decrefs(ref_counting_cycles_gc *me) {
     vector *st = me->decrefs;
-    v_add(st, p);
     while (st->used) {
-        p = v_remove(st);
+        ptr p = v_remove(st);
         P_DEC_RC(p);
         if (P_GET_RC(p) == 0) {
             rcc_release(me, p);
@@ -169,54 +291,188 @@ rcc_decref(ref_counting_cycles_gc *me, ptr p) {
     }
 }
 
+static void
+rcc_decref(ref_counting_cycles_gc *me, ptr p) {
+    v_add(me->decrefs, p);
+    rcc_process_decrefs(me);
+}
+
 static inline void
 rcc_addref(ref_counting_cycles_gc *me, ptr p) {
-    if (p != 0) {
+    if (P_OBJ_P(p)) {
         P_INC_RC(p);
-        P_SET_COL(p, COL_BLACK);
+        RCC_SET_COL(p, COL_BLACK);
     }
 }
 
 void
 rcc_free(ref_counting_cycles_gc *me) {
+    if (me->concurrent) {
+        __atomic_store_n(&me->stop, true, __ATOMIC_RELAXED);
+        if (!thr_wait_for_threads(1, &me->thread)) {
+            error("Failed to join the cycle collector thread!\n");
+        }
+    }
     rcc_collect(me);
     qf_free(me->qf);
     v_free(me->blacks);
     v_free(me->grays);
     v_free(me->whites);
     v_free(me->decrefs);
-    hs_free(me->candidates);
+    v_free(me->candidates);
+    v_free(me->work);
+    v_free(me->batch);
     free(me);
 }
 
+bool
+rcc_can_allot_p(ref_counting_cycles_gc *me, size_t size) {
+    rcc_lock(me);
+    bool ok = qf_can_allot_p(me->qf, size);
+    rcc_unlock(me);
+    return ok;
+}
+
+ptr
+rcc_do_allot(ref_counting_cycles_gc *me, int type, size_t size) {
+    rcc_lock(me);
+    ptr p = qf_allot_block(me->qf, size);
+    rcc_unlock(me);
+    P_SET_TYPE(p, type);
+    return p;
+}
+
+size_t
+rcc_space_used(ref_counting_cycles_gc *me) {
+    rcc_lock(me);
+    size_t used = qf_space_used(me->qf);
+    rcc_unlock(me);
+    return used;
+}
+
 void
-rcc_set_ptr(ref_counting_cycles_gc *me, ptr *from, ptr to) {
+rcc_heap_stats(ref_counting_cycles_gc *me, gc_stats *stats) {
+    rcc_lock(me);
+    gs_set_quick_fit(stats, me->qf);
+    rcc_unlock(me);
+}
+
+bool
+rcc_resize(ref_counting_cycles_gc *me, size_t size) {
+    rcc_lock(me);
+    ptr end = me->qf->start + me->qf->size;
+    bool ok = qf_resize(me->qf, size);
+    if (ok) {
+        heap_release(me->qf->start + me->qf->size, end);
+    }
+    rcc_unlock(me);
+    return ok;
+}
+
+// The store must happen while holding the lock since the background
+// collector traverses slots.
+void
+rcc_set_ptr(ref_counting_cycles_gc *me, ref *from, ptr to) {
+    rcc_lock(me);
     rcc_addref(me, to);
-    if (*from != 0) {
-        rcc_decref(me, *from);
+    ptr old = REF_DECODE(*from);
+    if (P_OBJ_P(old)) {
+        rcc_decref(me, old);
     }
-    *from = to;
+    *from = REF_ENCODE(to);
+    rcc_unlock(me);
 }
 
 void
-rcc_set_new_ptr(ref_counting_cycles_gc *me, ptr *from, ptr to) {
+rcc_set_new_ptr(ref_counting_cycles_gc *me, ref *from, ptr to) {
+    rcc_lock(me);
     rcc_addref(me, to);
-    *from = to;
+    *from = REF_ENCODE(to);
+    rcc_unlock(me);
+}
+
+// The lock is taken once and the old values are pushed on the
+// decrement stack and processed together after the stores.
+void
+rcc_fill_ptrs(ref_counting_cycles_gc *me, ref *from, size_t n, ptr to) {
+    rcc_lock(me);
+    if (P_OBJ_P(to)) {
+        P_ADD_RC(to, n);
+        RCC_SET_COL(to, COL_BLACK);
+    }
+    vector *st = me->decrefs;
+    ref r = REF_ENCODE(to);
+    for (size_t i = 0; i < n; i++) {
+        ptr old = REF_DECODE(from[i]);
+        if (P_OBJ_P(old)) {
+            v_add(st, old);
+        }
+        from[i] = r;
+    }
+    rcc_process_decrefs(me);
+    rcc_unlock(me);
+}
+
+void
+rcc_copy_ptrs(ref_counting_cycles_gc *me, ref *from, ref *src, size_t n) {
+    rcc_lock(me);
+    for (size_t i = 0; i < n; i++) {
+        rcc_addref(me, REF_DECODE(src[i]));
+    }
+    vector *st = me->decrefs;
+    for (size_t i = 0; i < n; i++) {
+        ptr old = REF_DECODE(from[i]);
+        if (P_OBJ_P(old)) {
+            v_add(st, old);
+        }
+    }
+    memmove(from, src, n * sizeof(ref));
+    rcc_process_decrefs(me);
+    rcc_unlock(me);
 }
 
 static gc_dispatch
 table = {
     (gc_func_init)rcc_init,
     (gc_func_free)rcc_free,
-    (gc_func_can_allot_p)rc_can_allot_p,
+    (gc_func_can_allot_p)rcc_can_allot_p,
     (gc_func_collect)rcc_collect,
-    (gc_func_do_allot)rc_do_allot,
+    (gc_func_do_allot)rcc_do_allot,
     (gc_func_set_ptr)rcc_set_ptr,
     (gc_func_set_ptr)rcc_set_new_ptr,
-    (gc_func_space_used)rc_space_used
+    (gc_func_fill_ptrs)rcc_fill_ptrs,
+    (gc_func_copy_ptrs)rcc_copy_ptrs,
+    (gc_func_space_used)rcc_space_used,
+    (gc_func_heap_stats)rcc_heap_stats,
+    (gc_func_resize)rcc_resize,
+    NULL,
+    NULL
 };
 
 gc_dispatch *
 rcc_get_dispatch_table() {
     return &table;
 }
+
+static gc_dispatch
+table_concurrent = {
+    (gc_func_init)rcc_init_concurrent,
+    (gc_func_free)rcc_free,
+    (gc_func_can_allot_p)rcc_can_allot_p,
+    (gc_func_collect)rcc_collect,
+    (gc_func_do_allot)rcc_do_allot,
+    (gc_func_set_ptr)rcc_set_ptr,
+    (gc_func_set_ptr)rcc_set_new_ptr,
+    (gc_func_fill_ptrs)rcc_fill_ptrs,
+    (gc_func_copy_ptrs)rcc_copy_ptrs,
+    (gc_func_space_used)rcc_space_used,
+    (gc_func_heap_stats)rcc_heap_stats,
+    (gc_func_resize)rcc_resize,
+    NULL,
+    NULL
+};
+
+gc_dispatch *
+rcc_get_dispatch_table_concurrent() {
+    return &table_concurrent;
+}
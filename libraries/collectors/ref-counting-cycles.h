@@ -1,8 +1,18 @@
 #ifndef REF_COUNTING_CYCLES_H
 #define REF_COUNTING_CYCLES_H
 
-#include "datatypes/hashset.h"
+#include <stdbool.h>
 #include "datatypes/vector.h"
+#include "quickfit/quickfit.h"
+#include "threads/threads.h"
+#include "collectors/common.h"
+
+// The background collector takes the candidate buffer when it has
+// this many candidates...
+#define RCC_TRIGGER_SIZE 4096
+// ...and processes this many candidates at a time while holding the
+// heap lock.
+#define RCC_BATCH_SIZE 256
 
 typedef struct {
     quick_fit *qf;
@@ -10,11 +20,53 @@ typedef struct {
     vector *grays;
     vector *whites;
     vector *decrefs;
-    hashset *candidates;
+    // Possible roots of garbage cycles. The mutator appends objects
+    // to candidates and sets their COL_BUFFERED bits so that none is
+    // added twice.
+    vector *candidates;
+    // Candidates taken by the background collector and the batch of
+    // them being collected.
+    vector *work;
+    vector *batch;
+
+    // Only used if cycles are collected in the background. The lock
+    // guards all ref counts, colors and the allocator.
+    bool concurrent;
+    bool lock;
+    bool stop;
+    thr_handle thread;
+
+    // Stats. Pauses are in nanoseconds.
+    size_t n_candidates;
+    size_t n_batches;
+    uint64_t max_batch_pause;
 } ref_counting_cycles_gc;
 
-gc_dispatch *rcc_get_dispatch_table();
+ref_counting_cycles_gc *rcc_init(ptr start, size_t size);
+// Runs cycle collection on a background thread. Garbage cycles can
+// then be freed at any time, not only when allocating, so objects
+// must be rooted while they are only referenced by C variables.
+ref_counting_cycles_gc *rcc_init_concurrent(ptr start, size_t size);
+void rcc_free(ref_counting_cycles_gc *me);
 
+bool rcc_can_allot_p(ref_counting_cycles_gc *me, size_t size);
+// Collects all buffered candidates.
+void rcc_collect(ref_counting_cycles_gc *me);
+ptr rcc_do_allot(ref_counting_cycles_gc *me, int type, size_t size);
 
+void rcc_set_ptr(ref_counting_cycles_gc *me, ref *from, ptr to);
+void rcc_set_new_ptr(ref_counting_cycles_gc *me, ref *from, ptr to);
+void rcc_fill_ptrs(ref_counting_cycles_gc *me, ref *from, size_t n, ptr to);
+void rcc_copy_ptrs(ref_counting_cycles_gc *me, ref *from, ref *src,
+                   size_t n);
+
+size_t rcc_space_used(ref_counting_cycles_gc *me);
+void rcc_heap_stats(ref_counting_cycles_gc *me, gc_stats *stats);
+
+// Heap resizing
+bool rcc_resize(ref_counting_cycles_gc *me, size_t size);
+
+gc_dispatch *rcc_get_dispatch_table();
+gc_dispatch *rcc_get_dispatch_table_concurrent();
 
 #endif
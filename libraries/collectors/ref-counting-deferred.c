@@ -0,0 +1,199 @@
+// Deferred reference counting, as described by Deutsch and Bobrow.
+//
+// Only pointers stored in heap objects are counted. Stores to the
+// roots are plain stores, which makes pushing and popping the vm
+// stack as cheap as for the tracing collectors. The barrier tells
+// the two apart by checking whether the slot is inside the heap.
+//
+// Since roots aren't counted, an object whose count drops to zero
+// may still be referenced from the stack. It is therefore not freed
+// immediately but added to the zero count table (zct). New objects
+// start with a zero count so they are added too. When the table is
+// full the vm is asked to collect, and the table is reconciled: the
+// roots are counted, all objects in the table that still have zero
+// counts are freed and then the roots are uncounted again.
+//
+// An object's color is COL_PURPLE while it is in the table, so that
+// it isn't added twice.
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "quickfit/quickfit.h"
+#include "collectors/common.h"
+#include "collectors/ref-counting-deferred.h"
+
+#define RCD_HEAP_P(me, p) \
+    ((ptr)(p) >= (me)->qf->start && \
+     (ptr)(p) < (me)->qf->start + (me)->qf->size)
+
+ref_counting_deferred_gc *
+rcd_init(ptr start, size_t size) {
+    ref_counting_deferred_gc *me = malloc(sizeof(ref_counting_deferred_gc));
+    me->qf = qf_init(start, size);
+    me->zct = v_init(16);
+    me->zct_limit = RCD_ZCT_LIMIT;
+    me->n_reconciles = 0;
+    return me;
+}
+
+void
+rcd_free(ref_counting_deferred_gc *me) {
+    v_free(me->zct);
+    qf_free(me->qf);
+    free(me);
+}
+
+static inline void
+rcd_zct_add(ref_counting_deferred_gc *me, ptr p) {
+    if (P_GET_COL(p) != COL_PURPLE) {
+        P_SET_COL(p, COL_PURPLE);
+        v_add(me->zct, p);
+    }
+}
+
+static inline void
+rcd_decref(ref_counting_deferred_gc *me, ptr p) {
+    if (P_OBJ_P(p)) {
+        P_DEC_RC(p);
+        if (P_GET_RC(p) == 0) {
+            rcd_zct_add(me, p);
+        }
+    }
+}
+
+static inline void
+rcd_addref(ref_counting_deferred_gc *me, ptr p) {
+    if (P_OBJ_P(p)) {
+        P_INC_RC(p);
+    }
+}
+
+void
+rcd_collect(ref_counting_deferred_gc *me, vector *roots) {
+    for (size_t i = 0; i < roots->used; i++) {
+        rcd_addref(me, roots->array[i]);
+    }
+    // Children of freed objects whose counts drop to zero are added
+    // to the table and freed in turn.
+    vector *v = me->zct;
+    while (v->used) {
+        ptr p = v_remove(v);
+        P_SET_COL(p, COL_BLACK);
+        if (P_GET_RC(p) == 0) {
+            P_FOR_EACH_CHILD(p, { rcd_decref(me, p_child); });
+            qf_free_block(me->qf, p, QF_GET_BLOCK_SIZE(p));
+        }
+    }
+    for (size_t i = 0; i < roots->used; i++) {
+        rcd_decref(me, roots->array[i]);
+    }
+    // If the stack is deep, most of the table may be objects only
+    // referenced from it.
+    me->zct_limit = MAX(RCD_ZCT_LIMIT, 2 * v->used);
+    me->n_reconciles++;
+}
+
+// Returning false when the table is full makes the vm call
+// rcd_collect.
+bool
+rcd_can_allot_p(ref_counting_deferred_gc *me, size_t size) {
+    return me->zct->used < me->zct_limit && qf_can_allot_p(me->qf, size);
+}
+
+ptr
+rcd_do_allot(ref_counting_deferred_gc *me, int type, size_t size) {
+    ptr p = qf_allot_block(me->qf, size);
+    P_SET_TYPE(p, type);
+    rcd_zct_add(me, p);
+    return p;
+}
+
+size_t
+rcd_space_used(ref_counting_deferred_gc *me) {
+    return qf_space_used(me->qf);
+}
+
+void
+rcd_heap_stats(ref_counting_deferred_gc *me, gc_stats *stats) {
+    gs_set_quick_fit(stats, me->qf);
+}
+
+bool
+rcd_resize(ref_counting_deferred_gc *me, size_t size) {
+    ptr end = me->qf->start + me->qf->size;
+    bool ok = qf_resize(me->qf, size);
+    if (ok) {
+        heap_release(me->qf->start + me->qf->size, end);
+    }
+    return ok;
+}
+
+void
+rcd_set_ptr(ref_counting_deferred_gc *me, ref *from, ptr to) {
+    if (RCD_HEAP_P(me, from)) {
+        rcd_addref(me, to);
+        rcd_decref(me, REF_DECODE(*from));
+    }
+    *from = REF_ENCODE(to);
+}
+
+void
+rcd_set_new_ptr(ref_counting_deferred_gc *me, ref *from, ptr to) {
+    if (RCD_HEAP_P(me, from)) {
+        rcd_addref(me, to);
+    }
+    *from = REF_ENCODE(to);
+}
+
+void
+rcd_fill_ptrs(ref_counting_deferred_gc *me, ref *from, size_t n, ptr to) {
+    if (RCD_HEAP_P(me, from)) {
+        if (P_OBJ_P(to)) {
+            P_ADD_RC(to, n);
+        }
+        for (size_t i = 0; i < n; i++) {
+            rcd_decref(me, REF_DECODE(from[i]));
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        from[i] = REF_ENCODE(to);
+    }
+}
+
+void
+rcd_copy_ptrs(ref_counting_deferred_gc *me, ref *from, ref *src,
+              size_t n) {
+    if (RCD_HEAP_P(me, from)) {
+        for (size_t i = 0; i < n; i++) {
+            rcd_addref(me, REF_DECODE(src[i]));
+        }
+        for (size_t i = 0; i < n; i++) {
+            rcd_decref(me, REF_DECODE(from[i]));
+        }
+    }
+    memmove(from, src, n * sizeof(ref));
+}
+
+static gc_dispatch
+table = {
+    (gc_func_init)rcd_init,
+    (gc_func_free)rcd_free,
+    (gc_func_can_allot_p)rcd_can_allot_p,
+    (gc_func_collect)rcd_collect,
+    (gc_func_do_allot)rcd_do_allot,
+    (gc_func_set_ptr)rcd_set_ptr,
+    (gc_func_set_ptr)rcd_set_new_ptr,
+    (gc_func_fill_ptrs)rcd_fill_ptrs,
+    (gc_func_copy_ptrs)rcd_copy_ptrs,
+    (gc_func_space_used)rcd_space_used,
+    (gc_func_heap_stats)rcd_heap_stats,
+    (gc_func_resize)rcd_resize,
+    NULL,
+    NULL
+};
+
+gc_dispatch *
+rcd_get_dispatch_table() {
+    return &table;
+}
@@ -0,0 +1,42 @@
+#ifndef REF_COUNTING_DEFERRED_H
+#define REF_COUNTING_DEFERRED_H
+
+#include <stdbool.h>
+#include "datatypes/vector.h"
+#include "quickfit/quickfit.h"
+#include "collectors/common.h"
+
+// The zero count table is reconciled when it has this many entries.
+#define RCD_ZCT_LIMIT 10000
+
+typedef struct {
+    quick_fit *qf;
+    // Objects whose ref count has dropped to zero. They are freed if
+    // no root points to them when the table is reconciled.
+    vector *zct;
+    size_t zct_limit;
+    size_t n_reconciles;
+} ref_counting_deferred_gc;
+
+gc_dispatch *rcd_get_dispatch_table();
+
+ref_counting_deferred_gc *rcd_init(ptr start, size_t size);
+void rcd_free(ref_counting_deferred_gc *me);
+
+bool rcd_can_allot_p(ref_counting_deferred_gc *me, size_t size);
+void rcd_collect(ref_counting_deferred_gc *me, vector *roots);
+ptr rcd_do_allot(ref_counting_deferred_gc *me, int type, size_t size);
+
+void rcd_set_ptr(ref_counting_deferred_gc *me, ref *from, ptr to);
+void rcd_set_new_ptr(ref_counting_deferred_gc *me, ref *from, ptr to);
+void rcd_fill_ptrs(ref_counting_deferred_gc *me, ref *from, size_t n, ptr to);
+void rcd_copy_ptrs(ref_counting_deferred_gc *me, ref *from, ref *src,
+                   size_t n);
+
+size_t rcd_space_used(ref_counting_deferred_gc *me);
+void rcd_heap_stats(ref_counting_deferred_gc *me, gc_stats *stats);
+
+// Heap resizing
+bool rcd_resize(ref_counting_deferred_gc *me, size_t size);
+
+#endif
@@ -1,5 +1,7 @@
 // Copyright (C) 2016 Björn Lindqvist
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "quickfit/quickfit.h"
 #include "collectors/common.h"
 #include "collectors/ref-counting.h"
@@ -7,14 +9,31 @@
 // Reference counting is a bit faster when using malloc/free over my
 // quickfit-allocator. Perhaps because my qf_free_block() function is
 // not well optimized.
+//
+// In incremental mode, objects whose counts drop to zero are put on
+// the decrefs list and each barrier and allocation frees at most
+// max_frees of them. That bounds the pause when the last reference
+// to a large structure is removed. Pending objects are freed before
+// the allocator is allowed to fail.
 ref_counting_gc *
-rc_init(ptr start, size_t size) {
+rc_init_incremental(ptr start, size_t size, size_t max_frees) {
     ref_counting_gc *me = malloc(sizeof(ref_counting_gc));
     me->qf = qf_init(start, size);
     me->decrefs = v_init(16);
+    me->max_frees = max_frees;
     return me;
 }
 
+ref_counting_gc *
+rc_init(ptr start, size_t size) {
+    return rc_init_incremental(start, size, 0);
+}
+
+static ref_counting_gc *
+rc_init_default_incremental(ptr start, size_t size) {
+    return rc_init_incremental(start, size, RC_DEFAULT_MAX_FREES);
+}
+
 void
 rc_free(ref_counting_gc *me) {
     v_free(me->decrefs);
@@ -22,13 +41,37 @@ rc_free(ref_counting_gc *me) {
     free(me);
 }
 
+// Frees at most n pending objects.
+static void
+rc_free_pending(ref_counting_gc *me, size_t n) {
+    vector *v = me->decrefs;
+    while (v->used && n--) {
+        ptr p = v_remove(v);
+        P_FOR_EACH_CHILD(p, {
+            P_DEC_RC(p_child);
+            if (P_GET_RC(p_child) == 0) {
+                v_add(v, p_child);
+            }
+        });
+        qf_free_block(me->qf, p, QF_GET_BLOCK_SIZE(p));
+    }
+}
+
 bool
 rc_can_allot_p(ref_counting_gc *me, size_t size) {
-    return qf_can_allot_p(me->qf, size);
+    if (qf_can_allot_p(me->qf, size)) {
+        return true;
+    }
+    if (me->decrefs->used) {
+        rc_free_pending(me, SIZE_MAX);
+        return qf_can_allot_p(me->qf, size);
+    }
+    return false;
 }
 
 void
 rc_collect(ref_counting_gc *me, vector *roots) {
+    rc_free_pending(me, SIZE_MAX);
 }
 
 size_t
@@ -36,48 +79,112 @@ rc_space_used(ref_counting_gc *me) {
     return qf_space_used(me->qf);
 }
 
+void
+rc_heap_stats(ref_counting_gc *me, gc_stats *stats) {
+    gs_set_quick_fit(stats, me->qf);
+}
+
+bool
+rc_resize(ref_counting_gc *me, size_t size) {
+    ptr end = me->qf->start + me->qf->size;
+    bool ok = qf_resize(me->qf, size);
+    if (ok) {
+        heap_release(me->qf->start + me->qf->size, end);
+    }
+    return ok;
+}
+
 ptr
 rc_do_allot(ref_counting_gc *me, int type, size_t size) {
+    if (me->max_frees) {
+        rc_free_pending(me, me->max_frees);
+    }
     ptr p = qf_allot_block(me->qf, size);
     P_SET_TYPE(p, type);
     return p;
 }
 
-static void
-rc_decref(ref_counting_gc *me, ptr p) {
-    if (p == 0) {
-        return;
-    }
-    vector *v = me->decrefs;
-    v_add(v, p);
-    while (v->used) {
-        p = v_remove(v);
+// Queues the object for freeing if its count drops to zero.
+static inline void
+rc_dec_only(ref_counting_gc *me, ptr p) {
+    if (P_OBJ_P(p)) {
         P_DEC_RC(p);
         if (P_GET_RC(p) == 0) {
-            P_FOR_EACH_CHILD(p, { v_add(v, p_child); });
-            qf_free_block(me->qf, p, QF_GET_BLOCK_SIZE(p));
+            v_add(me->decrefs, p);
         }
     }
 }
 
+static void
+rc_decref(ref_counting_gc *me, ptr p) {
+    if (!P_OBJ_P(p)) {
+        return;
+    }
+    rc_dec_only(me, p);
+    rc_free_pending(me, me->max_frees ? me->max_frees : SIZE_MAX);
+}
+
 static inline void
 rc_addref(ref_counting_gc *me, ptr p) {
-    if (p != 0) {
+    if (P_OBJ_P(p)) {
         P_INC_RC(p);
     }
 }
 
 void
-rc_set_ptr(ref_counting_gc *me, ptr *from, ptr to) {
-    rc_decref(me, *from);
+rc_set_ptr(ref_counting_gc *me, ref *from, ptr to) {
+    // Increment first so that storing the same pointer doesn't free
+    // it.
     rc_addref(me, to);
-    *from = to;
+    rc_decref(me, REF_DECODE(*from));
+    *from = REF_ENCODE(to);
 }
 
 void
-rc_set_new_ptr(ref_counting_gc *me, ptr *from, ptr to) {
+rc_set_new_ptr(ref_counting_gc *me, ref *from, ptr to) {
     rc_addref(me, to);
-    *from = to;
+    *from = REF_ENCODE(to);
+}
+
+// All increments are done before the decrements, and the objects
+// whose counts drop to zero are freed in one batch afterwards. The
+// incremental mode may free as many objects as n set_ptr calls.
+void
+rc_fill_ptrs(ref_counting_gc *me, ref *from, size_t n, ptr to) {
+    if (P_OBJ_P(to)) {
+        P_ADD_RC(to, n);
+    }
+    for (size_t i = 0; i < n; i++) {
+        rc_dec_only(me, REF_DECODE(from[i]));
+        from[i] = REF_ENCODE(to);
+    }
+    rc_free_pending(me, me->max_frees ? me->max_frees * n : SIZE_MAX);
+}
+
+void
+rc_copy_ptrs(ref_counting_gc *me, ref *from, ref *src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        rc_addref(me, REF_DECODE(src[i]));
+    }
+    for (size_t i = 0; i < n; i++) {
+        rc_dec_only(me, REF_DECODE(from[i]));
+    }
+    memmove(from, src, n * sizeof(ref));
+    rc_free_pending(me, me->max_frees ? me->max_frees * n : SIZE_MAX);
+}
+
+// Images hold no counts, so every ref in them is counted here. The
+// vm counts the roots when it adds them.
+bool
+rc_load_image(ref_counting_gc *me, size_t n_bytes) {
+    if (!qf_adopt_blocks(me->qf, n_bytes)) {
+        return false;
+    }
+    ptr end = me->qf->start + n_bytes;
+    for (ptr p = me->qf->start; p < end; p += QF_GET_BLOCK_SIZE(p)) {
+        P_FOR_EACH_CHILD(p, { P_INC_RC(p_child); });
+    }
+    return true;
 }
 
 static gc_dispatch
@@ -89,10 +196,39 @@ table = {
     (gc_func_do_allot)rc_do_allot,
     (gc_func_set_ptr)rc_set_ptr,
     (gc_func_set_ptr)rc_set_new_ptr,
-    (gc_func_space_used)rc_space_used
+    (gc_func_fill_ptrs)rc_fill_ptrs,
+    (gc_func_copy_ptrs)rc_copy_ptrs,
+    (gc_func_space_used)rc_space_used,
+    (gc_func_heap_stats)rc_heap_stats,
+    (gc_func_resize)rc_resize,
+    NULL,
+    (gc_func_load_image)rc_load_image
 };
 
 gc_dispatch *
 rc_get_dispatch_table() {
     return &table;
 }
+
+static gc_dispatch
+table_incremental = {
+    (gc_func_init)rc_init_default_incremental,
+    (gc_func_free)rc_free,
+    (gc_func_can_allot_p)rc_can_allot_p,
+    (gc_func_collect)rc_collect,
+    (gc_func_do_allot)rc_do_allot,
+    (gc_func_set_ptr)rc_set_ptr,
+    (gc_func_set_ptr)rc_set_new_ptr,
+    (gc_func_fill_ptrs)rc_fill_ptrs,
+    (gc_func_copy_ptrs)rc_copy_ptrs,
+    (gc_func_space_used)rc_space_used,
+    (gc_func_heap_stats)rc_heap_stats,
+    (gc_func_resize)rc_resize,
+    NULL,
+    (gc_func_load_image)rc_load_image
+};
+
+gc_dispatch *
+rc_get_dispatch_table_incremental() {
+    return &table_incremental;
+}
@@ -6,18 +6,45 @@
 #include "quickfit/quickfit.h"
 #include "collectors/common.h"
 
+// Default number of objects the incremental mode frees per barrier
+// or allocation.
+#define RC_DEFAULT_MAX_FREES 64
+
 typedef struct {
     quick_fit *qf;
+    // Objects whose ref count has dropped to zero but which haven't
+    // been freed yet.
     vector *decrefs;
+    // Maximum number of objects to free per barrier or allocation. 0
+    // means that objects are freed transitively right away.
+    size_t max_frees;
 } ref_counting_gc;
 
 gc_dispatch *rc_get_dispatch_table();
+// Frees at most RC_DEFAULT_MAX_FREES objects at a time.
+gc_dispatch *rc_get_dispatch_table_incremental();
 
 ref_counting_gc *rc_init(ptr start, size_t max_used);
+ref_counting_gc *rc_init_incremental(ptr start, size_t size,
+                                     size_t max_frees);
 void rc_free(ref_counting_gc *me);
 
 bool rc_can_allot_p(ref_counting_gc *me, size_t n_bytes);
+// Frees all pending objects.
+void rc_collect(ref_counting_gc *me, vector *roots);
 ptr rc_do_allot(ref_counting_gc *me, int type, size_t n_bytes);
+
+void rc_set_ptr(ref_counting_gc *me, ref *from, ptr to);
+void rc_set_new_ptr(ref_counting_gc *me, ref *from, ptr to);
+void rc_fill_ptrs(ref_counting_gc *me, ref *from, size_t n, ptr to);
+void rc_copy_ptrs(ref_counting_gc *me, ref *from, ref *src, size_t n);
 size_t rc_space_used(ref_counting_gc *me);
+void rc_heap_stats(ref_counting_gc *me, gc_stats *stats);
+
+// Heap resizing
+bool rc_resize(ref_counting_gc *me, size_t size);
+
+// Heap images
+bool rc_load_image(ref_counting_gc *me, size_t n_bytes);
 
 #endif
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <string.h>
+#include "datatypes/common.h"
+#include "collectors/stats.h"
+
+void
+gs_clear(gc_stats *me) {
+    memset(me, 0, sizeof(gc_stats));
+}
+
+static inline size_t
+gs_bucket_index(uint64_t v) {
+    if (v < GS_SUB_BUCKETS) {
+        return v;
+    }
+    size_t mag = 63 - __builtin_clzll(v);
+    size_t sub = (v >> (mag - GS_SUB_BITS)) & (GS_SUB_BUCKETS - 1);
+    return (mag - GS_SUB_BITS + 1) * GS_SUB_BUCKETS + sub;
+}
+
+// Largest value that falls in the bucket.
+static uint64_t
+gs_bucket_max(size_t i) {
+    if (i < GS_SUB_BUCKETS) {
+        return i;
+    }
+    size_t shift = i / GS_SUB_BUCKETS - 1;
+    uint64_t sub = i % GS_SUB_BUCKETS;
+    uint64_t lo = (GS_SUB_BUCKETS + sub) << shift;
+    return lo + ((uint64_t)1 << shift) - 1;
+}
+
+void
+gs_record_pause(gc_stats *me, uint64_t ns) {
+    me->n_collections++;
+    me->pause_total += ns;
+    me->pause_max = MAX(me->pause_max, ns);
+    me->pauses[gs_bucket_index(ns)]++;
+}
+
+uint64_t
+gs_pause_percentile(gc_stats *me, double pct) {
+    if (!me->n_collections) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(pct / 100 * me->n_collections + 0.5);
+    rank = MAX(rank, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < GS_N_BUCKETS; i++) {
+        seen += me->pauses[i];
+        if (seen >= rank) {
+            return MIN(gs_bucket_max(i), me->pause_max);
+        }
+    }
+    return me->pause_max;
+}
+
+double
+gs_fragmentation(gc_stats *me) {
+    if (!me->free_space) {
+        return 0;
+    }
+    return 1 - (double)me->largest_free_block / me->free_space;
+}
+
+void
+gs_set_quick_fit(gc_stats *me, quick_fit *qf) {
+    me->free_space = qf->free_space;
+    me->n_free_blocks = qf->n_blocks;
+    me->largest_free_block = qf_largest_free_block(qf);
+}
+
+void
+gs_set_free_space(gc_stats *me, size_t free_space) {
+    me->free_space = free_space;
+    me->n_free_blocks = free_space ? 1 : 0;
+    me->largest_free_block = free_space;
+}
+
+void
+gs_print(gc_stats *me) {
+    double avg = me->n_collections
+        ? (double)me->pause_total / me->n_collections : 0;
+    printf("%lu collections, pauses avg %.3f ms, p50 %.3f ms, "
+           "p99 %.3f ms, max %.3f ms\n",
+           me->n_collections, avg / 1000 / 1000,
+           (double)gs_pause_percentile(me, 50) / 1000 / 1000,
+           (double)gs_pause_percentile(me, 99) / 1000 / 1000,
+           (double)me->pause_max / 1000 / 1000);
+    printf("%lu MB allocated, %lu MB survived in total, %lu MB promoted, "
+           "%lu MB large, %lu free blocks, %.1f%% fragmentation\n",
+           me->bytes_allocated >> 20, me->bytes_survived_total >> 20,
+           me->bytes_promoted >> 20, me->bytes_large >> 20,
+           me->n_free_blocks,
+           gs_fragmentation(me) * 100);
+}
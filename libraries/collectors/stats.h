@@ -0,0 +1,54 @@
+#ifndef COLLECTORS_STATS_H
+#define COLLECTORS_STATS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "quickfit/quickfit.h"
+
+// Pauses are recorded in a log-linear histogram, like in
+// HdrHistogram. Values below GS_SUB_BUCKETS get one bucket each and
+// every larger power of two is split into GS_SUB_BUCKETS buckets, so
+// the relative error is at most 1 / GS_SUB_BUCKETS.
+#define GS_SUB_BITS     4
+#define GS_SUB_BUCKETS  (1 << GS_SUB_BITS)
+#define GS_N_BUCKETS    ((64 - GS_SUB_BITS + 1) * GS_SUB_BUCKETS)
+
+typedef struct {
+    // Counted by the vm. Times are in nanoseconds.
+    size_t n_collections;
+    uint64_t pause_total;
+    uint64_t pause_max;
+    size_t bytes_allocated;
+    // Bytes live after the last collection and the sum over all
+    // collections.
+    size_t bytes_survived;
+    size_t bytes_survived_total;
+    uint64_t pauses[GS_N_BUCKETS];
+
+    // Filled in by the collector when a snapshot is taken. Collectors
+    // without free lists report the free space as a single block.
+    size_t bytes_promoted;
+    // Bytes in objects outside of the resizable heap.
+    size_t bytes_large;
+    size_t free_space;
+    size_t n_free_blocks;
+    size_t largest_free_block;
+} gc_stats;
+
+void gs_clear(gc_stats *me);
+void gs_record_pause(gc_stats *me, uint64_t ns);
+
+// Returns the pause time at the given percentile. It is accurate to
+// within the histogram's resolution.
+uint64_t gs_pause_percentile(gc_stats *me, double pct);
+
+// Returns how much of the free space isn't in the largest free
+// block, between 0 and 1.
+double gs_fragmentation(gc_stats *me);
+
+void gs_set_quick_fit(gc_stats *me, quick_fit *qf);
+void gs_set_free_space(gc_stats *me, size_t free_space);
+
+void gs_print(gc_stats *me);
+
+#endif
@@ -0,0 +1,157 @@
+#include <string.h>
+#include "collectors/trace.h"
+
+trace_recorder *
+tr_init(char *path, size_t heap_size) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return NULL;
+    }
+    trace_recorder *me = malloc(sizeof(trace_recorder));
+    me->f = f;
+    me->n_allocs = 0;
+    me->n_ops = 0;
+    me->n_unresolved = 0;
+    tr_forget_recent(me);
+    fwrite(TR_MAGIC, 1, strlen(TR_MAGIC), f);
+    fputc(TR_VERSION, f);
+    tr_record_uint(me, heap_size);
+    return me;
+}
+
+size_t
+tr_free(trace_recorder *me) {
+    size_t n_unresolved = me->n_unresolved;
+    fclose(me->f);
+    free(me);
+    return n_unresolved;
+}
+
+void
+tr_record_op(trace_recorder *me, tr_op op) {
+    putc(op, me->f);
+    me->n_ops++;
+}
+
+void
+tr_record_uint(trace_recorder *me, uint64_t n) {
+    while (n >= 0x80) {
+        putc((n & 0x7f) | 0x80, me->f);
+        n >>= 7;
+    }
+    putc(n, me->f);
+}
+
+void
+tr_record_int(trace_recorder *me, int64_t n) {
+    tr_record_uint(me, ((uint64_t)n << 1) ^ (uint64_t)(n >> 63));
+}
+
+void
+tr_record_double(trace_recorder *me, double d) {
+    fwrite(&d, sizeof(double), 1, me->f);
+}
+
+void
+tr_record_ref(trace_recorder *me, vector *roots, ptr p) {
+    if (!p) {
+        tr_record_uint(me, TR_REF_NULL);
+        return;
+    }
+    if (P_TAGGED_P(p)) {
+        tr_record_uint(me, (1 << 2) | TR_REF_NULL);
+        tr_record_int(me, P_UNTAG_INT(p));
+        return;
+    }
+    size_t n = MIN(me->n_allocs, TR_N_RECENT);
+    for (size_t i = 0; i < n; i++) {
+        size_t idx = (me->n_allocs - 1 - i) % TR_N_RECENT;
+        if (me->recent[idx] == p) {
+            tr_record_uint(me, (i << 2) | TR_REF_RECENT);
+            return;
+        }
+    }
+    for (size_t i = roots->used; i > 0; i--) {
+        if (roots->array[i - 1] == p) {
+            tr_record_uint(me, ((i - 1) << 2) | TR_REF_ROOT);
+            return;
+        }
+    }
+    tr_record_uint(me, TR_REF_UNRESOLVED);
+    me->n_unresolved++;
+}
+
+void
+tr_record_alloc(trace_recorder *me, ptr p) {
+    me->recent[me->n_allocs % TR_N_RECENT] = p;
+    me->n_allocs++;
+}
+
+void
+tr_forget_recent(trace_recorder *me) {
+    memset(me->recent, 0, sizeof(me->recent));
+}
+
+trace *
+tr_read(char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    if (size < 0) {
+        fclose(f);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_SET);
+    trace *me = malloc(sizeof(trace));
+    me->data = malloc(MAX(size, 1));
+    me->size = fread(me->data, 1, size, f);
+    fclose(f);
+    size_t n = strlen(TR_MAGIC);
+    if (me->size <= n + 1 || memcmp(me->data, TR_MAGIC, n) ||
+        me->data[n] != TR_VERSION) {
+        tr_trace_free(me);
+        return NULL;
+    }
+    me->pos = n + 1;
+    me->heap_size = tr_next_uint(me);
+    me->start = me->pos;
+    return me;
+}
+
+void
+tr_trace_free(trace *me) {
+    free(me->data);
+    free(me);
+}
+
+uint64_t
+tr_next_uint(trace *me) {
+    uint64_t n = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t b = tr_next_byte(me);
+        n |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    return n;
+}
+
+int64_t
+tr_next_int(trace *me) {
+    uint64_t n = tr_next_uint(me);
+    return (int64_t)(n >> 1) ^ -(int64_t)(n & 1);
+}
+
+double
+tr_next_double(trace *me) {
+    double d = 0;
+    if (me->pos + sizeof(double) <= me->size) {
+        memcpy(&d, me->data + me->pos, sizeof(double));
+    }
+    me->pos += sizeof(double);
+    return d;
+}
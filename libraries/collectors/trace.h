@@ -0,0 +1,107 @@
+#ifndef COLLECTORS_TRACE_H
+#define COLLECTORS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "datatypes/vector.h"
+#include "collectors/common.h"
+
+// Traces of vm operations that can be replayed with any collector.
+//
+// A trace starts with TR_MAGIC, a version byte and the heap size.
+// Then come the operations, each an opcode byte followed by its
+// operands. Integers are stored as LEB128 varints.
+//
+// Object addresses differ between collectors so references are
+// stored as an index into the root stack or as the number of
+// allocations since the object was allocated. The replayer keeps the
+// last TR_N_RECENT allocated objects at the bottom of the root stack
+// since the mutator may hold them in C variables while it
+// allocates. References the recorder can't express are replayed as
+// null.
+#define TR_MAGIC        "GCTR"
+#define TR_VERSION      1
+#define TR_N_RECENT     16
+
+typedef enum {
+    TR_ADD = 1,
+    TR_REMOVE,
+    TR_SET,
+    TR_SET_SLOT,
+    TR_INT,
+    TR_FLOAT,
+    TR_ARRAY,
+    TR_WRAPPER,
+    TR_COLLECT,
+    TR_RAW_ARRAY
+} tr_op;
+
+// Tags in the low two bits of recorded references. Tagged ints are
+// recorded as TR_REF_NULL with index 1 followed by their value.
+#define TR_REF_NULL         0
+#define TR_REF_ROOT         1
+#define TR_REF_RECENT       2
+#define TR_REF_UNRESOLVED   3
+
+typedef struct {
+    FILE *f;
+    ptr recent[TR_N_RECENT];
+    size_t n_allocs;
+    size_t n_ops;
+    size_t n_unresolved;
+} trace_recorder;
+
+// Recording, used by the vm.
+trace_recorder *tr_init(char *path, size_t heap_size);
+// Closes the file and returns the number of references that couldn't
+// be recorded.
+size_t tr_free(trace_recorder *me);
+
+void tr_record_op(trace_recorder *me, tr_op op);
+void tr_record_uint(trace_recorder *me, uint64_t n);
+void tr_record_int(trace_recorder *me, int64_t n);
+void tr_record_double(trace_recorder *me, double d);
+void tr_record_ref(trace_recorder *me, vector *roots, ptr p);
+void tr_record_alloc(trace_recorder *me, ptr p);
+// Called on collections since moving collectors invalidate the
+// recent allocations.
+void tr_forget_recent(trace_recorder *me);
+
+// Replaying
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t heap_size;
+    // Where the operations start and the read position.
+    size_t start;
+    size_t pos;
+} trace;
+
+typedef struct {
+    size_t n_ops;
+    uint64_t time;
+    size_t peak_used;
+    gc_stats gc;
+} tr_result;
+
+// Returns NULL if the file can't be read or isn't a trace.
+trace *tr_read(char *path);
+void tr_trace_free(trace *me);
+
+// Decoding. Reading past the end returns zeroes.
+static inline bool
+tr_at_end_p(trace *me) {
+    return me->pos >= me->size;
+}
+
+static inline uint8_t
+tr_next_byte(trace *me) {
+    return me->pos < me->size ? me->data[me->pos++] : 0;
+}
+
+uint64_t tr_next_uint(trace *me);
+int64_t tr_next_int(trace *me);
+double tr_next_double(trace *me);
+
+#endif
@@ -0,0 +1,166 @@
+// Template for vms bound to one collector at compile time. The vm
+// functions call the collector through the function pointers in its
+// gc_dispatch table, so neither allocation nor barriers can be
+// inlined. Including this header with the parameters below defined
+// generates static inline versions of the hot vm functions that call
+// the collector's fast paths directly:
+//
+//     #define VM_SPEC_PREFIX      cgv
+//     #define VM_SPEC_GC          copying_gc
+//     #define VM_SPEC_DISPATCH    cg_get_dispatch_table
+//     #define VM_SPEC_ALLOT       cg_allot_fast
+//     #include "collectors/vm-spec.h"
+//
+// defines cgv_init, cgv_add, cgv_set_slot, cgv_array_init and so on.
+// The parameters are undefined again so the header can be included
+// once per collector.
+//
+// VM_SPEC_PREFIX      Prefix of the generated functions.
+// VM_SPEC_GC          Type of the collector.
+// VM_SPEC_DISPATCH    Function returning its dispatch table.
+// VM_SPEC_ALLOT       Allocates (gc, type, n_bytes) without collecting
+//                     and returns 0 if it can't. Optional, by default
+//                     every allocation takes the vm_allot slow path.
+// VM_SPEC_SET_PTR     Barrier for (gc, from, to). Optional, by
+//                     default a plain store.
+// VM_SPEC_SET_NEW_PTR Barrier for the slots of new objects and for
+//                     new roots. Defaults to VM_SPEC_SET_PTR.
+//
+// The generated vms are ordinary vms and the dynamic functions work
+// on them too. But the generated functions don't record traces and
+// must only be used while the vm has no attached mutators.
+#include "collectors/vm.h"
+
+#ifndef VM_SPEC_FN
+#define VM_SPEC_CAT2(a, b) a##_##b
+#define VM_SPEC_CAT(a, b) VM_SPEC_CAT2(a, b)
+#define VM_SPEC_FN(name) VM_SPEC_CAT(VM_SPEC_PREFIX, name)
+
+// Runs a barrier on a root like vm_root_barrier in vm.c.
+#ifdef GC_COMPRESSED_REFS
+#define VM_SPEC_ROOT_BARRIER(barrier, gc, root, p)  \
+    do {                                            \
+        ref _r = REF_ENCODE(*(root));               \
+        barrier(gc, &_r, p);                        \
+        *(root) = (p);                              \
+    } while (0)
+#else
+#define VM_SPEC_ROOT_BARRIER(barrier, gc, root, p) barrier(gc, root, p)
+#endif
+#endif
+
+#if !defined(VM_SPEC_PREFIX) || !defined(VM_SPEC_GC) || \
+    !defined(VM_SPEC_DISPATCH)
+#error "VM_SPEC_PREFIX, VM_SPEC_GC and VM_SPEC_DISPATCH must be defined"
+#endif
+
+#ifndef VM_SPEC_ALLOT
+#define VM_SPEC_ALLOT(gc, type, n_bytes) 0
+#endif
+
+#ifndef VM_SPEC_SET_PTR
+#define VM_SPEC_SET_PTR(gc, from, to) \
+    ((void)(gc), *(from) = REF_ENCODE(to))
+#endif
+
+#ifndef VM_SPEC_SET_NEW_PTR
+#define VM_SPEC_SET_NEW_PTR VM_SPEC_SET_PTR
+#endif
+
+static inline vm *
+VM_SPEC_FN(init)(size_t size) {
+    return vm_init(VM_SPEC_DISPATCH(), size);
+}
+
+static inline ptr
+VM_SPEC_FN(allot)(vm *me, size_t size, int type) {
+    ptr p = VM_SPEC_ALLOT((VM_SPEC_GC *)me->gc_obj, type, size);
+    if (p) {
+        me->stats.bytes_allocated += size;
+        return p;
+    }
+    return vm_allot(me, size, type);
+}
+
+// Roots interface
+static inline ptr
+VM_SPEC_FN(add)(vm *me, ptr p) {
+    v_add(me->roots, 0);
+    ptr *root = &me->roots->array[me->roots->used - 1];
+    VM_SPEC_ROOT_BARRIER(VM_SPEC_SET_NEW_PTR,
+                         (VM_SPEC_GC *)me->gc_obj, root, p);
+    return p;
+}
+
+static inline ptr
+VM_SPEC_FN(remove)(vm *me) {
+    ptr p = v_remove(me->roots);
+    ptr *root = &me->roots->array[me->roots->used];
+    VM_SPEC_ROOT_BARRIER(VM_SPEC_SET_PTR,
+                         (VM_SPEC_GC *)me->gc_obj, root, 0);
+    return p;
+}
+
+static inline void
+VM_SPEC_FN(set)(vm *me, size_t i, ptr p) {
+    if (i >= vm_size(me)) {
+        error("Out of bounds %lu!", i);
+    }
+    VM_SPEC_ROOT_BARRIER(VM_SPEC_SET_PTR,
+                         (VM_SPEC_GC *)me->gc_obj, &me->roots->array[i], p);
+}
+
+// Barriers
+static inline void
+VM_SPEC_FN(set_slot)(vm *me, ptr p_from, size_t i, ptr p) {
+    VM_SPEC_SET_PTR((VM_SPEC_GC *)me->gc_obj, SLOT_P(p_from, i), p);
+}
+
+// Object allocation. Values are kept on the root stack while
+// allocating like the dynamic versions do.
+static inline ptr
+VM_SPEC_FN(boxed_int_init)(vm *me, int value) {
+    ptr item = VM_SPEC_FN(allot)(me, NPTRS(2), TYPE_INT);
+    *VALUE_P(item) = value;
+    return item;
+}
+
+static inline ptr
+VM_SPEC_FN(boxed_float_init)(vm *me, double value) {
+    ptr item = VM_SPEC_FN(allot)(me, NPTRS(2), TYPE_FLOAT);
+    *(double *)VALUE_P(item) = value;
+    return item;
+}
+
+static inline ptr
+VM_SPEC_FN(wrapper_init)(vm *me, ptr value) {
+    VM_SPEC_FN(add)(me, value);
+    ptr item = VM_SPEC_FN(allot)(me, P_SLOTS_SIZE(1), TYPE_WRAPPER);
+    VM_SPEC_SET_NEW_PTR((VM_SPEC_GC *)me->gc_obj,
+                        SLOT_P(item, 0), vm_last(me));
+    VM_SPEC_FN(remove)(me);
+    return item;
+}
+
+static inline ptr
+VM_SPEC_FN(array_init)(vm *me, int n, ptr value) {
+    VM_SPEC_FN(add)(me, value);
+    VM_SPEC_FN(add)(me, VM_SPEC_FN(boxed_int_init)(me, n));
+    ptr item = VM_SPEC_FN(allot)(me, P_ARRAY_SIZE(n), TYPE_ARRAY);
+    VM_SPEC_GC *gc = me->gc_obj;
+    ptr *roots = &me->roots->array[me->roots->used - 2];
+    VM_SPEC_SET_NEW_PTR(gc, SLOT_P(item, 0), roots[1]);
+    for (int i = 1; i <= n; i++) {
+        VM_SPEC_SET_NEW_PTR(gc, SLOT_P(item, i), roots[0]);
+    }
+    VM_SPEC_FN(remove)(me);
+    VM_SPEC_FN(remove)(me);
+    return item;
+}
+
+#undef VM_SPEC_PREFIX
+#undef VM_SPEC_GC
+#undef VM_SPEC_DISPATCH
+#undef VM_SPEC_ALLOT
+#undef VM_SPEC_SET_PTR
+#undef VM_SPEC_SET_NEW_PTR
@@ -1,45 +1,282 @@
 #include <assert.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include "datatypes/bitarray.h"
+#include "threads/threads.h"
 #include "collectors/vm.h"
 
-ptr
-vm_remove(vm *me) {
+// Roots are full ptrs but barriers store refs. With compressed refs
+// the barrier is run on a ref holding the old value of the root and
+// the new value is stored in the root afterwards. No barrier cares
+// about the address of a root, only that it is outside the heap.
+static inline void
+vm_root_barrier(vm *me, gc_func_set_ptr set_ptr, ptr *root, ptr p) {
+#ifdef GC_COMPRESSED_REFS
+    ref r = REF_ENCODE(*root);
+    set_ptr(me->gc_obj, &r, p);
+    *root = p;
+#else
+    set_ptr(me->gc_obj, root, p);
+#endif
+}
+
+// The public functions record themselves in the trace if one is
+// being recorded. The vm uses the static versions internally.
+static ptr
+vm_pop(vm *me) {
     ptr p = v_remove(me->roots);
     ptr *ptr = &me->roots->array[me->roots->used];
-    me->gc_dispatch->set_ptr(me->gc_obj, ptr, 0);
+    vm_root_barrier(me, me->gc_dispatch->set_ptr, ptr, 0);
     return p;
 }
 
-vm *
-vm_init(gc_dispatch *gc_dispatch, size_t size) {
+ptr
+vm_remove(vm *me) {
+    if (me->trace) {
+        tr_record_op(me->trace, TR_REMOVE);
+    }
+    return vm_pop(me);
+}
+
+// The heap is reserved by the caller.
+static vm *
+vm_init_heap(gc_dispatch *gc_dispatch, ptr memory, size_t size) {
     assert(size >= 4096);
     vm *me = malloc(sizeof(vm));
     me->roots = v_init(16);
-    me->memory = (ptr)malloc(size);
+    me->memory = memory;
     me->size = size;
+    me->min_size = size;
+    me->max_size = size;
+    me->target_occupancy = 0;
     me->gc_dispatch = gc_dispatch;
     me->gc_obj = gc_dispatch->init(me->memory, size);
+    me->trace = NULL;
+    me->owner = me;
+    me->tlab.here = me->tlab.end = 0;
+    me->mutators = v_init(4);
+    v_add(me->mutators, (ptr)me);
+    me->all_roots = v_init(16);
+    me->n_mutators = 1;
+    me->lock = false;
+    me->gc_requested = false;
+    me->n_parked = 0;
+    vm_stats_reset(me);
     return me;
 }
 
+vm *
+vm_init(gc_dispatch *gc_dispatch, size_t size) {
+    return vm_init_heap(gc_dispatch, heap_reserve(size), size);
+}
+
 void
 vm_free(vm *me) {
+    if (me->n_mutators > 1) {
+        error("Mutators must be detached before the vm is freed!\n");
+    }
+    if (me->trace) {
+        vm_trace_stop(me);
+    }
     while (me->roots->used) {
-        vm_remove(me);
+        vm_pop(me);
     }
     v_free(me->roots);
+    v_free(me->mutators);
+    v_free(me->all_roots);
     me->gc_dispatch->free(me->gc_obj);
-    free((void*)me->memory);
+    heap_unreserve(me->memory, me->max_size);
     free(me);
 }
 
-ptr
-vm_add(vm *me, ptr p) {
+// Safepoints. A mutator that collects while others are attached takes
+// the lock, sets gc_requested and waits for the others to park. The
+// parked count and the flag are both sequentially consistent so a
+// mutator leaving its parked state either sees the flag set again or
+// is seen as running by the collector.
+void
+vm_enter_blocking(vm *me) {
+    __atomic_add_fetch(&me->owner->n_parked, 1, __ATOMIC_SEQ_CST);
+}
+
+void
+vm_leave_blocking(vm *me) {
+    vm *owner = me->owner;
+    while (true) {
+        while (__atomic_load_n(&owner->gc_requested, __ATOMIC_SEQ_CST)) {
+            thr_yield();
+        }
+        __atomic_sub_fetch(&owner->n_parked, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&owner->gc_requested, __ATOMIC_SEQ_CST)) {
+            return;
+        }
+        __atomic_add_fetch(&owner->n_parked, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static inline void
+vm_safepoint(vm *me) {
+    if (__atomic_load_n(&me->owner->gc_requested, __ATOMIC_SEQ_CST)) {
+        vm_enter_blocking(me);
+        vm_leave_blocking(me);
+    }
+}
+
+// Mutators waiting for the lock park if a collection is requested
+// since the collecting mutator holds it.
+static void
+vm_lock(vm *me) {
+    vm *owner = me->owner;
+    while (__atomic_test_and_set(&owner->lock, __ATOMIC_ACQUIRE)) {
+        vm_safepoint(me);
+        thr_yield();
+    }
+}
+
+static void
+vm_unlock(vm *me) {
+    __atomic_clear(&me->owner->lock, __ATOMIC_RELEASE);
+}
+
+// Called with the lock held.
+static void
+vm_stop_world(vm *me) {
+    vm *owner = me->owner;
+    __atomic_store_n(&owner->gc_requested, true, __ATOMIC_SEQ_CST);
+    int n_others = owner->n_mutators - 1;
+    while (__atomic_load_n(&owner->n_parked, __ATOMIC_SEQ_CST) < n_others) {
+        thr_yield();
+    }
+}
+
+static void
+vm_start_world(vm *me) {
+    __atomic_store_n(&me->owner->gc_requested, false, __ATOMIC_SEQ_CST);
+}
+
+vm *
+vm_attach(vm *me) {
+    vm *owner = me->owner;
+    if (!owner->gc_dispatch->refill) {
+        error("The collector can't share its heap!\n");
+    }
+    if (owner->trace) {
+        error("Can't add mutators while recording a trace!\n");
+    }
+    vm *m = malloc(sizeof(vm));
+    vm_lock(me);
+    *m = *owner;
+    m->roots = v_init(16);
+    m->owner = owner;
+    m->tlab.here = m->tlab.end = 0;
+    m->mutators = NULL;
+    m->all_roots = NULL;
+    gs_clear(&m->stats);
+    v_add(owner->mutators, (ptr)m);
+    __atomic_add_fetch(&owner->n_mutators, 1, __ATOMIC_SEQ_CST);
+    vm_unlock(me);
+    return m;
+}
+
+// The world is stopped so that the mutator's allocations can be added
+// to the owner's stats.
+void
+vm_detach(vm *me) {
+    vm *owner = me->owner;
+    if (me == owner) {
+        error("The owner of the heap can't be detached!\n");
+    }
+    while (me->roots->used) {
+        vm_pop(me);
+    }
+    vm_lock(me);
+    vm_stop_world(me);
+    owner->stats.bytes_allocated += me->stats.bytes_allocated;
+    vector *v = owner->mutators;
+    for (size_t i = 0; i < v->used; i++) {
+        if (v->array[i] == (ptr)me) {
+            v->array[i] = v->array[--v->used];
+            break;
+        }
+    }
+    __atomic_sub_fetch(&owner->n_mutators, 1, __ATOMIC_SEQ_CST);
+    vm_start_world(me);
+    vm_unlock(me);
+    v_free(me->roots);
+    free(me);
+}
+
+static bool
+vm_resize(vm *me, size_t size) {
+    if (!me->gc_dispatch->resize(me->gc_obj, size)) {
+        return false;
+    }
+    me->size = size;
+    return true;
+}
+
+vm *
+vm_init_growable(gc_dispatch *gc_dispatch,
+                 size_t min_size, size_t max_size,
+                 double target_occupancy) {
+    if (!gc_dispatch->resize) {
+        error("The collector can't resize its heap!\n");
+    }
+    min_size = ALIGN(min_size, VM_HEAP_ALIGNMENT);
+    max_size = ALIGN(max_size, VM_HEAP_ALIGNMENT);
+    assert(min_size <= max_size);
+    assert(target_occupancy > 0 && target_occupancy <= 1);
+    vm *me = vm_init(gc_dispatch, max_size);
+    me->min_size = min_size;
+    me->target_occupancy = target_occupancy;
+    if (!vm_resize(me, min_size)) {
+        error("Can't shrink the empty heap!\n");
+    }
+    vm_stats_reset(me);
+    return me;
+}
+
+// Sizes the heap for the live data after a collection. The usable
+// part of the heap can be smaller than its size, e.g. for semispace
+// collectors, so the occupancy is measured against the free space
+// the collector reports.
+static void
+vm_adjust_heap(vm *me) {
+    if (me->min_size == me->max_size) {
+        return;
+    }
+    gc_stats gs;
+    gs_clear(&gs);
+    me->gc_dispatch->heap_stats(me->gc_obj, &gs);
+    size_t used = vm_space_used(me) - gs.bytes_large;
+    double occupancy = (double)used / MAX(used + gs.free_space, 1);
+    size_t want = (size_t)(me->size * occupancy / me->target_occupancy);
+    want = ALIGN(want, VM_HEAP_ALIGNMENT);
+    want = CLAMP(want, me->min_size, me->max_size);
+    if (want > me->size || want < me->size / 2) {
+        vm_resize(me, want);
+    }
+}
+
+static ptr
+vm_push(vm *me, ptr p) {
     v_add(me->roots, 0);
     ptr *ptr = &me->roots->array[me->roots->used - 1];
-    me->gc_dispatch->set_new_ptr(me->gc_obj, ptr, p);
+    vm_root_barrier(me, me->gc_dispatch->set_new_ptr, ptr, p);
     return p;
 }
 
+ptr
+vm_add(vm *me, ptr p) {
+    if (me->trace) {
+        tr_record_op(me->trace, TR_ADD);
+        tr_record_ref(me->trace, me->roots, p);
+    }
+    return vm_push(me, p);
+}
+
 ptr
 vm_last(vm *me) {
     return v_peek(me->roots);
@@ -55,7 +292,12 @@ vm_set(vm *me, size_t i, ptr p) {
     if (i >= vm_size(me)) {
         error("Out of bounds %lu!", i);
     }
-    me->gc_dispatch->set_ptr(me->gc_obj, &me->roots->array[i], p);
+    if (me->trace) {
+        tr_record_op(me->trace, TR_SET);
+        tr_record_uint(me->trace, i);
+        tr_record_ref(me->trace, me->roots, p);
+    }
+    vm_root_barrier(me, me->gc_dispatch->set_ptr, &me->roots->array[i], p);
 }
 
 ptr
@@ -63,84 +305,834 @@ vm_get(vm *me, size_t i) {
     return me->roots->array[i];
 }
 
+// With several mutators their roots are collected together and
+// copied back since moving collectors update them.
+static vector *
+vm_gather_roots(vm *me) {
+    vector *all = me->all_roots;
+    all->used = 0;
+    for (size_t i = 0; i < me->mutators->used; i++) {
+        vm *m = (vm *)me->mutators->array[i];
+        for (size_t j = 0; j < m->roots->used; j++) {
+            v_add(all, m->roots->array[j]);
+        }
+    }
+    return all;
+}
+
+static void
+vm_scatter_roots(vm *me) {
+    ptr *p = me->all_roots->array;
+    for (size_t i = 0; i < me->mutators->used; i++) {
+        vm *m = (vm *)me->mutators->array[i];
+        memcpy(m->roots->array, p, NPTRS(m->roots->used));
+        p += m->roots->used;
+    }
+}
+
+// The buffers of all mutators are invalidated and their allocations
+// added to the owner's stats. Other mutators must be stopped.
+static void
+vm_collect_now(vm *me) {
+    vm *owner = me->owner;
+    uint64_t start = nano_count();
+    bool shared = owner->n_mutators > 1;
+    vector *roots = shared ? vm_gather_roots(owner) : owner->roots;
+    owner->gc_dispatch->collect(owner->gc_obj, roots);
+    if (shared) {
+        vm_scatter_roots(owner);
+    }
+    for (size_t i = 0; i < owner->mutators->used; i++) {
+        vm *m = (vm *)owner->mutators->array[i];
+        m->tlab.here = m->tlab.end = 0;
+        if (m != owner) {
+            owner->stats.bytes_allocated += m->stats.bytes_allocated;
+            m->stats.bytes_allocated = 0;
+        }
+    }
+    vm_adjust_heap(owner);
+    gs_record_pause(&owner->stats, nano_count() - start);
+    size_t live = vm_space_used(owner);
+    owner->stats.bytes_survived = live;
+    owner->stats.bytes_survived_total += live;
+    if (owner->trace) {
+        tr_forget_recent(owner->trace);
+    }
+}
+
 void
 vm_collect(vm *me) {
-    me->gc_dispatch->collect(me->gc_obj, me->roots);
+    if (me->trace) {
+        tr_record_op(me->trace, TR_COLLECT);
+    }
+    if (__atomic_load_n(&me->owner->n_mutators, __ATOMIC_RELAXED) == 1) {
+        vm_collect_now(me);
+        return;
+    }
+    vm_lock(me);
+    vm_stop_world(me);
+    vm_collect_now(me);
+    vm_start_world(me);
+    vm_unlock(me);
 }
 
 void
 vm_set_slot(vm *me, ptr p_from, size_t i, ptr p) {
+    if (me->trace) {
+        tr_record_op(me->trace, TR_SET_SLOT);
+        tr_record_ref(me->trace, me->roots, p_from);
+        tr_record_uint(me->trace, i);
+        tr_record_ref(me->trace, me->roots, p);
+    }
     me->gc_dispatch->set_ptr(me->gc_obj, SLOT_P(p_from, i), p);
 }
 
-static ptr
-vm_allot(vm *me, size_t n_ptrs, int type) {
-    size_t size = NPTRS(n_ptrs);
-    void* gc_obj = me->gc_obj;
+// Collectors without bulk barriers get plain stores.
+static void
+vm_fill_ptrs(vm *me, ref *from, size_t n, ptr p) {
+    gc_func_fill_ptrs fill_ptrs = me->gc_dispatch->fill_ptrs;
+    if (fill_ptrs) {
+        fill_ptrs(me->gc_obj, from, n, p);
+    } else {
+        ref r = REF_ENCODE(p);
+        for (size_t i = 0; i < n; i++) {
+            from[i] = r;
+        }
+    }
+}
+
+static void
+vm_copy_ptrs(vm *me, ref *from, ref *src, size_t n) {
+    gc_func_copy_ptrs copy_ptrs = me->gc_dispatch->copy_ptrs;
+    if (copy_ptrs) {
+        copy_ptrs(me->gc_obj, from, src, n);
+    } else {
+        memmove(from, src, n * sizeof(ref));
+    }
+}
+
+// Bulk writes are recorded as one TR_SET_SLOT per slot. The values
+// are recorded before they are stored so overlapping copies replay
+// correctly.
+static void
+vm_record_set_slots(vm *me, ptr p_from, size_t i, ref *values,
+                    size_t stride, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        tr_record_op(me->trace, TR_SET_SLOT);
+        tr_record_ref(me->trace, me->roots, p_from);
+        tr_record_uint(me->trace, i + j);
+        tr_record_ref(me->trace, me->roots, REF_DECODE(values[j * stride]));
+    }
+}
+
+void
+vm_fill_slots(vm *me, ptr p_from, size_t i, size_t n, ptr p) {
+    if (me->trace) {
+        ref r = REF_ENCODE(p);
+        vm_record_set_slots(me, p_from, i, &r, 0, n);
+    }
+    vm_fill_ptrs(me, SLOT_P(p_from, i), n, p);
+}
+
+void
+vm_copy_slots(vm *me, ptr p_to, size_t i, ptr p_from, size_t j, size_t n) {
+    if (me->trace) {
+        vm_record_set_slots(me, p_to, i, SLOT_P(p_from, j), 1, n);
+    }
+    vm_copy_ptrs(me, SLOT_P(p_to, i), SLOT_P(p_from, j), n);
+}
+
+// Refills the mutator's buffer if tlab is set.
+static bool
+vm_can_allot_p(vm *me, size_t size, bool tlab) {
+    void *gc_obj = me->gc_obj;
     gc_dispatch *gc_dispatch = me->gc_dispatch;
-    if (!gc_dispatch->can_allot_p(gc_obj, size)) {
-        vm_collect(me);
-        if (!gc_dispatch->can_allot_p(gc_obj, size)) {
-            error("Can't allocate %lu bytes! Space used %lu\n",
-                  size, vm_space_used(me));
+    if (tlab) {
+        return gc_dispatch->refill(gc_obj, &me->tlab, size);
+    }
+    return gc_dispatch->can_allot_p(gc_obj, size);
+}
+
+// Collects, and grows the heap if needed, until size bytes fit. The
+// world stays stopped until the heap is big enough since growing it
+// can't happen while buffers are handed out.
+static void
+vm_make_room(vm *me, size_t size, bool tlab) {
+    if (vm_can_allot_p(me, size, tlab)) {
+        return;
+    }
+    vm *owner = me->owner;
+    vm_stop_world(me);
+    vm_collect_now(me);
+    bool ok;
+    while (!(ok = vm_can_allot_p(me, size, tlab)) &&
+           owner->size < owner->max_size) {
+        vm_resize(owner, MIN(owner->size * 2, owner->max_size));
+    }
+    if (!ok) {
+        error("Can't allocate %lu bytes! Space used %lu\n",
+              size, vm_space_used(me));
+    }
+    vm_start_world(me);
+}
+
+// A single mutator allocates directly from the collector. Several
+// allocate small objects from their buffers and everything else with
+// the lock held.
+ptr
+vm_allot(vm *me, size_t size, int type) {
+    me->stats.bytes_allocated += size;
+    if (__atomic_load_n(&me->owner->n_mutators, __ATOMIC_RELAXED) == 1) {
+        vm_make_room(me, size, false);
+        return me->gc_dispatch->do_allot(me->gc_obj, type, size);
+    }
+    vm_safepoint(me);
+    gc_tlab *t = &me->tlab;
+    if (size < GC_TLAB_SIZE / 4) {
+        if (t->here + size > t->end) {
+            vm_lock(me);
+            vm_make_room(me, size, true);
+            vm_unlock(me);
         }
+        ptr p = t->here;
+        t->here += size;
+        AT(p) = t->header | (type << 1) | (t->sized ? (ptr)size << 32 : 0);
+        return p;
     }
-    return gc_dispatch->do_allot(gc_obj, type, size);
+    vm_lock(me);
+    vm_make_room(me, size, false);
+    ptr p = me->gc_dispatch->do_allot(me->gc_obj, type, size);
+    vm_unlock(me);
+    return p;
 }
 
+static ptr
+vm_allocated(vm *me, ptr item) {
+    if (me->trace) {
+        tr_record_alloc(me->trace, item);
+    }
+    return item;
+}
+
+static ptr
+vm_box_int(vm *me, int64_t value) {
+    ptr item = vm_allot(me, NPTRS(2), TYPE_INT);
+    *VALUE_P(item) = value;
+    return item;
+}
 
 ptr
 vm_boxed_int_init(vm *me, int value) {
-    ptr item = vm_allot(me, 2, TYPE_INT);
-    *SLOT_P(item, 0) = value;
-    return item;
+    if (me->trace) {
+        tr_record_op(me->trace, TR_INT);
+        tr_record_int(me->trace, value);
+    }
+    return vm_allocated(me, vm_box_int(me, value));
+}
+
+// Only ints that don't fit in a tagged ptr are boxed.
+ptr
+vm_int_init(vm *me, int64_t value) {
+    if (value >= P_TAG_INT_MIN && value <= P_TAG_INT_MAX) {
+        return P_TAG_INT(value);
+    }
+    if (me->trace) {
+        tr_record_op(me->trace, TR_INT);
+        tr_record_int(me->trace, value);
+    }
+    return vm_allocated(me, vm_box_int(me, value));
+}
+
+int64_t
+vm_int_value(ptr p) {
+    if (P_TAGGED_P(p)) {
+        return P_UNTAG_INT(p);
+    }
+    return (int64_t)*VALUE_P(p);
 }
 
 ptr
 vm_boxed_float_init(vm *me, double value) {
-    ptr item = vm_allot(me, 2, TYPE_FLOAT);
-    *(double *)SLOT_P(item, 0) = value;
-    return item;
+    if (me->trace) {
+        tr_record_op(me->trace, TR_FLOAT);
+        tr_record_double(me->trace, value);
+    }
+    ptr item = vm_allot(me, NPTRS(2), TYPE_FLOAT);
+    *(double *)VALUE_P(item) = value;
+    return vm_allocated(me, item);
 }
 
 // Pointers are pushed onto the root stack because we don't want the
 // collectors to sweep those objects while we are using them. The
 // copying collector might change object addresses and the reference
 // counter might free objects without any references.
+//
+// The elements of new arrays are cleared for collectors with bulk
+// barriers since the barriers read the old values.
+static ptr
+vm_array_allot(vm *me, size_t n) {
+    vm_push(me, vm_box_int(me, n));
+    ptr item = vm_allot(me, P_ARRAY_SIZE(n), TYPE_ARRAY);
+    me->gc_dispatch->set_new_ptr(me->gc_obj, SLOT_P(item, 0), vm_last(me));
+    vm_pop(me);
+    if (me->gc_dispatch->fill_ptrs) {
+        memset(SLOT_P(item, 1), 0, n * sizeof(ref));
+    }
+    return item;
+}
+
 ptr
 vm_array_init(vm *me, int n, ptr value) {
-    vm_add(me, value);
+    if (me->trace) {
+        tr_record_op(me->trace, TR_ARRAY);
+        tr_record_uint(me->trace, n);
+        tr_record_ref(me->trace, me->roots, value);
+    }
+    vm_push(me, value);
+    ptr item = vm_array_allot(me, n);
+    vm_fill_ptrs(me, SLOT_P(item, 1), n, vm_last(me));
+    vm_pop(me);
+    return vm_allocated(me, item);
+}
+
+// Recorded as an array of nulls followed by the slot writes.
+ptr
+vm_array_init_from(vm *me, ptr arr, size_t i, size_t n) {
+    if (me->trace) {
+        tr_record_op(me->trace, TR_ARRAY);
+        tr_record_uint(me->trace, n);
+        tr_record_ref(me->trace, me->roots, 0);
+    }
+    vm_push(me, arr);
+    ptr item = vm_array_allot(me, n);
+    arr = vm_last(me);
+    vm_copy_ptrs(me, SLOT_P(item, 1), SLOT_P(arr, i), n);
+    vm_pop(me);
+    vm_allocated(me, item);
+    if (me->trace) {
+        vm_record_set_slots(me, item, 1, SLOT_P(item, 1), 1, n);
+    }
+    return item;
+}
+
+ptr
+vm_wrapper_init(vm *me, ptr value) {
+    if (me->trace) {
+        tr_record_op(me->trace, TR_WRAPPER);
+        tr_record_ref(me->trace, me->roots, value);
+    }
+    vm_push(me, value);
+    ptr item = vm_allot(me, P_SLOTS_SIZE(1), TYPE_WRAPPER);
 
-    vm_add(me, vm_boxed_int_init(me, n));
-    ptr item = vm_allot(me, 2 + n, TYPE_ARRAY);
     me->gc_dispatch->set_new_ptr(me->gc_obj, SLOT_P(item, 0), vm_last(me));
-    vm_remove(me);
+    vm_pop(me);
+    return vm_allocated(me, item);
+}
 
-    value = vm_last(me);
-    ptr *base = SLOT_P(item, 1);
+// The count is stored directly since the slot isn't scanned. The
+// elements are left for the caller to initialize.
+static ptr
+vm_raw_array_init(vm *me, int type, size_t n) {
+    if (me->trace) {
+        tr_record_op(me->trace, TR_RAW_ARRAY);
+        tr_record_uint(me->trace, type);
+        tr_record_uint(me->trace, n);
+    }
+    size_t size = type == TYPE_BYTE_ARRAY
+        ? ALIGN(n, sizeof(ptr)) : NPTRS(n);
+    ptr item = vm_allot(me, NPTRS(2) + size, type);
+    RAW_COUNT(item) = n;
+    return vm_allocated(me, item);
+}
+
+ptr
+vm_float_array_init(vm *me, size_t n, double value) {
+    ptr item = vm_raw_array_init(me, TYPE_FLOAT_ARRAY, n);
     for (size_t i = 0; i < n; i++) {
-        me->gc_dispatch->set_new_ptr(me->gc_obj, base + i, value);
+        *FLOAT_SLOT_P(item, i) = value;
     }
-    vm_remove(me);
     return item;
 }
 
 ptr
-vm_wrapper_init(vm *me, ptr value) {
-    vm_add(me, value);
-    ptr item = vm_allot(me, 2, TYPE_WRAPPER);
+vm_int_array_init(vm *me, size_t n, int64_t value) {
+    ptr item = vm_raw_array_init(me, TYPE_INT_ARRAY, n);
+    for (size_t i = 0; i < n; i++) {
+        *INT_SLOT_P(item, i) = value;
+    }
+    return item;
+}
 
-    me->gc_dispatch->set_new_ptr(me->gc_obj, SLOT_P(item, 0), vm_last(me));
-    vm_remove(me);
+ptr
+vm_byte_array_init(vm *me, size_t n, uint8_t value) {
+    ptr item = vm_raw_array_init(me, TYPE_BYTE_ARRAY, n);
+    memset(BYTE_SLOT_P(item, 0), value, n);
     return item;
 }
 
 void
 vm_tree_dump(vm *me) {
-    p_print_slots(0, me->roots->array, me->roots->used);
+    for (size_t i = 0; i < me->roots->used; i++) {
+        p_print(2, i, me->roots->array[i]);
+    }
 }
 
 size_t
 vm_space_used(vm *me) {
     return me->gc_dispatch->space_used(me->gc_obj);
 }
+
+void
+vm_stats_snapshot(vm *me, gc_stats *snapshot) {
+    *snapshot = me->stats;
+    me->gc_dispatch->heap_stats(me->gc_obj, snapshot);
+    snapshot->bytes_promoted -= me->promoted_base;
+}
+
+void
+vm_stats_reset(vm *me) {
+    gs_clear(&me->stats);
+    me->gc_dispatch->heap_stats(me->gc_obj, &me->stats);
+    me->promoted_base = me->stats.bytes_promoted;
+}
+
+bool
+vm_trace_start(vm *me, char *path) {
+    if (me->n_mutators > 1) {
+        error("Traces can't be recorded with several mutators!\n");
+    }
+    if (me->roots->used) {
+        error("Traces must start with an empty root stack!\n");
+    }
+    me->trace = tr_init(path, me->max_size);
+    return me->trace != NULL;
+}
+
+size_t
+vm_trace_stop(vm *me) {
+    size_t n_unresolved = tr_free(me->trace);
+    me->trace = NULL;
+    return n_unresolved;
+}
+
+static ptr
+vm_replay_ref(vm *me, trace *t, size_t n_allocs) {
+    uint64_t r = tr_next_uint(t);
+    size_t i = r >> 2;
+    switch (r & 3) {
+    case TR_REF_ROOT:
+        return vm_get(me, TR_N_RECENT + i);
+    case TR_REF_RECENT:
+        return vm_get(me, (n_allocs - 1 - i) % TR_N_RECENT);
+    case TR_REF_NULL:
+        return i ? P_TAG_INT(tr_next_int(t)) : 0;
+    default:
+        return 0;
+    }
+}
+
+vm *
+vm_replay(trace *t, gc_dispatch *gc_dispatch, size_t size, tr_result *res) {
+    vm *me = vm_init(gc_dispatch, size);
+    for (size_t i = 0; i < TR_N_RECENT; i++) {
+        vm_add(me, 0);
+    }
+    size_t n_allocs = 0;
+    res->n_ops = 0;
+    res->peak_used = 0;
+    t->pos = t->start;
+    uint64_t start = nano_count();
+    while (!tr_at_end_p(t)) {
+        tr_op op = tr_next_byte(t);
+        ptr item = 0;
+        switch (op) {
+        case TR_ADD:
+            vm_add(me, vm_replay_ref(me, t, n_allocs));
+            break;
+        case TR_REMOVE:
+            vm_remove(me);
+            break;
+        case TR_SET: {
+            size_t i = tr_next_uint(t);
+            vm_set(me, TR_N_RECENT + i, vm_replay_ref(me, t, n_allocs));
+            break;
+        }
+        case TR_SET_SLOT: {
+            ptr p_from = vm_replay_ref(me, t, n_allocs);
+            size_t i = tr_next_uint(t);
+            vm_set_slot(me, p_from, i, vm_replay_ref(me, t, n_allocs));
+            break;
+        }
+        case TR_INT:
+            item = vm_box_int(me, tr_next_int(t));
+            break;
+        case TR_FLOAT:
+            item = vm_boxed_float_init(me, tr_next_double(t));
+            break;
+        case TR_ARRAY: {
+            int n = (int)tr_next_uint(t);
+            item = vm_array_init(me, n, vm_replay_ref(me, t, n_allocs));
+            break;
+        }
+        case TR_WRAPPER:
+            item = vm_wrapper_init(me, vm_replay_ref(me, t, n_allocs));
+            break;
+        case TR_RAW_ARRAY: {
+            int type = (int)tr_next_uint(t);
+            size_t n = tr_next_uint(t);
+            item = vm_raw_array_init(me, type, n);
+            break;
+        }
+        case TR_COLLECT:
+            vm_collect(me);
+            break;
+        default:
+            error("Unknown trace operation %d!\n", op);
+        }
+        if (item) {
+            vm_set(me, n_allocs % TR_N_RECENT, item);
+            n_allocs++;
+            res->peak_used = MAX(res->peak_used, vm_space_used(me));
+        }
+        res->n_ops++;
+    }
+    res->time = nano_count() - start;
+    vm_stats_snapshot(me, &res->gc);
+    return me;
+}
+
+// Heap images
+
+// Open addressing table numbering the objects in the image. Objects
+// are at least 8 byte aligned.
+typedef struct {
+    ptr key;
+    size_t number;
+} vm_image_entry;
+
+typedef struct {
+    vm_image_entry *entries;
+    size_t mask;
+    size_t used;
+} vm_image_index;
+
+static void
+vm_image_index_init(vm_image_index *me, size_t capacity) {
+    me->entries = calloc(capacity, sizeof(vm_image_entry));
+    me->mask = capacity - 1;
+    me->used = 0;
+}
+
+static inline vm_image_entry *
+vm_image_index_find(vm_image_index *me, ptr p) {
+    size_t i = (((p >> 3) * 0x9e3779b97f4a7c15UL) >> 32) & me->mask;
+    while (me->entries[i].key && me->entries[i].key != p) {
+        i = (i + 1) & me->mask;
+    }
+    return &me->entries[i];
+}
+
+// Returns the number of p, which is numbered n if it is new.
+static size_t
+vm_image_index_add(vm_image_index *me, ptr p, size_t n) {
+    vm_image_entry *e = vm_image_index_find(me, p);
+    if (e->key) {
+        return e->number;
+    }
+    e->key = p;
+    e->number = n;
+    me->used++;
+    if (2 * me->used > me->mask) {
+        vm_image_index old = *me;
+        vm_image_index_init(me, 2 * (old.mask + 1));
+        for (size_t i = 0; i <= old.mask; i++) {
+            vm_image_entry o = old.entries[i];
+            if (o.key) {
+                vm_image_index_add(me, o.key, o.number);
+            }
+        }
+        free(old.entries);
+    }
+    return n;
+}
+
+static inline size_t
+vm_image_index_get(vm_image_index *me, ptr p) {
+    vm_image_entry *e = vm_image_index_find(me, p);
+    assert(e->key == p);
+    return e->number;
+}
+
+static inline void
+vm_image_visit(vector *objs, vm_image_index *index, ptr p) {
+    size_t n = objs->used;
+    if (P_OBJ_P(p) && vm_image_index_add(index, p, n) == n) {
+        v_add(objs, p);
+    }
+}
+
+static size_t
+vm_image_data_offset(size_t n_roots) {
+    return ALIGN(sizeof(vm_image_header) + 8 * n_roots, HEAP_PAGE_SIZE);
+}
+
+bool
+vm_save_image(vm *me, char *path) {
+    if (me->owner != me || me->n_mutators > 1) {
+        error("Can't save the image of a shared heap!\n");
+    }
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    // Objects are numbered in breadth-first order from the roots.
+    vector *objs = v_init(256);
+    vm_image_index index;
+    vm_image_index_init(&index, 256);
+    vector *roots = me->roots;
+    for (size_t i = 0; i < roots->used; i++) {
+        vm_image_visit(objs, &index, roots->array[i]);
+    }
+    for (size_t i = 0; i < objs->used; i++) {
+        ptr p = objs->array[i];
+        P_FOR_EACH_CHILD(p, { vm_image_visit(objs, &index, p_child); });
+    }
+
+    // New addresses are relative to the origin.
+    ptr origin = heap_origin();
+    ptr base = me->memory - origin;
+    size_t n = objs->used;
+    ptr *addrs = malloc(sizeof(ptr) * MAX(n, 1));
+    size_t n_bytes = 0;
+    size_t max_block = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t block = ALIGN(p_size(objs->array[i]), VM_IMAGE_ALIGNMENT);
+        addrs[i] = base + n_bytes;
+        n_bytes += block;
+        max_block = MAX(max_block, block);
+    }
+
+    vm_image_header h;
+    memcpy(h.magic, VM_IMAGE_MAGIC, 4);
+    h.version = VM_IMAGE_VERSION;
+    h.ref_size = sizeof(ref);
+    h.padding = 0;
+    h.base = base;
+    h.n_bytes = n_bytes;
+    h.n_roots = roots->used;
+    fwrite(&h, sizeof(vm_image_header), 1, f);
+    for (size_t i = 0; i < roots->used; i++) {
+        ptr p = roots->array[i];
+        uint64_t r = P_OBJ_P(p) ? addrs[vm_image_index_get(&index, p)] : p;
+        fwrite(&r, sizeof(uint64_t), 1, f);
+    }
+    // The buffer is also used for padding the roots to the objects.
+    size_t pad = vm_image_data_offset(roots->used) -
+        sizeof(vm_image_header) - 8 * roots->used;
+    ptr buf = (ptr)calloc(MAX(max_block, HEAP_PAGE_SIZE), 1);
+    fwrite((void *)buf, 1, pad, f);
+    for (size_t i = 0; i < n; i++) {
+        ptr p = objs->array[i];
+        size_t size = p_size(p);
+        size_t block = ALIGN(size, VM_IMAGE_ALIGNMENT);
+        memcpy((void *)buf, (void *)p, size);
+        memset((void *)(buf + size), 0, block - size);
+        AT(buf) = ((ptr)block << 32) | (P_GET_TYPE(p) << 1);
+        size_t n_slots = p_slot_count(p);
+        for (size_t j = 0; j < n_slots; j++) {
+            ptr c = P_GET_SLOT(p, j);
+            if (P_OBJ_P(c)) {
+                c = origin + addrs[vm_image_index_get(&index, c)];
+                *SLOT_P(buf, j) = REF_ENCODE(c);
+            }
+        }
+        fwrite((void *)buf, 1, block, f);
+    }
+    free((void *)buf);
+    free(addrs);
+    free(index.entries);
+    v_free(objs);
+    bool ok = !ferror(f);
+    return fclose(f) == 0 && ok;
+}
+
+static inline void
+vm_image_relocate_slot(ref *r, ptr delta) {
+    ptr p = REF_DECODE(*r);
+    if (P_OBJ_P(p)) {
+        *r = REF_ENCODE(p + delta);
+    }
+}
+
+static void
+vm_image_relocate(ptr start, size_t n_bytes, ptr delta) {
+    ptr end = start + n_bytes;
+    for (ptr p = start; p < end; p += QF_GET_BLOCK_SIZE(p)) {
+        int type = P_GET_TYPE(p);
+        if (!TYPE_CONTAINER_P(type)) {
+            continue;
+        }
+        // The count of an array must be relocated before its slots
+        // can be counted.
+        vm_image_relocate_slot(SLOT_P(p, 0), delta);
+        size_t n_slots = p_slot_count(p);
+        for (size_t i = 1; i < n_slots; i++) {
+            vm_image_relocate_slot(SLOT_P(p, i), delta);
+        }
+    }
+}
+
+// Object refs in the image must point to the start of a block. r is
+// relative to heap_origin().
+static bool
+vm_image_ref_valid_p(vm_image_header *h, bitarray *starts, ptr r) {
+    if (!P_OBJ_P(r)) {
+        return true;
+    }
+    ptr ofs = r - h->base;
+    return r >= h->base && ofs < h->n_bytes &&
+        ofs % VM_IMAGE_ALIGNMENT == 0 &&
+        ba_get_bit(starts, ofs / VM_IMAGE_ALIGNMENT);
+}
+
+// Size of the object in block p, or SIZE_MAX if its type or counts
+// are bad. Array counts must be refs to boxed ints. Its slot count is
+// stored in n_slots.
+static size_t
+vm_image_object_size(vm_image_header *h, bitarray *starts,
+                     ptr start, ptr p, size_t *n_slots) {
+    size_t block = QF_GET_BLOCK_SIZE(p);
+    size_t count;
+    *n_slots = 0;
+    switch (P_GET_TYPE(p)) {
+    case TYPE_INT:
+    case TYPE_FLOAT:
+        return NPTRS(2);
+    case TYPE_WRAPPER:
+        *n_slots = 1;
+        return P_SLOTS_SIZE(1);
+    case TYPE_ARRAY: {
+        ptr r = REF_DECODE(*SLOT_P(p, 0));
+        if (!P_OBJ_P(r) ||
+            !vm_image_ref_valid_p(h, starts, r - heap_origin())) {
+            return SIZE_MAX;
+        }
+        ptr cnt = start + r - heap_origin() - h->base;
+        if (P_GET_TYPE(cnt) != TYPE_INT ||
+            QF_GET_BLOCK_SIZE(cnt) < NPTRS(2)) {
+            return SIZE_MAX;
+        }
+        count = *VALUE_P(cnt);
+        *n_slots = 1 + count;
+        return count < block ? P_ARRAY_SIZE(count) : SIZE_MAX;
+    }
+    case TYPE_FLOAT_ARRAY:
+    case TYPE_INT_ARRAY:
+        count = RAW_COUNT(p);
+        return count < block ? NPTRS(2 + count) : SIZE_MAX;
+    case TYPE_BYTE_ARRAY:
+        count = RAW_COUNT(p);
+        return count < block
+            ? NPTRS(2) + ALIGN(count, sizeof(ptr)) : SIZE_MAX;
+    default:
+        return SIZE_MAX;
+    }
+}
+
+// The blocks must tile the body exactly, each object must fit in its
+// block and all refs must point to blocks, or else relocating or
+// adopting the blocks runs wild.
+static bool
+vm_image_valid_p(vm_image_header *h, ptr start, uint64_t *roots) {
+    ptr end = start + h->n_bytes;
+    bitarray *starts = ba_init(
+        ALIGN(h->n_bytes / VM_IMAGE_ALIGNMENT + 1, BA_WORD_BITS));
+    bool ok = true;
+    for (ptr p = start; ok && p < end; p += QF_GET_BLOCK_SIZE(p)) {
+        size_t block = QF_GET_BLOCK_SIZE(p);
+        ok = block && block % VM_IMAGE_ALIGNMENT == 0 && block <= end - p;
+        if (ok) {
+            ba_set_bit(starts, (p - start) / VM_IMAGE_ALIGNMENT);
+        }
+    }
+    for (ptr p = start; ok && p < end; p += QF_GET_BLOCK_SIZE(p)) {
+        size_t n_slots;
+        size_t size = vm_image_object_size(h, starts, start, p, &n_slots);
+        ok = size <= QF_GET_BLOCK_SIZE(p);
+        for (size_t i = 0; ok && i < n_slots; i++) {
+            ptr r = REF_DECODE(*SLOT_P(p, i));
+            ok = !P_OBJ_P(r) ||
+                vm_image_ref_valid_p(h, starts, r - heap_origin());
+        }
+    }
+    for (size_t i = 0; ok && i < h->n_roots; i++) {
+        ok = vm_image_ref_valid_p(h, starts, roots[i]);
+    }
+    ba_free(starts);
+    return ok;
+}
+
+vm *
+vm_load_image(char *path, gc_dispatch *gc_dispatch, size_t size) {
+    if (!gc_dispatch->load_image) {
+        error("The collector can't load heap images!\n");
+    }
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    size_t file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    vm_image_header h;
+    if (fread(&h, sizeof(vm_image_header), 1, f) != 1 ||
+        memcmp(h.magic, VM_IMAGE_MAGIC, 4) ||
+        h.version != VM_IMAGE_VERSION ||
+        h.ref_size != sizeof(ref) ||
+        h.n_bytes > size ||
+        h.n_roots > file_size / sizeof(uint64_t) ||
+        vm_image_data_offset(h.n_roots) + h.n_bytes > file_size) {
+        fclose(f);
+        return NULL;
+    }
+    uint64_t *roots = malloc(sizeof(uint64_t) * MAX(h.n_roots, 1));
+    if (fread(roots, sizeof(uint64_t), h.n_roots, f) != h.n_roots) {
+        free(roots);
+        fclose(f);
+        return NULL;
+    }
+    // The collector is initialized first since it may write to the
+    // empty heap.
+    ptr origin = heap_origin();
+    ptr memory = heap_reserve_at(origin + h.base, size);
+    vm *me = vm_init_heap(gc_dispatch, memory, size);
+    size_t offset = vm_image_data_offset(h.n_roots);
+    bool ok = true;
+#ifdef _WIN32
+    fseek(f, offset, SEEK_SET);
+    ok = fread((void *)memory, 1, h.n_bytes, f) == h.n_bytes;
+#else
+    if (h.n_bytes) {
+        void *p = mmap((void *)memory, h.n_bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_FIXED, fileno(f), offset);
+        ok = p != MAP_FAILED;
+    }
+#endif
+    fclose(f);
+    ok = ok && vm_image_valid_p(&h, memory, roots);
+    ptr delta = memory - origin - h.base;
+    if (ok && delta) {
+        vm_image_relocate(memory, h.n_bytes, delta);
+    }
+    if (!ok || !gc_dispatch->load_image(me->gc_obj, h.n_bytes)) {
+        free(roots);
+        vm_free(me);
+        return NULL;
+    }
+    for (size_t i = 0; i < h.n_roots; i++) {
+        ptr r = roots[i];
+        vm_add(me, P_OBJ_P(r) ? origin + r + delta : r);
+    }
+    free(roots);
+    return me;
+}
@@ -2,19 +2,105 @@
 #define COLLECTORS_VM_H
 
 #include "datatypes/vector.h"
+#include "quickfit/quickfit.h"
 #include "collectors/common.h"
+#include "collectors/trace.h"
+
+// Growable heaps are resized in multiples of this.
+#define VM_HEAP_ALIGNMENT   (64 * 1024)
+
+// Heap images hold the objects reachable from the roots of a vm and
+// can be loaded by any collector with a load_image function.
+//
+// An image starts with a vm_image_header followed by the roots as
+// 64-bit words. The objects come next, at the first page boundary so
+// that they can be mapped straight into the heap. They are laid out
+// back to back as quick fit blocks of VM_IMAGE_ALIGNMENT bytes with
+// their refs encoded as if the heap started at base bytes from
+// heap_origin(). Object roots are stored relative to heap_origin()
+// too. If the heap can't be placed there every ref is relocated when
+// the image is loaded.
+#define VM_IMAGE_MAGIC      "GCIM"
+#define VM_IMAGE_VERSION    1
+#define VM_IMAGE_ALIGNMENT  QF_DATA_ALIGNMENT
 
 typedef struct {
+    char magic[4];
+    uint32_t version;
+    // Images can only be loaded with the ref width they were saved
+    // with.
+    uint32_t ref_size;
+    uint32_t padding;
+    uint64_t base;
+    uint64_t n_bytes;
+    uint64_t n_roots;
+} vm_image_header;
+
+// A vm is a mutator with its own roots. The vm returned by vm_init
+// owns the heap and more mutators sharing it can be added with
+// vm_attach. They allocate from thread-local buffers and all of them
+// are stopped at safepoints in the allocator for collections. Heap
+// fields are only valid in the owner.
+typedef struct _vm {
     vector *roots;
+    struct _vm *owner;
+    gc_tlab tlab;
     ptr memory;
+    // Current heap size. Address space for max_size bytes is reserved
+    // but only the pages the collector touches are committed.
     size_t size;
+    size_t min_size;
+    size_t max_size;
+    // The fraction of the usable heap that live data should occupy
+    // after a collection. Only used by growable heaps.
+    double target_occupancy;
     gc_dispatch *gc_dispatch;
     void* gc_obj;
+    gc_stats stats;
+    // Bytes promoted by the collector when the stats were reset.
+    size_t promoted_base;
+    // Set while recording a trace.
+    trace_recorder *trace;
+
+    // Mutators, including the owner, and the roots of all of them
+    // during collections.
+    vector *mutators;
+    vector *all_roots;
+    int n_mutators;
+    // Protects the shared heap while there are several mutators.
+    bool lock;
+    // Set by the mutator that collects until it is done. The others
+    // park at their next safepoint.
+    bool gc_requested;
+    int n_parked;
 } vm;
 
 vm *vm_init(gc_dispatch *gc_dispatch, size_t max_used);
+// The heap starts at min_size bytes. After each collection it is
+// grown or shrunk so that live data occupies about target_occupancy
+// of it. Heaps shrink only when the occupancy falls below half the
+// target so that they don't oscillate. If an allocation still fails
+// after a collection the heap is doubled until it fits or max_size
+// is reached. Requires a collector with a resize function.
+vm *vm_init_growable(gc_dispatch *gc_dispatch,
+                     size_t min_size, size_t max_size,
+                     double target_occupancy);
 void vm_free(vm *me);
 
+// Adds a mutator sharing the heap of me. It should be called from the
+// thread using me and the new mutator handed to another thread, which
+// detaches it when done. Allocations made by a mutator are added to
+// the owner's stats when it is detached or a collection happens.
+// Requires a collector with thread-local allocation buffers.
+vm *vm_attach(vm *me);
+void vm_detach(vm *me);
+
+// Lets collections proceed while the mutator waits for something,
+// like other threads finishing. It must not use the vm until it
+// calls vm_leave_blocking.
+void vm_enter_blocking(vm *me);
+void vm_leave_blocking(vm *me);
+
 // Roots interface
 ptr vm_add(vm *me, ptr p);
 ptr vm_remove(vm *me);
@@ -28,15 +114,57 @@ void vm_collect(vm *me);
 
 // Barriers & ref counting
 void vm_set_slot(vm *me, ptr p_from, size_t i, ptr p);
+// Like n calls to vm_set_slot for the slots from i, but the
+// collector's barrier is only run once. vm_copy_slots copies the
+// slots of p_from starting at j and the ranges may overlap.
+void vm_fill_slots(vm *me, ptr p_from, size_t i, size_t n, ptr p);
+void vm_copy_slots(vm *me, ptr p_to, size_t i, ptr p_from, size_t j, size_t n);
 
 // Object allocation
+// Allocates an object of size bytes whose slots the caller must
+// initialize before allocating again. It is the slow path of the
+// specialized vms in collectors/vm-spec.h.
+ptr vm_allot(vm *me, size_t size, int type);
 ptr vm_boxed_int_init(vm *me, int value);
+// Returns a tagged int, unless the value needs more than 63 bits.
+// vm_int_value reads both tagged and boxed ints.
+ptr vm_int_init(vm *me, int64_t value);
+int64_t vm_int_value(ptr p);
+// Arrays of n raw values, read and written with FLOAT_SLOT_P,
+// INT_SLOT_P and BYTE_SLOT_P. No barriers are needed.
+ptr vm_float_array_init(vm *me, size_t n, double value);
+ptr vm_int_array_init(vm *me, size_t n, int64_t value);
+ptr vm_byte_array_init(vm *me, size_t n, uint8_t value);
 ptr vm_boxed_float_init(vm *me, double value);
 ptr vm_array_init(vm *me, int n, ptr value);
+// New array with the n slots of arr starting at slot i as elements.
+ptr vm_array_init_from(vm *me, ptr arr, size_t i, size_t n);
 ptr vm_wrapper_init(vm *me, ptr value);
 
 // Stats
 void vm_tree_dump(vm *me);
 size_t vm_space_used(vm *me);
+// Copies the stats gathered since the last reset to snapshot.
+void vm_stats_snapshot(vm *me, gc_stats *snapshot);
+void vm_stats_reset(vm *me);
+
+// Tracing. Recording must start before any roots are added. Stopping
+// returns the number of references that couldn't be recorded.
+bool vm_trace_start(vm *me, char *path);
+size_t vm_trace_stop(vm *me);
+
+// Replays the trace on a new vm with the given collector and heap
+// size and returns it. The roots of the trace start at index
+// TR_N_RECENT.
+vm *vm_replay(trace *t, gc_dispatch *gc_dispatch, size_t size,
+              tr_result *res);
+
+// Heap images. Saving requires that the vm is the only mutator of its
+// heap and returns false if the file can't be written. Loading
+// returns a new vm with the roots of the image, or NULL if the file
+// isn't a valid image or the objects don't fit in a heap of the given
+// size.
+bool vm_save_image(vm *me, char *path);
+vm *vm_load_image(char *path, gc_dispatch *gc_dispatch, size_t size);
 
 #endif
@@ -44,6 +44,14 @@ ba_set_bit(bitarray *me, int addr) {
     AT(p) |= (ptr)1 << bit_idx;
 }
 
+void
+ba_clear_bit(bitarray *me, int addr) {
+    int word_idx = addr / BA_WORD_BITS;
+    int bit_idx = addr & WORD_MASK;
+    ptr p = me->bits + word_idx * sizeof(ptr);
+    AT(p) &= ~((ptr)1 << bit_idx);
+}
+
 void
 ba_set_bit_range(bitarray *me, int addr, int n) {
     int word_start_idx = addr / BA_WORD_BITS;
@@ -116,6 +124,35 @@ ba_next_set_bit(bitarray *me, int addr) {
     return me->n_bits;
 }
 
+int
+ba_prev_set_bit(bitarray *me, int addr) {
+    int word_idx = addr / BA_WORD_BITS;
+    int bit_idx = addr & WORD_MASK;
+
+    // Masks out the bits above addr in the first word.
+    ptr mask = bit_idx == WORD_MASK ? ~(ptr)0 : ((ptr)1 << (bit_idx + 1)) - 1;
+    for (int i = word_idx; i >= 0; i--) {
+        ptr pattern = AT(me->bits + i * sizeof(ptr)) & mask;
+        if (pattern) {
+            return i * BA_WORD_BITS + (int)bw_log2(pattern);
+        }
+        mask = ~(ptr)0;
+    }
+    return -1;
+}
+
+int
+ba_prev_set_bit_in_word(bitarray *me, int addr) {
+    int word_idx = addr / BA_WORD_BITS;
+    int bit_idx = addr & WORD_MASK;
+    ptr mask = bit_idx == WORD_MASK ? ~(ptr)0 : ((ptr)1 << (bit_idx + 1)) - 1;
+    ptr pattern = AT(me->bits + word_idx * sizeof(ptr)) & mask;
+    if (pattern) {
+        return word_idx * BA_WORD_BITS + (int)bw_log2(pattern);
+    }
+    return -1;
+}
+
 unsigned int
 ba_bitsum(bitarray *me) {
     unsigned int sum = 0;
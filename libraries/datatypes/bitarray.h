@@ -59,12 +59,17 @@ bitarray *ba_init(int n_bits);
 void ba_free(bitarray *me);
 
 void ba_set_bit(bitarray *me, int addr);
+void ba_clear_bit(bitarray *me, int addr);
 bool ba_get_bit(bitarray *me, int addr);
 void ba_set_bit_range(bitarray *me, int addr, int n);
 void ba_clear(bitarray *me);
 
 int ba_next_unset_bit(bitarray *me, int start);
 int ba_next_set_bit(bitarray *me, int start);
+// Last set bit at or before start, -1 if there is none.
+int ba_prev_set_bit(bitarray *me, int start);
+// Same, but only the word containing start is searched.
+int ba_prev_set_bit_in_word(bitarray *me, int start);
 
 // Count of the number of lit bits in a bitarray.
 unsigned int ba_bitsum(bitarray *me);
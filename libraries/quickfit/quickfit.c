@@ -131,6 +131,80 @@ qf_space_used(quick_fit *me) {
     return me->size - me->free_space;
 }
 
+size_t
+qf_largest_free_block(quick_fit *qf) {
+    rbtree *node = rbt_iterate(qf->large_blocks, NULL, BST_RIGHT);
+    if (node) {
+        return node->key;
+    }
+    for (int i = QF_N_BUCKETS - 1; i >= 0; i--) {
+        vector *small_blocks = qf->buckets[i];
+        if (small_blocks->used) {
+            return i * QF_DATA_ALIGNMENT;
+        }
+    }
+    return 0;
+}
+
+// Blocks that are in use have non-zero low bits in their headers.
+#define QF_BLOCK_USED_P(p)  (AT(p) & 0xffffffff)
+
+bool
+qf_resize(quick_fit *me, size_t size) {
+    if (size == me->size) {
+        return true;
+    }
+    ptr iter = me->start;
+    ptr end = me->start + me->size;
+    if (size > me->size) {
+        // The new range is given a header so that the pass below
+        // merges it with the free block ending at the old end.
+        QF_SET_BLOCK_SIZE(end, size - me->size);
+    } else {
+        ptr used_end = iter;
+        while (iter < end) {
+            size_t block_size = QF_GET_BLOCK_SIZE(iter);
+            if (QF_BLOCK_USED_P(iter)) {
+                used_end = iter + block_size;
+            }
+            iter += block_size;
+        }
+        if (used_end > me->start + size) {
+            return false;
+        }
+    }
+    // Rebuild the free lists, coalescing adjacent free blocks and
+    // cutting off the tail.
+    qf_clear(me);
+    me->size = size;
+    iter = me->start;
+    end = me->start + size;
+    while (iter < end) {
+        if (QF_BLOCK_USED_P(iter)) {
+            iter += QF_GET_BLOCK_SIZE(iter);
+            continue;
+        }
+        ptr free_start = iter;
+        while (iter < end && !QF_BLOCK_USED_P(iter)) {
+            iter += QF_GET_BLOCK_SIZE(iter);
+        }
+        qf_free_block(me, free_start, MIN(iter, end) - free_start);
+    }
+    return true;
+}
+
+bool
+qf_adopt_blocks(quick_fit *me, size_t n_bytes) {
+    if (n_bytes > me->size) {
+        return false;
+    }
+    qf_clear(me);
+    if (n_bytes < me->size) {
+        qf_free_block(me, me->start + n_bytes, me->size - n_bytes);
+    }
+    return true;
+}
+
 bool
 qf_can_allot_p(quick_fit *me, size_t size) {
     size_t small = ALIGN(size, QF_DATA_ALIGNMENT);
@@ -16,7 +16,7 @@
 // The header format is setup so that it is compatible with the one
 // described in collectors/common.h.
 #define QF_GET_BLOCK_SIZE(p)        (AT(p) >> 32L)
-#define QF_SET_BLOCK_SIZE(p, n)     AT(p) = (n << 32L)
+#define QF_SET_BLOCK_SIZE(p, n)     AT(p) = ((n) << 32L)
 
 typedef struct {
     vector* buckets[QF_N_BUCKETS];
@@ -36,5 +36,13 @@ void qf_free_block(quick_fit *qf, ptr p, size_t size);
 void qf_print(quick_fit *qf);
 bool qf_can_allot_p(quick_fit *qf, size_t size);
 size_t qf_space_used(quick_fit *qf);
+size_t qf_largest_free_block(quick_fit *qf);
+// Grows or shrinks the heap from its end. Shrinking fails if blocks
+// in use are in the way. Blocks in use must have a non-zero type in
+// their headers.
+bool qf_resize(quick_fit *qf, size_t size);
+// Takes the first n_bytes of the heap as blocks in use that someone
+// else has laid out and frees the rest. Fails if they don't fit.
+bool qf_adopt_blocks(quick_fit *qf, size_t n_bytes);
 
 #endif
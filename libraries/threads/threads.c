@@ -1,6 +1,11 @@
 // Copyright (C) 2020 Björn Lindqvist <bjourne@gmail.com>
 #include <inttypes.h>
 #include <stdio.h>
+#ifndef _WIN32
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
 #include "threads/threads.h"
 
 bool
@@ -37,3 +42,34 @@ thr_wait_for_threads(size_t n, thr_handle *handles) {
     }
     return true;
 }
+
+size_t
+thr_n_cores() {
+#if _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+#endif
+}
+
+void
+thr_yield() {
+#if _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+void
+thr_sleep(size_t usecs) {
+#if _WIN32
+    Sleep((DWORD)((usecs + 999) / 1000));
+#else
+    struct timespec ts = { usecs / 1000000, (usecs % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+#endif
+}
@@ -20,6 +20,15 @@ thr_create_threads(size_t n, thr_handle *handles,
                    void *(*func) (void *));
 bool thr_wait_for_threads(size_t n, thr_handle *handles);
 
+// Number of online processors.
+size_t thr_n_cores();
+
+// Give up the processor to another thread.
+void thr_yield();
+
+// Sleep for at least the given number of microseconds.
+void thr_sleep(size_t usecs);
+
 
 
 
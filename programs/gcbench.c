@@ -0,0 +1,771 @@
+// Records vm traces and replays them with every collector.
+//
+// Usage:
+//     gcbench record TRACE    records the built-in workload
+//     gcbench replay TRACE [HEAP_MB]
+//     gcbench mark [HEAP_MB]  compares plain and prefetching marking
+//     gcbench threads [N]     allocation throughput with 1 to N threads
+//     gcbench scan [MB]       compares conservative range scanners
+//     gcbench traverse [DEPTH] compares copy orders for tree traversal
+//     gcbench bulk            compares per-slot and bulk slot writes
+//     gcbench spec            compares dynamic and specialized vms
+//     gcbench image [HEAP_MB] times saving and loading heap images
+//
+// Replaying reports the mutator throughput, the time spent in the
+// collector, pause percentiles and the peak heap usage. By default
+// the trace is replayed with the same heap size it was recorded with.
+//
+// The mark benchmark fills most of the heap with a random graph so
+// that nearly every object visited is a cache miss. The heap should
+// be at least ten times larger than the last level cache.
+//
+// The threads benchmark attaches mutators to a shared heap and lets
+// each allocate short-lived objects from its allocation buffer while
+// keeping a few. Throughput can only scale with the number of cores.
+//
+// The scan benchmark filters buffers of random words for pointers
+// into a heap range like the conservative collector does for stacks.
+// Stack-like buffers have few hits, heap-like ones have many.
+//
+// The traverse benchmark builds a binary tree and a set of linked
+// lists, collects them with breadth-first and depth-first copying and
+// then times depth-first traversals of them.
+//
+// The bulk benchmark fills, copies and slices arrays of pointers with
+// every collector, once slot by slot and once with the bulk vm
+// functions that only run the barrier once per call.
+//
+// The spec benchmark times allocations and slot writes through the
+// gc_dispatch table and through vms specialized for the collector
+// with collectors/vm-spec.h. The written slots and values are old so
+// the generational barrier only does its checks.
+//
+// The image benchmark builds the random graph of the mark benchmark,
+// saves it as a heap image and loads it twice. The first load can
+// map the image where it was saved, the second is relocated since
+// the first vm is in the way.
+#include <stdio.h>
+#include <string.h>
+#include "threads/threads.h"
+#include "collectors/vm.h"
+#include "collectors/copying.h"
+#include "collectors/conservative.h"
+#include "collectors/copying-opt.h"
+#include "collectors/generational.h"
+#include "collectors/immix.h"
+#include "collectors/mark-compact.h"
+#include "collectors/mark-sweep.h"
+#include "collectors/mark-sweep-bits.h"
+#include "collectors/mark-sweep-inc.h"
+#include "collectors/ref-counting.h"
+#include "collectors/ref-counting-cycles.h"
+#include "collectors/ref-counting-deferred.h"
+
+#define VM_SPEC_PREFIX      cgv
+#define VM_SPEC_GC          copying_gc
+#define VM_SPEC_DISPATCH    cg_get_dispatch_table
+#define VM_SPEC_ALLOT       cg_allot_fast
+#include "collectors/vm-spec.h"
+
+#define VM_SPEC_PREFIX      genv
+#define VM_SPEC_GC          generational_gc
+#define VM_SPEC_DISPATCH    gen_get_dispatch_table
+#define VM_SPEC_ALLOT       gen_allot_fast
+#define VM_SPEC_SET_PTR     gen_set_ptr_fast
+#include "collectors/vm-spec.h"
+
+#define VM_SPEC_PREFIX      msv
+#define VM_SPEC_GC          mark_sweep_gc
+#define VM_SPEC_DISPATCH    ms_get_dispatch_table
+#define VM_SPEC_ALLOT       ms_allot_fast
+#include "collectors/vm-spec.h"
+
+#define WORKLOAD_HEAP_SIZE  (256 * 1024 * 1024)
+#define WORKLOAD_N_ROOTS    100
+#define WORKLOAD_N_ELS      500
+#define WORKLOAD_N_LOOPS    2000000
+
+#define MARK_HEAP_MB        1536
+#define MARK_N_SLOTS        6
+#define MARK_N_LOOPS        3
+
+#define THREADS_HEAP_SIZE   (64 * 1024 * 1024)
+#define THREADS_N_ALLOCS    4000000
+
+#define SCAN_MB             16
+#define SCAN_N_LOOPS        20
+
+#define TRAVERSE_DEPTH      21
+#define TRAVERSE_N_LOOPS    10
+#define TRAVERSE_N_LISTS    1000
+
+#define BULK_HEAP_SIZE      (64 * 1024 * 1024)
+#define BULK_N_ARRAYS       64
+#define BULK_N_SLOTS        1000
+#define BULK_N_LOOPS        200
+
+#define SPEC_HEAP_SIZE      (64 * 1024 * 1024)
+#define SPEC_N_ALLOCS       20000000
+#define SPEC_N_STORES       100000000
+// Must be a power of two.
+#define SPEC_N_SLOTS        1024
+
+#define IMAGE_HEAP_MB       256
+#define IMAGE_PATH          "gcbench-image.gcim"
+
+static ptr
+random_object(vm *v) {
+    if (rand_n(2)) {
+        return vm_array_init(v, rand_n(200), random_object(v));
+    }
+    switch (rand_n(TYPE_ARRAY)) {
+    case TYPE_INT:
+        return vm_boxed_int_init(v, rand_n(100));
+    case TYPE_FLOAT:
+        return vm_boxed_float_init(v, (double)rand_n(100));
+    case TYPE_WRAPPER:
+        return vm_wrapper_init(v, random_object(v));
+    default:
+        return 0;
+    }
+}
+
+// Same as test_torture in tests/collectors/collectors.c.
+static int
+record(char *path) {
+    rand_init(0);
+    vm *v = vm_init(ms_get_dispatch_table(), WORKLOAD_HEAP_SIZE);
+    if (!vm_trace_start(v, path)) {
+        printf("Can't write %s!\n", path);
+        return 1;
+    }
+    for (int i = 0; i < WORKLOAD_N_ROOTS; i++) {
+        vm_add(v, vm_array_init(v, WORKLOAD_N_ELS, 0));
+    }
+    for (int i = 0; i < WORKLOAD_N_LOOPS; i++) {
+        ptr arr = vm_get(v, rand_n(WORKLOAD_N_ROOTS));
+        vm_set_slot(v, arr, 1 + rand_n(WORKLOAD_N_ELS), random_object(v));
+    }
+    size_t n_ops = v->trace->n_ops;
+    size_t n_unresolved = vm_trace_stop(v);
+    printf("Recorded %lu operations, %lu unresolved references\n",
+           n_ops, n_unresolved);
+    vm_free(v);
+    return 0;
+}
+
+// All collectors, in the order they are reported.
+static char *
+collector_names[] = {
+    "Copying",
+    "Optimized Copying",
+    "Parallel Copying",
+    "Mark & Sweep",
+    "Parallel Mark & Sweep",
+    "Prefetching Mark & Sweep",
+    "Mark & Sweep (separate mark bits)",
+    "Parallel Mark & Sweep (mark bits)",
+    "Lazy Mark & Sweep (mark bits)",
+    "Prefetching Mark & Sweep (mark bits)",
+    "Incremental Mark & Sweep",
+    "Mark & Compact",
+    "Immix",
+    "Generational",
+    "Reference Counting",
+    "Incremental Reference Counting",
+    "Cycle-collecting Reference Counting",
+    "Concurrent Cycle-collecting RC",
+    "Deferred Reference Counting",
+    "Depth-first Copying"
+};
+
+static gc_dispatch *
+collector_dispatch(size_t i) {
+    gc_dispatch *dispatches[] = {
+        cg_get_dispatch_table(),
+        cg_get_dispatch_table_optimized(),
+        cg_get_dispatch_table_parallel(),
+        ms_get_dispatch_table(),
+        ms_get_dispatch_table_parallel(),
+        ms_get_dispatch_table_prefetch(),
+        msb_get_dispatch_table(),
+        msb_get_dispatch_table_parallel(),
+        msb_get_dispatch_table_lazy(),
+        msb_get_dispatch_table_prefetch(),
+        msi_get_dispatch_table(),
+        mc_get_dispatch_table(),
+        ix_get_dispatch_table(),
+        gen_get_dispatch_table(),
+        rc_get_dispatch_table(),
+        rc_get_dispatch_table_incremental(),
+        rcc_get_dispatch_table(),
+        rcc_get_dispatch_table_concurrent(),
+        rcd_get_dispatch_table(),
+        cg_get_dispatch_table_depth_first()
+    };
+    return dispatches[i];
+}
+
+static void
+replay_one(trace *t, char *name, gc_dispatch *dispatch, size_t size) {
+    tr_result res;
+    vm *v = vm_replay(t, dispatch, size, &res);
+    vm_free(v);
+    gc_stats *gs = &res.gc;
+    double mut_secs = (double)(res.time - gs->pause_total) / 1e9;
+    printf("%-36s %8.2f %8.3f %5lu %8.3f %8.3f %8.3f %6lu\n",
+           name, res.n_ops / mut_secs / 1e6,
+           (double)gs->pause_total / 1e9,
+           gs->n_collections,
+           (double)gs_pause_percentile(gs, 50) / 1e6,
+           (double)gs_pause_percentile(gs, 99) / 1e6,
+           (double)gs->pause_max / 1e6,
+           res.peak_used >> 20);
+}
+
+static int
+replay(char *path, size_t size) {
+    trace *t = tr_read(path);
+    if (!t) {
+        printf("Can't read %s!\n", path);
+        return 1;
+    }
+    size = size ? size : t->heap_size;
+    printf("Replaying %lu bytes of trace with a %lu MB heap\n\n",
+           t->size, size >> 20);
+    printf("%-36s %8s %8s %5s %8s %8s %8s %6s\n",
+           "Collector", "Mops/s", "GC s", "GCs",
+           "p50 ms", "p99 ms", "max ms", "MB");
+    for (size_t i = 0; i < ARRAY_SIZE(collector_names); i++) {
+        replay_one(t, collector_names[i], collector_dispatch(i), size);
+    }
+    tr_trace_free(t);
+    return 0;
+}
+
+// Each node is an array whose slots point to random other nodes. The
+// index array is only used while building the graph.
+static void
+build_graph(vm *v, size_t n) {
+    ptr index = vm_add(v, vm_array_init(v, n, 0));
+    for (size_t i = 0; i < n; i++) {
+        vm_set_slot(v, index, 1 + i, vm_array_init(v, MARK_N_SLOTS, 0));
+    }
+    for (size_t i = 0; i < n; i++) {
+        ptr node = P_GET_SLOT(index, 1 + i);
+        for (int j = 0; j < MARK_N_SLOTS; j++) {
+            ptr to = P_GET_SLOT(index, 1 + rand_n(n));
+            vm_set_slot(v, node, 1 + j, to);
+        }
+    }
+    vm_set(v, 0, P_GET_SLOT(index, 1));
+    vm_collect(v);
+}
+
+static double
+time_collections(vm *v) {
+    uint64_t start = nano_count();
+    for (int i = 0; i < MARK_N_LOOPS; i++) {
+        vm_collect(v);
+    }
+    return (double)(nano_count() - start) / MARK_N_LOOPS / 1e6;
+}
+
+static int
+mark(size_t size) {
+    // Nodes take up P_ARRAY_SIZE(MARK_N_SLOTS) bytes rounded up to
+    // the quick fit alignment plus 16 for their length ints and a
+    // slot in the index array.
+    size_t node_size = ALIGN(P_ARRAY_SIZE(MARK_N_SLOTS), QF_DATA_ALIGNMENT)
+        + 16 + sizeof(ref);
+    size_t n = size / node_size * 9 / 10;
+    printf("%lu nodes in a %lu MB heap, %d collections per run\n\n",
+           n, size >> 20, MARK_N_LOOPS);
+    printf("%-36s %10s %10s %8s %8s\n",
+           "Collector", "Live MB", "Plain ms", "Pf ms", "Speedup");
+    for (int i = 0; i < 2; i++) {
+        rand_init(0);
+        vm *v;
+        bool *prefetch;
+        char *name;
+        if (i == 0) {
+            v = vm_init(ms_get_dispatch_table(), size);
+            prefetch = &((mark_sweep_gc *)v->gc_obj)->prefetch;
+            name = "Mark & Sweep";
+        } else {
+            v = vm_init(msb_get_dispatch_table(), size);
+            prefetch = &((mark_sweep_bits_gc *)v->gc_obj)->prefetch;
+            name = "Mark & Sweep (separate mark bits)";
+        }
+        build_graph(v, n);
+        *prefetch = false;
+        double plain = time_collections(v);
+        *prefetch = true;
+        double pf = time_collections(v);
+        printf("%-36s %10lu %10.1f %8.1f %8.2f\n",
+               name, vm_space_used(v) >> 20, plain, pf, plain / pf);
+        vm_free(v);
+    }
+    return 0;
+}
+
+// Each mutator keeps every 64th object in a ring of 1000 slots.
+static void *
+allocate_objects(void *args) {
+    vm *v = *(vm **)args;
+    vm_add(v, vm_array_init(v, 1000, 0));
+    for (int i = 0; i < THREADS_N_ALLOCS; i++) {
+        ptr p = i % 2
+            ? vm_boxed_int_init(v, i)
+            : vm_array_init(v, i % 8, 0);
+        if (i % 64 == 0) {
+            vm_set_slot(v, vm_get(v, 0), 1 + i / 64 % 1000, p);
+        }
+    }
+    vm_detach(v);
+    return NULL;
+}
+
+static int
+threads(int max_threads) {
+    gc_dispatch *dispatches[] = {
+        cg_get_dispatch_table(),
+        ix_get_dispatch_table()
+    };
+    char *names[] = {"Copying", "Immix"};
+    printf("%d allocations per thread in a %d MB heap, %lu cores\n\n",
+           THREADS_N_ALLOCS, THREADS_HEAP_SIZE >> 20, thr_n_cores());
+    printf("%-36s %8s %5s %10s %8s\n",
+           "Collector", "Threads", "GCs", "Mallocs/s", "Speedup");
+    for (size_t i = 0; i < ARRAY_SIZE(dispatches); i++) {
+        double base = 0;
+        for (int n = 1; n <= max_threads; n *= 2) {
+            vm *v = vm_init(dispatches[i], THREADS_HEAP_SIZE);
+            vm *mutators[n];
+            thr_handle handles[n];
+            for (int j = 0; j < n; j++) {
+                mutators[j] = vm_attach(v);
+            }
+            uint64_t start = nano_count();
+            vm_enter_blocking(v);
+            thr_create_threads(n, handles, sizeof(vm *), mutators,
+                               allocate_objects);
+            thr_wait_for_threads(n, handles);
+            vm_leave_blocking(v);
+            double secs = (double)(nano_count() - start) / 1e9;
+            double rate = (double)n * THREADS_N_ALLOCS / secs / 1e6;
+            if (n == 1) {
+                base = rate;
+            }
+            gc_stats gs;
+            vm_stats_snapshot(v, &gs);
+            printf("%-36s %8d %5lu %10.1f %8.2f\n",
+                   names[i], n, gs.n_collections, rate, rate / base);
+            vm_free(v);
+        }
+    }
+    return 0;
+}
+
+// One word at a time with two compares, the way it was done before.
+static void
+scan_branchy(ptr lo, ptr hi, ptr start, size_t size, vector *out) {
+    for (ptr *iter = (ptr *)lo; iter < (ptr *)hi; iter++) {
+        ptr p = *iter;
+        if (p >= start && p < start + size) {
+            v_add(out, p);
+        }
+    }
+}
+
+static int
+scan(size_t size) {
+    typedef void (*scanner)(ptr, ptr, ptr, size_t, vector *);
+    scanner scanners[] = {
+        scan_branchy, cs_filter_words_scalar, cs_filter_words
+    };
+    char *names[] = {"Branchy", "Scalar", "Vectorized"};
+    // Percent of the words that point into the heap.
+    int densities[] = {2, 50};
+    char *buffers[] = {"Stack", "Heap"};
+
+    size_t n = size / sizeof(ptr);
+    ptr *words = malloc(size);
+    ptr start = 0x7f0000000000;
+    size_t heap_size = 1 << 30;
+    vector *out = v_init(n);
+    printf("%lu MB buffers, %d scans per run\n\n", size >> 20, SCAN_N_LOOPS);
+    printf("%-8s %-12s %8s %8s %8s\n",
+           "Buffer", "Scanner", "Hits", "GB/s", "Speedup");
+    for (size_t i = 0; i < ARRAY_SIZE(densities); i++) {
+        rand_init(0);
+        for (size_t j = 0; j < n; j++) {
+            words[j] = rand_n(100) < densities[i]
+                ? start + rand_n(heap_size)
+                : rand_n(1 << 30);
+        }
+        double base = 0;
+        for (size_t j = 0; j < ARRAY_SIZE(scanners); j++) {
+            uint64_t t0 = nano_count();
+            for (int k = 0; k < SCAN_N_LOOPS; k++) {
+                out->used = 0;
+                scanners[j]((ptr)words, (ptr)(words + n),
+                            start, heap_size, out);
+            }
+            double secs = (double)(nano_count() - t0) / 1e9;
+            double rate = (double)size * SCAN_N_LOOPS / secs / 1e9;
+            if (j == 0) {
+                base = rate;
+            }
+            printf("%-8s %-12s %8lu %8.2f %8.2f\n",
+                   buffers[i], names[j], out->used, rate, rate / base);
+        }
+    }
+    v_free(out);
+    free(words);
+    return 0;
+}
+
+// Slots 1 and 2 of each node are its subtrees. The nodes are
+// allocated breadth-first.
+static void
+build_tree(vm *v, size_t n) {
+    ptr index = vm_add(v, vm_array_init(v, n, 0));
+    for (size_t i = 0; i < n; i++) {
+        vm_set_slot(v, index, 1 + i, vm_array_init(v, 2, 0));
+    }
+    for (size_t i = 0; i < n / 2; i++) {
+        ptr node = P_GET_SLOT(index, 1 + i);
+        vm_set_slot(v, node, 1, P_GET_SLOT(index, 1 + 2 * i + 1));
+        vm_set_slot(v, node, 2, P_GET_SLOT(index, 1 + 2 * i + 2));
+    }
+    vm_set(v, 0, P_GET_SLOT(index, 1));
+}
+
+// Sums the counts of all nodes, left subtrees first.
+static size_t
+sum_tree(ptr node) {
+    if (!node) {
+        return 0;
+    }
+    size_t sum = *VALUE_P(P_GET_SLOT(node, 0));
+    sum += sum_tree(P_GET_SLOT(node, 1));
+    return sum + sum_tree(P_GET_SLOT(node, 2));
+}
+
+// TRAVERSE_N_LISTS lists whose nodes have a boxed int in slot 1 and
+// the next node in slot 2. The lists are built in round-robin.
+static void
+build_lists(vm *v, size_t n) {
+    ptr heads = vm_add(v, vm_array_init(v, TRAVERSE_N_LISTS, 0));
+    for (size_t i = 0; i < n; i++) {
+        ptr node = vm_add(v, vm_array_init(v, 2, 0));
+        vm_set_slot(v, node, 1, vm_boxed_int_init(v, 1));
+        heads = vm_get(v, 0);
+        size_t j = 1 + i % TRAVERSE_N_LISTS;
+        vm_set_slot(v, node, 2, P_GET_SLOT(heads, j));
+        vm_set_slot(v, heads, j, vm_remove(v));
+    }
+}
+
+static size_t
+sum_lists(ptr heads) {
+    size_t sum = 0;
+    for (size_t i = 0; i < TRAVERSE_N_LISTS; i++) {
+        for (ptr p = P_GET_SLOT(heads, 1 + i); p; p = P_GET_SLOT(p, 2)) {
+            sum += *VALUE_P(P_GET_SLOT(p, 1));
+        }
+    }
+    return sum;
+}
+
+static int
+traverse(int depth) {
+    gc_dispatch *dispatches[] = {
+        cg_get_dispatch_table_optimized(),
+        cg_get_dispatch_table_depth_first()
+    };
+    char *names[] = {"Breadth-first", "Depth-first"};
+    size_t n = ((size_t)1 << depth) - 1;
+    // List nodes with their ints take 64 bytes, in both spaces.
+    size_t size = 2 * ALIGN(n * NPTRS(8) + (1 << 20), (1 << 20));
+    printf("%lu nodes in a %lu MB heap, %d traversals per run\n\n",
+           n, size >> 20, TRAVERSE_N_LOOPS);
+    printf("%-8s %-16s %10s %12s %8s\n",
+           "Graph", "Copy order", "GC ms", "Traverse ms", "Speedup");
+    for (int i = 0; i < 2; i++) {
+        double base = 0;
+        for (size_t j = 0; j < ARRAY_SIZE(dispatches); j++) {
+            vm *v = vm_init(dispatches[j], size);
+            if (i == 0) {
+                build_tree(v, n);
+            } else {
+                build_lists(v, n);
+            }
+            uint64_t start = nano_count();
+            vm_collect(v);
+            double gc = (double)(nano_count() - start) / 1e6;
+            start = nano_count();
+            for (int k = 0; k < TRAVERSE_N_LOOPS; k++) {
+                ptr root = vm_get(v, 0);
+                size_t sum = i == 0 ? sum_tree(root) : sum_lists(root);
+                if (sum != (i == 0 ? 2 * n : n)) {
+                    error("The graph is broken!\n");
+                }
+            }
+            double ms = (double)(nano_count() - start)
+                / TRAVERSE_N_LOOPS / 1e6;
+            if (j == 0) {
+                base = ms;
+            }
+            printf("%-8s %-16s %10.1f %12.1f %8.2f\n",
+                   i == 0 ? "Tree" : "Lists", names[j], gc, ms, base / ms);
+            vm_free(v);
+        }
+    }
+    return 0;
+}
+
+// Fills each array with one of the values, copies it to the next one
+// and makes a new array from half of it.
+static void
+bulk_round(vm *v, bool bulk, int k) {
+    size_t n = BULK_N_SLOTS;
+    for (size_t i = 1; i < BULK_N_ARRAYS; i++) {
+        ptr value = P_GET_SLOT(vm_get(v, 0), 1 + (i + k) % BULK_N_ARRAYS);
+        ptr arr = vm_get(v, i);
+        if (bulk) {
+            vm_fill_slots(v, arr, 1, n, value);
+        } else {
+            for (size_t j = 1; j <= n; j++) {
+                vm_set_slot(v, arr, j, value);
+            }
+        }
+    }
+    for (size_t i = 1; i < BULK_N_ARRAYS - 1; i++) {
+        ptr from = vm_get(v, i);
+        ptr to = vm_get(v, i + 1);
+        if (bulk) {
+            vm_copy_slots(v, to, 1, from, 1, n);
+        } else {
+            for (size_t j = 1; j <= n; j++) {
+                vm_set_slot(v, to, j, P_GET_SLOT(from, j));
+            }
+        }
+    }
+    for (size_t i = 1; i < BULK_N_ARRAYS; i++) {
+        if (bulk) {
+            vm_add(v, vm_array_init_from(v, vm_get(v, i), 1, n / 2));
+        } else {
+            ptr slice = vm_add(v, vm_array_init(v, n / 2, 0));
+            ptr arr = vm_get(v, i);
+            for (size_t j = 1; j <= n / 2; j++) {
+                vm_set_slot(v, slice, j, P_GET_SLOT(arr, j));
+            }
+        }
+        vm_remove(v);
+    }
+}
+
+// Returns the number of seconds the rounds took.
+static double
+bulk_run(gc_dispatch *dispatch, bool bulk) {
+    vm *v = vm_init(dispatch, BULK_HEAP_SIZE);
+    vm_add(v, vm_array_init(v, BULK_N_ARRAYS, 0));
+    for (size_t i = 0; i < BULK_N_ARRAYS; i++) {
+        vm_set_slot(v, vm_get(v, 0), 1 + i, vm_boxed_int_init(v, (int)i));
+    }
+    for (size_t i = 1; i < BULK_N_ARRAYS; i++) {
+        vm_add(v, vm_array_init(v, BULK_N_SLOTS, 0));
+    }
+    uint64_t start = nano_count();
+    for (int k = 0; k < BULK_N_LOOPS; k++) {
+        bulk_round(v, bulk, k);
+    }
+    double secs = (double)(nano_count() - start) / 1e9;
+    vm_free(v);
+    return secs;
+}
+
+static int
+bulk() {
+    // Slots written per round by the fills, copies and slices.
+    double n_slots = (double)BULK_N_LOOPS * BULK_N_SLOTS
+        * ((BULK_N_ARRAYS - 1) + (BULK_N_ARRAYS - 2)
+           + (BULK_N_ARRAYS - 1) / 2.0);
+    printf("%.0f slot writes per run\n\n", n_slots);
+    printf("%-36s %12s %12s %8s\n",
+           "Collector", "Slots Mops/s", "Bulk Mops/s", "Speedup");
+    for (size_t i = 0; i < ARRAY_SIZE(collector_names); i++) {
+        double slots = bulk_run(collector_dispatch(i), false);
+        double bulk = bulk_run(collector_dispatch(i), true);
+        printf("%-36s %12.1f %12.1f %8.2f\n",
+               collector_names[i], n_slots / slots / 1e6,
+               n_slots / bulk / 1e6, slots / bulk);
+    }
+    return 0;
+}
+
+// Defines functions timing the allocations and stores of the vm
+// functions with prefix P. They return nanoseconds per operation.
+#define SPEC_TIMERS(P)                                                  \
+    static double                                                       \
+    P##_time_allocs(vm *v) {                                            \
+        uint64_t start = nano_count();                                  \
+        for (int i = 0; i < SPEC_N_ALLOCS; i++) {                       \
+            P##_boxed_int_init(v, i);                                   \
+        }                                                               \
+        return (double)(nano_count() - start) / SPEC_N_ALLOCS;          \
+    }                                                                   \
+    static double                                                       \
+    P##_time_stores(vm *v) {                                            \
+        ptr arr = vm_get(v, 0);                                         \
+        ptr value = vm_get(v, 1);                                       \
+        uint64_t start = nano_count();                                  \
+        for (size_t i = 0; i < SPEC_N_STORES; i++) {                    \
+            P##_set_slot(v, arr, 1 + (i & (SPEC_N_SLOTS - 1)), value);  \
+        }                                                               \
+        return (double)(nano_count() - start) / SPEC_N_STORES;          \
+    }
+
+SPEC_TIMERS(vm)
+SPEC_TIMERS(cgv)
+SPEC_TIMERS(genv)
+SPEC_TIMERS(msv)
+
+typedef double (*spec_timer)(vm *v);
+
+static double
+spec_time(gc_dispatch *dispatch, spec_timer timer) {
+    vm *v = vm_init(dispatch, SPEC_HEAP_SIZE);
+    vm_add(v, vm_array_init(v, SPEC_N_SLOTS, 0));
+    vm_add(v, vm_boxed_int_init(v, 0));
+    vm_collect(v);
+    double ns = timer(v);
+    vm_free(v);
+    return ns;
+}
+
+static int
+spec() {
+    char *names[] = {"Copying", "Generational", "Mark & Sweep"};
+    gc_dispatch *dispatches[] = {
+        cg_get_dispatch_table(),
+        gen_get_dispatch_table(),
+        ms_get_dispatch_table()
+    };
+    spec_timer allocs[] = {
+        cgv_time_allocs, genv_time_allocs, msv_time_allocs
+    };
+    spec_timer stores[] = {
+        cgv_time_stores, genv_time_stores, msv_time_stores
+    };
+    printf("%d allocations and %d slot writes, ns per operation\n\n",
+           SPEC_N_ALLOCS, SPEC_N_STORES);
+    printf("%-14s %9s %9s %8s %9s %9s %8s\n",
+           "Collector", "Alloc", "Static", "Speedup",
+           "Store", "Static", "Speedup");
+    for (size_t i = 0; i < ARRAY_SIZE(names); i++) {
+        double alloc_dyn = spec_time(dispatches[i], vm_time_allocs);
+        double alloc_spec = spec_time(dispatches[i], allocs[i]);
+        double store_dyn = spec_time(dispatches[i], vm_time_stores);
+        double store_spec = spec_time(dispatches[i], stores[i]);
+        printf("%-14s %9.2f %9.2f %8.2f %9.2f %9.2f %8.2f\n",
+               names[i], alloc_dyn, alloc_spec, alloc_dyn / alloc_spec,
+               store_dyn, store_spec, store_dyn / store_spec);
+    }
+    return 0;
+}
+
+static double
+ms_since(uint64_t start) {
+    return (double)(nano_count() - start) / 1e6;
+}
+
+static int
+image(size_t size) {
+    // Same node size as in the mark benchmark. The graph only fills a
+    // quarter of the heap so that it fits in a semispace.
+    size_t node_size = ALIGN(P_ARRAY_SIZE(MARK_N_SLOTS), QF_DATA_ALIGNMENT)
+        + 16 + sizeof(ref);
+    size_t n = size / node_size / 4;
+    printf("%lu nodes in a %lu MB heap\n\n", n, size >> 20);
+    printf("%-14s %8s %9s %9s %9s %9s\n",
+           "Collector", "Live MB", "Build ms", "Save ms", "Load ms",
+           "Reloc ms");
+    char *names[] = {"Copying", "Mark & Sweep", "Ref Counting"};
+    gc_dispatch *dispatches[] = {
+        cg_get_dispatch_table(),
+        ms_get_dispatch_table(),
+        rc_get_dispatch_table()
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(names); i++) {
+        rand_init(0);
+        uint64_t start = nano_count();
+        vm *v = vm_init(dispatches[i], size);
+        build_graph(v, n);
+        double build = ms_since(start);
+        start = nano_count();
+        if (!vm_save_image(v, IMAGE_PATH)) {
+            error("Can't write %s!\n", IMAGE_PATH);
+        }
+        double save = ms_since(start);
+        size_t used = vm_space_used(v);
+        vm_free(v);
+        start = nano_count();
+        v = vm_load_image(IMAGE_PATH, dispatches[i], size);
+        double load = ms_since(start);
+        start = nano_count();
+        vm *v2 = vm_load_image(IMAGE_PATH, dispatches[i], size);
+        double reloc = ms_since(start);
+        if (!v || !v2) {
+            error("Can't load %s!\n", IMAGE_PATH);
+        }
+        printf("%-14s %8lu %9.1f %9.1f %9.1f %9.1f\n",
+               names[i], used >> 20, build, save, load, reloc);
+        vm_free(v2);
+        vm_free(v);
+    }
+    remove(IMAGE_PATH);
+    return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+    if (argc == 3 && !strcmp(argv[1], "record")) {
+        return record(argv[2]);
+    }
+    if ((argc == 3 || argc == 4) && !strcmp(argv[1], "replay")) {
+        size_t size = argc == 4 ? (size_t)atoi(argv[3]) << 20 : 0;
+        return replay(argv[2], size);
+    }
+    if ((argc == 2 || argc == 3) && !strcmp(argv[1], "mark")) {
+        size_t size = argc == 3 ? (size_t)atoi(argv[2]) : MARK_HEAP_MB;
+        return mark(size << 20);
+    }
+    if ((argc == 2 || argc == 3) && !strcmp(argv[1], "threads")) {
+        int n = argc == 3 ? atoi(argv[2]) : MAX((int)thr_n_cores(), 4);
+        return threads(n);
+    }
+    if ((argc == 2 || argc == 3) && !strcmp(argv[1], "scan")) {
+        size_t size = argc == 3 ? (size_t)atoi(argv[2]) : SCAN_MB;
+        return scan(size << 20);
+    }
+    if ((argc == 2 || argc == 3) && !strcmp(argv[1], "traverse")) {
+        return traverse(argc == 3 ? atoi(argv[2]) : TRAVERSE_DEPTH);
+    }
+    if (argc == 2 && !strcmp(argv[1], "bulk")) {
+        return bulk();
+    }
+    if (argc == 2 && !strcmp(argv[1], "spec")) {
+        return spec();
+    }
+    if ((argc == 2 || argc == 3) && !strcmp(argv[1], "image")) {
+        size_t size = argc == 3 ? (size_t)atoi(argv[2]) : IMAGE_HEAP_MB;
+        return image(size << 20);
+    }
+    printf("usage: %s record TRACE | replay TRACE [HEAP_MB] | "
+           "mark [HEAP_MB] | threads [N] | scan [MB] | "
+           "traverse [DEPTH] | bulk | spec | image [HEAP_MB]\n", argv[0]);
+    return 1;
+}
@@ -3,10 +3,15 @@
 #include "collectors/vm.h"
 #include "collectors/copying.h"
 #include "collectors/copying-opt.h"
+#include "collectors/generational.h"
+#include "collectors/immix.h"
+#include "collectors/mark-compact.h"
 #include "collectors/mark-sweep.h"
 #include "collectors/mark-sweep-bits.h"
+#include "collectors/mark-sweep-inc.h"
 #include "collectors/ref-counting.h"
 #include "collectors/ref-counting-cycles.h"
+#include "collectors/ref-counting-deferred.h"
 
 gc_dispatch *dispatch = NULL;
 
@@ -55,21 +60,21 @@ test_ref_counts() {
     assert(vm_space_used(v) == 0);
 
     ptr w = vm_add(v, vm_wrapper_init(v, vm_boxed_int_init(v, 3)));
-    assert(P_GET_RC(*SLOT_P(w, 0)) == 1);
+    assert(P_GET_RC(P_GET_SLOT(w, 0)) == 1);
     assert(vm_space_used(v) == NPTRS(4));
     vm_remove(v);
     vm_collect(v);
     assert(vm_space_used(v) == 0);
 
-    vm_add(v, vm_array_init(v, 10, 0));
-    assert(vm_space_used(v) == NPTRS(14));
+    vm_add(v, vm_array_init(v, 12, 0));
+    assert(vm_space_used(v) == P_ARRAY_SIZE(12) + NPTRS(2));
     vm_remove(v);
     vm_collect(v);
     assert(vm_space_used(v) == 0);
 
-    ptr a = vm_add(v, vm_array_init(v, 10, vm_boxed_int_init(v, 3)));
-    assert(P_GET_RC(*SLOT_P(a, 3)) == 10);
-    assert(vm_space_used(v) == NPTRS(16));
+    ptr a = vm_add(v, vm_array_init(v, 12, vm_boxed_int_init(v, 3)));
+    assert(P_GET_RC(P_GET_SLOT(a, 3)) == 12);
+    assert(vm_space_used(v) == P_ARRAY_SIZE(12) + NPTRS(4));
     vm_remove(v);
     vm_collect(v);
     assert(vm_space_used(v) == 0);
@@ -135,8 +140,8 @@ test_collect() {
     vm_collect(v);
     assert(vm_space_used(v) == NPTRS(2));
 
-    vm_add(v, vm_array_init(v, 10, 0));
-    assert(vm_space_used(v) == NPTRS(2 + 12 + 2));
+    vm_add(v, vm_array_init(v, 12, 0));
+    assert(vm_space_used(v) == P_ARRAY_SIZE(12) + NPTRS(4));
     vm_remove(v);
     vm_remove(v);
     if (dispatch == rcc_get_dispatch_table() ||
@@ -146,6 +151,161 @@ test_collect() {
     vm_free(v);
 }
 
+// Tagged ints are never followed, even if they look like pointers
+// into the heap.
+void
+test_tagged_ints() {
+    vm *v = vm_init(dispatch, 64 * 1024);
+    int64_t heap_int = (int64_t)(REF_ENCODE(v->memory) >> 1);
+    int64_t values[] = {
+        0, -1, 1234, P_TAG_INT_MIN, P_TAG_INT_MAX, heap_int, heap_int + 40
+    };
+    size_t n = ARRAY_SIZE(values);
+    ptr arr = vm_add(v, vm_array_init(v, n + 1, 0));
+    for (size_t i = 0; i < n; i++) {
+        ptr p = vm_int_init(v, values[i]);
+        assert(P_TAGGED_P(p));
+        vm_set_slot(v, arr, 1 + i, p);
+    }
+    ptr p = vm_boxed_int_init(v, 7);
+    vm_set_slot(v, vm_get(v, 0), 1 + n, p);
+    vm_add(v, vm_int_init(v, -5));
+    size_t used = vm_space_used(v);
+    assert(used == P_ARRAY_SIZE(n + 1) + NPTRS(4));
+    vm_collect(v);
+    assert(vm_space_used(v) == used);
+    arr = vm_get(v, 0);
+    for (size_t i = 0; i < n; i++) {
+        assert(vm_int_value(P_GET_SLOT(arr, 1 + i)) == values[i]);
+    }
+    assert(vm_int_value(P_GET_SLOT(arr, 1 + n)) == 7);
+    assert(vm_int_value(vm_get(v, 1)) == -5);
+
+    // Barriers see objects replaced by ints and ints by objects.
+    p = vm_boxed_int_init(v, 8);
+    vm_set_slot(v, vm_get(v, 0), 1, p);
+    vm_set_slot(v, vm_get(v, 0), 1 + n, vm_int_init(v, 9));
+    vm_collect(v);
+    assert(vm_space_used(v) == used);
+    assert(vm_int_value(P_GET_SLOT(vm_get(v, 0), 1)) == 8);
+
+    vm_remove(v);
+    vm_remove(v);
+    vm_collect(v);
+    assert(vm_space_used(v) == 0);
+    vm_free(v);
+}
+
+// Raw arrays aren't scanned, so ints that look like pointers survive
+// moving collections unchanged. The large ones go to the large object
+// spaces of the collectors that have them.
+void
+test_raw_arrays() {
+    vm *v = vm_init(dispatch, 1 << 20);
+    size_t sizes[] = {0, 1, 9, 3000};
+    for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+        size_t n = sizes[i];
+        vm_add(v, vm_array_init(v, 4, 0));
+        vm_set_slot(v, vm_last(v), 1, vm_float_array_init(v, n, 0.5));
+        vm_set_slot(v, vm_last(v), 2, vm_int_array_init(v, n, 0));
+        vm_set_slot(v, vm_last(v), 3, vm_byte_array_init(v, n, 0xab));
+        vm_set_slot(v, vm_last(v), 4, vm_boxed_int_init(v, (int)n));
+        ptr ints = P_GET_SLOT(vm_last(v), 2);
+        for (size_t j = 0; j < n; j++) {
+            *INT_SLOT_P(ints, j) = (int64_t)vm_last(v) + j;
+        }
+    }
+    // Some collectors round block sizes up.
+    size_t n_bytes = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+        size_t n = sizes[i];
+        n_bytes += P_ARRAY_SIZE(4) + NPTRS(2) + NPTRS(2 + n) * 2 +
+            NPTRS(2) + ALIGN(n, sizeof(ptr)) + NPTRS(2);
+    }
+    assert(vm_space_used(v) >= n_bytes);
+    ptr before[ARRAY_SIZE(sizes)];
+    for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+        before[i] = vm_get(v, i);
+    }
+    vm_collect(v);
+    size_t used = vm_space_used(v);
+    assert(used >= n_bytes && used < n_bytes + 512);
+    vm_collect(v);
+    vm_collect(v);
+    assert(vm_space_used(v) == used);
+    for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+        size_t n = sizes[i];
+        ptr arr = vm_get(v, i);
+        ptr floats = P_GET_SLOT(arr, 1);
+        ptr ints = P_GET_SLOT(arr, 2);
+        ptr bytes = P_GET_SLOT(arr, 3);
+        assert(P_GET_TYPE(floats) == TYPE_FLOAT_ARRAY);
+        assert(RAW_COUNT(floats) == n && RAW_COUNT(ints) == n);
+        assert(RAW_COUNT(bytes) == n);
+        for (size_t j = 0; j < n; j++) {
+            assert(*FLOAT_SLOT_P(floats, j) == 0.5);
+            assert(*INT_SLOT_P(ints, j) == (int64_t)before[i] + j);
+            assert(*BYTE_SLOT_P(bytes, j) == 0xab);
+        }
+        assert(*VALUE_P(P_GET_SLOT(arr, 4)) == n);
+    }
+    while (vm_size(v)) {
+        vm_remove(v);
+    }
+    vm_collect(v);
+    assert(vm_space_used(v) == 0);
+    vm_free(v);
+}
+
+static void
+check_bulk_slots(ptr arr) {
+    for (int i = 1; i <= 100; i++) {
+        int64_t value = i - 1;
+        if (i <= 10) {
+            value = 1000;
+        } else if (i > 20 && i <= 70) {
+            value = i - 11;
+        }
+        assert(*VALUE_P(P_GET_SLOT(arr, i)) == value);
+    }
+}
+
+// Bulk writes into an array that has survived a collection with new
+// objects. Garbage is allocated afterwards to trigger collections
+// that rely on the barriers.
+void
+test_bulk_slots() {
+    vm *v = vm_init(dispatch, 1 << 20);
+    vm_add(v, vm_array_init(v, 100, 0));
+    for (int i = 0; i < 100; i++) {
+        vm_set_slot(v, vm_get(v, 0), 1 + i, vm_boxed_int_init(v, i));
+    }
+    vm_collect(v);
+    ptr p = vm_boxed_int_init(v, 1000);
+    vm_fill_slots(v, vm_get(v, 0), 1, 10, p);
+    // Overlapping copy from slots 11-60 to 21-70.
+    ptr arr = vm_get(v, 0);
+    vm_copy_slots(v, arr, 21, arr, 11, 50);
+    check_bulk_slots(vm_get(v, 0));
+    vm_add(v, vm_array_init_from(v, vm_get(v, 0), 1, 100));
+    for (int i = 0; i < 50000; i++) {
+        vm_add(v, vm_boxed_int_init(v, i));
+        vm_remove(v);
+    }
+    vm_collect(v);
+    check_bulk_slots(vm_get(v, 0));
+    check_bulk_slots(vm_get(v, 1));
+    // The first ten ints and 60-69 are gone.
+    size_t used = 2 * (P_ARRAY_SIZE(100) + NPTRS(2)) + 81 * NPTRS(2);
+    assert(vm_space_used(v) == used);
+
+    vm_remove(v);
+    vm_remove(v);
+    vm_collect(v);
+    assert(vm_space_used(v) == 0);
+    vm_free(v);
+}
+
 void
 test_dump() {
     vm *v = vm_init(dispatch, 4096);
@@ -229,7 +389,7 @@ test_torture() {
     assert(n_roots == 100);
     for (int i = 0; i < 10000000; i++) {
         ptr rand_arr = vm_get(v, rand_n(n_roots));
-        int n_els = (int)*SLOT_P(*SLOT_P(rand_arr, 0), 0);
+        int n_els = (int)*VALUE_P(P_GET_SLOT(rand_arr, 0));
         ptr p = random_object(v);
         vm_set_slot(v, rand_arr, 1 + rand_n(n_els), p);
     }
@@ -260,6 +420,9 @@ test_collector(char *name, gc_dispatch *this_dispatch) {
     PRINT_RUN(test_ref_counts);
     PRINT_RUN(test_ref_count_colors);
     PRINT_RUN(test_collect);
+    PRINT_RUN(test_tagged_ints);
+    PRINT_RUN(test_raw_arrays);
+    PRINT_RUN(test_bulk_slots);
     PRINT_RUN(test_dump);
     PRINT_RUN(test_stack_overflow);
     PRINT_RUN(test_mark_stack_overflow);
@@ -277,7 +440,21 @@ main(int argc, char *argv[]) {
         rcc_get_dispatch_table(),
         ms_get_dispatch_table(),
         msb_get_dispatch_table(),
-        cg_get_dispatch_table_optimized()
+        cg_get_dispatch_table_optimized(),
+        gen_get_dispatch_table(),
+        ms_get_dispatch_table_parallel(),
+        msb_get_dispatch_table_parallel(),
+        msi_get_dispatch_table(),
+        msb_get_dispatch_table_lazy(),
+        mc_get_dispatch_table(),
+        cg_get_dispatch_table_parallel(),
+        rcd_get_dispatch_table(),
+        rc_get_dispatch_table_incremental(),
+        rcc_get_dispatch_table_concurrent(),
+        ms_get_dispatch_table_prefetch(),
+        msb_get_dispatch_table_prefetch(),
+        ix_get_dispatch_table(),
+        cg_get_dispatch_table_depth_first()
     };
     char *names[] = {
         "Copying",
@@ -285,7 +462,21 @@ main(int argc, char *argv[]) {
         "Cycle-collecting Reference Counting",
         "Mark & Sweep",
         "Mark & Sweep (separate mark bits)",
-        "Optimized Copying"
+        "Optimized Copying",
+        "Generational",
+        "Parallel Mark & Sweep",
+        "Parallel Mark & Sweep (separate mark bits)",
+        "Incremental Mark & Sweep",
+        "Mark & Sweep (separate mark bits, lazy sweeping)",
+        "Mark & Compact",
+        "Parallel Copying",
+        "Deferred Reference Counting",
+        "Incremental Reference Counting",
+        "Concurrent Cycle-collecting Reference Counting",
+        "Prefetching Mark & Sweep",
+        "Prefetching Mark & Sweep (separate mark bits)",
+        "Immix",
+        "Depth-first Copying"
     };
     for (size_t n = 0; n < ARRAY_SIZE(names); n++) {
         test_collector(names[n], dispatches[n]);
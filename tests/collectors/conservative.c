@@ -0,0 +1,251 @@
+// Checks the collector with conservative stack scanning.
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "collectors/conservative.h"
+#include "threads/threads.h"
+
+static ptr
+int_init(conservative_gc *cs, ptr value) {
+    ptr p = cs_allot(cs, TYPE_INT, NPTRS(2));
+    *VALUE_P(p) = value;
+    return p;
+}
+
+static ptr
+wrapper_init(conservative_gc *cs, ptr value) {
+    ptr p = cs_allot(cs, TYPE_WRAPPER, NPTRS(2));
+    P_SET_SLOT(p, 0, value);
+    return p;
+}
+
+// Allocated in a separate frame so that no references to the
+// garbage remain on the stack.
+static void __attribute__((noinline))
+allocate_garbage(conservative_gc *cs, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        int_init(cs, i);
+    }
+}
+
+void
+test_find_object() {
+    conservative_gc *cs = cs_init(1 << 16);
+    cs_register_thread(cs, NULL);
+    ptr p1 = cs_allot(cs, TYPE_INT, 100);
+    ptr p2 = cs_allot(cs, TYPE_INT, NPTRS(2));
+    assert(QF_GET_BLOCK_SIZE(p1) == 112);
+    assert(cs_find_object(cs, p1) == p1);
+    assert(cs_find_object(cs, p1 + 111) == p1);
+    assert(cs_find_object(cs, p2 + 8) == p2);
+
+    // Outside the heap or in free space.
+    assert(!cs_find_object(cs, 0));
+    assert(!cs_find_object(cs, cs->start - 8));
+    assert(!cs_find_object(cs, cs->start + cs->size));
+    assert(!cs_find_object(cs, cs->start + cs->size - 8));
+    cs_unregister_thread(cs);
+    cs_free(cs);
+}
+
+// Returns the offset of a new object spanning ten bitmap words so
+// that no pointer to it is left on the stack.
+static size_t __attribute__((noinline))
+allocate_large(conservative_gc *cs, size_t size) {
+    ptr big = cs_allot(cs, TYPE_INT, size);
+    assert(cs_find_object(cs, big + size - 8) == big);
+    assert(cs_find_object(cs, big + 3 * CS_CHUNK) == big);
+    assert(!cs_find_object(cs, big + size + 8));
+    return big - cs->start;
+}
+
+// Pointers into the tail of an object spanning several bitmap words.
+// Once it is freed, the smaller objects allocated in its place are
+// found instead.
+void
+test_find_large_object() {
+    conservative_gc *cs = cs_init(1 << 16);
+    cs_register_thread(cs, NULL);
+    ptr small = int_init(cs, 1);
+    size_t size = 10 * CS_CHUNK;
+    size_t tail = allocate_large(cs, size) + size - 8;
+    assert(cs_find_object(cs, small + 8) == small);
+    cs_collect(cs);
+    assert(!cs_find_object(cs, cs->start + tail));
+    ptr p = 0;
+    while (p < cs->start + tail - CS_CHUNK) {
+        p = int_init(cs, 2);
+    }
+    assert(cs_find_object(cs, p + 8) == p);
+    assert(*VALUE_P(small) == 1);
+    cs_unregister_thread(cs);
+    cs_free(cs);
+}
+
+// The vectorized and scalar filters agree with a plain loop for all
+// alignments and lengths, including words at the range boundaries.
+void
+test_filter_words() {
+    ptr start = 0x10000;
+    size_t size = 0x1000;
+    ptr values[] = {
+        0, 1, start - 1, start, start + 8, start + size - 1,
+        start + size, start + size + 8, (ptr)-1, (ptr)INT64_MIN
+    };
+    size_t n = 3000;
+    ptr *words = malloc(NPTRS(n));
+    rand_init(0);
+    for (size_t i = 0; i < n; i++) {
+        words[i] = values[rand_n(ARRAY_SIZE(values))];
+    }
+    vector *v1 = v_init(16);
+    vector *v2 = v_init(16);
+    for (size_t lo = 0; lo < 20; lo++) {
+        for (size_t hi = lo; hi < n; hi += 1 + rand_n(300)) {
+            v1->used = v2->used = 0;
+            cs_filter_words((ptr)&words[lo], (ptr)&words[hi],
+                            start, size, v1);
+            cs_filter_words_scalar((ptr)&words[lo], (ptr)&words[hi],
+                                   start, size, v2);
+            size_t j = 0;
+            for (size_t i = lo; i < hi; i++) {
+                if (words[i] >= start && words[i] < start + size) {
+                    assert(v1->array[j] == words[i]);
+                    assert(v2->array[j] == words[i]);
+                    j++;
+                }
+            }
+            assert(v1->used == j);
+            assert(v2->used == j);
+        }
+    }
+    // Unaligned bounds are rounded inwards.
+    v1->used = 0;
+    words[0] = words[1] = start;
+    cs_filter_words((ptr)words + 1, (ptr)&words[2] - 1, start, size, v1);
+    assert(v1->used == 0);
+    v_free(v1);
+    v_free(v2);
+    free(words);
+}
+
+void
+test_stack_roots() {
+    conservative_gc *cs = cs_init(1 << 16);
+    cs_register_thread(cs, NULL);
+    ptr p = int_init(cs, 1234);
+    // Only an interior pointer to the object is kept.
+    volatile ptr inner = int_init(cs, 5678) + NPTRS(1);
+    allocate_garbage(cs, 10000);
+    assert(cs->n_collections > 0);
+    assert(P_GET_TYPE(p) == TYPE_INT);
+    assert(*VALUE_P(p) == 1234);
+    assert(cs_find_object(cs, inner) == inner - NPTRS(1));
+    assert(AT(inner) == 5678);
+
+    // The garbage is gone.
+    size_t n_collections = cs->n_collections;
+    cs_collect(cs);
+    assert(cs->n_collections == n_collections + 1);
+    assert(cs_space_used(cs) < 1024);
+    cs_unregister_thread(cs);
+    cs_free(cs);
+}
+
+// Objects only reachable from the heap are found by precise
+// scanning.
+void
+test_precise_heap() {
+    conservative_gc *cs = cs_init(1 << 16);
+    cs_register_thread(cs, NULL);
+    ptr head = 0;
+    for (int i = 0; i < 100; i++) {
+        head = wrapper_init(cs, head);
+        allocate_garbage(cs, 50);
+    }
+    cs_collect(cs);
+    size_t n = 0;
+    for (ptr p = head; p; p = P_GET_SLOT(p, 0)) {
+        assert(P_GET_TYPE(p) == TYPE_WRAPPER);
+        n++;
+    }
+    assert(n == 100);
+    cs_unregister_thread(cs);
+    cs_free(cs);
+}
+
+#define N_THREADS       4
+#define N_THREAD_ALLOCS 20000
+
+typedef struct {
+    conservative_gc *cs;
+    int id;
+} thread_args;
+
+// Lists of (value, next) arrays.
+static ptr
+cons_init(conservative_gc *cs, ptr value, ptr next) {
+    ptr count = int_init(cs, 2);
+    ptr p = cs_allot(cs, TYPE_ARRAY, P_ARRAY_SIZE(2));
+    P_SET_SLOT(p, 0, count);
+    P_SET_SLOT(p, 1, value);
+    P_SET_SLOT(p, 2, next);
+    return p;
+}
+
+static void *
+thread_main(void *args) {
+    thread_args *a = (thread_args *)args;
+    conservative_gc *cs = a->cs;
+    cs_register_thread(cs, NULL);
+    ptr head = 0;
+    for (int i = 0; i < N_THREAD_ALLOCS; i++) {
+        ptr p = int_init(cs, a->id * N_THREAD_ALLOCS + i);
+        if (i % 100 == 0) {
+            head = cons_init(cs, p, head);
+        }
+    }
+    int i = N_THREAD_ALLOCS - 100;
+    for (ptr p = head; p; p = P_GET_SLOT(p, 2)) {
+        ptr value = *VALUE_P(P_GET_SLOT(p, 1));
+        assert(value == (ptr)(a->id * N_THREAD_ALLOCS + i));
+        i -= 100;
+    }
+    assert(i == -100);
+    cs_unregister_thread(cs);
+    return NULL;
+}
+
+void
+test_threads() {
+    conservative_gc *cs = cs_init(1 << 20);
+    cs_register_thread(cs, NULL);
+    ptr keep = int_init(cs, 1234);
+    thread_args args[N_THREADS];
+    for (int i = 0; i < N_THREADS; i++) {
+        args[i].cs = cs;
+        args[i].id = i;
+    }
+    thr_handle handles[N_THREADS];
+    cs_enter_blocking(cs);
+    assert(thr_create_threads(N_THREADS, handles, sizeof(thread_args),
+                              args, thread_main));
+    assert(thr_wait_for_threads(N_THREADS, handles));
+    cs_leave_blocking(cs);
+    assert(cs->threads->used == 1);
+    assert(cs->n_collections > 0);
+    assert(*VALUE_P(keep) == 1234);
+    cs_unregister_thread(cs);
+    cs_free(cs);
+}
+
+int
+main(int argc, char *argv[]) {
+    PRINT_RUN(test_find_object);
+    PRINT_RUN(test_find_large_object);
+    PRINT_RUN(test_filter_words);
+    PRINT_RUN(test_stack_roots);
+    PRINT_RUN(test_precise_heap);
+    PRINT_RUN(test_threads);
+    return 0;
+}
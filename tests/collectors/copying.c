@@ -0,0 +1,61 @@
+// Checks the copy orders of the optimized copying collector.
+#include <assert.h>
+#include <stdio.h>
+#include "collectors/vm.h"
+#include "collectors/copying.h"
+#include "collectors/copying-opt.h"
+
+// Complete binary tree of arrays whose slots 1 and 2 are the left
+// and right subtrees.
+static ptr
+tree_init(vm *v, int depth) {
+    vm_add(v, vm_array_init(v, 2, 0));
+    if (depth > 1) {
+        ptr left = tree_init(v, depth - 1);
+        vm_set_slot(v, vm_get(v, v->roots->used - 1), 1, left);
+        ptr right = tree_init(v, depth - 1);
+        vm_set_slot(v, vm_get(v, v->roots->used - 1), 2, right);
+    }
+    return vm_remove(v);
+}
+
+// Number of inner nodes whose left child is at most max_dist bytes
+// after them.
+static size_t
+count_close_children(ptr node, size_t max_dist) {
+    ptr left = P_GET_SLOT(node, 1);
+    if (!left) {
+        return 0;
+    }
+    return (left - node <= max_dist)
+        + count_close_children(left, max_dist)
+        + count_close_children(P_GET_SLOT(node, 2), max_dist);
+}
+
+// Size of a node with its count int.
+#define NODE_SIZE (P_ARRAY_SIZE(2) + NPTRS(2))
+
+// Depth-first copying places the left child of every node right after
+// it, breadth-first copying only does that for the root.
+void
+test_copy_order() {
+    gc_dispatch *dispatches[] = {
+        cg_get_dispatch_table_optimized(),
+        cg_get_dispatch_table_depth_first()
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(dispatches); i++) {
+        vm *v = vm_init(dispatches[i], 1 << 20);
+        vm_add(v, tree_init(v, 8));
+        vm_collect(v);
+        size_t n = count_close_children(vm_get(v, 0), NODE_SIZE);
+        assert(i == 0 ? n == 1 : n == 127);
+        assert(vm_space_used(v) == 255 * NODE_SIZE);
+        vm_free(v);
+    }
+}
+
+int
+main(int argc, char *argv[]) {
+    PRINT_RUN(test_copy_order);
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <assert.h>
+#include "collectors/vm.h"
+#include "collectors/generational.h"
+
+void
+test_init() {
+    vm *v = vm_init(gen_get_dispatch_table(), 4096);
+    generational_gc *gen = (generational_gc *)v->gc_obj;
+    assert(gen->nursery.end - gen->nursery.start == 512);
+    assert(gen->qf->size == 4096 - 512);
+    assert(gen->large_size == 128);
+    vm_free(v);
+}
+
+void
+test_promotion() {
+    vm *v = vm_init(gen_get_dispatch_table(), 4096);
+    generational_gc *gen = (generational_gc *)v->gc_obj;
+
+    ptr p = vm_add(v, vm_boxed_int_init(v, 20));
+    assert(p == gen->nursery.start);
+
+    // Fill the nursery so that the next allocation triggers a minor
+    // collection.
+    while (vm_boxed_int_init(v, 0) < gen->nursery.end - NPTRS(2)) {
+    }
+    vm_boxed_int_init(v, 0);
+    assert(gen->nursery.here == gen->nursery.start + NPTRS(2));
+
+    p = vm_get(v, 0);
+    assert(p >= gen->qf->start && p < gen->nursery.start);
+    assert(P_GET_TYPE(p) == TYPE_INT);
+    assert(*VALUE_P(p) == 20);
+    assert(QF_GET_BLOCK_SIZE(p) == 16);
+    assert(gen_space_used(gen) == NPTRS(4));
+    vm_free(v);
+}
+
+void
+test_remembered_set() {
+    vm *v = vm_init(gen_get_dispatch_table(), 4096);
+    generational_gc *gen = (generational_gc *)v->gc_obj;
+
+    ptr w = vm_add(v, vm_wrapper_init(v, 0));
+    vm_collect(v);
+    w = vm_get(v, 0);
+    assert(w < gen->nursery.start);
+    assert(gen->remset->used == 0);
+
+    // Old-to-young pointer must be remembered, but only once.
+    vm_set_slot(v, w, 0, vm_boxed_int_init(v, 77));
+    vm_set_slot(v, w, 0, vm_boxed_int_init(v, 78));
+    assert(gen->remset->used == 1);
+
+    // Minor collection via a failed allocation.
+    gen->minor_requested = true;
+    vm_collect(v);
+    assert(gen->remset->used == 0);
+    ptr p = P_GET_SLOT(w, 0);
+    assert(p < gen->nursery.start);
+    assert(*VALUE_P(p) == 78);
+    assert(gen_space_used(gen) == NPTRS(4));
+
+    // Root stores are never remembered.
+    vm_add(v, vm_boxed_int_init(v, 3));
+    assert(gen->remset->used == 0);
+    vm_free(v);
+}
+
+void
+test_large_objects() {
+    vm *v = vm_init(gen_get_dispatch_table(), 4096);
+    generational_gc *gen = (generational_gc *)v->gc_obj;
+    ptr a = vm_add(v, vm_array_init(v, 40, 0));
+    assert(a < gen->nursery.start);
+    // The count is in the nursery.
+    assert(gen->remset->used == 1);
+    gen->minor_requested = true;
+    vm_collect(v);
+    assert(gen_space_used(gen) == P_ARRAY_SIZE(40) + NPTRS(2));
+    vm_remove(v);
+    vm_collect(v);
+    assert(gen_space_used(gen) == 0);
+    vm_free(v);
+}
+
+int
+main(int argc, char *argv[]) {
+    PRINT_RUN(test_init);
+    PRINT_RUN(test_promotion);
+    PRINT_RUN(test_remembered_set);
+    PRINT_RUN(test_large_objects);
+    return 0;
+}
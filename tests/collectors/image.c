@@ -0,0 +1,302 @@
+// Checks saving and loading of heap images.
+#include <assert.h>
+#include <stdio.h>
+#include "collectors/vm.h"
+#include "collectors/copying.h"
+#include "collectors/copying-opt.h"
+#include "collectors/mark-sweep.h"
+#include "collectors/mark-sweep-bits.h"
+#include "collectors/ref-counting.h"
+
+#define IMAGE_PATH "collectors-image-test.gcim"
+#define HEAP_SIZE (4 << 20)
+
+// The graph has shared objects, raw arrays, tagged ints and nulls.
+// Cyclic graphs also have an array containing itself.
+static void
+build_graph(vm *v, bool cyclic) {
+    ptr arr = vm_add(v, vm_array_init(v, 10, 0));
+    ptr w = vm_wrapper_init(v, vm_boxed_float_init(v, 2.5));
+    vm_set_slot(v, arr, 1, vm_boxed_int_init(v, 7));
+    vm_set_slot(v, arr, 2, w);
+    vm_set_slot(v, arr, 3, vm_int_init(v, -3));
+    vm_set_slot(v, arr, 4, vm_float_array_init(v, 5, 1.5));
+    vm_set_slot(v, arr, 5, vm_byte_array_init(v, 13, 9));
+    vm_set_slot(v, arr, 6, cyclic ? arr : 0);
+    vm_set_slot(v, arr, 7, w);
+    ptr nested = vm_array_init(v, 300, 0);
+    vm_set_slot(v, arr, 9, nested);
+    for (int i = 0; i < 300; i++) {
+        vm_set_slot(v, nested, 1 + i, vm_boxed_int_init(v, i * 100));
+        // Garbage that shouldn't end up in the image.
+        vm_array_init(v, 20, 0);
+    }
+    vm_set_slot(v, arr, 10, vm_int_array_init(v, 3, -1));
+    vm_add(v, vm_int_init(v, 1234));
+    vm_add(v, 0);
+    vm_add(v, w);
+}
+
+static void
+check_graph(vm *v, bool cyclic) {
+    assert(vm_size(v) == 4);
+    ptr arr = vm_get(v, 0);
+    assert(P_GET_TYPE(arr) == TYPE_ARRAY);
+    assert(*VALUE_P(P_GET_SLOT(arr, 0)) == 10);
+    assert(*VALUE_P(P_GET_SLOT(arr, 1)) == 7);
+    ptr w = P_GET_SLOT(arr, 2);
+    assert(P_GET_TYPE(w) == TYPE_WRAPPER);
+    assert(*(double *)VALUE_P(P_GET_SLOT(w, 0)) == 2.5);
+    assert(vm_int_value(P_GET_SLOT(arr, 3)) == -3);
+    ptr floats = P_GET_SLOT(arr, 4);
+    assert(P_GET_TYPE(floats) == TYPE_FLOAT_ARRAY);
+    assert(RAW_COUNT(floats) == 5);
+    for (int i = 0; i < 5; i++) {
+        assert(*FLOAT_SLOT_P(floats, i) == 1.5);
+    }
+    ptr bytes = P_GET_SLOT(arr, 5);
+    assert(RAW_COUNT(bytes) == 13);
+    for (int i = 0; i < 13; i++) {
+        assert(*BYTE_SLOT_P(bytes, i) == 9);
+    }
+    assert(P_GET_SLOT(arr, 6) == (cyclic ? arr : 0));
+    assert(P_GET_SLOT(arr, 7) == w);
+    assert(P_GET_SLOT(arr, 8) == 0);
+    ptr nested = P_GET_SLOT(arr, 9);
+    assert(*VALUE_P(P_GET_SLOT(nested, 0)) == 300);
+    for (int i = 0; i < 300; i++) {
+        assert(*VALUE_P(P_GET_SLOT(nested, 1 + i)) == i * 100);
+    }
+    ptr ints = P_GET_SLOT(arr, 10);
+    assert(RAW_COUNT(ints) == 3 && *INT_SLOT_P(ints, 2) == -1);
+    assert(vm_int_value(vm_get(v, 1)) == 1234);
+    assert(vm_get(v, 2) == 0);
+    assert(vm_get(v, 3) == w);
+}
+
+#define N_LOADERS 9
+
+static void
+get_loaders(gc_dispatch *loaders[N_LOADERS]) {
+    loaders[0] = cg_get_dispatch_table();
+    loaders[1] = cg_get_dispatch_table_parallel();
+    loaders[2] = cg_get_dispatch_table_optimized();
+    loaders[3] = cg_get_dispatch_table_depth_first();
+    loaders[4] = ms_get_dispatch_table();
+    loaders[5] = ms_get_dispatch_table_parallel();
+    loaders[6] = msb_get_dispatch_table();
+    loaders[7] = msb_get_dispatch_table_lazy();
+    loaders[8] = rc_get_dispatch_table();
+}
+
+// Images saved by a moving and a non-moving collector are loaded by
+// all collectors that support it and the heaps are used afterwards.
+void
+test_round_trip() {
+    gc_dispatch *loaders[N_LOADERS];
+    get_loaders(loaders);
+    gc_dispatch *savers[] = {
+        ms_get_dispatch_table(),
+        cg_get_dispatch_table()
+    };
+    for (int i = 0; i < ARRAY_SIZE(savers); i++) {
+        vm *v = vm_init(savers[i], HEAP_SIZE);
+        build_graph(v, true);
+        vm_collect(v);
+        check_graph(v, true);
+        assert(vm_save_image(v, IMAGE_PATH));
+        size_t used = vm_space_used(v);
+        vm_free(v);
+        for (int j = 0; j < N_LOADERS; j++) {
+            v = vm_load_image(IMAGE_PATH, loaders[j], HEAP_SIZE);
+            assert(v);
+            check_graph(v, true);
+            // Padding to the block alignment is all that is added.
+            assert(vm_space_used(v) <= 2 * used);
+            vm_collect(v);
+            check_graph(v, true);
+            for (int k = 0; k < 100; k++) {
+                vm_add(v, vm_array_init(v, 50, vm_get(v, 0)));
+                vm_remove(v);
+            }
+            vm_collect(v);
+            check_graph(v, true);
+            vm_free(v);
+        }
+    }
+    remove(IMAGE_PATH);
+}
+
+// A second vm loading the image while the first one is alive can't
+// be placed where the image was saved so its refs are relocated.
+void
+test_relocation() {
+    gc_dispatch *loaders[N_LOADERS];
+    get_loaders(loaders);
+    vm *v = vm_init(ms_get_dispatch_table(), HEAP_SIZE);
+    build_graph(v, true);
+    assert(vm_save_image(v, IMAGE_PATH));
+    for (int i = 0; i < N_LOADERS; i++) {
+        vm *v2 = vm_load_image(IMAGE_PATH, loaders[i], HEAP_SIZE);
+        assert(v2);
+        assert(v2->memory != v->memory);
+        check_graph(v2, true);
+        vm_collect(v2);
+        check_graph(v2, true);
+        vm_free(v2);
+    }
+    check_graph(v, true);
+    vm_free(v);
+    remove(IMAGE_PATH);
+}
+
+// Ref counts are rebuilt when the image is loaded so that all objects
+// are freed once the roots are gone.
+void
+test_ref_counts() {
+    vm *v = vm_init(ms_get_dispatch_table(), HEAP_SIZE);
+    build_graph(v, false);
+    assert(vm_save_image(v, IMAGE_PATH));
+    vm_free(v);
+    v = vm_load_image(IMAGE_PATH, rc_get_dispatch_table(), HEAP_SIZE);
+    check_graph(v, false);
+    ptr arr = vm_get(v, 0);
+    assert(P_GET_RC(arr) == 1);
+    assert(P_GET_RC(vm_get(v, 3)) == 3);
+    assert(P_GET_RC(P_GET_SLOT(arr, 9)) == 1);
+    while (vm_size(v)) {
+        vm_remove(v);
+    }
+    vm_collect(v);
+    assert(vm_space_used(v) == 0);
+    vm_free(v);
+    remove(IMAGE_PATH);
+}
+
+void
+test_empty() {
+    vm *v = vm_init(cg_get_dispatch_table(), HEAP_SIZE);
+    vm_add(v, vm_int_init(v, 5));
+    assert(vm_save_image(v, IMAGE_PATH));
+    vm_free(v);
+    v = vm_load_image(IMAGE_PATH, ms_get_dispatch_table(), HEAP_SIZE);
+    assert(vm_size(v) == 1);
+    assert(vm_int_value(vm_get(v, 0)) == 5);
+    assert(vm_space_used(v) == 0);
+    vm_free(v);
+    remove(IMAGE_PATH);
+}
+
+// Overwrites the 64-bit word at offset in the image and checks that it
+// no longer loads.
+static void
+check_corrupt_word(long offset, uint64_t w) {
+    FILE *f = fopen(IMAGE_PATH, "r+b");
+    uint64_t old;
+    fseek(f, offset, SEEK_SET);
+    assert(fread(&old, sizeof(uint64_t), 1, f) == 1);
+    fseek(f, offset, SEEK_SET);
+    fwrite(&w, sizeof(uint64_t), 1, f);
+    fclose(f);
+    assert(!vm_load_image(IMAGE_PATH, ms_get_dispatch_table(), HEAP_SIZE));
+    f = fopen(IMAGE_PATH, "r+b");
+    fseek(f, offset, SEEK_SET);
+    fwrite(&old, sizeof(uint64_t), 1, f);
+    fclose(f);
+}
+
+static void
+check_corrupt_body() {
+    FILE *f = fopen(IMAGE_PATH, "rb");
+    vm_image_header h;
+    assert(fread(&h, sizeof(vm_image_header), 1, f) == 1);
+    uint64_t root;
+    assert(fread(&root, sizeof(uint64_t), 1, f) == 1);
+    fclose(f);
+    long body = ALIGN(sizeof(vm_image_header) + 8 * h.n_roots,
+                      HEAP_PAGE_SIZE);
+
+    // Bad sizes in the header of the first block.
+    uint64_t type = TYPE_ARRAY << 1;
+    check_corrupt_word(body, type);
+    check_corrupt_word(body, ((uint64_t)24 << 32) | type);
+    check_corrupt_word(body, ((uint64_t)(h.n_bytes + 16) << 32) | type);
+
+    // Bad types of the array root and of its count.
+    long arr = body + (root - h.base);
+    f = fopen(IMAGE_PATH, "rb");
+    fseek(f, arr, SEEK_SET);
+    uint64_t header;
+    assert(fread(&header, sizeof(uint64_t), 1, f) == 1);
+    ref slot0;
+    assert(fread(&slot0, sizeof(ref), 1, f) == 1);
+    fclose(f);
+    assert(BF_GET(header, 1, 4) == TYPE_ARRAY);
+    uint64_t size_bits = header & ~(uint64_t)0xffffffff;
+    check_corrupt_word(arr, size_bits);
+    check_corrupt_word(arr, size_bits | (9 << 1));
+    long cnt = body + (REF_DECODE(slot0) - heap_origin() - h.base);
+    check_corrupt_word(cnt, ((uint64_t)16 << 32) | (TYPE_FLOAT << 1));
+
+    // Array counts that don't fit the block.
+    check_corrupt_word(cnt + sizeof(ptr), 1000);
+    check_corrupt_word(cnt + sizeof(ptr), (uint64_t)1 << 60);
+
+    // Object roots outside of the body.
+    check_corrupt_word(sizeof(vm_image_header), h.base + h.n_bytes);
+    check_corrupt_word(sizeof(vm_image_header), h.base - 16);
+
+    // The restored image still loads.
+    vm *v = vm_load_image(IMAGE_PATH, ms_get_dispatch_table(), HEAP_SIZE);
+    assert(v);
+    check_graph(v, true);
+    vm_free(v);
+}
+
+void
+test_bad_files() {
+    assert(!vm_load_image("no-such-file.gcim",
+                          ms_get_dispatch_table(), HEAP_SIZE));
+
+    FILE *f = fopen(IMAGE_PATH, "wb");
+    fputs("not an image", f);
+    fclose(f);
+    assert(!vm_load_image(IMAGE_PATH, ms_get_dispatch_table(), HEAP_SIZE));
+
+    vm *v = vm_init(ms_get_dispatch_table(), HEAP_SIZE);
+    build_graph(v, true);
+    assert(vm_save_image(v, IMAGE_PATH));
+    vm_free(v);
+
+    // Too small heaps, also for the semispaces of copying. The image
+    // is about 8 kb.
+    assert(!vm_load_image(IMAGE_PATH, ms_get_dispatch_table(), 4096));
+    assert(!vm_load_image(IMAGE_PATH, cg_get_dispatch_table(), 8192));
+
+    // Truncated after the header.
+    f = fopen(IMAGE_PATH, "rb");
+    char buf[sizeof(vm_image_header)];
+    assert(fread(buf, sizeof(buf), 1, f) == 1);
+    fclose(f);
+    f = fopen(IMAGE_PATH, "wb");
+    fwrite(buf, sizeof(buf), 1, f);
+    fclose(f);
+    assert(!vm_load_image(IMAGE_PATH, ms_get_dispatch_table(), HEAP_SIZE));
+
+    v = vm_init(ms_get_dispatch_table(), HEAP_SIZE);
+    build_graph(v, true);
+    assert(vm_save_image(v, IMAGE_PATH));
+    vm_free(v);
+    check_corrupt_body();
+    remove(IMAGE_PATH);
+}
+
+int
+main(int argc, char *argv[]) {
+    PRINT_RUN(test_round_trip);
+    PRINT_RUN(test_relocation);
+    PRINT_RUN(test_ref_counts);
+    PRINT_RUN(test_empty);
+    PRINT_RUN(test_bad_files);
+    return 0;
+}
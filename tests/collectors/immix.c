@@ -0,0 +1,173 @@
+// Checks the Immix collector and compares it with the copying and
+// mark & sweep collectors.
+#include <assert.h>
+#include <stdio.h>
+#include "collectors/vm.h"
+#include "collectors/copying.h"
+#include "collectors/immix.h"
+#include "collectors/mark-sweep.h"
+
+void
+test_bump_allocation() {
+    vm *v = vm_init(ix_get_dispatch_table(), 1 << 20);
+    immix_gc *ix = (immix_gc *)v->gc_obj;
+    ptr p1 = vm_boxed_int_init(v, 1);
+    ptr p2 = vm_boxed_int_init(v, 2);
+    assert(p2 == p1 + NPTRS(2));
+    assert(IX_GET_SIZE(AT(p1)) == NPTRS(2));
+    assert(P_GET_TYPE(p1) == TYPE_INT);
+    assert(ix->allocated == NPTRS(4));
+    vm_free(v);
+}
+
+// Lines without live objects are reused after a collection. The heap
+// is too small to have an evacuation reserve so nothing moves.
+void
+test_line_reuse() {
+    vm *v = vm_init(ix_get_dispatch_table(), 1 << 19);
+    ptr first = vm_add(v, vm_boxed_int_init(v, 0));
+    for (int i = 0; i < 1000; i++) {
+        vm_boxed_int_init(v, i);
+    }
+    ptr last = vm_add(v, vm_boxed_int_init(v, 0));
+    vm_collect(v);
+    assert(vm_space_used(v) == NPTRS(4));
+    ptr p = vm_boxed_int_init(v, 0);
+    assert(p > first);
+    assert(p < last);
+    assert((p - first) % IX_LINE_SIZE == 0);
+
+    // Reachable objects are intact.
+    vm_set(v, 0, vm_array_init(v, 10, vm_get(v, 1)));
+    vm_collect(v);
+    vm_collect(v);
+    ptr arr = vm_get(v, 0);
+    for (int i = 1; i <= 10; i++) {
+        assert(P_GET_SLOT(arr, i) == last);
+    }
+    assert(vm_space_used(v) == P_ARRAY_SIZE(10) + NPTRS(4));
+    vm_free(v);
+}
+
+// Objects in sparse blocks are moved out of them.
+void
+test_evacuation() {
+    vm *v = vm_init(ix_get_dispatch_table(), 16 << 20);
+    immix_gc *ix = (immix_gc *)v->gc_obj;
+    size_t n_objs = (14 << 20) / NPTRS(2);
+    vm_add(v, vm_array_init(v, n_objs / 1024, 0));
+    for (size_t i = 0; i < n_objs; i++) {
+        ptr p = vm_boxed_int_init(v, (int)i);
+        if (i % 1024 == 0) {
+            vm_set_slot(v, vm_get(v, 0), 1 + i / 1024, p);
+        }
+    }
+    // The first collection finds the sparse blocks, the following
+    // ones evacuate them.
+    vm_collect(v);
+    size_t used = vm_space_used(v);
+    assert(ix->evacuated == 0);
+    for (int i = 0; i < 8; i++) {
+        vm_collect(v);
+    }
+    assert(ix->evacuated > 0);
+    assert(vm_space_used(v) == used);
+
+    ptr arr = vm_get(v, 0);
+    for (size_t i = 0; i < n_objs / 1024; i++) {
+        ptr p = P_GET_SLOT(arr, 1 + i);
+        assert(P_GET_TYPE(p) == TYPE_INT);
+        assert(*VALUE_P(p) == i * 1024);
+    }
+    gc_stats gs;
+    vm_stats_snapshot(v, &gs);
+    assert(gs.largest_free_block > (8 << 20));
+    vm_free(v);
+}
+
+void
+test_large_objects() {
+    vm *v = vm_init(ix_get_dispatch_table(), 1 << 20);
+    immix_gc *ix = (immix_gc *)v->gc_obj;
+    ptr arr = vm_add(v, vm_array_init(v, IX_LARGE_OBJECT_SIZE, 0));
+    vm_set_slot(v, arr, 1, vm_boxed_int_init(v, 7));
+    assert(ix->los->objects->used == 1);
+    vm_collect(v);
+    assert(*VALUE_P(P_GET_SLOT(arr, 1)) == 7);
+    assert(vm_space_used(v) == P_ARRAY_SIZE(IX_LARGE_OBJECT_SIZE) + NPTRS(4));
+
+    gc_stats gs;
+    vm_stats_snapshot(v, &gs);
+    assert(gs.bytes_large == P_ARRAY_SIZE(IX_LARGE_OBJECT_SIZE));
+    vm_remove(v);
+    vm_collect(v);
+    assert(vm_space_used(v) == 0);
+    vm_free(v);
+}
+
+// Same mix as the torture test in collectors.c.
+static ptr
+random_object(vm *v) {
+    if (rand_n(2)) {
+        return vm_array_init(v, rand_n(200), random_object(v));
+    } else if (rand_n(2)) {
+        return vm_boxed_int_init(v, rand_n(100));
+    }
+    return vm_wrapper_init(v, vm_boxed_float_init(v, rand_n(100)));
+}
+
+static void
+torture(vm *v) {
+    rand_init(0);
+    for (int i = 0; i < 100; i++) {
+        vm_add(v, vm_array_init(v, 500, 0));
+    }
+    for (int i = 0; i < 3000000; i++) {
+        ptr arr = vm_get(v, rand_n(100));
+        vm_set_slot(v, arr, 1 + rand_n(500), random_object(v));
+    }
+}
+
+// The torture workload keeps about 42 MB live. Copying is run with
+// twice the heap since only half of it is usable at a time.
+void
+test_compare() {
+    gc_dispatch *dispatches[] = {
+        cg_get_dispatch_table(),
+        ms_get_dispatch_table(),
+        ix_get_dispatch_table()
+    };
+    char *names[] = {"Copying", "Mark & Sweep", "Immix"};
+    size_t heap_sizes[] = {128, 96, 64};
+    printf("%-14s %8s %5s %8s %8s %8s\n",
+           "Collector", "Heap MB", "GCs", "Total s", "GC s", "Free MB");
+    for (size_t i = 0; i < ARRAY_SIZE(heap_sizes); i++) {
+        for (size_t j = 0; j < ARRAY_SIZE(dispatches); j++) {
+            size_t size = heap_sizes[i] << 20;
+            if (j == 0) {
+                size *= 2;
+            }
+            uint64_t start = nano_count();
+            vm *v = vm_init(dispatches[j], size);
+            torture(v);
+            vm_collect(v);
+            double total = (double)(nano_count() - start) / 1e9;
+            gc_stats gs;
+            vm_stats_snapshot(v, &gs);
+            printf("%-14s %8lu %5lu %8.3f %8.3f %8lu\n",
+                   names[j], size >> 20, gs.n_collections, total,
+                   (double)gs.pause_total / 1e9, gs.free_space >> 20);
+            vm_free(v);
+        }
+    }
+}
+
+int
+main(int argc, char *argv[]) {
+    PRINT_RUN(test_bump_allocation);
+    PRINT_RUN(test_line_reuse);
+    PRINT_RUN(test_evacuation);
+    PRINT_RUN(test_large_objects);
+    PRINT_RUN(test_compare);
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Checks the large object space and its use by the copying
+// collectors.
+#include <assert.h>
+#include <stdio.h>
+#include "collectors/vm.h"
+#include "collectors/copying.h"
+#include "collectors/copying-opt.h"
+#include "collectors/large-objects.h"
+
+#define LARGE_N_ELS (CG_LARGE_OBJECT_SIZE / sizeof(ref))
+
+void
+test_sweep() {
+    large_object_space *los = los_init();
+    ptr p1 = los_allot(los, TYPE_ARRAY, 20000);
+    ptr p2 = los_allot(los, TYPE_ARRAY, 5000);
+    assert(p1 % HEAP_PAGE_SIZE == 0);
+    assert(p2 % HEAP_PAGE_SIZE == 0);
+    assert(P_GET_TYPE(p1) == TYPE_ARRAY);
+    assert(LOS_GET_SIZE(p1) == 20000);
+    assert(los->size == 25000);
+    assert(los->allocated == 25000);
+
+    los_mark(los, p2);
+    los_mark(los, p2);
+    assert(los->mark_stack->used == 1);
+    los->mark_stack->used = 0;
+    los_sweep(los);
+    assert(los->objects->used == 1);
+    assert(los->size == 5000);
+    assert(los->allocated == 0);
+    assert(!P_GET_MARK(p2));
+
+    los_sweep(los);
+    assert(los->size == 0);
+    los_free(los);
+}
+
+void
+test_not_moved() {
+    gc_dispatch *dispatches[] = {
+        cg_get_dispatch_table(),
+        cg_get_dispatch_table_optimized()
+    };
+    for (int i = 0; i < ARRAY_SIZE(dispatches); i++) {
+        vm *v = vm_init(dispatches[i], 1 << 20);
+        ptr arr = vm_add(v, vm_array_init(v, LARGE_N_ELS, 0));
+        for (int j = 0; j < 10; j++) {
+            vm_set_slot(v, arr, 1 + j, vm_boxed_int_init(v, j));
+        }
+        // A large object only reachable from another one.
+        ptr arr2 = vm_array_init(v, LARGE_N_ELS, 0);
+        vm_set_slot(v, arr, 11, arr2);
+        vm_set_slot(v, arr2, 1, vm_boxed_int_init(v, 99));
+        size_t large_size = 2 * P_ARRAY_SIZE(LARGE_N_ELS);
+        assert(vm_space_used(v) == large_size + NPTRS(2) * 13);
+
+        vm_collect(v);
+        assert(vm_get(v, 0) == arr);
+        assert(P_GET_SLOT(arr, 11) == arr2);
+        assert(vm_space_used(v) == large_size + NPTRS(2) * 13);
+        assert(*VALUE_P(P_GET_SLOT(arr, 0)) == LARGE_N_ELS);
+        for (int j = 0; j < 10; j++) {
+            assert(*VALUE_P(P_GET_SLOT(arr, 1 + j)) == j);
+        }
+        assert(*VALUE_P(P_GET_SLOT(arr2, 1)) == 99);
+
+        gc_stats gs;
+        vm_stats_snapshot(v, &gs);
+        assert(gs.bytes_large == large_size);
+
+        vm_remove(v);
+        vm_collect(v);
+        assert(vm_space_used(v) == 0);
+        vm_free(v);
+    }
+}
+
+// Large object allocation triggers collections so that garbage large
+// objects don't pile up.
+void
+test_garbage() {
+    vm *v = vm_init(cg_get_dispatch_table(), 1 << 20);
+    for (int i = 0; i < 1000; i++) {
+        vm_array_init(v, LARGE_N_ELS, 0);
+    }
+    copying_gc *cg = (copying_gc *)v->gc_obj;
+    assert(cg->los->size <= 1 << 19);
+    assert(v->stats.n_collections > 10);
+
+    // Larger than a semispace.
+    vm_add(v, vm_array_init(v, 1 << 17, 0));
+    assert(cg->los->size >= P_ARRAY_SIZE(1 << 17));
+    vm_free(v);
+}
+
+// Big live arrays and small garbage.
+void
+test_big_arrays() {
+    gc_dispatch *dispatches[] = {
+        cg_get_dispatch_table(),
+        cg_get_dispatch_table_optimized()
+    };
+    char *names[] = {"Copying", "Optimized Copying"};
+    for (int i = 0; i < ARRAY_SIZE(dispatches); i++) {
+        rand_init(0);
+        vm *v = vm_init(dispatches[i], 80 << 20);
+        for (int j = 0; j < 40; j++) {
+            vm_add(v, vm_array_init(v, 100000, 0));
+        }
+        for (int j = 0; j < 8000000; j++) {
+            ptr arr = vm_get(v, rand_n(40));
+            ptr p = vm_boxed_int_init(v, j);
+            if (!rand_n(100)) {
+                vm_set_slot(v, arr, 1 + rand_n(100000), p);
+            }
+        }
+        gc_stats gs;
+        vm_stats_snapshot(v, &gs);
+        printf("%-20s %4lu collections, %.3f s GC, %lu MB large\n",
+               names[i], gs.n_collections,
+               (double)gs.pause_total / 1e9, gs.bytes_large >> 20);
+        vm_free(v);
+    }
+}
+
+int
+main(int argc, char *argv[]) {
+    PRINT_RUN(test_sweep);
+    PRINT_RUN(test_not_moved);
+    PRINT_RUN(test_garbage);
+    PRINT_RUN(test_big_arrays);
+    return 0;
+}
@@ -0,0 +1,184 @@
+// Checks the mark & compact collector and compares it with mark &
+// sweep and copying.
+#include <assert.h>
+#include "collectors/vm.h"
+#include "collectors/copying.h"
+#include "collectors/mark-compact.h"
+#include "collectors/mark-sweep.h"
+
+void
+test_slide() {
+    vm *v = vm_init(mc_get_dispatch_table(), 4096);
+    mark_compact_gc *mc = (mark_compact_gc *)v->gc_obj;
+    ptr a = vm_add(v, vm_boxed_int_init(v, 10));
+    vm_add(v, vm_boxed_int_init(v, 20));
+    ptr c = vm_add(v, vm_wrapper_init(v, vm_boxed_int_init(v, 30)));
+    assert(a == mc->start);
+    assert(c == mc->start + NPTRS(6));
+
+    // Remove the second int, the wrapped int and the wrapper slide
+    // down.
+    vm_set(v, 1, 0);
+    vm_collect(v);
+    assert(mc_space_used(mc) == NPTRS(6));
+    assert(vm_get(v, 0) == a);
+    c = vm_get(v, 2);
+    assert(c == mc->start + NPTRS(4));
+    assert(!P_GET_MARK(c));
+    assert(P_GET_TYPE(c) == TYPE_WRAPPER);
+    ptr i = P_GET_SLOT(c, 0);
+    assert(i == mc->start + NPTRS(2));
+    assert(P_GET_TYPE(i) == TYPE_INT);
+    assert(*VALUE_P(i) == 30);
+
+    // Allocation continues after the live objects.
+    assert(vm_boxed_int_init(v, 40) == mc->start + NPTRS(6));
+    vm_free(v);
+}
+
+void
+test_arrays() {
+    vm *v = vm_init(mc_get_dispatch_table(), 1 << 20);
+    ptr arr = vm_add(v, vm_array_init(v, 100, 0));
+    for (int i = 0; i < 100; i++) {
+        vm_boxed_int_init(v, i);
+        vm_set_slot(v, arr, 1 + i, vm_boxed_int_init(v, i));
+    }
+    vm_collect(v);
+    arr = vm_get(v, 0);
+    assert(vm_space_used(v) == P_ARRAY_SIZE(100) + NPTRS(2 + 100 * 2));
+    for (int i = 0; i < 100; i++) {
+        ptr p = P_GET_SLOT(arr, 1 + i);
+        assert(P_GET_TYPE(p) == TYPE_INT);
+        assert(*VALUE_P(p) == i);
+    }
+    vm_free(v);
+}
+
+// Every second object is freed so no free block is larger than a
+// boxed int. Mark & sweep can't fit the large array even though half
+// the heap is free.
+void
+test_fragmentation() {
+    size_t heap_size = 64 * 1024;
+    size_t big = heap_size / 4;
+    ptr mem = heap_reserve(heap_size);
+    vector *roots = v_init(16);
+
+    mark_sweep_gc *ms = ms_init(mem, heap_size);
+    for (size_t i = 0; ms_can_allot_p(ms, NPTRS(2)); i++) {
+        ptr p = ms_do_allot(ms, TYPE_INT, NPTRS(2));
+        if (i % 2) {
+            v_add(roots, p);
+        }
+    }
+    size_t n = roots->used;
+    ms_collect(ms, roots);
+    assert(ms->qf->free_space > big);
+    assert(!ms_can_allot_p(ms, big));
+    ms_free(ms);
+
+    roots->used = 0;
+    mark_compact_gc *mc = mc_init(mem, heap_size);
+    while (mc_can_allot_p(mc, NPTRS(2))) {
+        ptr p = mc_do_allot(mc, TYPE_INT, NPTRS(2));
+        if (roots->used < n) {
+            v_add(roots, p);
+        }
+    }
+    mc_collect(mc, roots);
+    assert(mc_space_used(mc) == n * NPTRS(2));
+    assert(mc_can_allot_p(mc, big));
+    mc_free(mc);
+
+    v_free(roots);
+    heap_unreserve(mem, heap_size);
+}
+
+// Collect is wrapped to measure how full the heap is when the
+// collector gives up and how much is live afterwards.
+static gc_dispatch *bench_inner;
+static size_t bench_n_collections;
+static size_t bench_used_sum;
+static size_t bench_peak_live;
+
+static void
+bench_collect(void *gc_obj, vector *roots) {
+    bench_used_sum += bench_inner->space_used(gc_obj);
+    bench_inner->collect(gc_obj, roots);
+    size_t live = bench_inner->space_used(gc_obj);
+    bench_peak_live = MAX(bench_peak_live, live);
+    bench_n_collections++;
+}
+
+static ptr
+random_object(vm *v) {
+    if (rand_n(2)) {
+        return vm_array_init(v, rand_n(200), random_object(v));
+    }
+    switch (rand_n(TYPE_ARRAY)) {
+    case TYPE_INT:
+        return vm_boxed_int_init(v, rand_n(100));
+    case TYPE_FLOAT:
+        return vm_boxed_float_init(v, (double)rand_n(100));
+    case TYPE_WRAPPER:
+        return vm_wrapper_init(v, random_object(v));
+    default:
+        return 0;
+    }
+}
+
+#define BENCH_HEAP_SIZE     (128 * 1024 * 1024)
+#define BENCH_N_ROOTS       50
+#define BENCH_N_ELS         500
+#define BENCH_N_LOOPS       2000000
+
+// The same workload as test_torture in collectors.c, but with a
+// smaller heap so that all collectors have to collect often. Mark &
+// sweep gives up before the heap is full because it is fragmented
+// and copying can only fill half of it.
+static void
+bench_torture(char *name, gc_dispatch *dispatch) {
+    gc_dispatch table = *dispatch;
+    table.collect = bench_collect;
+    bench_inner = dispatch;
+    bench_n_collections = 0;
+    bench_used_sum = 0;
+    bench_peak_live = 0;
+
+    rand_init(0);
+    uint64_t start = nano_count();
+    vm *v = vm_init(&table, BENCH_HEAP_SIZE);
+    for (int i = 0; i < BENCH_N_ROOTS; i++) {
+        vm_add(v, vm_array_init(v, BENCH_N_ELS, 0));
+    }
+    for (int i = 0; i < BENCH_N_LOOPS; i++) {
+        ptr arr = vm_get(v, rand_n(BENCH_N_ROOTS));
+        vm_set_slot(v, arr, 1 + rand_n(BENCH_N_ELS), random_object(v));
+    }
+    vm_free(v);
+    double secs = (double)(nano_count() - start) / 1000 / 1000 / 1000;
+    double fill = (double)bench_used_sum / bench_n_collections
+        / BENCH_HEAP_SIZE;
+    printf("%-14s %6.3f s, %4lu collections, peak live %3lu MB, "
+           "heap %3.0f%% full at collection\n",
+           name, secs, bench_n_collections, bench_peak_live >> 20,
+           fill * 100);
+}
+
+void
+test_torture_bench() {
+    bench_torture("Mark & Compact", mc_get_dispatch_table());
+    bench_torture("Mark & Sweep", ms_get_dispatch_table());
+    bench_torture("Copying", cg_get_dispatch_table());
+}
+
+int
+main(int argc, char *argv[]) {
+    rand_init(0);
+    PRINT_RUN(test_slide);
+    PRINT_RUN(test_arrays);
+    PRINT_RUN(test_fragmentation);
+    PRINT_RUN(test_torture_bench);
+    return 0;
+}
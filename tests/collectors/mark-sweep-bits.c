@@ -4,7 +4,7 @@
 void
 test_bit_markings() {
     size_t heap_size = 1024 * 1024;
-    ptr mem = (ptr)malloc(heap_size);
+    ptr mem = heap_reserve(heap_size);
     mark_sweep_bits_gc *ms = msb_init(mem, heap_size);
 
     assert(ms->ba->n_words == (heap_size / 16 / BA_WORD_BITS));
@@ -15,11 +15,50 @@ test_bit_markings() {
     msb_collect(ms, roots);
 
     msb_free(ms);
-    free((void*)mem);
+    heap_unreserve(mem, heap_size);
+    v_free(roots);
+}
+
+void
+test_lazy_sweep() {
+    size_t heap_size = 1024 * 1024;
+    ptr mem = heap_reserve(heap_size);
+    mark_sweep_bits_gc *ms = msb_init_lazy(mem, heap_size);
+
+    vector *roots = v_init(16);
+    for (int i = 0; i < 100; i++) {
+        ptr p = msb_do_allot(ms, TYPE_INT, 1008);
+        if (i % 2 == 0) {
+            v_add(roots, p);
+        }
+    }
+    assert(msb_space_used(ms) == 100 * 1008);
+
+    // Collection ends after marking.
+    msb_collect(ms, roots);
+    assert(ms->qf->free_space == 0);
+    assert(ms->sweep_bit == 0);
+    assert(msb_space_used(ms) == 50 * 1008);
+
+    // Only the first free range is swept.
+    assert(msb_can_allot_p(ms, 1008));
+    assert(ms->sweep_bit > 0 && ms->sweep_bit < ms->ba->n_bits);
+    assert(msb_space_used(ms) == 50 * 1008);
+
+    // Sweeps the rest.
+    ptr p = msb_do_allot(ms, TYPE_INT, heap_size - 100 * 1008);
+    assert(p);
+    assert(ms->unswept_free == 0);
+    assert(msb_space_used(ms) == heap_size - 50 * 1008);
+    assert(!msb_can_allot_p(ms, 2000));
+
+    msb_free(ms);
+    heap_unreserve(mem, heap_size);
     v_free(roots);
 }
 
 int
 main(int argc, char *argv[]) {
     PRINT_RUN(test_bit_markings);
+    PRINT_RUN(test_lazy_sweep);
 }
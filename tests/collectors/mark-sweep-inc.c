@@ -0,0 +1,100 @@
+#include <assert.h>
+#include "collectors/vm.h"
+#include "collectors/mark-sweep-inc.h"
+
+void
+test_forced_collect() {
+    vm *v = vm_init(msi_get_dispatch_table(), 4096);
+    mark_sweep_inc_gc *msi = (mark_sweep_inc_gc *)v->gc_obj;
+    vm_add(v, vm_boxed_int_init(v, 20));
+    vm_boxed_int_init(v, 30);
+    assert(msi_space_used(msi) == 32);
+    vm_collect(v);
+    assert(msi_space_used(msi) == 16);
+    assert(!msi->marking);
+    assert(msi->n_cycles == 1);
+    vm_free(v);
+}
+
+void
+test_cycle_trigger() {
+    vm *v = vm_init(msi_get_dispatch_table(), 4096);
+    mark_sweep_inc_gc *msi = (mark_sweep_inc_gc *)v->gc_obj;
+    while (msi->n_cycles == 0) {
+        vm_boxed_int_init(v, 0);
+    }
+    // Nothing is reachable so the first slice finished the cycle
+    // before the int was allocated.
+    assert(!msi->marking);
+    assert(msi->n_slices == 1);
+    assert(msi_space_used(msi) == 16);
+    vm_free(v);
+}
+
+// An object moved from an unscanned to a scanned object during
+// marking must survive.
+void
+test_deletion_barrier() {
+    vm *v = vm_init(msi_get_dispatch_table(), 1 << 20);
+    mark_sweep_inc_gc *msi = (mark_sweep_inc_gc *)v->gc_obj;
+    vector *stack = msi->ms->mark_stack;
+
+    ptr w2 = vm_add(v, vm_wrapper_init(v, vm_boxed_int_init(v, 42)));
+    ptr w1 = vm_add(v, vm_wrapper_init(v, 0));
+    msi->cycle_requested = true;
+    vm_collect(v);
+    assert(msi->marking);
+    assert(stack->used == 2);
+
+    // Allocating 16 bytes only pays for scanning w1.
+    msi->work_ratio = 1.0;
+    vm_boxed_int_init(v, 7);
+    assert(stack->used == 1 && v_peek(stack) == w2);
+
+    // Move the int from w2 to w1.
+    ptr p = P_GET_SLOT(w2, 0);
+    vm_set_slot(v, w1, 0, p);
+    vm_set_slot(v, w2, 0, 0);
+    assert(P_GET_MARK(p));
+
+    while (msi->marking) {
+        vm_boxed_int_init(v, 0);
+    }
+    assert(P_GET_TYPE(p) == TYPE_INT);
+    assert(*VALUE_P(p) == 42);
+    vm_collect(v);
+    assert(msi_space_used(msi) == NPTRS(6));
+    vm_free(v);
+}
+
+// Measures the maximum pause per slice for a few work ratios.
+void
+test_slice_pauses() {
+    double ratios[] = {0.5, 2.0, 8.0};
+    for (size_t i = 0; i < ARRAY_SIZE(ratios); i++) {
+        vm *v = vm_init(msi_get_dispatch_table(), 64 * 1024 * 1024);
+        mark_sweep_inc_gc *msi = (mark_sweep_inc_gc *)v->gc_obj;
+        msi->work_ratio = ratios[i];
+        vm_add(v, vm_array_init(v, 100000, 0));
+        for (int j = 0; j < 4000000; j++) {
+            ptr w = vm_wrapper_init(v, vm_boxed_int_init(v, j));
+            vm_set_slot(v, vm_get(v, 0), 1 + rand_n(100000), w);
+        }
+        printf("ratio %.1f: %lu cycles, %lu slices, "
+               "max slice %.1f us, max sweep %.1f us\n",
+               ratios[i], msi->n_cycles, msi->n_slices,
+               msi->max_slice_pause / 1000.0,
+               msi->max_sweep_pause / 1000.0);
+        vm_free(v);
+    }
+}
+
+int
+main(int argc, char *argv[]) {
+    rand_init(0);
+    PRINT_RUN(test_forced_collect);
+    PRINT_RUN(test_cycle_trigger);
+    PRINT_RUN(test_deletion_barrier);
+    PRINT_RUN(test_slice_pauses);
+    return 0;
+}
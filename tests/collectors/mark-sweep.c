@@ -22,7 +22,7 @@ test_collect_1() {
 
 void
 test_collect_2() {
-    ptr mem = (ptr)malloc(4096);
+    ptr mem = heap_reserve(4096);
     mark_sweep_gc *ms = ms_init(mem, 4096);
 
     vector *roots = v_init(16);
@@ -40,12 +40,12 @@ test_collect_2() {
 
     v_free(roots);
     ms_free(ms);
-    free((void*)mem);
+    heap_unreserve(mem, 4096);
 }
 
 void
 test_collect_3() {
-    ptr mem = (ptr)malloc(4096);
+    ptr mem = heap_reserve(4096);
     mark_sweep_gc *ms = ms_init(mem, 4096);
     vector *roots = v_init(16);
 
@@ -69,19 +69,63 @@ test_collect_3() {
 
     v_free(roots);
     ms_free(ms);
-    free((void*)mem);
+    heap_unreserve(mem, 4096);
 }
 
 void
 test_do_allot() {
-    ptr mem = (ptr)malloc(4096);
+    ptr mem = heap_reserve(4096);
     mark_sweep_gc *ms = ms_init(mem, 4096);
 
     ms_do_allot(ms, TYPE_INT, 176);
     assert(QF_GET_BLOCK_SIZE(mem) == 176);
 
     ms_free(ms);
-    free((void*)mem);
+    heap_unreserve(mem, 4096);
+}
+
+// Marking with prefetching must find the same objects, even though
+// objects are pushed more than once.
+void
+test_mark_prefetch() {
+    rand_init(0);
+    ptr mem = heap_reserve(1 << 20);
+    mark_sweep_gc *ms = ms_init(mem, 1 << 20);
+    vector *roots = v_init(16);
+    vector *objs = v_init(16);
+    for (int i = 0; i < 1000; i++) {
+        ptr p = ms_do_allot(ms, TYPE_WRAPPER, NPTRS(2));
+        P_SET_SLOT(p, 0, 0);
+        v_add(objs, p);
+    }
+    // Random links and cycles.
+    for (int i = 0; i < 1000; i++) {
+        if (rand_n(3)) {
+            P_SET_SLOT(objs->array[i], 0, objs->array[rand_n(1000)]);
+        }
+    }
+    for (int i = 0; i < 10; i++) {
+        v_add(roots, objs->array[rand_n(1000)]);
+    }
+    ms_mark(ms->mark_stack, roots);
+    size_t n_marked = 0;
+    for (int i = 0; i < 1000; i++) {
+        ptr p = objs->array[i];
+        n_marked += P_GET_MARK(p);
+        P_UNMARK(p);
+    }
+    assert(n_marked > 10);
+    ms_mark_prefetch(ms->mark_stack, roots);
+    assert(ms->mark_stack->used == 0);
+    for (int i = 0; i < 1000; i++) {
+        n_marked -= P_GET_MARK(objs->array[i]);
+    }
+    assert(n_marked == 0);
+    ms_sweep(ms);
+    v_free(objs);
+    v_free(roots);
+    ms_free(ms);
+    heap_unreserve(mem, 1 << 20);
 }
 
 int
@@ -90,4 +134,5 @@ main(int argc, char *argv[]) {
     PRINT_RUN(test_collect_2);
     PRINT_RUN(test_collect_3);
     PRINT_RUN(test_do_allot);
+    PRINT_RUN(test_mark_prefetch);
 }
@@ -0,0 +1,226 @@
+// Checks parallel copying and measures how copy throughput scales
+// with the number of copying threads.
+#include <assert.h>
+#include "collectors/vm.h"
+#include "collectors/copying.h"
+#include "threads/threads.h"
+
+#define HEAP_SIZE   (512 * 1024 * 1024)
+#define N_ARRAYS    1000
+#define N_ELS       2000
+
+static void
+build_heap(vm *v, int n_arrays, int n_els) {
+    vm_add(v, vm_array_init(v, n_arrays, 0));
+    for (int i = 0; i < n_arrays; i++) {
+        ptr arr = vm_add(v, vm_array_init(v, n_els, 0));
+        for (int j = 0; j < n_els; j++) {
+            ptr w = vm_wrapper_init(v, vm_boxed_int_init(v, j));
+            vm_set_slot(v, arr, 1 + j, w);
+        }
+        vm_set_slot(v, vm_get(v, 0), 1 + i, arr);
+        vm_remove(v);
+    }
+}
+
+static void
+check_heap(vm *v, int n_arrays, int n_els) {
+    ptr root = vm_get(v, 0);
+    assert(*VALUE_P(P_GET_SLOT(root, 0)) == n_arrays);
+    for (int i = 0; i < n_arrays; i++) {
+        ptr arr = P_GET_SLOT(root, 1 + i);
+        for (int j = 0; j < n_els; j++) {
+            ptr w = P_GET_SLOT(arr, 1 + j);
+            assert(P_GET_TYPE(w) == TYPE_WRAPPER);
+            assert(*VALUE_P(P_GET_SLOT(w, 0)) == j);
+        }
+    }
+}
+
+// More threads than cores must work too. Objects shared by many
+// arrays must only be copied once.
+void
+test_many_threads() {
+    size_t heap_size = 64 * 1024 * 1024;
+    ptr mem = heap_reserve(heap_size);
+    copying_gc *cg = cg_init_parallel(mem, heap_size, 8);
+    vector *roots = v_init(16);
+    ptr shared = cg_do_allot(cg, TYPE_INT, 16);
+    *VALUE_P(shared) = 1234;
+    for (int i = 0; i < 100; i++) {
+        ptr arr = cg_do_allot(cg, TYPE_ARRAY, P_ARRAY_SIZE(1000));
+        ptr cnt = cg_do_allot(cg, TYPE_INT, NPTRS(2));
+        *VALUE_P(cnt) = 1000;
+        P_SET_SLOT(arr, 0, cnt);
+        for (int j = 0; j < 1000; j++) {
+            P_SET_SLOT(arr, 1 + j, j % 2 ? cg_do_allot(cg, TYPE_INT, 16)
+                : shared);
+        }
+        v_add(roots, arr);
+    }
+    cg_do_allot(cg, TYPE_INT, 16);
+    size_t used = cg_space_used(cg);
+    cg_collect(cg, roots);
+    assert(cg_space_used(cg) == used - 16);
+    cg_collect(cg, roots);
+    assert(cg_space_used(cg) == used - 16);
+    shared = P_GET_SLOT(roots->array[0], 1);
+    for (size_t i = 0; i < roots->used; i++) {
+        assert(P_GET_SLOT(roots->array[i], 1) == shared);
+    }
+    assert(*VALUE_P(shared) == 1234);
+    roots->used = 50;
+    cg_collect(cg, roots);
+    assert(cg_space_used(cg) ==
+           50 * (P_ARRAY_SIZE(1000) + NPTRS(2)) + 50 * 500 * 16 + 16);
+    v_free(roots);
+    cg_free(cg);
+    heap_unreserve(mem, heap_size);
+}
+
+// Root i is handled by worker i % n_threads, so runs of n_threads
+// roots to the same object make all workers race to copy it. Sizes
+// are read while other workers may be forwarding the object.
+#define RACE_N_THREADS  16
+#define RACE_N_SHARED   200
+
+void
+test_racing_workers() {
+    size_t heap_size = 64 * 1024 * 1024;
+    ptr mem = heap_reserve(heap_size);
+    copying_gc *cg = cg_init_parallel(mem, heap_size, RACE_N_THREADS);
+    vector *roots = v_init(16);
+    ptr shared[RACE_N_SHARED];
+    size_t used = 0;
+    for (int i = 0; i < RACE_N_SHARED; i++) {
+        // Some arrays are larger than a quarter buffer and are carved
+        // directly from the to-space.
+        size_t n_els = i % 10 ? i * 3 : 3000 + i;
+        size_t size = P_ARRAY_SIZE(n_els);
+        ptr arr = cg_do_allot(cg, TYPE_ARRAY, size);
+        ptr cnt = cg_do_allot(cg, TYPE_INT, NPTRS(2));
+        *VALUE_P(cnt) = n_els;
+        P_SET_SLOT(arr, 0, cnt);
+        ptr ints = cg_do_allot(cg, TYPE_INT_ARRAY, NPTRS(2 + i));
+        RAW_COUNT(ints) = i;
+        for (size_t j = 0; j < n_els; j++) {
+            P_SET_SLOT(arr, 1 + j, j % 2 ? ints : P_TAG_INT(j));
+        }
+        used += size + NPTRS(2) + NPTRS(2 + i);
+        shared[i] = arr;
+    }
+    for (int i = 0; i < RACE_N_SHARED; i++) {
+        for (int j = 0; j < RACE_N_THREADS; j++) {
+            v_add(roots, shared[i]);
+            v_add(roots, shared[(i + j) % RACE_N_SHARED]);
+        }
+    }
+    assert(cg_space_used(cg) == used);
+    for (int k = 0; k < 100; k++) {
+        cg_collect(cg, roots);
+        assert(cg_space_used(cg) == used);
+    }
+    for (size_t i = 0; i < roots->used; i += 2 * RACE_N_THREADS) {
+        ptr arr = roots->array[i];
+        for (int j = 1; j < 2 * RACE_N_THREADS; j += 2) {
+            assert(roots->array[i + j - 1] == arr);
+        }
+        int n = i / (2 * RACE_N_THREADS);
+        size_t n_els = *VALUE_P(P_GET_SLOT(arr, 0));
+        assert(n_els == (n % 10 ? n * 3 : 3000 + n));
+        for (size_t j = 0; j < n_els; j++) {
+            ptr v = P_GET_SLOT(arr, 1 + j);
+            if (j % 2) {
+                assert(P_GET_TYPE(v) == TYPE_INT_ARRAY);
+                assert(RAW_COUNT(v) == n);
+                assert(v == P_GET_SLOT(arr, 2));
+            } else {
+                assert(v == P_TAG_INT(j));
+            }
+        }
+    }
+    v_free(roots);
+    cg_free(cg);
+    heap_unreserve(mem, heap_size);
+}
+
+// Parallel copying leaves gaps in the to-space that the serial copier
+// doesn't, so a semispace filled as far as the collector allows must
+// still fit after copying it several times.
+void
+test_full_semispace() {
+    size_t heap_size = 4 * 1024 * 1024;
+    ptr mem = heap_reserve(heap_size);
+    copying_gc *cg = cg_init_parallel(mem, heap_size, 8);
+    vector *roots = v_init(16);
+    size_t n_allocs = 0;
+    while (true) {
+        size_t n_els = (n_allocs * 37) % 1500;
+        size_t size = P_ARRAY_SIZE(n_els);
+        if (!cg_can_allot_p(cg, size + NPTRS(2))) {
+            break;
+        }
+        ptr arr = cg_do_allot(cg, TYPE_ARRAY, size);
+        ptr cnt = cg_do_allot(cg, TYPE_INT, NPTRS(2));
+        *VALUE_P(cnt) = n_els;
+        P_SET_SLOT(arr, 0, cnt);
+        for (size_t i = 0; i < n_els; i++) {
+            P_SET_SLOT(arr, 1 + i, P_TAG_INT(i));
+        }
+        v_add(roots, arr);
+        n_allocs++;
+    }
+    size_t used = cg_space_used(cg);
+    for (int i = 0; i < 5; i++) {
+        cg_collect(cg, roots);
+        assert(cg_space_used(cg) == used);
+    }
+    for (size_t i = 0; i < roots->used; i++) {
+        ptr arr = roots->array[i];
+        size_t n_els = *VALUE_P(P_GET_SLOT(arr, 0));
+        assert(n_els == (i * 37) % 1500);
+        if (n_els) {
+            assert(P_GET_SLOT(arr, n_els) == P_TAG_INT(n_els - 1));
+        }
+    }
+    v_free(roots);
+    cg_free(cg);
+    heap_unreserve(mem, heap_size);
+}
+
+void
+test_scaling() {
+    vm *v = vm_init(cg_get_dispatch_table_parallel(), HEAP_SIZE);
+    build_heap(v, N_ARRAYS, N_ELS);
+    copying_gc *cg = (copying_gc *)v->gc_obj;
+    size_t used = vm_space_used(v);
+    printf("%lu MB live\n", (unsigned long)(used >> 20));
+    size_t n_cores = thr_n_cores();
+    size_t n = 1;
+    while (true) {
+        pc_free(cg->pc);
+        cg->pc = pc_init(n);
+        uint64_t t0 = nano_count();
+        vm_collect(v);
+        uint64_t t1 = nano_count();
+        assert(vm_space_used(v) == used);
+        check_heap(v, N_ARRAYS, N_ELS);
+        double secs = (double)(t1 - t0) / 1000 / 1000 / 1000;
+        printf("%2lu threads: %.3f seconds, %.0f MB/s\n",
+               (unsigned long)n, secs, (used >> 20) / secs);
+        if (n == n_cores) {
+            break;
+        }
+        n = MIN(2 * n, n_cores);
+    }
+    vm_free(v);
+}
+
+int
+main(int argc, char *argv[]) {
+    PRINT_RUN(test_many_threads);
+    PRINT_RUN(test_racing_workers);
+    PRINT_RUN(test_full_semispace);
+    PRINT_RUN(test_scaling);
+    return 0;
+}
@@ -0,0 +1,111 @@
+// Checks parallel marking and measures how mark throughput scales
+// with the number of marking threads.
+#include <assert.h>
+#include "collectors/vm.h"
+#include "collectors/mark-sweep.h"
+#include "collectors/mark-sweep-bits.h"
+#include "threads/threads.h"
+
+#define HEAP_SIZE   (512 * 1024 * 1024)
+#define N_ARRAYS    3000
+#define N_ELS       2000
+
+static void
+build_heap(vm *v, int n_arrays, int n_els) {
+    vm_add(v, vm_array_init(v, n_arrays, 0));
+    for (int i = 0; i < n_arrays; i++) {
+        ptr arr = vm_add(v, vm_array_init(v, n_els, 0));
+        for (int j = 0; j < n_els; j++) {
+            ptr w = vm_wrapper_init(v, vm_boxed_int_init(v, j));
+            vm_set_slot(v, arr, 1 + j, w);
+        }
+        vm_set_slot(v, vm_get(v, 0), 1 + i, arr);
+        vm_remove(v);
+    }
+}
+
+static void
+bench_mark(vm *v, parallel_marker **pm, bitarray *ba, ptr start) {
+    size_t used = vm_space_used(v);
+    printf("%lu MB live\n", (unsigned long)(used >> 20));
+    size_t n_cores = thr_n_cores();
+    size_t n = 1;
+    while (true) {
+        pm_free(*pm);
+        *pm = pm_init(n, ba, start);
+        if (ba) {
+            ba_clear(ba);
+        }
+        uint64_t t0 = nano_count();
+        pm_mark(*pm, v->roots);
+        uint64_t t1 = nano_count();
+        // Unmarks everything and must not free anything.
+        vm_collect(v);
+        assert(vm_space_used(v) == used);
+        double secs = (double)(t1 - t0) / 1000 / 1000 / 1000;
+        printf("%2lu threads: %.3f seconds, %.0f MB/s\n",
+               (unsigned long)n, secs, (used >> 20) / secs);
+        if (n == n_cores) {
+            break;
+        }
+        n = MIN(2 * n, n_cores);
+    }
+}
+
+void
+test_ms_scaling() {
+    vm *v = vm_init(ms_get_dispatch_table_parallel(), HEAP_SIZE);
+    build_heap(v, N_ARRAYS, N_ELS);
+    mark_sweep_gc *ms = (mark_sweep_gc *)v->gc_obj;
+    bench_mark(v, &ms->pm, NULL, 0);
+    vm_free(v);
+}
+
+void
+test_msb_scaling() {
+    vm *v = vm_init(msb_get_dispatch_table_parallel(), HEAP_SIZE);
+    build_heap(v, N_ARRAYS, N_ELS);
+    mark_sweep_bits_gc *msb = (mark_sweep_bits_gc *)v->gc_obj;
+    bench_mark(v, &msb->pm, msb->ba, msb->qf->start);
+    vm_free(v);
+}
+
+// More threads than cores must work too.
+void
+test_many_threads() {
+    size_t heap_size = 64 * 1024 * 1024;
+    ptr mem = heap_reserve(heap_size);
+    mark_sweep_gc *ms = ms_init_parallel(mem, heap_size, 8);
+    vector *roots = v_init(16);
+    for (int i = 0; i < 100; i++) {
+        ptr arr = ms_do_allot(ms, TYPE_ARRAY, P_ARRAY_SIZE(1000));
+        ptr cnt = ms_do_allot(ms, TYPE_INT, NPTRS(2));
+        *VALUE_P(cnt) = 1000;
+        P_SET_SLOT(arr, 0, cnt);
+        for (int j = 0; j < 1000; j++) {
+            P_SET_SLOT(arr, 1 + j, i % 2 ? ms_do_allot(ms, TYPE_INT, 16) : 0);
+        }
+        v_add(roots, arr);
+    }
+    ms_do_allot(ms, TYPE_INT, 16);
+    size_t used = ms_space_used(ms);
+    ms_collect(ms, roots);
+    assert(ms_space_used(ms) == used - 16);
+    ms_collect(ms, roots);
+    assert(ms_space_used(ms) == used - 16);
+    roots->used = 50;
+    ms_collect(ms, roots);
+    assert(ms_space_used(ms) ==
+           50 * (P_ARRAY_SIZE(1000) + NPTRS(2)) + 25 * 1000 * 16);
+    v_free(roots);
+    ms_free(ms);
+    heap_unreserve(mem, heap_size);
+}
+
+int
+main(int argc, char *argv[]) {
+    PRINT_RUN(test_many_threads);
+    PRINT_RUN(test_ms_scaling);
+    PRINT_RUN(test_msb_scaling);
+    return 0;
+}
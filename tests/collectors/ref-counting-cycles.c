@@ -0,0 +1,144 @@
+// Checks cycle collection and measures how many garbage cycles per
+// second are collected with and without the background collector.
+#include <assert.h>
+#include "collectors/vm.h"
+#include "collectors/ref-counting-cycles.h"
+
+// The cycle is left on the root stack. Otherwise the background
+// collector could free it before it is stored anywhere.
+static ptr
+push_cycle(vm *v) {
+    ptr a = vm_add(v, vm_wrapper_init(v, 0));
+    ptr b = vm_wrapper_init(v, a);
+    vm_set_slot(v, a, 0, b);
+    return a;
+}
+
+void
+test_collect_cycle() {
+    vm *v = vm_init(rcc_get_dispatch_table(), 4096);
+    ref_counting_cycles_gc *rcc = (ref_counting_cycles_gc *)v->gc_obj;
+    ptr a = push_cycle(v);
+    assert(vm_space_used(v) == NPTRS(4));
+    vm_remove(v);
+    assert(P_GET_COL(a) == (COL_PURPLE | COL_BUFFERED));
+    assert(rcc->candidates->used == 1);
+    vm_collect(v);
+    assert(vm_space_used(v) == 0);
+    assert(!rcc->candidates->used);
+    vm_free(v);
+}
+
+// Objects are only buffered once and those whose counts drop to zero
+// while buffered are freed when the buffer is processed.
+void
+test_buffered_once() {
+    vm *v = vm_init(rcc_get_dispatch_table(), 4096);
+    ref_counting_cycles_gc *rcc = (ref_counting_cycles_gc *)v->gc_obj;
+    ptr w = vm_add(v, vm_wrapper_init(v, 0));
+    for (int i = 0; i < 10; i++) {
+        vm_add(v, w);
+        vm_remove(v);
+    }
+    assert(rcc->n_candidates == 1);
+    assert(rcc->candidates->used == 1);
+    assert(P_GET_COL(w) == (COL_PURPLE | COL_BUFFERED));
+
+    vm_remove(v);
+    assert(P_GET_RC(w) == 0);
+    assert(vm_space_used(v) == NPTRS(2));
+    vm_collect(v);
+    assert(vm_space_used(v) == 0);
+    vm_free(v);
+}
+
+// Chain of 2-cycles where each cycle references the previous one and
+// the first references a live object.
+void
+test_shared_cycles() {
+    vm *v = vm_init(rcc_get_dispatch_table(), 1 << 20);
+    ptr live = vm_add(v, vm_boxed_int_init(v, 7));
+    ptr prev = live;
+    vm_add(v, 0);
+    for (int i = 0; i < 100; i++) {
+        ptr a = vm_add(v, vm_array_init(v, 2, 0));
+        ptr b = vm_array_init(v, 2, 0);
+        vm_set_slot(v, a, 1, b);
+        vm_set_slot(v, b, 1, a);
+        vm_set_slot(v, b, 2, prev);
+        vm_remove(v);
+        vm_set(v, 1, a);
+        prev = a;
+    }
+    vm_remove(v);
+    vm_collect(v);
+    assert(vm_space_used(v) == NPTRS(2));
+    assert(P_GET_RC(live) == 1);
+    assert(*VALUE_P(live) == 7);
+    vm_free(v);
+}
+
+// Without explicit collections, the background thread frees the
+// cycles.
+void
+test_background() {
+    vm *v = vm_init(rcc_get_dispatch_table_concurrent(), 1 << 20);
+    ref_counting_cycles_gc *rcc = (ref_counting_cycles_gc *)v->gc_obj;
+    for (int i = 0; i < RCC_TRIGGER_SIZE; i++) {
+        push_cycle(v);
+        vm_remove(v);
+    }
+    while (vm_space_used(v) > 0) {
+        thr_yield();
+    }
+    assert(rcc->n_batches >= RCC_TRIGGER_SIZE / RCC_BATCH_SIZE);
+    vm_free(v);
+}
+
+#define BENCH_HEAP_SIZE (32 * 1024 * 1024)
+#define BENCH_N_SLOTS   1000
+#define BENCH_N_LOOPS   2000000
+
+// Garbage cycles are created by replacing random elements of an array
+// with new cycles. The pause is the longest time taken by one
+// iteration.
+static void
+bench_churn(char *name, gc_dispatch *dispatch) {
+    rand_init(0);
+    vm *v = vm_init(dispatch, BENCH_HEAP_SIZE);
+    ref_counting_cycles_gc *rcc = (ref_counting_cycles_gc *)v->gc_obj;
+    ptr arr = vm_add(v, vm_array_init(v, BENCH_N_SLOTS, 0));
+    uint64_t max_pause = 0;
+    uint64_t start = nano_count();
+    for (int i = 0; i < BENCH_N_LOOPS; i++) {
+        uint64_t t0 = nano_count();
+        vm_set_slot(v, arr, 1 + rand_n(BENCH_N_SLOTS), push_cycle(v));
+        vm_remove(v);
+        max_pause = MAX(max_pause, nano_count() - t0);
+    }
+    double secs = (double)(nano_count() - start) / 1000 / 1000 / 1000;
+    printf("%-12s %.3f s, %.2fM cycles/s, %.2fM candidates/s, "
+           "max pause %.1f ms, max batch %.1f ms\n",
+           name, secs, BENCH_N_LOOPS / secs / 1e6,
+           rcc->n_candidates / secs / 1e6,
+           (double)max_pause / 1000 / 1000,
+           (double)rcc->max_batch_pause / 1000 / 1000);
+    vm_free(v);
+}
+
+void
+test_churn_bench() {
+    bench_churn("Synchronous", rcc_get_dispatch_table());
+    bench_churn("Concurrent", rcc_get_dispatch_table_concurrent());
+}
+
+int
+main(int argc, char *argv[]) {
+    rand_init(0);
+    PRINT_RUN(test_collect_cycle);
+    PRINT_RUN(test_buffered_once);
+    PRINT_RUN(test_shared_cycles);
+    PRINT_RUN(test_background);
+    PRINT_RUN(test_churn_bench);
+    return 0;
+}
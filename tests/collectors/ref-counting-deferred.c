@@ -0,0 +1,105 @@
+#include <assert.h>
+#include "collectors/vm.h"
+#include "collectors/ref-counting.h"
+#include "collectors/ref-counting-deferred.h"
+
+void
+test_root_stores() {
+    vm *v = vm_init(rcd_get_dispatch_table(), 4096);
+    ref_counting_deferred_gc *rcd = (ref_counting_deferred_gc *)v->gc_obj;
+    ptr i = vm_add(v, vm_boxed_int_init(v, 10));
+    vm_add(v, i);
+    assert(P_GET_RC(i) == 0);
+    assert(rcd->zct->used == 1);
+
+    // Slot stores are counted.
+    ptr w = vm_add(v, vm_wrapper_init(v, i));
+    assert(P_GET_RC(i) == 1);
+    vm_set_slot(v, w, 0, 0);
+    assert(P_GET_RC(i) == 0);
+    assert(rcd->zct->used == 2);
+    vm_free(v);
+}
+
+void
+test_reconcile() {
+    vm *v = vm_init(rcd_get_dispatch_table(), 4096);
+    ref_counting_deferred_gc *rcd = (ref_counting_deferred_gc *)v->gc_obj;
+    ptr w = vm_add(v, vm_wrapper_init(v, vm_boxed_int_init(v, 3)));
+    vm_add(v, vm_array_init(v, 12, w));
+    vm_boxed_int_init(v, 4);
+    assert(vm_space_used(v) == NPTRS(2 + 2) + P_ARRAY_SIZE(12) + NPTRS(2 + 2));
+    vm_collect(v);
+    assert(vm_space_used(v) == NPTRS(2 + 2) + P_ARRAY_SIZE(12) + NPTRS(2));
+    // Only the roots have zero counts.
+    assert(rcd->zct->used == 1);
+    assert(P_GET_RC(w) == 12);
+
+    vm_remove(v);
+    vm_collect(v);
+    assert(vm_space_used(v) == NPTRS(4));
+    assert(P_GET_RC(w) == 0);
+    vm_remove(v);
+    vm_collect(v);
+    assert(vm_space_used(v) == 0);
+    assert(rcd->zct->used == 0);
+    vm_free(v);
+}
+
+// The zct must be reconciled when it fills up and roots must survive
+// it.
+void
+test_zct_limit() {
+    vm *v = vm_init(rcd_get_dispatch_table(), 1 << 20);
+    ref_counting_deferred_gc *rcd = (ref_counting_deferred_gc *)v->gc_obj;
+    for (int i = 0; i < 2 * RCD_ZCT_LIMIT; i++) {
+        vm_add(v, vm_boxed_int_init(v, i));
+    }
+    assert(rcd->n_reconciles == 1);
+    assert(rcd->zct_limit == 2 * RCD_ZCT_LIMIT);
+    for (int i = 0; i < 2 * RCD_ZCT_LIMIT; i++) {
+        assert(*VALUE_P(vm_get(v, i)) == i);
+    }
+    vm_free(v);
+}
+
+// Compares the time for a stack heavy workload with immediate and
+// deferred ref counting.
+static double
+bench_stack_traffic(gc_dispatch *dispatch) {
+    vm *v = vm_init(dispatch, 64 * 1024 * 1024);
+    ptr arr = vm_add(v, vm_array_init(v, 1000, 0));
+    uint64_t start = nano_count();
+    for (int i = 0; i < 5000000; i++) {
+        ptr w = vm_add(v, vm_wrapper_init(v, arr));
+        vm_add(v, vm_get(v, 1));
+        vm_add(v, P_GET_SLOT(vm_get(v, 2), 0));
+        vm_set(v, 2, vm_get(v, 1));
+        vm_remove(v);
+        vm_remove(v);
+        if (i % 8 == 0) {
+            vm_set_slot(v, arr, 1 + rand_n(1000), w);
+        }
+        vm_remove(v);
+    }
+    vm_free(v);
+    return (double)(nano_count() - start) / 1000 / 1000 / 1000;
+}
+
+void
+test_bench_stack_traffic() {
+    printf("immediate: %.3f seconds\n",
+           bench_stack_traffic(rc_get_dispatch_table()));
+    printf("deferred:  %.3f seconds\n",
+           bench_stack_traffic(rcd_get_dispatch_table()));
+}
+
+int
+main(int argc, char *argv[]) {
+    rand_init(0);
+    PRINT_RUN(test_root_stores);
+    PRINT_RUN(test_reconcile);
+    PRINT_RUN(test_zct_limit);
+    PRINT_RUN(test_bench_stack_traffic);
+    return 0;
+}
@@ -1,9 +1,10 @@
 #include <assert.h>
+#include "collectors/vm.h"
 #include "collectors/ref-counting.h"
 
 void
 test_do_allot() {
-    ptr mem = (ptr)malloc(4096);
+    ptr mem = heap_reserve(4096);
 
     ref_counting_gc *rc = rc_init(mem, 4096);
 
@@ -13,11 +14,102 @@ test_do_allot() {
 
     rc_free(rc);
 
-    free((void*)mem);
+    heap_unreserve(mem, 4096);
+}
+
+void
+test_incremental_free() {
+    vm *v = vm_init(rc_get_dispatch_table_incremental(), 1 << 20);
+    ref_counting_gc *rc = (ref_counting_gc *)v->gc_obj;
+    assert(rc->max_frees == RC_DEFAULT_MAX_FREES);
+    vm_add(v, vm_wrapper_init(v, 0));
+    for (int i = 0; i < 1000; i++) {
+        vm_set(v, 0, vm_wrapper_init(v, vm_get(v, 0)));
+    }
+    assert(vm_space_used(v) == 1001 * NPTRS(2));
+
+    // Only part of the chain is freed by the barrier.
+    vm_remove(v);
+    size_t n_freed = RC_DEFAULT_MAX_FREES;
+    assert(vm_space_used(v) == (1001 - n_freed) * NPTRS(2));
+    assert(rc->decrefs->used == 1);
+
+    // And some more by the allocation.
+    vm_add(v, vm_boxed_int_init(v, 3));
+    n_freed += RC_DEFAULT_MAX_FREES;
+    assert(vm_space_used(v) == (1001 - n_freed + 1) * NPTRS(2));
+
+    vm_collect(v);
+    assert(vm_space_used(v) == NPTRS(2));
+    assert(!rc->decrefs->used);
+    vm_free(v);
+}
+
+// Pending objects are freed before allocation fails.
+void
+test_drain_before_failure() {
+    ptr mem = heap_reserve(4096);
+    ref_counting_gc *rc = rc_init_incremental(mem, 4096, 1);
+    ptr arr = rc_do_allot(rc, TYPE_ARRAY, P_ARRAY_SIZE(100));
+    ptr cnt = rc_do_allot(rc, TYPE_INT, NPTRS(2));
+    *VALUE_P(cnt) = 100;
+    rc_set_new_ptr(rc, SLOT_P(arr, 0), cnt);
+    for (int i = 0; i < 100; i++) {
+        ptr p = rc_do_allot(rc, TYPE_INT, NPTRS(2));
+        rc_set_new_ptr(rc, SLOT_P(arr, 1 + i), p);
+    }
+    ref root = 0;
+    rc_set_new_ptr(rc, &root, arr);
+    size_t n_fillers = 0;
+    while (rc_can_allot_p(rc, 16)) {
+        rc_do_allot(rc, TYPE_INT, 16);
+        n_fillers++;
+    }
+
+    // Only the array is freed and it is too small to be split into
+    // 16 byte blocks.
+    rc_set_ptr(rc, &root, 0);
+    assert(rc->decrefs->used == 101);
+    assert(rc_can_allot_p(rc, 16));
+    assert(!rc->decrefs->used);
+    assert(rc_space_used(rc) == n_fillers * 16);
+    rc_free(rc);
+    heap_unreserve(mem, 4096);
+}
+
+// Measures the longest pause for a single pointer store when large
+// structures are dropped.
+static void
+bench_pauses(char *name, gc_dispatch *dispatch) {
+    vm *v = vm_init(dispatch, 256 * 1024 * 1024);
+    uint64_t max_pause = 0;
+    for (int i = 0; i < 10; i++) {
+        vm_add(v, vm_array_init(v, 100000, 0));
+        for (int j = 0; j < 100000; j++) {
+            ptr w = vm_wrapper_init(v, vm_boxed_int_init(v, j));
+            uint64_t start = nano_count();
+            vm_set_slot(v, vm_get(v, 0), 1 + j, w);
+            max_pause = MAX(max_pause, nano_count() - start);
+        }
+        uint64_t start = nano_count();
+        vm_remove(v);
+        max_pause = MAX(max_pause, nano_count() - start);
+    }
+    printf("%-12s max pause %.1f us\n", name, max_pause / 1000.0);
+    vm_free(v);
+}
+
+void
+test_bench_pauses() {
+    bench_pauses("eager", rc_get_dispatch_table());
+    bench_pauses("incremental", rc_get_dispatch_table_incremental());
 }
 
 int
 main(int argc, char *argv[]) {
     PRINT_RUN(test_do_allot);
+    PRINT_RUN(test_incremental_free);
+    PRINT_RUN(test_drain_before_failure);
+    PRINT_RUN(test_bench_pauses);
     return 0;
 }
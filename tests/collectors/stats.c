@@ -0,0 +1,192 @@
+// Checks the gc stats and prints them for a workload on every
+// collector.
+#include <assert.h>
+#include "collectors/vm.h"
+#include "collectors/copying.h"
+#include "collectors/copying-opt.h"
+#include "collectors/generational.h"
+#include "collectors/mark-compact.h"
+#include "collectors/mark-sweep.h"
+#include "collectors/mark-sweep-bits.h"
+#include "collectors/mark-sweep-inc.h"
+#include "collectors/ref-counting.h"
+#include "collectors/ref-counting-cycles.h"
+#include "collectors/ref-counting-deferred.h"
+
+void
+test_histogram() {
+    gc_stats gs;
+    gs_clear(&gs);
+    assert(gs_pause_percentile(&gs, 50) == 0);
+    for (uint64_t i = 1; i <= 1000; i++) {
+        gs_record_pause(&gs, i * 1000);
+    }
+    assert(gs.n_collections == 1000);
+    assert(gs.pause_max == 1000 * 1000);
+    assert(gs.pause_total == 500500 * 1000);
+    uint64_t p50 = gs_pause_percentile(&gs, 50);
+    uint64_t p99 = gs_pause_percentile(&gs, 99);
+    assert(p50 >= 500 * 1000 && p50 <= 500 * 1000 * 17 / 16);
+    assert(p99 >= 990 * 1000 && p99 <= 1000 * 1000);
+    assert(gs_pause_percentile(&gs, 100) == 1000 * 1000);
+
+    // Small values are exact.
+    gs_clear(&gs);
+    for (uint64_t i = 0; i < GS_SUB_BUCKETS; i++) {
+        gs_record_pause(&gs, i);
+    }
+    assert(gs_pause_percentile(&gs, 50) == GS_SUB_BUCKETS / 2 - 1);
+
+    // Huge values fit too.
+    gs_record_pause(&gs, UINT64_MAX);
+    assert(gs_pause_percentile(&gs, 100) == UINT64_MAX);
+}
+
+void
+test_counters() {
+    vm *v = vm_init(ms_get_dispatch_table(), 1 << 20);
+    gc_stats gs;
+    vm_stats_snapshot(v, &gs);
+    assert(gs.n_collections == 0);
+    assert(gs.bytes_allocated == 0);
+    assert(gs.free_space == 1 << 20);
+
+    vm_add(v, vm_wrapper_init(v, vm_boxed_int_init(v, 3)));
+    vm_boxed_int_init(v, 4);
+    vm_collect(v);
+    vm_stats_snapshot(v, &gs);
+    assert(gs.n_collections == 1);
+    assert(gs.bytes_allocated == NPTRS(6));
+    assert(gs.bytes_survived == NPTRS(4));
+    assert(gs.free_space == (1 << 20) - NPTRS(4));
+    assert(gs.pause_max > 0);
+
+    vm_collect(v);
+    vm_stats_snapshot(v, &gs);
+    assert(gs.n_collections == 2);
+    assert(gs.bytes_survived_total == NPTRS(8));
+
+    vm_stats_reset(v);
+    vm_stats_snapshot(v, &gs);
+    assert(gs.n_collections == 0);
+    assert(gs.bytes_allocated == 0);
+    assert(gs.bytes_survived_total == 0);
+    assert(gs.free_space == (1 << 20) - NPTRS(4));
+    vm_free(v);
+}
+
+// Every second int is freed so there are many small free blocks.
+// Compaction gets rid of them.
+void
+test_fragmentation() {
+    gc_dispatch *dispatches[] = {
+        ms_get_dispatch_table(),
+        mc_get_dispatch_table()
+    };
+    for (int i = 0; i < 2; i++) {
+        vm *v = vm_init(dispatches[i], 1 << 20);
+        ptr arr = vm_add(v, vm_array_init(v, 1000, 0));
+        for (int j = 0; j < 2000; j++) {
+            ptr p = vm_boxed_int_init(v, j);
+            if (j % 2) {
+                vm_set_slot(v, arr, 1 + j / 2, p);
+            }
+        }
+        vm_collect(v);
+        gc_stats gs;
+        vm_stats_snapshot(v, &gs);
+        assert(gs.free_space == (1 << 20) - vm_space_used(v));
+        if (i == 0) {
+            assert(gs.n_free_blocks > 1000);
+            assert(gs_fragmentation(&gs) > 0.01);
+        } else {
+            assert(gs.n_free_blocks == 1);
+            assert(gs_fragmentation(&gs) == 0);
+        }
+        vm_free(v);
+    }
+}
+
+void
+test_promoted() {
+    vm *v = vm_init(gen_get_dispatch_table(), 1 << 20);
+    vm_add(v, vm_array_init(v, 10, 0));
+    gc_stats gs;
+    vm_stats_snapshot(v, &gs);
+    assert(gs.bytes_promoted == 0);
+    vm_collect(v);
+    vm_stats_snapshot(v, &gs);
+    assert(gs.bytes_promoted == P_ARRAY_SIZE(10) + NPTRS(2));
+
+    // Old objects aren't promoted again.
+    vm_stats_reset(v);
+    vm_collect(v);
+    vm_stats_snapshot(v, &gs);
+    assert(gs.bytes_promoted == 0);
+    vm_free(v);
+}
+
+static ptr
+random_object(vm *v) {
+    if (rand_n(2)) {
+        return vm_array_init(v, rand_n(200), random_object(v));
+    }
+    switch (rand_n(TYPE_ARRAY)) {
+    case TYPE_INT:
+        return vm_boxed_int_init(v, rand_n(100));
+    case TYPE_FLOAT:
+        return vm_boxed_float_init(v, (double)rand_n(100));
+    case TYPE_WRAPPER:
+        return vm_wrapper_init(v, random_object(v));
+    default:
+        return 0;
+    }
+}
+
+#define REPORT_HEAP_SIZE    (64 * 1024 * 1024)
+#define REPORT_N_ROOTS      50
+#define REPORT_N_ELS        500
+#define REPORT_N_LOOPS      1000000
+
+static void
+report(char *name, gc_dispatch *dispatch) {
+    rand_init(0);
+    vm *v = vm_init(dispatch, REPORT_HEAP_SIZE);
+    for (int i = 0; i < REPORT_N_ROOTS; i++) {
+        vm_add(v, vm_array_init(v, REPORT_N_ELS, 0));
+    }
+    for (int i = 0; i < REPORT_N_LOOPS; i++) {
+        ptr arr = vm_get(v, rand_n(REPORT_N_ROOTS));
+        vm_set_slot(v, arr, 1 + rand_n(REPORT_N_ELS), random_object(v));
+    }
+    gc_stats gs;
+    vm_stats_snapshot(v, &gs);
+    printf("%s\n", name);
+    gs_print(&gs);
+    vm_free(v);
+}
+
+void
+test_report() {
+    report("Copying", cg_get_dispatch_table());
+    report("Optimized Copying", cg_get_dispatch_table_optimized());
+    report("Mark & Sweep", ms_get_dispatch_table());
+    report("Mark & Sweep (separate mark bits)", msb_get_dispatch_table());
+    report("Incremental Mark & Sweep", msi_get_dispatch_table());
+    report("Mark & Compact", mc_get_dispatch_table());
+    report("Generational", gen_get_dispatch_table());
+    report("Reference Counting", rc_get_dispatch_table());
+    report("Cycle-collecting Reference Counting", rcc_get_dispatch_table());
+    report("Deferred Reference Counting", rcd_get_dispatch_table());
+}
+
+int
+main(int argc, char *argv[]) {
+    rand_init(0);
+    PRINT_RUN(test_histogram);
+    PRINT_RUN(test_counters);
+    PRINT_RUN(test_fragmentation);
+    PRINT_RUN(test_promoted);
+    PRINT_RUN(test_report);
+    return 0;
+}
@@ -0,0 +1,208 @@
+// Checks recording and replaying of vm traces.
+#include <assert.h>
+#include <stdio.h>
+#include "collectors/vm.h"
+#include "collectors/copying.h"
+#include "collectors/mark-sweep.h"
+#include "collectors/ref-counting.h"
+
+#define TRACE_PATH "collectors-trace-test.gctr"
+
+static void
+check_heap(vm *v, size_t base) {
+    assert(vm_size(v) == base + 2);
+    ptr arr = vm_get(v, base);
+    assert(P_GET_TYPE(arr) == TYPE_ARRAY);
+    assert(*VALUE_P(P_GET_SLOT(arr, 0)) == 100);
+    for (int i = 0; i < 100; i++) {
+        ptr p = P_GET_SLOT(arr, 1 + i);
+        if (i % 2) {
+            assert(P_GET_TYPE(p) == TYPE_WRAPPER);
+            p = P_GET_SLOT(p, 0);
+            assert(*(double *)VALUE_P(p) == i / 2.0);
+        } else {
+            assert(*VALUE_P(p) == -i);
+        }
+    }
+    ptr w = vm_get(v, base + 1);
+    assert(P_GET_TYPE(w) == TYPE_WRAPPER);
+    assert(P_GET_SLOT(w, 0) == arr);
+}
+
+void
+test_round_trip() {
+    vm *v = vm_init(ms_get_dispatch_table(), 1 << 20);
+    assert(vm_trace_start(v, TRACE_PATH));
+    ptr arr = vm_add(v, vm_array_init(v, 100, 0));
+    for (int i = 0; i < 100; i++) {
+        ptr p = i % 2
+            ? vm_wrapper_init(v, vm_boxed_float_init(v, i / 2.0))
+            : vm_boxed_int_init(v, -i);
+        vm_set_slot(v, arr, 1 + i, p);
+        vm_add(v, vm_array_init(v, 50, 0));
+        vm_remove(v);
+    }
+    vm_add(v, 0);
+    vm_set(v, 1, vm_wrapper_init(v, arr));
+    vm_collect(v);
+    size_t n_ops = v->trace->n_ops;
+    assert(n_ops == 2 + 50 * 6 + 50 * 5 + 4);
+    assert(vm_trace_stop(v) == 0);
+    check_heap(v, 0);
+    vm_free(v);
+
+    trace *t = tr_read(TRACE_PATH);
+    assert(t);
+    assert(t->heap_size == 1 << 20);
+    gc_dispatch *dispatches[] = {
+        ms_get_dispatch_table(),
+        cg_get_dispatch_table(),
+        rc_get_dispatch_table()
+    };
+    for (int i = 0; i < ARRAY_SIZE(dispatches); i++) {
+        tr_result res;
+        v = vm_replay(t, dispatches[i], t->heap_size, &res);
+        assert(res.n_ops == n_ops);
+        assert(res.gc.n_collections >= 1);
+        assert(res.peak_used >= NPTRS(102 + 2));
+        check_heap(v, TR_N_RECENT);
+        vm_free(v);
+    }
+    tr_trace_free(t);
+    remove(TRACE_PATH);
+}
+
+// Replaying with a small heap forces collections between allocations
+// and their uses.
+void
+test_moving() {
+    vm *v = vm_init(ms_get_dispatch_table(), 1 << 20);
+    assert(vm_trace_start(v, TRACE_PATH));
+    vm_add(v, 0);
+    for (int i = 0; i < 10000; i++) {
+        vm_array_init(v, 10, 0);
+        ptr a = vm_boxed_int_init(v, i);
+        vm_set(v, 0, vm_wrapper_init(v, a));
+    }
+    assert(vm_trace_stop(v) == 0);
+    vm_free(v);
+
+    trace *t = tr_read(TRACE_PATH);
+    tr_result res;
+    v = vm_replay(t, cg_get_dispatch_table(), 8192, &res);
+    assert(res.gc.n_collections > 10);
+    ptr w = vm_get(v, TR_N_RECENT);
+    assert(*VALUE_P(P_GET_SLOT(w, 0)) == 9999);
+    vm_free(v);
+    tr_trace_free(t);
+    remove(TRACE_PATH);
+}
+
+// Pointers read from slots can't be recorded.
+void
+test_unresolved() {
+    vm *v = vm_init(ms_get_dispatch_table(), 1 << 20);
+    assert(vm_trace_start(v, TRACE_PATH));
+    ptr w = vm_add(v, vm_wrapper_init(v, vm_boxed_int_init(v, 3)));
+    for (int i = 0; i < TR_N_RECENT; i++) {
+        vm_boxed_int_init(v, i);
+    }
+    vm_add(v, P_GET_SLOT(w, 0));
+    assert(vm_trace_stop(v) == 1);
+    vm_free(v);
+    remove(TRACE_PATH);
+
+    assert(!tr_read(TRACE_PATH));
+}
+
+// Tagged ints are recorded by value.
+void
+test_tagged_ints() {
+    vm *v = vm_init(ms_get_dispatch_table(), 1 << 20);
+    assert(vm_trace_start(v, TRACE_PATH));
+    ptr arr = vm_add(v, vm_array_init(v, 2, vm_int_init(v, -7)));
+    vm_set_slot(v, arr, 2, vm_int_init(v, P_TAG_INT_MAX));
+    vm_add(v, vm_int_init(v, 42));
+    assert(vm_trace_stop(v) == 0);
+    vm_free(v);
+
+    trace *t = tr_read(TRACE_PATH);
+    tr_result res;
+    v = vm_replay(t, cg_get_dispatch_table(), t->heap_size, &res);
+    arr = vm_get(v, TR_N_RECENT);
+    assert(vm_int_value(P_GET_SLOT(arr, 1)) == -7);
+    assert(vm_int_value(P_GET_SLOT(arr, 2)) == P_TAG_INT_MAX);
+    assert(vm_int_value(vm_get(v, TR_N_RECENT + 1)) == 42);
+    vm_free(v);
+    tr_trace_free(t);
+    remove(TRACE_PATH);
+}
+
+void
+test_raw_arrays() {
+    vm *v = vm_init(ms_get_dispatch_table(), 1 << 20);
+    assert(vm_trace_start(v, TRACE_PATH));
+    vm_add(v, vm_array_init(v, 1, 0));
+    vm_set_slot(v, vm_last(v), 1, vm_byte_array_init(v, 13, 1));
+    vm_add(v, vm_float_array_init(v, 100, 1.0));
+    assert(vm_trace_stop(v) == 0);
+    vm_free(v);
+
+    trace *t = tr_read(TRACE_PATH);
+    tr_result res;
+    v = vm_replay(t, cg_get_dispatch_table(), t->heap_size, &res);
+    ptr bytes = P_GET_SLOT(vm_get(v, TR_N_RECENT), 1);
+    assert(P_GET_TYPE(bytes) == TYPE_BYTE_ARRAY);
+    assert(RAW_COUNT(bytes) == 13);
+    ptr floats = vm_get(v, TR_N_RECENT + 1);
+    assert(P_GET_TYPE(floats) == TYPE_FLOAT_ARRAY);
+    assert(RAW_COUNT(floats) == 100);
+    vm_free(v);
+    tr_trace_free(t);
+    remove(TRACE_PATH);
+}
+
+// Bulk writes are recorded slot by slot, with the values they had
+// before an overlapping copy.
+void
+test_bulk_slots() {
+    vm *v = vm_init(ms_get_dispatch_table(), 1 << 20);
+    assert(vm_trace_start(v, TRACE_PATH));
+    ptr arr = vm_add(v, vm_array_init(v, 10, 0));
+    for (int i = 0; i < 5; i++) {
+        vm_set_slot(v, arr, 1 + i, vm_int_init(v, i));
+    }
+    vm_fill_slots(v, arr, 6, 5, vm_boxed_int_init(v, 5));
+    vm_copy_slots(v, arr, 3, arr, 1, 5);
+    vm_add(v, vm_array_init_from(v, arr, 2, 4));
+    assert(vm_trace_stop(v) == 0);
+    vm_free(v);
+
+    trace *t = tr_read(TRACE_PATH);
+    tr_result res;
+    v = vm_replay(t, cg_get_dispatch_table(), t->heap_size, &res);
+    arr = vm_get(v, TR_N_RECENT);
+    int64_t values[] = {0, 1, 0, 1, 2, 3, 4, 5, 5, 5};
+    for (int i = 0; i < 10; i++) {
+        assert(vm_int_value(P_GET_SLOT(arr, 1 + i)) == values[i]);
+    }
+    ptr copy = vm_get(v, TR_N_RECENT + 1);
+    assert(*VALUE_P(P_GET_SLOT(copy, 0)) == 4);
+    for (int i = 0; i < 4; i++) {
+        assert(P_GET_SLOT(copy, 1 + i) == P_GET_SLOT(arr, 2 + i));
+    }
+    vm_free(v);
+    tr_trace_free(t);
+    remove(TRACE_PATH);
+}
+
+int
+main(int argc, char *argv[]) {
+    PRINT_RUN(test_round_trip);
+    PRINT_RUN(test_moving);
+    PRINT_RUN(test_unresolved);
+    PRINT_RUN(test_tagged_ints);
+    PRINT_RUN(test_raw_arrays);
+    PRINT_RUN(test_bulk_slots);
+    return 0;
+}
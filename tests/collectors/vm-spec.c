@@ -0,0 +1,135 @@
+// Checks the vms specialized with collectors/vm-spec.h against the
+// dynamic ones.
+#include <assert.h>
+#include <stdio.h>
+#include "collectors/copying.h"
+#include "collectors/generational.h"
+#include "collectors/mark-sweep.h"
+
+#define VM_SPEC_PREFIX      cgv
+#define VM_SPEC_GC          copying_gc
+#define VM_SPEC_DISPATCH    cg_get_dispatch_table
+#define VM_SPEC_ALLOT       cg_allot_fast
+#include "collectors/vm-spec.h"
+
+#define VM_SPEC_PREFIX      genv
+#define VM_SPEC_GC          generational_gc
+#define VM_SPEC_DISPATCH    gen_get_dispatch_table
+#define VM_SPEC_ALLOT       gen_allot_fast
+#define VM_SPEC_SET_PTR     gen_set_ptr_fast
+#include "collectors/vm-spec.h"
+
+#define VM_SPEC_PREFIX      msv
+#define VM_SPEC_GC          mark_sweep_gc
+#define VM_SPEC_DISPATCH    ms_get_dispatch_table
+#define VM_SPEC_ALLOT       ms_allot_fast
+#include "collectors/vm-spec.h"
+
+// The same workload with the dynamic and the specialized functions.
+// Every tenth object is kept in one of the rooted arrays.
+#define WORKLOAD(P, v)                                              \
+    do {                                                            \
+        P##_add(v, P##_array_init(v, 100, 0));                      \
+        for (int i = 0; i < 100000; i++) {                          \
+            ptr p = i % 3 == 0 ? P##_boxed_int_init(v, i)           \
+                : i % 3 == 1 ? P##_boxed_float_init(v, i)           \
+                : P##_wrapper_init(v, P##_array_init(v, 3, 0));     \
+            if (i % 10 == 0) {                                      \
+                P##_set_slot(v, vm_get(v, 0), 1 + i / 10 % 100, p); \
+            }                                                       \
+        }                                                           \
+    } while (0)
+
+static void
+check_workload(vm *v) {
+    ptr arr = vm_get(v, 0);
+    for (int i = 99000; i < 100000; i += 10) {
+        ptr p = P_GET_SLOT(arr, 1 + i / 10 % 100);
+        int type = P_GET_TYPE(p);
+        if (i % 3 == 0) {
+            assert(type == TYPE_INT && *VALUE_P(p) == (ptr)i);
+        } else if (i % 3 == 1) {
+            assert(type == TYPE_FLOAT && *(double *)VALUE_P(p) == i);
+        } else {
+            assert(type == TYPE_WRAPPER);
+            assert(P_GET_TYPE(P_GET_SLOT(p, 0)) == TYPE_ARRAY);
+        }
+    }
+}
+
+static void
+compare(vm *dyn, vm *spec) {
+    check_workload(dyn);
+    check_workload(spec);
+    vm_collect(dyn);
+    vm_collect(spec);
+    assert(vm_space_used(dyn) == vm_space_used(spec));
+    assert(dyn->stats.bytes_allocated == spec->stats.bytes_allocated);
+    vm_free(dyn);
+    vm_free(spec);
+}
+
+void
+test_copying() {
+    vm *dyn = vm_init(cg_get_dispatch_table(), 1 << 20);
+    vm *spec = cgv_init(1 << 20);
+    WORKLOAD(vm, dyn);
+    WORKLOAD(cgv, spec);
+    assert(spec->stats.n_collections > 0);
+    compare(dyn, spec);
+}
+
+void
+test_generational() {
+    vm *dyn = vm_init(gen_get_dispatch_table(), 4 << 20);
+    vm *spec = genv_init(4 << 20);
+    WORKLOAD(vm, dyn);
+    WORKLOAD(genv, spec);
+    compare(dyn, spec);
+}
+
+void
+test_mark_sweep() {
+    vm *dyn = vm_init(ms_get_dispatch_table(), 1 << 20);
+    vm *spec = msv_init(1 << 20);
+    WORKLOAD(vm, dyn);
+    WORKLOAD(msv, spec);
+    compare(dyn, spec);
+}
+
+// Old objects pointing to nursery objects are remembered by the
+// inlined barrier.
+void
+test_generational_barrier() {
+    vm *v = genv_init(4 << 20);
+    generational_gc *gen = v->gc_obj;
+    ptr arr = genv_add(v, genv_array_init(v, 10, 0));
+    vm_collect(v);
+    arr = vm_get(v, 0);
+    assert(GEN_OLD_P(gen, arr));
+    assert(gen->remset->used == 0);
+    genv_set_slot(v, arr, 1, genv_boxed_int_init(v, 7));
+    genv_set_slot(v, arr, 1, genv_boxed_int_init(v, 8));
+    assert(gen->remset->used == 1);
+    genv_set_slot(v, arr, 2, P_TAG_INT(9));
+    assert(gen->remset->used == 1);
+
+    // Fill the nursery so that a minor collection promotes the int.
+    for (int i = 0; i < 100000; i++) {
+        genv_boxed_int_init(v, i);
+    }
+    arr = vm_get(v, 0);
+    assert(GEN_OLD_P(gen, P_GET_SLOT(arr, 1)));
+    assert(*VALUE_P(P_GET_SLOT(arr, 1)) == 8);
+    assert(P_GET_SLOT(arr, 2) == P_TAG_INT(9));
+    vm_free(v);
+}
+
+int
+main(int argc, char *argv[]) {
+    PRINT_RUN(test_copying);
+    PRINT_RUN(test_generational);
+    PRINT_RUN(test_mark_sweep);
+    PRINT_RUN(test_generational_barrier);
+    return 0;
+}
@@ -0,0 +1,357 @@
+// Checks growable vm heaps and heaps shared by several mutators.
+#include <assert.h>
+#include <stdio.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include "threads/threads.h"
+#include "collectors/vm.h"
+#include "collectors/copying.h"
+#include "collectors/copying-opt.h"
+#include "collectors/immix.h"
+#include "collectors/mark-compact.h"
+#include "collectors/mark-sweep.h"
+#include "collectors/mark-sweep-bits.h"
+#include "collectors/ref-counting.h"
+#include "collectors/ref-counting-cycles.h"
+#include "collectors/ref-counting-deferred.h"
+
+#define MIN_SIZE    (64 * 1024)
+#define MAX_SIZE    (64 * 1024 * 1024)
+
+#define RESIZABLE_DISPATCHES {                 \
+        cg_get_dispatch_table(),                \
+        cg_get_dispatch_table_optimized(),      \
+        ms_get_dispatch_table(),                \
+        msb_get_dispatch_table(),               \
+        msb_get_dispatch_table_lazy(),          \
+        msb_get_dispatch_table_parallel(),      \
+        mc_get_dispatch_table(),                \
+        rc_get_dispatch_table(),                \
+        rcc_get_dispatch_table(),               \
+        rcd_get_dispatch_table()                \
+    }
+
+// Adds n arrays with n_els slots each to the roots.
+static void
+add_arrays(vm *v, size_t n, size_t n_els) {
+    for (size_t i = 0; i < n; i++) {
+        ptr arr = vm_add(v, vm_array_init(v, n_els, 0));
+        vm_set_slot(v, arr, 1, vm_boxed_int_init(v, i));
+    }
+}
+
+void
+test_fixed() {
+    vm *v = vm_init(ms_get_dispatch_table(), 1 << 20);
+    add_arrays(v, 100, 1000);
+    assert(v->size == 1 << 20);
+    vm_collect(v);
+    assert(v->size == 1 << 20);
+    vm_free(v);
+}
+
+void
+test_grow_and_shrink() {
+    gc_dispatch *dispatches[] = RESIZABLE_DISPATCHES;
+    for (size_t i = 0; i < ARRAY_SIZE(dispatches); i++) {
+        vm *v = vm_init_growable(dispatches[i],
+                                 MIN_SIZE, MAX_SIZE, 0.5);
+        assert(v->size == MIN_SIZE);
+        gc_stats gs;
+        vm_stats_snapshot(v, &gs);
+        assert(gs.free_space <= MIN_SIZE);
+
+        add_arrays(v, 200, 1000);
+        size_t used = vm_space_used(v);
+        assert(used > 200 * P_ARRAY_SIZE(1000));
+        assert(v->size > used);
+        assert(v->size <= MAX_SIZE);
+        assert(v->size % VM_HEAP_ALIGNMENT == 0);
+
+        // The live data fits with room to spare after a collection.
+        vm_collect(v);
+        vm_stats_snapshot(v, &gs);
+        assert(gs.free_space >= vm_space_used(v) / 2);
+
+        while (vm_size(v)) {
+            vm_remove(v);
+        }
+        vm_collect(v);
+        assert(vm_space_used(v) == 0);
+        assert(v->size == MIN_SIZE);
+
+        // The heap grows again.
+        add_arrays(v, 10, 1000);
+        vm_collect(v);
+        assert(v->size > MIN_SIZE);
+        vm_free(v);
+    }
+}
+
+// Objects larger than the doubled heap are fine. The copying
+// collectors put them in their large object spaces so only the other
+// heaps grow.
+void
+test_large_object() {
+    gc_dispatch *dispatches[] = RESIZABLE_DISPATCHES;
+    for (size_t i = 0; i < ARRAY_SIZE(dispatches); i++) {
+        vm *v = vm_init_growable(dispatches[i],
+                                 MIN_SIZE, MAX_SIZE, 0.75);
+        vm_add(v, vm_array_init(v, 1 << 20, 0));
+        assert(vm_space_used(v) >= P_ARRAY_SIZE(1 << 20));
+        if (i >= 2) {
+            assert(v->size >= P_ARRAY_SIZE(1 << 20));
+        } else {
+            assert(v->size == MIN_SIZE);
+        }
+        vm_free(v);
+    }
+}
+
+// Shrunk heaps give their pages back to the OS.
+void
+test_release() {
+#ifndef _WIN32
+    vm *v = vm_init_growable(ms_get_dispatch_table(),
+                             MIN_SIZE, MAX_SIZE, 0.5);
+    add_arrays(v, 1000, 1000);
+    size_t grown_size = v->size;
+    assert(grown_size > 1000 * P_ARRAY_SIZE(1000));
+    while (vm_size(v)) {
+        vm_remove(v);
+    }
+    vm_collect(v);
+    assert(v->size == MIN_SIZE);
+
+    size_t n_pages = (grown_size - MIN_SIZE) / HEAP_PAGE_SIZE;
+    unsigned char *vec = malloc(n_pages);
+    void *start = (void *)(v->memory + MIN_SIZE);
+    assert(!mincore(start, grown_size - MIN_SIZE, vec));
+    for (size_t i = 0; i < n_pages; i++) {
+        assert(!(vec[i] & 1));
+    }
+    free(vec);
+    vm_free(v);
+#endif
+}
+
+// Live data that is kept while garbage is allocated.
+static void
+churn(vm *v) {
+    rand_init(0);
+    add_arrays(v, 100, 1000);
+    for (int i = 0; i < 2000000; i++) {
+        ptr arr = vm_get(v, rand_n(100));
+        ptr p = rand_n(2)
+            ? vm_boxed_int_init(v, i)
+            : vm_wrapper_init(v, vm_boxed_int_init(v, i));
+        vm_set_slot(v, arr, 1 + rand_n(1000), p);
+    }
+}
+
+// Compares fixed heaps of different sizes with growable ones.
+void
+test_churn() {
+    struct {
+        char *name;
+        size_t min_size, max_size;
+        double target_occupancy;
+    } configs[] = {
+        {"Fixed, 16MB", 16 << 20, 16 << 20, 0},
+        {"Fixed, 64MB", MAX_SIZE, MAX_SIZE, 0},
+        {"Growable, target 0.5", MIN_SIZE, MAX_SIZE, 0.5},
+        {"Growable, target 0.8", MIN_SIZE, MAX_SIZE, 0.8}
+    };
+    gc_dispatch *dispatches[] = {
+        cg_get_dispatch_table(),
+        ms_get_dispatch_table()
+    };
+    char *names[] = {"Copying", "Mark & Sweep"};
+    printf("%-14s %-22s %5s %8s %8s %8s\n",
+           "Collector", "Heap", "GCs", "GC s", "max ms", "MB");
+    for (size_t i = 0; i < ARRAY_SIZE(dispatches); i++) {
+        for (size_t j = 0; j < ARRAY_SIZE(configs); j++) {
+            vm *v = configs[j].target_occupancy
+                ? vm_init_growable(dispatches[i],
+                                   configs[j].min_size,
+                                   configs[j].max_size,
+                                   configs[j].target_occupancy)
+                : vm_init(dispatches[i], configs[j].max_size);
+            churn(v);
+            gc_stats gs;
+            vm_stats_snapshot(v, &gs);
+            printf("%-14s %-22s %5lu %8.3f %8.3f %8lu\n",
+                   names[i], configs[j].name, gs.n_collections,
+                   (double)gs.pause_total / 1e9,
+                   (double)gs.pause_max / 1e6,
+                   v->size >> 20);
+            vm_free(v);
+        }
+    }
+}
+
+// Running sums in an array, either as boxed or as tagged ints.
+static void
+sum_ints(vm *v, bool tagged) {
+    ptr sums = vm_add(v, vm_array_init(v, 1000, 0));
+    for (size_t i = 0; i < 1000; i++) {
+        vm_set_slot(v, sums, 1 + i, vm_int_init(v, 0));
+    }
+    for (int i = 0; i < 4000000; i++) {
+        size_t j = 1 + i % 1000;
+        int64_t sum = vm_int_value(P_GET_SLOT(vm_get(v, 0), j)) + i % 7;
+        ptr p = tagged ? vm_int_init(v, sum) : vm_boxed_int_init(v, sum);
+        vm_set_slot(v, vm_get(v, 0), j, p);
+    }
+    vm_remove(v);
+}
+
+void
+test_int_allocation() {
+    gc_dispatch *dispatches[] = {
+        cg_get_dispatch_table(),
+        ms_get_dispatch_table()
+    };
+    char *names[] = {"Copying", "Mark & Sweep"};
+    printf("%-14s %-8s %10s %5s %8s\n",
+           "Collector", "Ints", "MB alloc", "GCs", "Total s");
+    for (size_t i = 0; i < ARRAY_SIZE(dispatches); i++) {
+        for (int tagged = 0; tagged < 2; tagged++) {
+            uint64_t start = nano_count();
+            vm *v = vm_init(dispatches[i], 4 << 20);
+            sum_ints(v, tagged);
+            double total = (double)(nano_count() - start) / 1e9;
+            gc_stats gs;
+            vm_stats_snapshot(v, &gs);
+            printf("%-14s %-8s %10lu %5lu %8.3f\n",
+                   names[i], tagged ? "Tagged" : "Boxed",
+                   gs.bytes_allocated >> 20, gs.n_collections, total);
+            vm_free(v);
+        }
+    }
+}
+
+// A vector of a million floats, boxed in a pointer array or unboxed
+// in a float array.
+void
+test_float_vectors() {
+    gc_dispatch *dispatches[] = {
+        cg_get_dispatch_table(),
+        ms_get_dispatch_table()
+    };
+    char *names[] = {"Copying", "Mark & Sweep"};
+    size_t n = 1000000;
+    printf("%-14s %-8s %8s %8s\n", "Collector", "Vector", "MB", "GC ms");
+    for (size_t i = 0; i < ARRAY_SIZE(dispatches); i++) {
+        for (int raw = 0; raw < 2; raw++) {
+            vm *v = vm_init(dispatches[i], 128 << 20);
+            if (raw) {
+                ptr p = vm_add(v, vm_float_array_init(v, n, 0));
+                for (size_t j = 0; j < n; j++) {
+                    *FLOAT_SLOT_P(p, j) = j;
+                }
+            } else {
+                vm_add(v, vm_array_init(v, n, 0));
+                for (size_t j = 0; j < n; j++) {
+                    ptr p = vm_boxed_float_init(v, j);
+                    vm_set_slot(v, vm_get(v, 0), 1 + j, p);
+                }
+            }
+            uint64_t start = nano_count();
+            for (int j = 0; j < 10; j++) {
+                vm_collect(v);
+            }
+            double ms = (double)(nano_count() - start) / 10 / 1e6;
+            printf("%-14s %-8s %8lu %8.3f\n",
+                   names[i], raw ? "Raw" : "Boxed",
+                   vm_space_used(v) >> 20, ms);
+            vm_free(v);
+        }
+    }
+}
+
+#define N_MUTATORS          4
+#define N_MUTATOR_ALLOCS    200000
+
+typedef struct {
+    vm *v;
+    int id;
+} mutator_args;
+
+// Builds a list of numbered nodes among lots of garbage.
+static void *
+mutator_main(void *args) {
+    mutator_args *a = (mutator_args *)args;
+    vm *v = a->v;
+    vm_add(v, 0);
+    for (int i = 0; i < N_MUTATOR_ALLOCS; i++) {
+        vm_array_init(v, i % 20, 0);
+        if (i % 100 == 0) {
+            vm_add(v, vm_array_init(v, 2, 0));
+            ptr p = vm_boxed_int_init(v, a->id * N_MUTATOR_ALLOCS + i);
+            vm_set_slot(v, vm_last(v), 1, p);
+            vm_set_slot(v, vm_last(v), 2, vm_get(v, 0));
+            vm_set(v, 0, vm_remove(v));
+        }
+    }
+    int i = N_MUTATOR_ALLOCS - 100;
+    for (ptr p = vm_get(v, 0); p; p = P_GET_SLOT(p, 2)) {
+        ptr value = *VALUE_P(P_GET_SLOT(p, 1));
+        assert(value == (ptr)(a->id * N_MUTATOR_ALLOCS + i));
+        i -= 100;
+    }
+    assert(i == -100);
+    vm_detach(v);
+    return NULL;
+}
+
+void
+test_mutators() {
+    gc_dispatch *dispatches[] = {
+        cg_get_dispatch_table(),
+        cg_get_dispatch_table_optimized(),
+        ix_get_dispatch_table()
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(dispatches); i++) {
+        vm *v = vm_init(dispatches[i], 4 << 20);
+        ptr keep = vm_add(v, vm_boxed_int_init(v, 1234));
+        mutator_args args[N_MUTATORS];
+        for (int j = 0; j < N_MUTATORS; j++) {
+            args[j].v = vm_attach(v);
+            args[j].id = j;
+        }
+        thr_handle handles[N_MUTATORS];
+        vm_enter_blocking(v);
+        assert(thr_create_threads(N_MUTATORS, handles, sizeof(mutator_args),
+                                  args, mutator_main));
+        assert(thr_wait_for_threads(N_MUTATORS, handles));
+        vm_leave_blocking(v);
+        assert(v->n_mutators == 1);
+
+        gc_stats gs;
+        vm_stats_snapshot(v, &gs);
+        assert(gs.n_collections > 0);
+        assert(gs.bytes_allocated > N_MUTATORS * N_MUTATOR_ALLOCS * NPTRS(2));
+        keep = vm_get(v, 0);
+        assert(*VALUE_P(keep) == 1234);
+
+        // The heap can be used by the owner alone again.
+        vm_collect(v);
+        assert(vm_space_used(v) == NPTRS(2));
+        vm_free(v);
+    }
+}
+
+int
+main(int argc, char *argv[]) {
+    PRINT_RUN(test_fixed);
+    PRINT_RUN(test_grow_and_shrink);
+    PRINT_RUN(test_large_object);
+    PRINT_RUN(test_release);
+    PRINT_RUN(test_churn);
+    PRINT_RUN(test_int_allocation);
+    PRINT_RUN(test_float_vectors);
+    PRINT_RUN(test_mutators);
+    return 0;
+}
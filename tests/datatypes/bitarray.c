@@ -36,6 +36,11 @@ test_set_and_get_bit() {
     ba_set_bit(ba, 58);
     assert(ba_get_bit(ba, 58));
 
+    ba_clear_bit(ba, 58);
+    assert(!ba_get_bit(ba, 58));
+    ba_clear_bit(ba, 0);
+    assert(AT(ba->bits) == 2);
+
     ba_free(ba);
 }
 
@@ -137,6 +142,28 @@ test_next_set_bit() {
     ba_free(ba);
 }
 
+void
+test_prev_set_bit() {
+    bitarray *ba = ba_init(640);
+    assert(ba_prev_set_bit(ba, 639) == -1);
+    ba_set_bit(ba, 0);
+    assert(ba_prev_set_bit(ba, 0) == 0);
+    assert(ba_prev_set_bit(ba, 639) == 0);
+    ba_set_bit(ba, 63);
+    ba_set_bit(ba, 64);
+    assert(ba_prev_set_bit(ba, 62) == 0);
+    assert(ba_prev_set_bit(ba, 63) == 63);
+    assert(ba_prev_set_bit(ba, 64) == 64);
+    ba_set_bit(ba, 400);
+    assert(ba_prev_set_bit(ba, 399) == 64);
+    assert(ba_prev_set_bit(ba, 639) == 400);
+    assert(ba_prev_set_bit_in_word(ba, 62) == 0);
+    assert(ba_prev_set_bit_in_word(ba, 127) == 64);
+    assert(ba_prev_set_bit_in_word(ba, 399) == -1);
+    assert(ba_prev_set_bit_in_word(ba, 447) == 400);
+    ba_free(ba);
+}
+
 void
 test_bitsum() {
     bitarray *ba = ba_init(640);
@@ -195,6 +222,7 @@ main(int argc, char *argv[]) {
     PRINT_RUN(test_set_range);
     PRINT_RUN(test_next_unset_bit);
     PRINT_RUN(test_next_set_bit);
+    PRINT_RUN(test_prev_set_bit);
     PRINT_RUN(test_bitsum);
     return 0;
 }
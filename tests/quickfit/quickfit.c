@@ -1,21 +1,6 @@
 #include <assert.h>
 #include "quickfit/quickfit.h"
 
-size_t
-qf_largest_free_block(quick_fit *qf) {
-    rbtree *node = rbt_iterate(qf->large_blocks, NULL, BST_RIGHT);
-    if (node) {
-        return node->key;
-    }
-    for (int i = QF_N_BUCKETS - 1; i >= 0; i--) {
-        vector *small_blocks = qf->buckets[i];
-        if (small_blocks->used) {
-            return i * QF_DATA_ALIGNMENT;
-        }
-    }
-    return 0;
-}
-
 void
 test_basic() {
     size_t size = 10 * 1024;
@@ -217,6 +202,44 @@ test_clear() {
     free((void *)region);
 }
 
+void
+test_resize() {
+    size_t size = 10 * 1024;
+    ptr region = (ptr)malloc(size);
+    quick_fit *qf = qf_init(region, 4096);
+
+    // Mark two blocks as used by giving them a type.
+    ptr p1 = qf_allot_block(qf, 1024);
+    ptr p2 = qf_allot_block(qf, 1024);
+    AT(p1) |= 2;
+    AT(p2) |= 2;
+    assert(qf_space_used(qf) == 2048);
+
+    assert(qf_resize(qf, size));
+    assert(qf->size == size);
+    assert(qf_space_used(qf) == 2048);
+    // The new range is merged with the free block before it.
+    assert(qf->n_blocks == 1);
+    assert(qf_largest_free_block(qf) == size - 2048);
+
+    // The free blocks at the end are coalesced when shrinking.
+    assert(qf_resize(qf, 3072));
+    assert(qf->n_blocks == 1);
+    assert(qf_largest_free_block(qf) == 1024);
+    assert(!qf_resize(qf, 2048 - 16));
+
+    // Shrinking is blocked by the last used block.
+    qf_free_block(qf, p1, 1024);
+    assert(!qf_resize(qf, 1024));
+    assert(qf_space_used(qf) == 1024);
+    assert(qf_resize(qf, 2048));
+    assert(qf->n_blocks == 1);
+    assert(qf_largest_free_block(qf) == 1024);
+
+    qf_free(qf);
+    free((void *)region);
+}
+
 int
 main(int argc, char *argv[]) {
     rand_init(0);
@@ -231,5 +254,6 @@ main(int argc, char *argv[]) {
     PRINT_RUN(test_can_allot_p);
     PRINT_RUN(test_can_allot_p2);
     PRINT_RUN(test_can_allot_p_random);
+    PRINT_RUN(test_resize);
     return 0;
 }